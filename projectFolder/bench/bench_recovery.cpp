@@ -0,0 +1,320 @@
+#include "recovery/synth.h"
+#include "recovery/wav.h"
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// Usage: bench_recovery <recovery executable> [tracks] [Data Blocks]
+//
+// Builds synthetic card images in a temporary folder, runs modes 0 to 5, 9
+// and 10 of the recovery executable on them and prints the throughput of
+// every run. Besides the clean sessions one has a zeroed chunk and one a
+// muted track. Returns non-zero if any output differs from the recorded
+// audio.
+
+namespace
+{
+    std::string readFile(const std::filesystem::path& fn)
+    {
+        std::ifstream in(fn, std::ios::binary);
+        std::ostringstream data;
+        data << in.rdbuf();
+        return data.str();
+    }
+
+    void writeFile(const std::filesystem::path& fn, const std::string& data)
+    {
+        std::ofstream out(fn, std::ios::binary);
+        out.write(data.data(), data.size());
+    }
+
+    // The number after `key` in `fn`, 0 if there is none
+    uint64_t numberAfter(const std::filesystem::path& fn,
+                         const std::string& key)
+    {
+        auto text = readFile(fn);
+        auto at = text.find(key);
+        if (at == std::string::npos)
+        {
+            return 0;
+        }
+        return std::stoull(text.substr(at + key.size()));
+    }
+
+    // Chunks the mapping modes found in the references, from --stats
+    uint64_t matches(const std::filesystem::path& stats)
+    {
+        return numberAfter(stats, "\"matches\": ");
+    }
+
+    std::string hex(uint64_t v)
+    {
+        std::ostringstream s;
+        s << "0x" << std::hex << v;
+        return s.str();
+    }
+
+    struct Case
+    {
+        std::string name;
+        std::string args;
+        uint64_t bytes;  // of the image the mode has to go through
+        std::function<bool()> check;
+    };
+
+    // A synthetic session written to the bench folder with the arguments
+    // the modes need for it
+    struct Session
+    {
+        Recovery::SynthSession synth;
+        std::vector<std::string> audio;  // each track should recover to
+        std::string prefix;    // of the case names
+        std::string args;      // -t and -r
+        std::string mapArgs;   // from the WAV header chunks, with -d
+        std::string dataArgs;  // of the Data Blocks
+        uint64_t chunks;       // of all tracks, WAV header chunks included
+        uint64_t dataBytes;
+        uint64_t sessionBytes;
+    };
+
+    struct Bench
+    {
+        std::string app;
+        std::filesystem::path dir;
+        bool ok = true;
+
+        void run(const Case& c)
+        {
+            auto log = c.name + ".log";
+            auto cmd = "\"" + app + "\" -i card.dd " + c.args + " > \"" + log +
+                       "\" 2>&1";
+
+            auto start = std::chrono::steady_clock::now();
+            auto status = std::system(cmd.c_str());
+            std::chrono::duration<double> elapsed =
+                std::chrono::steady_clock::now() - start;
+
+            bool passed = status == 0 && c.check();
+            ok &= passed;
+            std::cout << std::left << std::setw(24) << c.name << std::right
+                      << std::fixed << std::setprecision(3) << std::setw(9)
+                      << elapsed.count() << " s " << std::setprecision(1)
+                      << std::setw(9) << c.bytes / elapsed.count() / 1e6
+                      << " MB/s  " << (passed ? "ok" : "FAILED (see " + log + ")")
+                      << std::endl;
+        }
+
+        // Builds the image of `opts` and the tracks the recorder saved
+        Session write(const std::string& prefix,
+                      const Recovery::SynthOptions& opts)
+        {
+            Session s;
+            std::string image;
+            s.synth = Recovery::synthesizeImage(opts, image);
+            auto& layout = s.synth.layout;
+            writeFile(dir / "card.dd", image);
+            for (uint32_t t = 0; t < layout.numTracks; ++t)
+            {
+                writeFile(dir / (std::to_string(t + 1) + ".audio(0).wav"),
+                          s.synth.tracks[t]);
+                s.audio.push_back(s.synth.tracks[t].substr(layout.chunkSize));
+            }
+
+            s.prefix = prefix;
+            s.args = " -t " + std::to_string(layout.numTracks) + " -r " +
+                     std::to_string(layout.repition);
+            s.dataArgs = " -o " + hex(layout.offset) + s.args + " -c " +
+                         std::to_string(layout.count);
+            s.chunks = uint64_t(layout.numTracks) *
+                       (1 + uint64_t(layout.repition) * layout.count);
+            s.mapArgs = " -o " + hex(s.synth.headerOffset) + s.args +
+                        " -d . -c " + std::to_string(s.chunks);
+            s.dataBytes = layout.dataBlockSize() * layout.count;
+            s.sessionBytes =
+                s.dataBytes + uint64_t(layout.chunkSize) * layout.numTracks;
+            return s;
+        }
+
+        bool recovered(const Session& s, const std::string& fn,
+                       uint32_t track)
+        {
+            auto headerSize = Recovery::wavHeaderSize({});
+            return readFile(dir / fn).substr(headerSize) == s.audio[track];
+        }
+
+        bool recoveredAll(const Session& s)
+        {
+            for (uint32_t t = 0; t < s.audio.size(); ++t)
+            {
+                if (!recovered(s, "Recover " + std::to_string(t + 1) + ".wav",
+                               t))
+                {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        // Runs every mode on a session of `numTracks` x `repition`
+        void session(uint32_t numTracks, uint32_t repition, uint32_t count)
+        {
+            Recovery::SynthOptions opts;
+            opts.layout.numTracks = numTracks;
+            opts.layout.repition = repition;
+            opts.layout.count = count;
+
+            auto s = write("t" + std::to_string(numTracks) + " r" +
+                               std::to_string(repition) + " ",
+                           opts);
+            auto& prefix = s.prefix;
+
+            run({prefix + "mode 0",
+                 "-m 0 -s " + std::to_string(numTracks) + " -o " +
+                     hex(s.synth.headerOffset) + s.args + " -c " +
+                     std::to_string(count),
+                 s.sessionBytes, [&] {
+                     return readFile(dir / "out.wav") ==
+                            s.synth.tracks[numTracks - 1];
+                 }});
+
+            run({prefix + "mode 1",
+                 "-m 1 --stats map.json --map blocks.map" + s.mapArgs,
+                 s.sessionBytes,
+                 [&] { return matches(dir / "map.json") == s.chunks; }});
+            run({prefix + "mode 10", "-m 10 --map blocks.map", s.sessionBytes,
+                 [&] { return recoveredAll(s); }});
+            // mode 2 expects one chunk per track and round
+            if (repition == 1)
+            {
+                run({prefix + "mode 2", "-m 2 --stats map.json" + s.mapArgs,
+                     s.sessionBytes,
+                     [&] { return matches(dir / "map.json") == s.chunks; }});
+            }
+            run({prefix + "mode 3", "-m 3 -s 1" + s.dataArgs, s.dataBytes,
+                 [&] { return recovered(s, "out.wav", 0); }});
+            for (auto io : {"sync", "auto"})
+            {
+                run({prefix + "mode 4 " + io,
+                     "-m 4 --io " + std::string(io) + s.dataArgs,
+                     s.dataBytes, [&] { return recoveredAll(s); }});
+            }
+        }
+
+        // One chunk of a track in the middle of the session is zeroed on
+        // the card. The sequential mapping modes lose the track there, the
+        // indexed mode 5 maps every other chunk and the recoveries come out
+        // silent just in that chunk.
+        void damaged(uint32_t numTracks, uint32_t count)
+        {
+            Recovery::SynthOptions opts;
+            opts.layout.numTracks = numTracks;
+            opts.layout.count = count;
+            std::string image;
+            auto layout = Recovery::synthesizeImage(opts, image).layout;
+
+            auto track = numTracks / 2;
+            auto block = count / 2;
+            auto at = uint64_t(layout.channelBlockSize()) * block +
+                      layout.chunkSize;
+            opts.damage = {{Recovery::SynthDamage::Kind::Zero,
+                            layout.offset + layout.dataBlockSize() * block +
+                                layout.channelBlockSize() * track +
+                                layout.chunkSize,
+                            layout.chunkSize}};
+            auto s = write("damaged ", opts);
+            s.audio[track].replace(at, layout.chunkSize, layout.chunkSize,
+                                   '\0');
+            auto log = dir / (s.prefix + "mode 5.log");
+
+            run({s.prefix + "mode 5", "-m 5 --map blocks.map" + s.mapArgs,
+                 s.sessionBytes, [&] {
+                     return numberAfter(log, ", matched ") == s.chunks - 1;
+                 }});
+            run({s.prefix + "mode 10", "-m 10 --map blocks.map",
+                 s.sessionBytes, [&] { return recoveredAll(s); }});
+            run({s.prefix + "mode 4", "-m 4" + s.dataArgs, s.dataBytes,
+                 [&] { return recoveredAll(s); }});
+        }
+
+        // A muted track records Channel Blocks of 0x00 that the occupancy
+        // map calls dead. Its saved chunks have to match them all the same.
+        void silent(uint32_t numTracks, uint32_t repition, uint32_t count)
+        {
+            Recovery::SynthOptions opts;
+            opts.layout.numTracks = numTracks;
+            opts.layout.repition = repition;
+            opts.layout.count = count;
+            auto channelBlockSize = uint64_t(opts.layout.chunkSize) * repition;
+            opts.silence = {{0, channelBlockSize * (count / 2),
+                             channelBlockSize}};
+            auto s = write("silent r" + std::to_string(repition) + " ", opts);
+            std::string occupancy = " --occupancy occupancy.map";
+
+            run({s.prefix + "mode 9",
+                 "-m 9" + occupancy + " -o " +
+                     hex(s.synth.headerOffset),
+                 s.sessionBytes, [&] {
+                     return std::filesystem::exists(dir / "occupancy.map");
+                 }});
+            auto mode = repition == 1 ? "2" : "1";
+            run({s.prefix + "mode " + mode,
+                 "-m " + std::string(mode) +
+                     " --stats map.json --map blocks.map" + occupancy +
+                     s.mapArgs,
+                 s.sessionBytes,
+                 [&] { return matches(dir / "map.json") == s.chunks; }});
+            run({s.prefix + "mode 10", "-m 10 --map blocks.map",
+                 s.sessionBytes, [&] { return recoveredAll(s); }});
+            run({s.prefix + "mode 4", "-m 4" + occupancy + s.dataArgs,
+                 s.dataBytes, [&] { return recoveredAll(s); }});
+        }
+    };
+}  // namespace
+
+int main(int argc, char** argv)
+{
+    if (argc < 2)
+    {
+        std::cerr << "Usage: " << argv[0]
+                  << " <recovery executable> [tracks] [Data Blocks]"
+                  << std::endl;
+        return 1;
+    }
+
+    Bench bench;
+    bench.app = std::filesystem::absolute(argv[1]).string();
+    uint32_t numTracks = argc > 2 ? std::stoul(argv[2]) : 34;
+    uint32_t count = argc > 3 ? std::stoul(argv[3]) : 16;
+
+    // a folder of its own, so runs side by side don't share their files
+    std::random_device random;
+    do
+    {
+        bench.dir = std::filesystem::temp_directory_path() /
+                    ("bench_recovery-" + std::to_string(random()));
+    } while (!std::filesystem::create_directory(bench.dir));
+    std::filesystem::current_path(bench.dir);
+
+    bench.session(numTracks, 8, count);
+    bench.session(numTracks, 1, count * 8);
+    bench.damaged(numTracks, count);
+    bench.silent(numTracks, 8, count);
+    bench.silent(numTracks, 1, count * 8);
+
+    std::filesystem::current_path(bench.dir.parent_path());
+    if (bench.ok)
+    {
+        std::filesystem::remove_all(bench.dir);
+        return 0;
+    }
+    std::cerr << "Outputs are kept in " << bench.dir << std::endl;
+    return 1;
+}
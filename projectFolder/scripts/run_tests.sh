@@ -28,6 +28,10 @@ fi
 echo "Running tests using ${cpu_count} threads..."
 ctest --output-on-failure --test-dir build/$BUILD_TYPE/tests -j$cpu_count
 RESULT=$?
+if [ $RESULT == 0 ] && [ -d build/$BUILD_TYPE/bench ]; then
+    ctest --output-on-failure --test-dir build/$BUILD_TYPE/bench
+    RESULT=$?
+fi
 if [ $RESULT == 0 ]; then
     echo "SUCCESS: Tests completed successfully!"
 else
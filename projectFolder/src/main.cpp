@@ -1,165 +1,1026 @@
 #include "flexibity/log.h"
 #include "flexibity/programOptions.hpp"
+#include "recovery/analysis.h"
+#include "recovery/blockMap.h"
+#include "recovery/carve.h"
+#include "recovery/demux.h"
+#include "recovery/detect.h"
+#include "recovery/fatfs.h"
+#include "recovery/flac.h"
+#include "recovery/hamming.h"
+#include "recovery/imageSource.h"
+#include "recovery/interleave.h"
+#include "recovery/journal.h"
+#include "recovery/mapper.h"
+#include "recovery/metrics.h"
+#include "recovery/occupancy.h"
+#include "recovery/preview.h"
+#include "recovery/reassembly.h"
+#include "recovery/splice.h"
+#include "recovery/stream.h"
+#include "recovery/sweep.h"
+#include "recovery/wav.h"
 #include "utility/utility.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
 #include <fstream>
+#include <iomanip>
 #include <iostream>
 #include <format>
+#include <vector>
 
 struct WAV_MAPPER
 {
     std::ifstream stream;
     std::string fn;
     char* readBuf;
-    bool matchFound;
+    bool matchFound = false;
+    bool uniform = false;  // a dead image chunk may match readBuf
+    uint32_t chunk;  // reference chunk number in readBuf
 };
 
-struct WAV_HEADER
-{
-    // WAV-формат начинается с RIFF-заголовка:
+struct OPTIONS {
 
-    // Содержит символы "RIFF" в ASCII кодировке
-    // (0x52494646 в big-endian представлении)
-    char chunkId[4];
+    std::string imgName;
+    std::vector<std::string> parts;  // of a split dump, after imgName
+    std::string rescueMapName;  // ddrescue mapfile of the joined image
+    Recovery::ImageSpec image;  // all of the above
+    std::string offsStr;
+    std::string toStr;    // last offset to sweep
+    std::string stepStr;  // offset sweep step, default is one chunk
+    uint32_t numTracks = 34;  // default is 34 (arm all)
+    uint32_t channelBlockSize = 0x8000;
+    uint32_t byteOffset = 0;
+    uint64_t offset = 0;
+    uint32_t count = 0;
+    uint32_t mode = 0;
+    uint32_t repition = 8;
+    uint32_t toRepition = 0;  // sweep repitions up to
+    uint32_t toTracks = 0;    // sweep track counts up to
+    uint32_t top = 20;        // sweep results shown
+    uint32_t selected = 1;
+    uint32_t threads = 0;  // 0 is one per core
+    uint32_t maxBitErrors = 0;  // per chunk in modes 1 and 2, 0 is exact
+    bool dummyRead = false;
+    bool recover = false;
+    bool interleave = false;  // one multichannel file instead of one per track
+    std::string format = "wav";  // output of modes 3 and 4: wav or flac
+    std::string io = "auto";  // sync skips the read-ahead pipeline
+    Recovery::PipelineOptions pipeline;
+    std::string dest;
+    std::string ofName = "out.wav";
+    std::string statsName;  // JSON metrics report written at exit
+    std::string occupancyName;  // occupancy map written by mode 9
+    std::string mapName;  // block map written by modes 1, 2, 5 and 15
+    std::string journalName;  // checkpoints of modes 1-4
+    uint32_t checkpoint = 60;  // seconds between checkpoints
+    bool resume = false;  // continue from the journal
+    std::string previewName = "preview.json";  // overview written by mode 13
+    uint32_t width = 64;  // overview bins per track
+    uint32_t window = 0;  // chunks mode 15 looks ahead, 0 is 2 Data Blocks
+#ifdef WINDOWS
+    std::string backend = "stream";
+#else
+    std::string backend = "mmap";
+#endif
+};
 
-    // 36 + subchunk2Size, или более точно:
-    // 4 + (8 + subchunk1Size) + (8 + subchunk2Size)
-    // Это оставшийся размер цепочки, начиная с этой позиции.
-    // Иначе говоря, это размер файла - 8, то есть,
-    // исключены поля chunkId и chunkSize.
-    uint32_t chunkSize;
+std::ofstream of;
+std::unique_ptr<Recovery::ImageSource> img;
+std::unique_ptr<Recovery::OccupancyMap> occupancy;  // dead chunks to skip
+
+// Synchronous output writes, counted like the AsyncWriter ones
+void writeOut (std::ostream &out, const char *data, size_t size) {
+    Recovery::StageTimer timer(Recovery::metrics().writeTime);
+    out.write(data, size);
+    Recovery::metrics().writes.add();
+    Recovery::metrics().bytesWritten.add(size);
+}
 
-    // Содержит символы "WAVE"
-    // (0x57415645 в big-endian представлении)
-    char format[4];
+// Counts one lookup of an image chunk in the references
+void countMatch (std::chrono::steady_clock::time_point start, bool found) {
+    auto& metrics = Recovery::metrics();
+    metrics.matchTime.record(std::chrono::steady_clock::now() - start);
+    metrics.matchAttempts.add();
+    if (found)
+    {
+        metrics.matches.add();
+    }
+}
 
-    // Формат "WAVE" состоит из двух подцепочек: "fmt " и "data":
-    // Подцепочка "fmt " описывает формат звуковых данных:
+// Reads the next reference chunk of modes 1 and 2 into the buffer
+void readReference (WAV_MAPPER &item, uint32_t channelBlockSize,
+                    uint32_t maxBitErrors) {
+    item.stream.read(item.readBuf, channelBlockSize);
+    item.uniform =
+        uint64_t(item.stream.gcount()) == channelBlockSize &&
+        Recovery::nearlyUniform(item.readBuf, channelBlockSize, maxBitErrors);
+}
 
-    // Содержит символы "fmt "
-    // (0x666d7420 в big-endian представлении)
-    char subchunk1Id[4];
+// Reference positions of modes 1 and 2 for a checkpoint
+void saveMapping (const WAV_MAPPER *maps, uint32_t numTracks,
+                  Recovery::JobState &state) {
+    state.chunks.clear();
+    state.matched.clear();
+    for (uint32_t i = 0; i < numTracks; ++i)
+    {
+        state.chunks.push_back(maps[i].chunk);
+        state.matched.push_back(maps[i].matchFound);
+    }
+}
 
-    // 16 для формата PCM.
-    // Это оставшийся размер подцепочки, начиная с этой позиции.
-    uint32_t subchunk1Size;
+// Rereads the reference chunks a resumed mapping run was looking for
+bool restoreMapping (WAV_MAPPER *maps, uint32_t numTracks,
+                     uint32_t channelBlockSize, uint32_t maxBitErrors,
+                     const Recovery::JobState &state) {
+    if (state.chunks.size() != numTracks || state.matched.size() != numTracks)
+    {
+        GERROR("Journal has no mapping state of " << std::dec << numTracks
+                                                  << " tracks");
+        return false;
+    }
+    for (uint32_t i = 0; i < numTracks; ++i)
+    {
+        auto& item = maps[i];
+        item.chunk = state.chunks[i];
+        item.matchFound = state.matched[i];
+        item.stream.clear();
+        item.stream.seekg(uint64_t(item.chunk) * channelBlockSize);
+        readReference(item, channelBlockSize, maxBitErrors);
+    }
+    return true;
+}
 
-    // Аудио формат, полный список можно получить здесь
-    // http://audiocoding.ru/wav_formats.txt Для PCM = 1 (то есть, Линейное
-    // квантование). Значения, отличающиеся от 1, обозначают некоторый формат
-    // сжатия.
-    uint16_t audioFormat;
+// Writes the metrics report however main() returns, and tells how much
+// of what was read the dump didn't have
+struct StatsReport {
+    std::string fn;
+    std::chrono::steady_clock::time_point start =
+        std::chrono::steady_clock::now();
 
-    // Количество каналов. Моно = 1, Стерео = 2 и т.д.
-    uint16_t numChannels;
+    ~StatsReport() {
+        if (auto unread = Recovery::metrics().unreadBytes.get())
+        {
+            GERROR(std::dec << unread << " bytes read from ranges ddrescue "
+                            "couldn't read were zero-filled");
+        }
+        if (fn.empty())
+        {
+            return;
+        }
+        std::ofstream out(fn);
+        Recovery::writeStats(out, std::chrono::steady_clock::now() - start);
+    }
+};
 
-    // Частота дискретизации. 8000 Гц, 44100 Гц и т.д.
-    uint32_t sampleRate;
+Recovery::Layout sessionLayout (const OPTIONS &opts) {
+    return {
+        .offset = opts.offset,
+        .chunkSize = opts.channelBlockSize,
+        .repition = opts.repition,
+        .numTracks = opts.numTracks,
+        .count = opts.count,
+    };
+}
 
-    // sampleRate * numChannels * bitsPerSample/8
-    uint32_t byteRate;
+// Drops the trailing Data Blocks the occupancy map knows are dead
+void trimDeadBlocks (Recovery::Layout &layout) {
+    if (!occupancy)
+    {
+        return;
+    }
+    auto count = layout.count;
+    while (layout.count &&
+           !occupancy->live(layout.channelBlockOffset(layout.count - 1, 0),
+                            layout.dataBlockSize()))
+    {
+        --layout.count;
+    }
+    if (layout.count != count)
+    {
+        GINFO("Skipping " << std::dec << count - layout.count
+                          << " dead Data Blocks at the end");
+    }
+}
+
+// The job a journal of `opts` belongs to
+Recovery::JobState jobState (const OPTIONS &opts) {
+    Recovery::JobState state;
+    state.mode = opts.mode;
+    state.offset = opts.offset;
+    state.chunkSize = opts.channelBlockSize;
+    state.repition = opts.repition;
+    state.numTracks = opts.numTracks;
+    state.count = opts.count;
+    state.selected = opts.mode == 3 ? opts.selected : 0;
+    return state;
+}
+
+// Loads the last checkpoint into `state` with --resume. A job without a
+// journal yet starts from the beginning, a journal of another job is
+// refused.
+bool resumeJob (const OPTIONS &opts, Recovery::JobState &state) {
+    if (!opts.resume)
+    {
+        return true;
+    }
+    if (!std::filesystem::exists(opts.journalName))
+    {
+        GINFO("No journal " << opts.journalName
+                            << ", starting from the beginning");
+        return true;
+    }
+    Recovery::JobState saved;
+    if (!saved.load(opts.journalName))
+    {
+        return false;
+    }
+    if (!saved.sameJob(state))
+    {
+        GERROR("Journal " << opts.journalName << " is of another job (mode "
+                          << std::dec << saved.mode << " at " << std::hex
+                          << saved.offset << ")");
+        return false;
+    }
+    state = saved;
+    GINFO("Resuming at " << std::dec << state.position << " of "
+                         << state.count);
+    return true;
+}
+
+// Starts a WAV output, or reopens output `i` of a resumed job where its
+// last checkpoint left it
+bool openOutput (std::ofstream &out, const std::string &fn,
+                 const Recovery::JobState &state, size_t i,
+                 const Recovery::WavFormat &format) {
+    if (state.position)
+    {
+        if (i >= state.outputs.size())
+        {
+            GERROR("No checkpoint of " << fn);
+            return false;
+        }
+        return Recovery::resumeOutput(out, fn, state.outputs[i]);
+    }
+    out.open(fn, std::ios::binary);
+    if (!out)
+    {
+        GERROR("Unable to open target file " << fn);
+        return false;
+    }
+    return Recovery::writeWavHeader(out, format);
+}
 
-    // numChannels * bitsPerSample/8
-    // Количество байт для одного сэмпла, включая все каналы.
-    uint16_t blockAlign;
+// Moves the layout past the Data Blocks a resumed job has written.
+// Returns their number.
+uint32_t skipDone (Recovery::Layout &layout, const Recovery::JobState &state) {
+    auto done = uint32_t(std::min<uint64_t>(state.position, layout.count));
+    layout.offset += layout.dataBlockSize() * done;
+    layout.count -= done;
+    return done;
+}
 
-    // Так называемая "глубиная" или точность звучания. 8 бит, 16 бит и т.д.
-    uint16_t bitsPerSample;
+// What modes 1 and 2 share: the reference tracks saved in --dest, the
+// block map and journal of the run and its counts. run() scans the image
+// and leaves matching each chunk to the mode.
+struct MappingJob {
+    const OPTIONS &opts;
+    std::vector<WAV_MAPPER> maps;
+    Recovery::JobState state;
+    Recovery::BlockMapWriter blockMap;
+    Recovery::Checkpointer checkpointer;
+    uint64_t skipped = 0;         // dead chunks never read
+    uint64_t damaged = 0;         // matched with bit errors
+    uint64_t totalBitErrors = 0;
+
+    MappingJob (const OPTIONS &opts)
+        : opts(opts), maps(opts.numTracks), state(jobState(opts)),
+          checkpointer(opts.journalName,
+                       std::chrono::seconds(opts.checkpoint)) {}
+
+    ~MappingJob () {
+        for (auto& item : maps)
+        {
+            delete[] item.readBuf;
+        }
+    }
 
-    // Подцепочка "data" содержит аудио-данные и их размер.
+    // Resumes the run, opens the block map and the references at their
+    // first chunk or where the journal left them. Returns 0 or the exit
+    // code.
+    int start () {
+        auto channelBlockSize = opts.channelBlockSize;
+        auto numTracks = opts.numTracks;
+        if (!resumeJob(opts, state))
+        {
+            return 7;
+        }
 
-    // Содержит символы "data"
-    // (0x64617461 в big-endian представлении)
-    char subchunk2Id[4];
+        if (!opts.mapName.empty() &&
+            !(state.position
+                  ? blockMap.resume(opts.mapName, channelBlockSize, numTracks,
+                                    state.outputs.empty() ? 0
+                                                          : state.outputs[0])
+                  : blockMap.open(opts.mapName, channelBlockSize, numTracks)))
+        {
+            return 6;
+        }
+
+        img->advise(Recovery::ImageSource::Access::Sequential, opts.offset,
+                    uint64_t(channelBlockSize) * opts.count);
 
-    // numSamples * numChannels * bitsPerSample/8
-    // Количество байт в области данных.
-    uint32_t subchunk2Size;
+        // init/open streams
+        for (uint32_t i = 0; i < numTracks; ++i)
+        {
+            std::ostringstream fn;
+            fn << i + 1 << ".audio(0).wav";
+            auto& item = maps[i];
+            item.fn = fn.str();
 
-    // Далее следуют непосредственно Wav данные.
+            item.readBuf = new char[channelBlockSize];
+
+            fn.str("");
+            fn.clear();
+
+            fn << opts.dest << "/" << item.fn;
+
+            item.stream.open(fn.str());
+            if (!item.stream.is_open())
+            {
+                GINFO("Unable to open target file " << fn.str() << " with "
+                                                    << item.stream.rdstate());
+                return 2;
+            }
+            GINFO("Track " << i << ": Reading " << std::hex << channelBlockSize
+                           << " bytes " << std::hex << item.stream.tellg());
+            readReference(item, channelBlockSize, opts.maxBitErrors);
+            item.matchFound = false;
+            item.chunk = 0;
+        }
+
+        if (state.position &&
+            !restoreMapping(maps.data(), numTracks, channelBlockSize,
+                            opts.maxBitErrors, state))
+        {
+            return 7;
+        }
+
+        skipped = state.skipped;
+        damaged = state.damaged;
+        totalBitErrors = state.bitErrors;
+        Recovery::metrics().matches.add(state.matches);
+        return 0;
+    }
+
+    // the first `scanned` chunks are mapped
+    void checkpoint (uint32_t scanned) {
+        state.position = scanned;
+        state.outputs.clear();
+        if (!opts.mapName.empty())
+        {
+            state.outputs.push_back(blockMap.flush());
+        }
+        saveMapping(maps.data(), opts.numTracks, state);
+        state.matches = Recovery::metrics().matches.get();
+        state.skipped = skipped;
+        state.damaged = damaged;
+        state.bitErrors = totalBitErrors;
+        checkpointer.save(state);
+    }
+
+    // Records the image chunk at `startPos` as the current chunk of
+    // reference `track`
+    void matched (uint64_t startPos, uint32_t track, uint64_t bitErrors) {
+        if (bitErrors)
+        {
+            RTRACE(bitErrors << " bit errors in track " << track + 1
+                             << " at " << std::hex << startPos);
+            ++damaged;
+            totalBitErrors += bitErrors;
+        }
+        if (!opts.mapName.empty())
+        {
+            blockMap.add(startPos, track, maps[track].chunk, 1, bitErrors);
+        }
+    }
+
+    // Whether a dead chunk may match the current chunk of a reference,
+    // e.g. the silence of a muted track, so it has to be read
+    bool deadMayMatch () const {
+        return std::any_of(maps.begin(), maps.end(),
+                           [](const WAV_MAPPER& item) { return item.uniform; });
+    }
+
+    // Hands `match(j, startPos, chunk)` every chunk from the journal's
+    // position on that the occupancy map doesn't skip. `match` returns 0
+    // to go on or the exit code to stop with. Returns the exit code of
+    // the run.
+    template <typename Match>
+    int run (const Match &match) {
+        auto channelBlockSize = opts.channelBlockSize;
+        Recovery::Progress progress(
+            "Mapping", Recovery::metrics().bytesRead,
+            uint64_t(channelBlockSize) * (opts.count - state.position));
+
+        for (auto j = uint32_t(state.position); j < opts.count; ++j)
+        {
+            if (checkpointer.due())
+            {
+                checkpoint(j);
+            }
+
+            auto startPos = opts.offset + uint64_t(channelBlockSize) * j;
+            RTRACE("Iter " << j << " Reading img " << std::hex
+                          << channelBlockSize << " bytes " << std::hex
+                          << startPos);
+            if (occupancy && !occupancy->live(startPos, channelBlockSize) &&
+                !deadMayMatch())
+            {
+                ++skipped;
+                continue;
+            }
+            auto chunk = img->read(startPos, channelBlockSize);
+            if (chunk.size() != channelBlockSize)
+            {
+                GERROR("Img eof!");
+                if (!opts.journalName.empty())
+                {
+                    checkpoint(j);
+                }
+                return 4;
+            }
+
+            if (auto rc = match(j, startPos, chunk))
+            {
+                return rc;
+            }
+        }
+
+        GINFO("Matched " << std::dec << Recovery::metrics().matches.get()
+                         << " of " << opts.count << " chunks, skipped "
+                         << skipped << " dead");
+        if (damaged)
+        {
+            GINFO(std::dec << damaged << " chunks matched with "
+                           << totalBitErrors << " bit errors in total");
+        }
+        checkpointer.finish();
+        if (!opts.mapName.empty() && !blockMap.close())
+        {
+            return 6;
+        }
+        return 0;
+    }
 };
 
-struct OPTIONS {
+// What modes 3 and 4 share: a WAV output per recovered track, the journal
+// the job resumes from and the checkpoints of the Data Blocks written
+struct RecoveryJob {
+    const OPTIONS &opts;
+    Recovery::Layout layout;
+    Recovery::JobState state;
+    Recovery::WavFormat format;
+    std::vector<std::string> names;
+    std::vector<std::ofstream> outs;
+    std::vector<uint64_t> starts;  // output lengths when this run started
+    uint32_t done = 0;             // Data Blocks of earlier runs
+    Recovery::Checkpointer checkpointer;
+
+    RecoveryJob (const OPTIONS &opts)
+        : opts(opts), layout(sessionLayout(opts)), state(jobState(opts)),
+          checkpointer(opts.journalName,
+                       std::chrono::seconds(opts.checkpoint)) {
+        trimDeadBlocks(layout);
+    }
 
-    std::string imgName;
-    std::string offsStr;
-    uint32_t numTracks = 34;  // default is 34 (arm all)
-    uint32_t channelBlockSize = 0x8000;
-    uint32_t byteOffset = 0;
-    uint64_t offset = 0;
-    uint32_t count = 0;
-    uint32_t mode = 0;
-    uint32_t repition = 8;
-    uint32_t selected = 1;
-    bool dummyRead = false;
-    std::string dest;
-    std::string ofName = "out.wav";
+    // Resumes the job and opens `names`, moving the layout past the Data
+    // Blocks it has written
+    bool start (const std::vector<std::string> &fns) {
+        if (!resumeJob(opts, state))
+        {
+            return false;
+        }
+        names = fns;
+        outs.resize(names.size());
+        for (size_t i = 0; i < names.size(); ++i)
+        {
+            if (!openOutput(outs[i], names[i], state, i, format))
+            {
+                return false;
+            }
+            starts.push_back(outs[i].tellp());
+        }
+        done = skipDone(layout, state);
+        return true;
+    }
+
+    // `blocks` of this run are written
+    void checkpoint (uint32_t blocks) {
+        state.position = done + blocks;
+        state.outputs.clear();
+        for (size_t i = 0; i < outs.size(); ++i)
+        {
+            outs[i].flush();
+            state.outputs.push_back(
+                starts[i] + uint64_t(layout.channelBlockSize()) * blocks);
+        }
+        checkpointer.save(state);
+    }
+
+    // Removes the journal of a complete job or checkpoints an interrupted
+    // one after `blocks`, and finalizes the outputs. Returns whether the
+    // job is complete.
+    bool finish (uint32_t blocks) {
+        if (blocks == layout.count)
+        {
+            checkpointer.finish();
+        }
+        else if (!opts.journalName.empty())
+        {
+            checkpoint(blocks);
+        }
+        bool finished = blocks == layout.count;
+        for (size_t i = 0; i < outs.size(); ++i)
+        {
+            if (!Recovery::finalizeWav(outs[i], format) || !outs[i].flush())
+            {
+                GERROR("Unable to write " << names[i]);
+                finished = false;
+            }
+        }
+        return finished;
+    }
 };
 
-char* readBuf = nullptr;
-std::ofstream of;
-std::ifstream img;
+// Encodes the tracks to FLAC on a pool of `opts.threads` encoders while
+// they are read, one file per track, or all of them into one file with
+// --interleave. Decodes to the same samples the WAV output holds.
+bool doRecoverFlac (OPTIONS &opts, std::vector<uint32_t> tracks) {
+    auto layout = sessionLayout(opts);
+    trimDeadBlocks(layout);
+    Recovery::StreamOptions streamOpts{tracks, occupancy.get()};
+    auto interleave = opts.interleave && tracks.empty();
+    uint32_t numTracks =
+        tracks.empty() ? layout.numTracks : uint32_t(tracks.size());
+
+    Recovery::WavFormat format;
+    std::vector<std::string> names;
+    if (interleave)
+    {
+        if (numTracks > 8)
+        {
+            GERROR("FLAC holds up to 8 channels, not " << std::dec
+                   << numTracks << ": recover without --interleave");
+            return false;
+        }
+        format.numChannels = numTracks;
+        names.push_back(std::format("Recover 1-{}.flac", numTracks));
+    }
+    else if (tracks.size() == 1)
+    {
+        names.push_back(std::filesystem::path(opts.ofName)
+                            .replace_extension(".flac")
+                            .string());
+    }
+    else
+    {
+        for (uint32_t i = 0; i < numTracks; ++i)
+        {
+            names.push_back(std::format("Recover {}.flac", i + 1));
+        }
+    }
 
-void doRecover (OPTIONS &opts) {
-    of.open(opts.ofName);
+    Recovery::FlacEncoderPool pool(opts.threads);
+    std::vector<std::ofstream> outs(names.size());
+    std::vector<std::unique_ptr<Recovery::FlacStream>> streams;
+    for (size_t i = 0; i < names.size(); ++i)
+    {
+        outs[i].open(names[i], std::ios::binary);
+        if (!outs[i])
+        {
+            GERROR("Unable to open target file " << names[i]);
+            return false;
+        }
+        streams.push_back(
+            std::make_unique<Recovery::FlacStream>(outs[i], format, pool));
+    }
+
+    // an interleaved Data Block is gathered, then interleaved as the WAV
+    // output is, samples split between blocks included
+    Recovery::Interleaver interleaver(layout);
+    std::vector<char> dataBlock(interleave ? layout.dataBlockSize() : 0);
+    auto sink = [&](uint32_t track, uint32_t, std::span<const char> audio) {
+        if (!interleave)
+        {
+            streams[tracks.size() == 1 ? 0 : track]->append(audio);
+            return;
+        }
+        auto channelBlockSize = layout.channelBlockSize();
+        memcpy(dataBlock.data() + size_t(track) * channelBlockSize,
+               audio.data(), audio.size());
+        if (track + 1 == layout.numTracks)
+        {
+            streams[0]->append(interleaver.append(dataBlock.data()));
+        }
+    };
+
+    Recovery::Progress progress("Encoding", Recovery::metrics().bytesRead,
+                                layout.channelBlockSize() * numTracks *
+                                    layout.count);
+    uint32_t blocks = 0;
+    if (opts.io == "sync")
+    {
+        blocks = Recovery::streamTracks(*img, layout, sink, streamOpts);
+    }
+    else
+    {
+        auto reader = Recovery::openBlockReader(
+            opts.image, opts.backend,
+            Recovery::streamRanges(layout, streamOpts), opts.pipeline);
+        if (!reader)
+        {
+            return false;
+        }
+        blocks = Recovery::streamTracks(*reader, layout, sink, streamOpts);
+    }
+    if (blocks != layout.count)
+    {
+        GERROR("Img eof!");
+    }
+
+    bool finished = blocks == layout.count;
+    uint64_t written = 0;
+    for (size_t i = 0; i < streams.size(); ++i)
+    {
+        if (!streams[i]->finish() || !outs[i].flush())
+        {
+            GERROR("Unable to write " << names[i]);
+            finished = false;
+            continue;
+        }
+        written += outs[i].tellp();
+    }
+    Recovery::metrics().writes.add(streams.size());
+    Recovery::metrics().bytesWritten.add(written);
+
+    GINFO("Encoded " << std::dec << blocks << " Data Blocks of "
+                     << layout.count << " for " << numTracks << " tracks, "
+                     << written << " bytes of FLAC");
+    return finished;
+};
+
+bool doRecover (OPTIONS &opts) {
+    if (opts.format == "flac")
+    {
+        return doRecoverFlac(opts, {opts.selected - 1});
+    }
+
+    RecoveryJob job(opts);
+    if (!job.start({opts.ofName}))
+    {
+        return false;
+    }
+    auto& layout = job.layout;
+    auto& of = job.outs[0];
 
-    auto offset = opts.offset;
-    auto count = opts.count;
-    auto channelBlockSize = opts.channelBlockSize;
     auto selected = opts.selected;
-    auto numTracks = opts.numTracks;
-    auto repition = opts.repition;
-    auto dest = opts.dest;
-
-    auto countStart = count;
-
-    GINFO("Seeking image to " << std::hex << offset);
-    img.seekg(offset);
-
-    WAV_HEADER wh = {
-        .chunkId = {'R','I','F','F'},
-        .chunkSize = 0x7FFFFF98,
-        .format = {'W','A','V','E'},
-        .subchunk1Id = {'f','m','t', ' '},
-        .subchunk1Size = 16,
-        .audioFormat = 1,
-        .numChannels = 1,
-        .sampleRate = 48000, //TODO: add to params
-        .byteRate = 144000,
-        .blockAlign = 3,
-        .bitsPerSample = 24,
-        .subchunk2Id = {'d','a','t','a'},
-        .subchunk2Size = 0x7FFFFF74
+    auto channelBlockSize = layout.channelBlockSize();
 
-    };
+    Recovery::Progress progress(std::format("Track {}", selected),
+                                Recovery::metrics().bytesRead,
+                                channelBlockSize * layout.count);
+
+    uint32_t blocks = 0;
+    if (opts.io != "sync")
+    {
+        auto reader = Recovery::openBlockReader(
+            opts.image, opts.backend,
+            Recovery::streamRanges(layout, {{selected - 1}}), opts.pipeline);
+        if (!reader)
+        {
+            return false;
+        }
+
+        Recovery::AsyncWriter writer;
+        for (; blocks < layout.count; ++blocks)
+        {
+            auto data = reader->acquire();
+            // released through the writer still, ranges go back in order
+            writer.write(of, data, [&] { reader->release(); });
+            if (data.size() != channelBlockSize)
+            {
+                GERROR("Img eof!");
+                break;
+            }
+            if (job.checkpointer.due())
+            {
+                writer.flush();
+                job.checkpoint(blocks + 1);
+            }
+        }
+        writer.flush();
+    }
+    else
+    {
+        blocks = Recovery::streamTracks(
+            *img, layout,
+            [&](uint32_t, uint32_t block, std::span<const char> data) {
+                RTRACE("Read data: " << std::hex << data.size() << " from: "
+                                     << layout.channelBlockOffset(
+                                            block, selected - 1));
+                RTRACE(Flexibity::log::dump(data.data(), data.size()));
+                writeOut(of, data.data(), data.size());
+                if (job.checkpointer.due())
+                {
+                    job.checkpoint(block + 1);
+                }
+            },
+            {{selected - 1}, occupancy.get()});
+        if (blocks != layout.count)
+        {
+            GERROR("Img eof!");
+        }
+    }
 
+    return job.finish(blocks);
+};
 
-    of.write((char *)&wh, sizeof(wh)); 
+bool doRecoverInterleaved (OPTIONS &opts) {
+    auto layout = sessionLayout(opts);
+    trimDeadBlocks(layout);
 
-    img.seekg(channelBlockSize * (selected - 1) * repition,
-                  std::ios_base::cur);
+    Recovery::WavFormat format;
+    format.numChannels = layout.numTracks;
+
+    auto fn = std::format("Recover 1-{}.wav", layout.numTracks);
+    std::ofstream out(fn, std::ios::binary);
+    if (!out || !Recovery::writeWavHeader(out, format))
+    {
+        GERROR("Unable to open target file " << fn);
+        return false;
+    }
 
-    while (count)
+    auto reader = Recovery::openBlockReader(
+        opts.image, opts.backend, Recovery::dataBlockRanges(layout),
+        opts.pipeline);
+    if (!reader)
+    {
+        return false;
+    }
+    Recovery::Progress progress("Interleaving", Recovery::metrics().bytesRead,
+                                layout.dataBlockSize() * layout.count);
+    auto blocks = Recovery::demuxInterleaved(*reader, layout, out);
+    if (!Recovery::finalizeWav(out, format) || !out.flush())
     {
-        for (auto i = repition; i > 0; --i)
+        GERROR("Unable to write " << fn);
+        return false;
+    }
+
+    GINFO("Recovered " << std::dec << blocks << " Data Blocks of "
+                       << layout.count << " into " << fn);
+    return blocks == layout.count;
+};
+
+bool doRecoverAll (OPTIONS &opts) {
+    if (opts.format == "flac")
+    {
+        return doRecoverFlac(opts, {});
+    }
+    if (opts.interleave)
+    {
+        return doRecoverInterleaved(opts);
+    }
+
+    RecoveryJob job(opts);
+    std::vector<std::string> names;
+    for (uint32_t i = 0; i < job.layout.numTracks; ++i)
+    {
+        names.push_back(std::format("Recover {}.wav", i + 1));
+    }
+    if (!job.start(names))
+    {
+        return false;
+    }
+    auto& layout = job.layout;
+    auto& outs = job.outs;
+
+    Recovery::Progress progress("All tracks", Recovery::metrics().bytesRead,
+                                layout.dataBlockSize() * layout.count);
+
+    uint32_t blocks = 0;
+    if (opts.io == "sync")
+    {
+        blocks = Recovery::streamTracks(
+            *img, layout,
+            [&](uint32_t track, uint32_t block, std::span<const char> audio) {
+                writeOut(outs[track], audio.data(), audio.size());
+                if (track + 1 == layout.numTracks && job.checkpointer.due())
+                {
+                    job.checkpoint(block + 1);
+                }
+            },
+            {{}, occupancy.get()});
+    }
+    else
+    {
+        auto reader = Recovery::openBlockReader(
+            opts.image, opts.backend, Recovery::dataBlockRanges(layout),
+            opts.pipeline);
+        if (!reader)
+        {
+            return false;
+        }
+        Recovery::AsyncWriter writer;
+        blocks = Recovery::demux(*reader, layout, outs, writer,
+                                 [&](uint32_t queued) {
+                                     if (job.checkpointer.due())
+                                     {
+                                         writer.flush();
+                                         job.checkpoint(queued);
+                                     }
+                                 });
+    }
+
+    auto finished = job.finish(blocks);
+
+    GINFO("Recovered " << std::dec << job.done + blocks << " Data Blocks of "
+                       << job.done + layout.count << " for "
+                       << layout.numTracks << " tracks");
+    return finished;
+};
+
+// Gathers every track from the chunks a mapping run found, reading the
+// image once in map order. Chunks the run didn't find are left as silence.
+bool doRecoverMapped (OPTIONS &opts) {
+    Recovery::BlockMap map;
+    if (!map.open(opts.mapName, opts.backend))
+    {
+        return false;
+    }
+    auto chunkSize = map.chunkSize();
+    auto numTracks = map.numTracks();
+
+    Recovery::WavFormat format;
+    auto headerSize = Recovery::wavHeaderSize(format);
+
+    std::vector<std::ofstream> outs(numTracks);
+    std::vector<uint64_t> next(numTracks, headerSize);  // write positions
+    std::vector<uint64_t> found(numTracks);
+    std::vector<uint32_t> last(numTracks);
+    for (uint32_t i = 0; i < numTracks; ++i)
+    {
+        auto fn = std::format("Recover {}.wav", i + 1);
+        outs[i].open(fn, std::ios::binary);
+        if (!outs[i] || !Recovery::writeWavHeader(outs[i], format))
+        {
+            GERROR("Unable to open target file " << fn);
+            return false;
+        }
+    }
+
+    Recovery::Progress progress("Gathering", Recovery::metrics().bytesRead,
+                                uint64_t(chunkSize) * map.entries().size());
+    auto chunks = Recovery::gatherChunks(
+        *img, map,
+        [&](const Recovery::BlockMapEntry& entry, const char* data,
+            size_t size) {
+            // chunk 0 is the recorder's WAV header chunk
+            auto track = entry.track;
+            if (entry.chunk == 0 || track >= numTracks)
+            {
+                return;
+            }
+            auto pos = headerSize + uint64_t(entry.chunk - 1) * chunkSize;
+            if (pos != next[track])
+            {
+                outs[track].seekp(pos);
+            }
+            writeOut(outs[track], data, size);
+            next[track] = pos + size;
+            ++found[track];
+            last[track] = std::max(last[track], entry.chunk);
+        });
+
+    bool finished = true;
+    for (uint32_t i = 0; i < numTracks; ++i)
+    {
+        if (!Recovery::finalizeWav(outs[i], format) || !outs[i].flush())
+        {
+            GERROR("Unable to write Recover " << std::dec << i + 1 << ".wav");
+            finished = false;
+        }
+    }
+
+    GINFO("Gathered " << std::dec << chunks << " of "
+                      << map.entries().size() << " mapped chunks");
+    for (uint32_t i = 0; i < numTracks; ++i)
+    {
+        GINFO("Track " << i + 1 << ": " << std::dec << found[i]
+                       << " chunks up to chunk " << last[i]);
+    }
+    return finished;
+};
+
+// Copies the recorder's `*.audio(N).wav` files off a card whose FAT32 or
+// exFAT filesystem is still readable, no offsets needed
+bool doRecoverFiles (OPTIONS &opts) {
+    std::vector<uint64_t> volumes = {opts.offset};
+    if (opts.offsStr.empty())
+    {
+        volumes = Recovery::findFatVolumes(*img);
+    }
+
+    std::vector<Recovery::FsFile> files;
+    for (auto offset : volumes)
+    {
+        Recovery::FatVolume volume;
+        if (!volume.open(*img, offset))
         {
-            auto startPos = img.tellg();
-            
-            img.read(readBuf, channelBlockSize);
-            GINFO("Read data: " << std::hex << channelBlockSize
-                          << " from: " << std::hex << startPos
-                          << " to: " << std::hex << img.tellg()); 
-            GDEBUG(Flexibity::log::dump(readBuf, channelBlockSize));
-            of.write(readBuf, channelBlockSize);
+            continue;
         }
-        img.seekg(channelBlockSize * (numTracks - 1) * repition,
-                  std::ios_base::cur);
-        GINFO("Finalizing iter " << countStart - count + 1
-                             << " Seeking to: " << std::hex << img.tellg());
+        for (auto& file : volume.files())
+        {
+            auto name = std::filesystem::path(file.path).filename().string();
+            if (name.find(".audio(") != std::string::npos &&
+                name.ends_with(").wav"))
+            {
+                files.push_back(std::move(file));
+            }
+        }
+    }
+    if (files.empty())
+    {
+        GERROR("No session files found on a FAT32 or exFAT volume");
+        return false;
+    }
 
-        --count;
+    uint64_t total = 0;
+    for (auto& file : files)
+    {
+        total += file.size;
     }
+    GINFO("Found " << std::dec << files.size() << " session files, " << total
+                   << " bytes");
+
+    std::filesystem::path dest = opts.dest.empty() ? "." : opts.dest;
+    Recovery::Progress progress("Copying", Recovery::metrics().bytesRead,
+                                total);
+    size_t failed = 0;
+    for (auto& file : files)
+    {
+        // one component at a time, none of them may leave `dest`
+        auto fn = dest;
+        std::string_view rest = file.path;
+        bool safe = true;
+        while (safe)
+        {
+            auto name = rest.substr(0, rest.find('/'));
+            safe = Recovery::safeFileName(name);
+            fn /= name;
+            if (name.size() == rest.size())
+            {
+                break;
+            }
+            rest.remove_prefix(name.size() + 1);
+        }
+        if (!safe)
+        {
+            GERROR("Unsafe file name " << file.path);
+            ++failed;
+            continue;
+        }
 
-    of.close();
+        std::error_code error;
+        std::filesystem::create_directories(fn.parent_path(), error);
+        std::ofstream out(fn, std::ios::binary);
+        if (!out)
+        {
+            GERROR("Unable to open target file " << fn.string());
+            ++failed;
+            continue;
+        }
+        auto copied = Recovery::readFile(
+            *img, file, [&](std::span<const char> data) {
+                writeOut(out, data.data(), data.size());
+            });
+        GINFO(file.path << ": " << std::dec << copied << " of " << file.size
+                        << " bytes from " << file.extents.size()
+                        << " extents");
+        if (copied < file.size || !out.flush())
+        {
+            GERROR("Unable to copy all of " << file.path);
+            ++failed;
+        }
+    }
+    if (failed)
+    {
+        GERROR(std::dec << failed << " of " << files.size()
+                        << " session files weren't copied completely");
+        return false;
+    }
+    return true;
 };
 
 int main(int argc, char** argv)
@@ -171,6 +1032,13 @@ int main(int argc, char** argv)
     options.desc.add_options()(
         "img,i", Flexibity::po::value<std::string>(&opts.imgName)->required(),
         "Define the image filename to recover from")(
+        "parts", Flexibity::po::value<std::vector<std::string>>(&opts.parts)
+                     ->multitoken(),
+        "Define the further parts of a split image, read after the -i one "
+        "in the order given")(
+        "rescueMap", Flexibity::po::value<std::string>(&opts.rescueMapName),
+        "Define the GNU ddrescue mapfile of the image, the ranges it "
+        "couldn't read come as zeros")(
         "tracks,t", Flexibity::po::value<uint32_t>(&opts.numTracks),
         "Define the number of tracks recorded")(
         "offset,o", Flexibity::po::value<std::string>(&opts.offsStr),
@@ -188,7 +1056,59 @@ int main(int argc, char** argv)
         "selected,s", Flexibity::po::value<uint32_t>(&opts.selected),
         "Define selected channel for recovery")(
         "dummy,u", Flexibity::po::value<bool>(&opts.dummyRead),
-        "Use dummy read (experiment)")
+        "Use dummy read (experiment)")(
+        "backend", Flexibity::po::value<std::string>(&opts.backend),
+        "Define the image reader backend: mmap or stream")(
+        "threads,j", Flexibity::po::value<uint32_t>(&opts.threads),
+        "Define the number of scan threads, 0 for all cores")(
+        "recover", Flexibity::po::bool_switch(&opts.recover),
+        "Recover the detected or corrected session right away (modes 6, 7, "
+        "15)")(
+        "io", Flexibity::po::value<std::string>(&opts.io),
+        "Define the recovery I/O: auto, uring, thread or sync")(
+        "depth", Flexibity::po::value<uint32_t>(&opts.pipeline.depth),
+        "Define the number of blocks read ahead")(
+        "direct", Flexibity::po::bool_switch(&opts.pipeline.direct),
+        "Read the image with O_DIRECT (uring)")(
+        "interleave", Flexibity::po::bool_switch(&opts.interleave),
+        "Recover all tracks into one interleaved multichannel file")(
+        "format", Flexibity::po::value<std::string>(&opts.format),
+        "Define the output of modes 3 and 4: wav or flac")(
+        "to", Flexibity::po::value<std::string>(&opts.toStr),
+        "Define the last offset to sweep (mode 8)")(
+        "step", Flexibity::po::value<std::string>(&opts.stepStr),
+        "Define the offset sweep step, default is one chunk (mode 8)")(
+        "toRepition", Flexibity::po::value<uint32_t>(&opts.toRepition),
+        "Define the last repitition count to sweep (mode 8)")(
+        "toTracks", Flexibity::po::value<uint32_t>(&opts.toTracks),
+        "Define the last number of tracks to sweep (mode 8)")(
+        "top", Flexibity::po::value<uint32_t>(&opts.top),
+        "Define the number of sweep results shown (mode 8)")(
+        "stats", Flexibity::po::value<std::string>(&opts.statsName),
+        "Write I/O and matching metrics as JSON to this file at exit")(
+        "occupancy", Flexibity::po::value<std::string>(&opts.occupancyName),
+        "Define the occupancy map written by mode 9: modes 1, 2 and 5 skip "
+        "its dead chunks no reference chunk may match, the other modes "
+        "rebuild them from their fill byte instead of reading them")(
+        "maxBitErrors", Flexibity::po::value<uint32_t>(&opts.maxBitErrors),
+        "Define the bit errors a chunk may have and still match in modes 1, "
+        "2 and 14, 0 is exact")(
+        "map", Flexibity::po::value<std::string>(&opts.mapName),
+        "Define the block map written by modes 1, 2, 5 and 15 and recovered "
+        "by mode 10")(
+        "journal", Flexibity::po::value<std::string>(&opts.journalName),
+        "Define the job journal modes 1-4 checkpoint to")(
+        "checkpoint", Flexibity::po::value<uint32_t>(&opts.checkpoint),
+        "Define the seconds between checkpoints, default is 60")(
+        "resume", Flexibity::po::bool_switch(&opts.resume),
+        "Resume an interrupted job of modes 1-4 from its journal")(
+        "preview", Flexibity::po::value<std::string>(&opts.previewName),
+        "Define the JSON level overview written by mode 13")(
+        "width", Flexibity::po::value<uint32_t>(&opts.width),
+        "Define the overview bins per track (mode 13)")(
+        "window", Flexibity::po::value<uint32_t>(&opts.window),
+        "Define the chunks after a chunk its successor is looked for, default "
+        "is two Data Blocks (mode 15)")
         ;
 
     
@@ -196,18 +1116,45 @@ int main(int argc, char** argv)
         options.parse(argc, argv);
         char* end = nullptr;
         opts.offset = strtoull(opts.offsStr.c_str(), &end, 0);
+        opts.pipeline.io = opts.io;
+        opts.image.parts = {opts.imgName};
+        opts.image.parts.insert(opts.image.parts.end(), opts.parts.begin(),
+                                opts.parts.end());
+        opts.image.rescueMap = opts.rescueMapName;
     }
 
-    readBuf = new char[opts.channelBlockSize];
+    if (!opts.journalName.empty() &&
+        (opts.format != "wav" || opts.interleave))
+    {
+        GERROR("Jobs are journaled with WAV output of one file per track "
+               "only");
+        return 1;
+    }
+    if (opts.resume && opts.journalName.empty())
+    {
+        GERROR("--resume needs the --journal of the job");
+        return 1;
+    }
 
-    img.open(opts.imgName);
-    GINFO("Opening image " << opts.imgName);
-    if (!img.is_open())
+    StatsReport statsReport{opts.statsName};
+
+    GINFO("Opening image " << opts.imgName << " with " << opts.backend);
+    img = Recovery::openImage(opts.image, opts.backend);
+    if (!img)
     {
-        GINFO("Unable to open image " << opts.imgName << " with " << img.rdstate());
+        GINFO("Unable to open image " << opts.imgName);
         return 1;
     }
 
+    if (!opts.occupancyName.empty() && opts.mode != 9)
+    {
+        occupancy = std::make_unique<Recovery::OccupancyMap>();
+        if (!occupancy->load(opts.occupancyName))
+        {
+            return 1;
+        }
+    }
+
     auto mode = opts.mode;
 
     if (mode == 0)
@@ -218,42 +1165,38 @@ int main(int argc, char** argv)
         auto channelBlockSize = opts.channelBlockSize;
         auto selected = opts.selected;
         auto numTracks = opts.numTracks;
-        auto repition = opts.repition;
-
-        auto countStart = count;
-
-        GINFO("Seeking image to " << std::hex << offset);
-        img.seekg(offset);
 
         of.open(opts.ofName);
 
-        auto start = img.tellg();
-        img.seekg(channelBlockSize * (selected - 1), std::ios_base::cur);
-        img.read(readBuf, channelBlockSize);
-        GINFO("Read header: " << std::hex << channelBlockSize
+        auto start = offset + uint64_t(channelBlockSize) * (selected - 1);
+        auto header = img->read(start, channelBlockSize);
+        GINFO("Read header: " << std::hex << header.size()
                               << " from: " << std::hex << start
-                              << " to: " << std::hex << img.tellg());
+                              << " to: " << std::hex << start + header.size());
+        writeOut(of, header.data(), header.size());
+        GDEBUG(Flexibity::log::dump(header.data(), header.size()));
 
         // skip all channels
-        img.seekg(channelBlockSize * (numTracks - selected), std::ios_base::cur);
-        GINFO("Finalizing iter " << countStart - count + 1
-                                 << " Seeking to: " << std::hex << img.tellg());
-        of.write(readBuf, channelBlockSize);
-        GDEBUG(Flexibity::log::dump(readBuf, channelBlockSize));
+        auto layout = sessionLayout(opts);
+        layout.offset = offset + uint64_t(channelBlockSize) * numTracks;
+        GINFO("Data starts at " << std::hex << layout.offset);
 
-        img.seekg(channelBlockSize * (selected - 1) * repition,
-                      std::ios_base::cur);
+        img->advise(Recovery::ImageSource::Access::Random, layout.offset,
+                    layout.dataBlockSize() * count);
 
-        while (count)
+        Recovery::Progress progress(std::format("Track {}", selected),
+                                    Recovery::metrics().bytesRead,
+                                    layout.channelBlockSize() * count);
+        for (uint32_t block = 0; block < count; ++block)
         {
-            for (int i = repition; i > 0; --i)
+            auto data = img->read(layout.channelBlockOffset(block, selected - 1),
+                                  layout.channelBlockSize());
+            writeOut(of, data.data(), data.size());
+            if (data.size() != layout.channelBlockSize())
             {
-                img.read(readBuf, channelBlockSize);
-                of.write(readBuf, channelBlockSize);
+                GERROR("Img eof!");
+                break;
             }
-            img.seekg(channelBlockSize * (numTracks - 1) * repition,
-                      std::ios_base::cur);
-            --count;
         }
 
         // GINFO(Flexibity::log::dump((const char *) &readBuf,
@@ -264,88 +1207,49 @@ int main(int argc, char** argv)
     else if (mode == 1)
     {  // sector mapping to study the write sequence pattern
 
-        
-        auto offset = opts.offset;
-        auto count = opts.count;
-        auto channelBlockSize = opts.channelBlockSize;
         auto numTracks = opts.numTracks;
-        auto dest = opts.dest;
-
-        auto maps = new WAV_MAPPER[numTracks];
-
-        GINFO("Seeking image to " << std::hex << offset);
-        img.seekg(offset);
-
-        // init/open streams
-        for (uint32_t i = 0; i < numTracks; ++i)
-        {
-            std::ostringstream fn;
-            fn << i + 1 << ".audio(0).wav";
-            auto& item = maps[i];
-            item.fn = fn.str();
-
-            item.readBuf = new char[channelBlockSize];
-
-            fn.str("");
-            fn.clear();
-
-            fn << dest << "/" << item.fn;
-
-            item.stream.open(fn.str());
-            if (!item.stream.is_open())
-            {
-                GINFO("Unable to open target file " << fn.str() << " with "
-                                                    << item.stream.rdstate());
-                return 2;
-            }
-        }
+        auto channelBlockSize = opts.channelBlockSize;
 
-        for (uint32_t i = 0; i < numTracks; ++i)
+        MappingJob job(opts);
+        if (auto rc = job.start())
         {
-            auto& item = maps[i];
-            GINFO("Track " << i << ": Reading " << std::hex << channelBlockSize
-                           << " bytes " << std::hex << item.stream.tellg());
-            item.stream.read(item.readBuf, channelBlockSize);
+            return rc;
         }
+        auto& maps = job.maps;
 
-        for (uint32_t j = 0; j < count; ++j)
-        {
-
-            if (img.eof())
-            {
-                GERROR("Img eof!");
-                return 4;
-            }
-
-            auto startPos = img.tellg();
-            GINFO("Iter " << j << " Reading img " << std::hex
-                          << channelBlockSize << " bytes " << std::hex
-                          << startPos);
-            img.read(readBuf, channelBlockSize);
-
+        auto rc = job.run([&](uint32_t j, uint64_t startPos,
+                              std::span<const char> chunk) {
+            auto matchStart = std::chrono::steady_clock::now();
             bool matchFound = false;
 
             for (uint32_t i = 0; i < numTracks; ++i)
             {
                 auto& item = maps[i];
 
+                uint64_t bitErrors = 0;
                 if (!item.stream.eof() &&
-                    memcmp(item.readBuf, readBuf, channelBlockSize) == 0)
+                    Recovery::nearlyEqual(item.readBuf, chunk.data(),
+                                          channelBlockSize, opts.maxBitErrors,
+                                          bitErrors))
                 {
 
-                    GINFO("Match for track " << i + 1 << " at iter " << j
+                    RTRACE("Match for track " << i + 1 << " at iter " << j
                                              << " offs: " << std::hex
                                              << startPos);
-                    GINFO("Track " << i + 1 << ": Reading " << std::hex
+                    RTRACE("Track " << i + 1 << ": Reading " << std::hex
                                    << channelBlockSize << " bytes at "
                                    << std::hex << item.stream.tellg());
                     matchFound = true;
-                    item.stream.read(item.readBuf, channelBlockSize);
+                    job.matched(startPos, i, bitErrors);
+                    readReference(item, channelBlockSize, opts.maxBitErrors);
+                    ++item.chunk;
 
                     break;
                 }
             }
 
+            countMatch(matchStart, matchFound);
+
             if (!matchFound)
             {
                 auto hasValidStreams = false;
@@ -362,75 +1266,40 @@ int main(int argc, char** argv)
                     return 2;
                 }
             }
+            return 0;
+        });
+        if (rc)
+        {
+            return rc;
         }
-
-        delete[] maps;
     }
     else if (mode == 2)
     {  // sector mapping to study the write sequence pattern
 
-        auto offset = opts.offset;
-        auto count = opts.count;
-        auto channelBlockSize = opts.channelBlockSize;
         auto numTracks = opts.numTracks;
-        auto dest = opts.dest;
-
-        GINFO("Seeking image to " << std::hex << offset);
-        img.seekg(offset);
-
-        auto maps = new WAV_MAPPER[numTracks];
+        auto channelBlockSize = opts.channelBlockSize;
 
-        // init/open streams
-        for (uint32_t i = 0; i < numTracks; ++i)
+        MappingJob job(opts);
+        if (auto rc = job.start())
         {
-            std::ostringstream fn;
-            fn << i + 1 << ".audio(0).wav";
-            auto& item = maps[i];
-            item.fn = fn.str();
-
-            item.readBuf = new char[channelBlockSize];
-
-            fn.str("");
-            fn.clear();
-
-            fn << dest << "/" << item.fn;
-
-            item.stream.open(fn.str());
-            if (!item.stream.is_open())
-            {
-                GINFO("Unable to open target file " << fn.str() << " with "
-                                                    << item.stream.rdstate());
-                return 2;
-            }
-            GINFO("Track " << i << ": Reading " << std::hex << channelBlockSize
-                           << " bytes " << std::hex << item.stream.tellg());
-            item.stream.read(item.readBuf, channelBlockSize);
-            item.matchFound = false;
+            return rc;
         }
+        auto& maps = job.maps;
 
-        for (uint32_t j = 0; j < count; ++j)
-        {
-
-            if (img.eof())
-            {
-                GERROR("Img eof!");
-                return 4;
-            }
-
-            auto startPos = img.tellg();
-            GINFO("Iter " << j << " Reading img " << std::hex
-                          << channelBlockSize << " bytes " << std::hex
-                          << startPos);
-            img.read(readBuf, channelBlockSize);
-
+        auto rc = job.run([&](uint32_t j, uint64_t startPos,
+                              std::span<const char> chunk) {
+            auto matchStart = std::chrono::steady_clock::now();
             bool matchFound = false;
 
             for (uint32_t i = 0; i < numTracks; ++i)
             {
                 auto& item = maps[i];
 
+                uint64_t bitErrors = 0;
                 if (!item.matchFound &&
-                    memcmp(item.readBuf, readBuf, channelBlockSize) == 0)
+                    Recovery::nearlyEqual(item.readBuf, chunk.data(),
+                                          channelBlockSize, opts.maxBitErrors,
+                                          bitErrors))
                 {
                     if (item.stream.eof())
                     {
@@ -438,41 +1307,45 @@ int main(int argc, char** argv)
                         return 3;
                     }
 
-                    GINFO("Match for track " << i + 1 << " at iter " << j
+                    RTRACE("Match for track " << i + 1 << " at iter " << j
                                              << " offs: " << std::hex
                                              << startPos);
 
                     matchFound = true;
                     item.matchFound = true;
+                    job.matched(startPos, i, bitErrors);
                     break;
                 }
             }
 
+            countMatch(matchStart, matchFound);
+
             bool exhausted = true;
 
             for (uint32_t i = 0; i < numTracks; ++i)
             {
                 auto& item = maps[i];
                 exhausted &= item.matchFound;
-                GINFO("Track " << i << " " << item.matchFound);
+                RTRACE("Track " << i << " " << item.matchFound);
             }
 
             if (exhausted)
             {
-                GINFO("All tracks are exhausted! Re-reading!");
+                RTRACE("All tracks are exhausted! Re-reading!");
                 for (uint32_t i = 0; i < numTracks; ++i)
                 {
                     auto& item = maps[i];
                     item.matchFound = false;
-                    item.stream.read(item.readBuf, channelBlockSize);
+                    readReference(item, channelBlockSize, opts.maxBitErrors);
+                    ++item.chunk;
                 }
             }
 
             if (matchFound)
             {
-                GINFO("Match found at img " << std::hex << startPos
+                RTRACE("Match found at img " << std::hex << startPos
                                             << ", continue");
-                continue;
+                return 0;
             }
 
             if (!matchFound && !exhausted)
@@ -480,26 +1353,507 @@ int main(int argc, char** argv)
                 GERROR("Unable to find Match at img " << std::hex << startPos);
                 return 2;
             }
+            return 0;
+        });
+        if (rc)
+        {
+            return rc;
         }
-
-        delete[] maps;
     }if (mode == 3)
     {  // actual recovery for unsaved session
 
-        doRecover(opts);
+        if (!doRecover(opts))
+        {
+            return 4;
+        }
     }if (mode == 4)
     {  // actual recovery for all channels of unsaved session
+        if (!doRecoverAll(opts))
+        {
+            return 4;
+        }
+    }
+    else if (mode == 5)
+    {  // indexed sector mapping, places chunks found in any order
+
+        auto offset = opts.offset;
+        auto count = opts.count;
+        auto channelBlockSize = opts.channelBlockSize;
         auto numTracks = opts.numTracks;
 
+        Recovery::ChunkIndex index;
+        if (!index.build(opts.dest, numTracks, channelBlockSize, opts.backend))
+        {
+            return 2;
+        }
+        GINFO("Indexed " << std::dec << index.size() << " reference chunks");
+
+        uint64_t chunks = count;
+        if (!chunks && img->size() > offset)
+        {
+            chunks = (img->size() - offset) / channelBlockSize;
+        }
+
+        Recovery::ChunkMap map;
+        Recovery::Progress progress("Mapping",
+                                    Recovery::metrics().matchAttempts, chunks,
+                                    " chunks");
+        auto stats = Recovery::mapImageParallel(
+            opts.image, opts.backend, offset, count, channelBlockSize, index,
+            opts.threads, map, occupancy.get());
+
+        Recovery::BlockMapWriter blockMap;
+        if (!opts.mapName.empty() &&
+            !blockMap.open(opts.mapName, channelBlockSize, numTracks))
+        {
+            return 6;
+        }
+
+        std::vector<uint64_t> found(numTracks);
+        for (auto& [startPos, item] : map)
+        {
+            auto& loc = item.location;
+            RTRACE("Match for track " << loc.track + 1 << " chunk " << std::dec
+                                     << loc.chunk << " offs: " << std::hex
+                                     << startPos
+                                     << (item.candidates > 1 ? " (ambiguous)"
+                                                             : ""));
+            ++found[loc.track];
+            if (!opts.mapName.empty())
+            {
+                blockMap.add(startPos, loc.track, loc.chunk, item.candidates);
+            }
+        }
+        if (!opts.mapName.empty() && !blockMap.close())
+        {
+            return 6;
+        }
+
+        GINFO("Scanned " << std::dec << stats.chunks << " chunks, matched "
+                         << stats.matched << ", ambiguous "
+                         << stats.ambiguous << ", skipped " << stats.skipped
+                         << " dead");
         for (uint32_t i = 0; i < numTracks; ++i)
-        {   
-            opts.ofName = std::format("Recover {}.wav", i + 1);
-            opts.selected = i + 1;
-            doRecover(opts);
+        {
+            GINFO("Track " << i + 1 << ": " << std::dec << found[i] << " of "
+                           << index.trackChunks(i) << " chunks found");
+        }
+    }
+    else if (mode == 6)
+    {  // detect session layouts from their runs of WAV headers
+
+        auto sessions = Recovery::detectSessions(*img, opts.offset, 0);
+        if (sessions.empty())
+        {
+            GERROR("No session headers found after " << std::hex
+                                                     << opts.offset);
+            return 5;
+        }
+
+        for (auto& session : sessions)
+        {
+            auto& layout = session.layout;
+            GINFO("Session headers start: " << std::hex << session.headerOffset
+                  << " raw data start: " << layout.offset);
+            GINFO("  tracks: " << std::dec << layout.numTracks
+                  << " rate: " << session.sampleRate
+                  << " bits: " << session.bitsPerSample);
+            GINFO("  Chunk size: " << std::hex << layout.chunkSize
+                  << " Channel Block size: " << layout.channelBlockSize()
+                  << " Data Block size: " << layout.dataBlockSize()
+                  << " (repition " << std::dec << layout.repition
+                  << ", confidence " << session.confidence << ")");
+            GINFO("  -o 0x" << std::hex << layout.offset << " -t " << std::dec
+                  << layout.numTracks << " -r " << layout.repition << " -c "
+                  << layout.count);
+        }
+
+        if (opts.recover)
+        {
+            auto& layout = sessions.front().layout;
+            opts.offset = layout.offset;
+            opts.numTracks = layout.numTracks;
+            opts.channelBlockSize = layout.chunkSize;
+            opts.repition = layout.repition;
+            if (!opts.count)
+            {
+                opts.count = layout.count;
+            }
+            if (!doRecoverAll(opts))
+            {
+                return 4;
+            }
+        }
+    }
+    else if (mode == 7)
+    {  // score audio continuity at chunk boundaries to verify the layout
+
+        auto layout = sessionLayout(opts);
+        if (!layout.count && img->size() > layout.offset)
+        {
+            layout.count =
+                (img->size() - layout.offset) / layout.dataBlockSize();
+        }
+
+        auto report = Recovery::analyzeContinuity(*img, layout);
+        for (uint32_t j = 0; j < layout.repition; ++j)
+        {
+            auto& stats = report.positions[j];
+            GINFO((j ? "Chunk " : "Channel Block ")
+                  << std::dec << j << " boundaries: " << stats.rough << " of "
+                  << stats.total << " rough");
+        }
+        for (uint32_t t = 0; t < layout.numTracks; ++t)
+        {
+            auto& flagged = report.tracks[t].flagged;
+            GINFO("Track " << std::dec << t + 1 << ": " << flagged.size()
+                           << " rough boundaries");
+            for (auto offset : flagged)
+            {
+                RTRACE("  at " << std::hex << offset);
+            }
+        }
+
+        double inner = 0;
+        for (uint32_t j = 1; j < layout.repition; ++j)
+        {
+            inner = std::max(inner, report.positions[j].roughFraction());
+        }
+        if (report.misalignment)
+        {
+            GINFO("Channel Blocks are read " << std::dec
+                  << report.misalignment << " chunks late, use -o 0x"
+                  << std::hex << report.correctedOffset);
+            if (report.correctedOffset > layout.offset)
+            {
+                GINFO("  track numbers shift by one from there");
+            }
+        }
+        else if (report.positions[0].roughFraction() > 0.5 && inner < 0.1)
+        {
+            GINFO("Chunks are continuous but Channel Blocks are not: "
+                  "check the track count and Data Block alignment");
+        }
+        else
+        {
+            GINFO("No misalignment detected");
+        }
+
+        if (opts.recover)
+        {
+            opts.offset = report.correctedOffset;
+            if (!opts.count)
+            {
+                opts.count = layout.count;
+            }
+            if (!doRecoverAll(opts))
+            {
+                return 4;
+            }
+        }
+    }
+    else if (mode == 8)
+    {  // rank candidate layouts by audio continuity, no WAVs written
+
+        Recovery::SweepRanges ranges;
+        ranges.base = sessionLayout(opts);
+        ranges.lastOffset =
+            opts.toStr.empty() ? opts.offset
+                               : strtoull(opts.toStr.c_str(), nullptr, 0);
+        ranges.offsetStep = strtoull(opts.stepStr.c_str(), nullptr, 0);
+        ranges.lastRepition = opts.toRepition;
+        ranges.lastNumTracks = opts.toTracks;
+
+        auto results = Recovery::sweepLayouts(*img, ranges.candidates(),
+                                              opts.threads);
+        if (results.empty())
+        {
+            GERROR("No candidate layout fits the image");
+            return 5;
+        }
+
+        for (size_t i = 0; i < results.size() && i < opts.top; ++i)
+        {
+            auto& layout = results[i].layout;
+            auto& boundaries = results[i].boundaries;
+            GINFO(std::dec << i + 1 << ". -o 0x" << std::hex << layout.offset
+                  << " -t " << std::dec << layout.numTracks << " -r "
+                  << layout.repition << " -c " << layout.count << ": "
+                  << boundaries.rough << " of " << boundaries.total
+                  << " boundaries rough");
+        }
+    }
+    else if (mode == 9)
+    {  // map erased and uniform chunks once, later passes skip them
+
+        Recovery::Progress progress(
+            "Occupancy", Recovery::metrics().bytesRead,
+            (opts.count ? uint64_t(opts.channelBlockSize) * opts.count
+                        : img->size() - std::min(img->size(), opts.offset)));
+        auto map = Recovery::mapOccupancy(*img, opts.offset, opts.count,
+                                          opts.channelBlockSize, opts.threads);
+        for (size_t c = 0; c < Recovery::chunkClasses; ++c)
+        {
+            GINFO(Recovery::chunkClassName(Recovery::ChunkClass(c)) << ": "
+                  << std::dec << map.counts[c] << " chunks");
+        }
+
+        auto fn = opts.occupancyName.empty() ? std::string("occupancy.map")
+                                             : opts.occupancyName;
+        if (!map.save(fn))
+        {
+            return 6;
+        }
+        GINFO("Occupancy map of " << std::dec << map.chunks
+                                  << " chunks written to " << fn);
+    }
+    else if (mode == 10)
+    {  // recovery driven by the block map of a mapping run
+
+        if (!doRecoverMapped(opts))
+        {
+            return 4;
+        }
+    }
+    else if (mode == 11)
+    {  // healthy card: copy the session files off its filesystem
+
+        if (!doRecoverFiles(opts))
+        {
+            return 5;
+        }
+    }
+    else if (mode == 12)
+    {  // carve every session of the card, each into its own folder
+
+        auto sessions = Recovery::detectSessions(*img, opts.offset, 0);
+        if (sessions.empty())
+        {
+            GERROR("No session headers found after " << std::hex
+                                                     << opts.offset);
+            return 5;
+        }
+
+        uint64_t total = 0;
+        for (auto& session : sessions)
+        {
+            trimDeadBlocks(session.layout);
+            total += session.layout.dataBlockSize() * session.layout.count;
+        }
+        GINFO("Carving " << std::dec << sessions.size() << " sessions, "
+                         << total << " bytes");
+
+        Recovery::Progress progress("Carving", Recovery::metrics().bytesRead,
+                                    total);
+        auto carved = Recovery::carveSessions(
+            *img, sessions, opts.dest.empty() ? "." : opts.dest, opts.threads,
+            occupancy.get());
+        bool complete = true;
+        for (auto& result : carved)
+        {
+            if (result.blocks != result.session.layout.count)
+            {
+                GERROR(result.dir << " is incomplete: " << std::dec
+                                  << result.blocks << " of "
+                                  << result.session.layout.count
+                                  << " Data Blocks");
+                complete = false;
+            }
+        }
+        if (!complete)
+        {
+            return 4;
+        }
+    }
+    else if (mode == 13)
+    {  // level overview of every track to check a layout, no WAVs written
+
+        auto layout = sessionLayout(opts);
+        trimDeadBlocks(layout);
+
+        std::vector<Recovery::TrackPreview> tracks;
+        {
+            Recovery::Progress progress("Preview",
+                                        Recovery::metrics().bytesRead,
+                                        layout.dataBlockSize() * layout.count);
+            tracks = Recovery::previewTracks(*img, layout, opts.width,
+                                             occupancy.get());
+        }
+
+        for (uint32_t t = 0; t < tracks.size(); ++t)
+        {
+            auto& total = tracks[t].total;
+            GINFO("Track " << std::dec << std::setw(2) << t + 1 << " |"
+                  << Recovery::previewWaveform(tracks[t]) << "| peak "
+                  << std::fixed << std::setprecision(1) << std::setw(6)
+                  << total.peakDb() << " rms " << std::setw(6)
+                  << total.rmsDb() << " dBFS "
+                  << Recovery::previewVerdict(total));
+            if (total.clipped)
+            {
+                GINFO("  " << std::dec << total.clipped
+                           << " samples at full scale");
+            }
+        }
+
+        std::ofstream out(opts.previewName);
+        Recovery::writePreviewJson(out, layout, tracks);
+        if (!out)
+        {
+            GERROR("Unable to write " << opts.previewName);
+            return 6;
+        }
+        GINFO("Overview of " << std::dec << tracks.size() << " tracks in "
+                             << opts.previewName);
+    }
+    else if (mode == 14)
+    {  // splice the tracks saved before the crash with their carved tails
+
+        auto layout = sessionLayout(opts);
+        if (layout.offset < uint64_t(layout.chunkSize) * layout.numTracks)
+        {
+            GERROR("The offset must be the first Data Block, after the WAV "
+                   "header chunks");
+            return 1;
+        }
+        if (!layout.count && img->size() > layout.offset)
+        {
+            layout.count = uint32_t((img->size() - layout.offset) /
+                                    layout.dataBlockSize());
+        }
+        trimDeadBlocks(layout);
+
+        std::vector<Recovery::SavedTrack> saved(layout.numTracks);
+        for (uint32_t i = 0; i < layout.numTracks; ++i)
+        {
+            auto fn = std::format("{}/{}.audio(0).wav", opts.dest, i + 1);
+            if (!std::filesystem::exists(fn))
+            {
+                GINFO("Track " << std::dec << i + 1
+                               << ": not saved, carving all of it");
+                continue;
+            }
+            saved[i].fn = fn;
+            if (!Recovery::confirmSaved(*img, layout, i, opts.maxBitErrors,
+                                        saved[i]))
+            {
+                return 2;
+            }
+            GINFO("Track " << std::dec << i + 1 << ": " << saved[i].confirmed
+                           << " of " << saved[i].size
+                           << " saved bytes confirmed in the image");
+            if (saved[i].bitErrors)
+            {
+                GINFO("  with " << std::dec << saved[i].bitErrors
+                                << " bit errors");
+            }
+        }
+
+        auto spliced =
+            Recovery::spliceTracks(*img, layout, saved, ".", occupancy.get());
+        if (spliced.empty())
+        {
+            return 6;
+        }
+        uint64_t reused = 0;
+        uint64_t carved = 0;
+        for (auto& track : spliced)
+        {
+            reused += track.reused;
+            carved += track.carved;
+        }
+        GINFO("Spliced " << std::dec << spliced.size() << " tracks: "
+                         << reused << " bytes reused from the saved files, "
+                         << carved << " carved from the image");
+    }
+    else if (mode == 15)
+    {  // chain the chunks into streams without references or a fixed stride
+
+        if (opts.mapName.empty())
+        {
+            GERROR("Mode 15 writes the streams it finds to the --map");
+            return 1;
+        }
+        auto layout = sessionLayout(opts);
+        Recovery::ReassemblyOptions reassembly;
+        reassembly.offset = layout.offset;
+        reassembly.chunks =
+            uint64_t(layout.count) * layout.numTracks * layout.repition;
+        reassembly.chunkSize = layout.chunkSize;
+        reassembly.window =
+            opts.window ? opts.window : 2 * layout.numTracks * layout.repition;
+        reassembly.maxStreams = layout.numTracks;
+        reassembly.threads = opts.threads;
+
+        auto length = img->size() > layout.offset
+                          ? img->size() - layout.offset
+                          : 0;
+        if (reassembly.chunks)
+        {
+            length = std::min(length, reassembly.chunks * layout.chunkSize);
+        }
+        Recovery::ReassemblyStats stats;
+        std::vector<Recovery::ReassembledStream> streams;
+        {
+            Recovery::Progress progress("Fingerprinting",
+                                        Recovery::metrics().bytesRead, length);
+            streams = Recovery::reassembleChunks(*img, reassembly, stats,
+                                                 occupancy.get());
+        }
+        GINFO("Reassembled " << std::dec << stats.chunks << " chunks: "
+                             << stats.dead << " dead, " << stats.links
+                             << " linked into " << stats.chains
+                             << " chains, " << stats.dropped
+                             << " chunks in no stream");
+
+        // chunk 0 is the WAV header chunk mode 10 leaves out
+        std::vector<Recovery::BlockMapEntry> entries;
+        for (uint32_t s = 0; s < streams.size(); ++s)
+        {
+            auto& chunks = streams[s].chunks;
+            GINFO("Stream " << std::dec << s + 1 << ": " << chunks.size()
+                            << " chunks from " << std::hex
+                            << chunks.front().offset);
+            for (uint32_t i = 0; i < chunks.size(); ++i)
+            {
+                entries.push_back(
+                    {chunks[i].offset, s, i + 1, chunks[i].candidates, 0});
+            }
+        }
+        std::sort(entries.begin(), entries.end(),
+                  [](const Recovery::BlockMapEntry& a,
+                     const Recovery::BlockMapEntry& b) {
+                      return a.offset < b.offset;
+                  });
+
+        Recovery::BlockMapWriter blockMap;
+        if (!blockMap.open(opts.mapName, layout.chunkSize,
+                           uint32_t(streams.size())))
+        {
+            return 6;
+        }
+        for (auto& entry : entries)
+        {
+            blockMap.add(entry.offset, entry.track, entry.chunk,
+                         entry.candidates);
+        }
+        if (!blockMap.close())
+        {
+            return 6;
+        }
+        GINFO("Block map of " << std::dec << streams.size()
+                              << " streams written to " << opts.mapName);
+
+        if (opts.recover)
+        {
+            if (!doRecoverMapped(opts))
+            {
+                return 4;
+            }
         }
     }
 
-    img.close();
+    img.reset();
 
     return 0;
 }
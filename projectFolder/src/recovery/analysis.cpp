@@ -0,0 +1,122 @@
+#include "analysis.h"
+#include "continuity.h"
+#include "flexibity/log.h"
+#include <cstring>
+
+namespace Recovery
+{
+    namespace
+    {
+        // boundaryScore() above this is a discontinuity
+        const double roughScore = 8;
+        // a chunk position is a misalignment when most of its boundaries
+        // are rough and it stands out from the other positions
+        const double misalignedFraction = 0.5;
+    }  // namespace
+
+    ContinuityReport analyzeContinuity(ImageSource& img, const Layout& layout)
+    {
+        ContinuityReport report;
+        report.correctedOffset = layout.offset;
+        report.positions.resize(layout.repition);
+        report.tracks.resize(layout.numTracks);
+        for (auto& track : report.tracks)
+        {
+            track.positions.resize(layout.repition);
+        }
+
+        auto channelBlockSize = layout.channelBlockSize();
+        // tail of the previous Channel Block of every track
+        std::vector<std::vector<char>> tails(
+            layout.numTracks, std::vector<char>(boundaryWindow));
+        std::vector<char> joined(boundaryWindow + 6);
+
+        img.advise(ImageSource::Access::Sequential, layout.offset,
+                   layout.dataBlockSize() * layout.count);
+
+        for (uint32_t block = 0; block < layout.count; ++block)
+        {
+            auto offset = layout.offset + layout.dataBlockSize() * block;
+            auto data = img.read(offset, layout.dataBlockSize());
+            if (data.size() != layout.dataBlockSize())
+            {
+                break;
+            }
+
+            for (uint32_t t = 0; t < layout.numTracks; ++t)
+            {
+                auto& track = report.tracks[t];
+                const char* channelBlock = data.data() + channelBlockSize * t;
+
+                auto score = [&](uint32_t j, const char* buf, size_t pos) {
+                    bool rough = boundaryScore(buf, pos) > roughScore;
+                    ++track.positions[j].total;
+                    track.positions[j].rough += rough;
+                    if (rough)
+                    {
+                        track.flagged.push_back(offset + channelBlockSize * t +
+                                                uint64_t(layout.chunkSize) * j);
+                    }
+                };
+
+                if (block > 0)
+                {
+                    memcpy(joined.data(), tails[t].data(), boundaryWindow);
+                    memcpy(joined.data() + boundaryWindow, channelBlock, 6);
+                    score(0, joined.data(), boundaryWindow);
+                }
+                for (uint32_t j = 1; j < layout.repition; ++j)
+                {
+                    score(j, channelBlock, size_t(layout.chunkSize) * j);
+                }
+
+                memcpy(tails[t].data(),
+                       channelBlock + channelBlockSize - boundaryWindow,
+                       boundaryWindow);
+            }
+        }
+
+        for (auto& track : report.tracks)
+        {
+            for (uint32_t j = 0; j < layout.repition; ++j)
+            {
+                report.positions[j].total += track.positions[j].total;
+                report.positions[j].rough += track.positions[j].rough;
+            }
+        }
+
+        // reading e chunks late puts the next track's first chunk at
+        // position repition - e of every Channel Block
+        uint32_t worst = 0;
+        double worstFraction = 0, otherFraction = 0;
+        for (uint32_t j = 1; j < layout.repition; ++j)
+        {
+            auto fraction = report.positions[j].roughFraction();
+            if (fraction > worstFraction)
+            {
+                otherFraction = worstFraction;
+                worstFraction = fraction;
+                worst = j;
+            }
+            else
+            {
+                otherFraction = std::max(otherFraction, fraction);
+            }
+        }
+
+        if (worst && worstFraction > misalignedFraction &&
+            worstFraction > 2 * otherFraction)
+        {
+            report.misalignment = layout.repition - worst;
+            uint64_t late = uint64_t(layout.chunkSize) * report.misalignment;
+            // stepping forward instead keeps the chunks in order but
+            // starts with the second track
+            report.correctedOffset =
+                layout.offset >= late
+                    ? layout.offset - late
+                    : layout.offset + uint64_t(layout.chunkSize) * worst;
+        }
+
+        return report;
+    }
+}  // namespace Recovery
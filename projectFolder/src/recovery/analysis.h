@@ -0,0 +1,46 @@
+#pragma once
+
+#include "recovery/imageSource.h"
+#include "recovery/layout.h"
+#include <cstdint>
+#include <vector>
+
+namespace Recovery
+{
+    // Boundaries of one chunk position inside the Channel Block:
+    // position 0 is the Channel Block boundary (Data Block to Data Block),
+    // the others are chunk boundaries inside the Channel Block
+    struct BoundaryStats
+    {
+        uint64_t total = 0;
+        uint64_t rough = 0;
+
+        double roughFraction() const
+        {
+            return total ? double(rough) / total : 0;
+        }
+    };
+
+    struct TrackContinuity
+    {
+        std::vector<BoundaryStats> positions;  // `repition` entries
+        std::vector<uint64_t> flagged;  // image offsets of rough boundaries
+    };
+
+    struct ContinuityReport
+    {
+        std::vector<TrackContinuity> tracks;
+        std::vector<BoundaryStats> positions;  // all tracks
+
+        // Chunks every Channel Block is read late by, detected from one
+        // dominating rough chunk position; 0 if none
+        uint32_t misalignment = 0;
+        // `layout.offset` corrected for `misalignment`
+        uint64_t correctedOffset = 0;
+    };
+
+    // Scores the continuity of every track stream the layout produces at
+    // each chunk and Channel Block boundary
+    ContinuityReport analyzeContinuity(ImageSource& img,
+                                       const Layout& layout);
+}  // namespace Recovery
@@ -0,0 +1,66 @@
+#include "asyncWriter.h"
+#include "metrics.h"
+
+namespace Recovery
+{
+    AsyncWriter::AsyncWriter() : worker([this] { run(); }) {}
+
+    AsyncWriter::~AsyncWriter()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m);
+            stopping = true;
+        }
+        cv.notify_all();
+        worker.join();
+    }
+
+    void AsyncWriter::write(std::ostream& out, std::span<const char> data,
+                            std::function<void()> done)
+    {
+        {
+            std::lock_guard<std::mutex> lock(m);
+            jobs.push_back({&out, data, std::move(done)});
+        }
+        cv.notify_all();
+    }
+
+    void AsyncWriter::flush()
+    {
+        std::unique_lock<std::mutex> lock(m);
+        cv.wait(lock, [&] { return jobs.empty() && !busy; });
+    }
+
+    void AsyncWriter::run()
+    {
+        std::unique_lock<std::mutex> lock(m);
+        while (true)
+        {
+            cv.wait(lock, [&] { return stopping || !jobs.empty(); });
+            if (jobs.empty())
+            {
+                return;
+            }
+
+            auto job = std::move(jobs.front());
+            jobs.pop_front();
+            busy = true;
+            lock.unlock();
+
+            {
+                StageTimer timer(metrics().writeTime);
+                job.out->write(job.data.data(), job.data.size());
+            }
+            metrics().writes.add();
+            metrics().bytesWritten.add(job.data.size());
+            if (job.done)
+            {
+                job.done();
+            }
+
+            lock.lock();
+            busy = false;
+            cv.notify_all();
+        }
+    }
+}  // namespace Recovery
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <ostream>
+#include <span>
+#include <thread>
+
+namespace Recovery
+{
+    // Writes queued buffers on a background thread, in queue order
+    class AsyncWriter
+    {
+    public:
+        AsyncWriter();
+        // Writes everything still queued
+        ~AsyncWriter();
+
+        // `data` must stay valid until `done` is called (on the writer
+        // thread) after it has been written
+        void write(std::ostream& out, std::span<const char> data,
+                   std::function<void()> done = {});
+
+        // Waits until the queue is written
+        void flush();
+
+    private:
+        struct Job
+        {
+            std::ostream* out;
+            std::span<const char> data;
+            std::function<void()> done;
+        };
+
+        void run();
+
+        std::mutex m;
+        std::condition_variable cv;
+        std::deque<Job> jobs;
+        bool busy = false;
+        bool stopping = false;
+        std::thread worker;
+    };
+}  // namespace Recovery
@@ -0,0 +1,170 @@
+#include "blockMap.h"
+#include "flexibity/log.h"
+#include "journal.h"
+#include <algorithm>
+#include <cstring>
+
+namespace Recovery
+{
+    namespace
+    {
+        const char fileMagic[8] = {'P', 'S', 'B', 'L', 'K', 'M', 'P', '1'};
+
+        struct FileHeader
+        {
+            char magic[8];
+            uint32_t chunkSize;
+            uint32_t numTracks;
+            uint64_t entries;
+        };
+
+        static_assert(sizeof(FileHeader) % alignof(BlockMapEntry) == 0);
+    }  // namespace
+
+    BlockMapWriter::~BlockMapWriter()
+    {
+        if (out.is_open())
+        {
+            close();
+        }
+    }
+
+    bool BlockMapWriter::open(const std::string& fn, uint32_t chunkSize,
+                              uint32_t numTracks)
+    {
+        this->fn = fn;
+        this->chunkSize = chunkSize;
+        this->numTracks = numTracks;
+        entries = 0;
+
+        out.open(fn, std::ios::binary | std::ios::trunc);
+        FileHeader header = {{}, chunkSize, numTracks, 0};
+        memcpy(header.magic, fileMagic, sizeof(fileMagic));
+        out.write((const char*)&header, sizeof(header));
+        if (!out)
+        {
+            GERROR("Unable to write block map " << fn);
+            return false;
+        }
+        return true;
+    }
+
+    bool BlockMapWriter::resume(const std::string& fn, uint32_t chunkSize,
+                                uint32_t numTracks, uint64_t length)
+    {
+        if (length < sizeof(FileHeader) ||
+            (length - sizeof(FileHeader)) % sizeof(BlockMapEntry))
+        {
+            GERROR("Bad checkpoint of block map " << fn);
+            return false;
+        }
+        this->fn = fn;
+        this->chunkSize = chunkSize;
+        this->numTracks = numTracks;
+        entries = (length - sizeof(FileHeader)) / sizeof(BlockMapEntry);
+        return resumeOutput(out, fn, length);
+    }
+
+    uint64_t BlockMapWriter::flush()
+    {
+        out.flush();
+        return sizeof(FileHeader) + entries * sizeof(BlockMapEntry);
+    }
+
+    void BlockMapWriter::add(uint64_t offset, uint32_t track, uint32_t chunk,
+                             uint32_t candidates, uint32_t bitErrors)
+    {
+        BlockMapEntry entry = {offset, track, chunk, candidates, bitErrors};
+        out.write((const char*)&entry, sizeof(entry));
+        ++entries;
+    }
+
+    bool BlockMapWriter::close()
+    {
+        FileHeader header = {{}, chunkSize, numTracks, entries};
+        memcpy(header.magic, fileMagic, sizeof(fileMagic));
+        out.seekp(0);
+        out.write((const char*)&header, sizeof(header));
+        out.close();
+        if (!out)
+        {
+            GERROR("Unable to write block map " << fn);
+            return false;
+        }
+        return true;
+    }
+
+    bool BlockMap::open(const std::string& fn, const std::string& backend)
+    {
+        file = openImage(fn, backend);
+        if (!file)
+        {
+            return false;
+        }
+
+        // one view of the whole file, kept until the map is closed
+        auto data = file->read(0, file->size());
+        FileHeader header = {};
+        if (data.size() >= sizeof(header))
+        {
+            memcpy(&header, data.data(), sizeof(header));
+        }
+        if (memcmp(header.magic, fileMagic, sizeof(fileMagic)) != 0)
+        {
+            GERROR("Not a block map: " << fn);
+            return false;
+        }
+        if ((data.size() - sizeof(header)) / sizeof(BlockMapEntry) <
+            header.entries)
+        {
+            GERROR("Truncated block map: " << fn);
+            return false;
+        }
+
+        mapChunkSize = header.chunkSize;
+        mapNumTracks = header.numTracks;
+        mapEntries = {(const BlockMapEntry*)(data.data() + sizeof(header)),
+                      size_t(header.entries)};
+        return true;
+    }
+
+    const BlockMapEntry* BlockMap::find(uint64_t offset) const
+    {
+        auto it = std::lower_bound(
+            mapEntries.begin(), mapEntries.end(), offset,
+            [](const BlockMapEntry& e, uint64_t o) { return e.offset < o; });
+        if (it == mapEntries.end() || it->offset != offset)
+        {
+            return nullptr;
+        }
+        return &*it;
+    }
+
+    uint64_t gatherChunks(ImageSource& img, const BlockMap& map,
+                          const ChunkSink& sink)
+    {
+        auto entries = map.entries();
+        if (entries.empty())
+        {
+            return 0;
+        }
+
+        auto first = entries.front().offset;
+        img.advise(ImageSource::Access::Sequential, first,
+                   entries.back().offset + map.chunkSize() - first);
+
+        uint64_t gathered = 0;
+        for (auto& entry : entries)
+        {
+            auto data = img.read(entry.offset, map.chunkSize());
+            if (data.size() != map.chunkSize())
+            {
+                GERROR("Img eof at mapped chunk " << std::hex << entry.offset);
+                break;
+            }
+            sink(entry, data.data(), data.size());
+            ++gathered;
+        }
+        return gathered;
+    }
+}  // namespace Recovery
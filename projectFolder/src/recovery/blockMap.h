@@ -0,0 +1,99 @@
+#pragma once
+
+#include "recovery/imageSource.h"
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <span>
+#include <string>
+
+namespace Recovery
+{
+    // One image chunk found in the references. The file is an array of
+    // these after a small header, in increasing image offset order.
+    struct BlockMapEntry
+    {
+        uint64_t offset;      // in the image
+        uint32_t track;       // 0-based
+        uint32_t chunk;       // chunk number inside the reference file
+        uint32_t candidates;  // reference locations it matched, 1 is certain
+        uint32_t bitErrors;   // bits that differ from the reference
+    };
+
+    static_assert(sizeof(BlockMapEntry) == 24);
+
+    // Appends the results of a mapping run to a block map file
+    class BlockMapWriter
+    {
+    public:
+        ~BlockMapWriter();
+
+        bool open(const std::string& fn, uint32_t chunkSize,
+                  uint32_t numTracks);
+
+        // Continues the map of an interrupted run from its checkpoint,
+        // `length` bytes as flush() returned them
+        bool resume(const std::string& fn, uint32_t chunkSize,
+                    uint32_t numTracks, uint64_t length);
+
+        // Entries must come in increasing image offset order
+        void add(uint64_t offset, uint32_t track, uint32_t chunk,
+                 uint32_t candidates = 1, uint32_t bitErrors = 0);
+
+        // Puts the entries added so far on disk for a checkpoint. Returns
+        // the length of the map that holds them.
+        uint64_t flush();
+
+        // Writes the entry count into the header, also done on destruction
+        // so a mapping run that ends early still leaves a usable map
+        bool close();
+
+    private:
+        std::ofstream out;
+        std::string fn;
+        uint32_t chunkSize = 0;
+        uint32_t numTracks = 0;
+        uint64_t entries = 0;
+    };
+
+    // Block map file opened with an image backend: with mmap the entries
+    // are used in place, no matter how large the map is
+    class BlockMap
+    {
+    public:
+        bool open(const std::string& fn, const std::string& backend);
+
+        uint32_t chunkSize() const
+        {
+            return mapChunkSize;
+        }
+        uint32_t numTracks() const
+        {
+            return mapNumTracks;
+        }
+        std::span<const BlockMapEntry> entries() const
+        {
+            return mapEntries;
+        }
+
+        // Entry of the chunk at image `offset`, nullptr if none was mapped
+        const BlockMapEntry* find(uint64_t offset) const;
+
+    private:
+        std::unique_ptr<ImageSource> file;
+        uint32_t mapChunkSize = 0;
+        uint32_t mapNumTracks = 0;
+        std::span<const BlockMapEntry> mapEntries;
+    };
+
+    // Receives every mapped chunk read back from the image
+    using ChunkSink = std::function<void(const BlockMapEntry& entry,
+                                         const char* data, size_t size)>;
+
+    // Reads the mapped chunks of the image in map order, a forward only
+    // gather. Returns the number of chunks read, stops early at the end of
+    // the image.
+    uint64_t gatherChunks(ImageSource& img, const BlockMap& map,
+                          const ChunkSink& sink);
+}  // namespace Recovery
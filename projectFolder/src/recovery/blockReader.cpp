@@ -0,0 +1,569 @@
+#include "blockReader.h"
+#include "flexibity/log.h"
+#include "imageSource.h"
+#include "metrics.h"
+#include <algorithm>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#ifdef LINUX
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <cerrno>
+#endif
+
+namespace Recovery
+{
+    namespace
+    {
+        // O_DIRECT wants offset, size and buffer aligned to the logical
+        // block size, 4K covers every device we read
+        const uint64_t ioAlign = 4096;
+
+        struct AlignedBuffer
+        {
+            explicit AlignedBuffer(size_t size)
+                : data((char*)std::aligned_alloc(
+                      ioAlign, (size + ioAlign - 1) / ioAlign * ioAlign))
+            {
+            }
+            ~AlignedBuffer()
+            {
+                std::free(data);
+            }
+            AlignedBuffer(const AlignedBuffer&) = delete;
+            AlignedBuffer& operator=(const AlignedBuffer&) = delete;
+
+            char* data;
+        };
+
+        // Ring of `depth` buffers filled by a worker thread in range order
+        // and consumed by acquire()/release() in the same order
+        class PrefetchReader : public BlockReader
+        {
+        public:
+            PrefetchReader(const BlockRanges& ranges, uint32_t depth,
+                           uint64_t bufferSize)
+                : ranges(ranges)
+            {
+                depth = std::max(1u, depth);
+                for (uint32_t i = 0; i < depth; ++i)
+                {
+                    slots.push_back(std::make_unique<AlignedBuffer>(bufferSize));
+                    views.emplace_back();
+                }
+            }
+
+            std::span<const char> acquire() override
+            {
+                std::unique_lock<std::mutex> lock(m);
+                cv.wait(lock, [&] { return ready > acquired || finished; });
+                if (ready == acquired)
+                {
+                    return {};
+                }
+                return views[acquired++ % slots.size()];
+            }
+
+            void release() override
+            {
+                {
+                    std::lock_guard<std::mutex> lock(m);
+                    ++released;
+                }
+                cv.notify_all();
+            }
+
+        protected:
+            void start()
+            {
+                worker = std::thread([this] {
+                    run();
+                    std::lock_guard<std::mutex> lock(m);
+                    finished = true;
+                    cv.notify_all();
+                });
+            }
+
+            // Derived destructors call it before their resources go away
+            void stop()
+            {
+                {
+                    std::lock_guard<std::mutex> lock(m);
+                    stopping = true;
+                }
+                cv.notify_all();
+                if (worker.joinable())
+                {
+                    worker.join();
+                }
+            }
+
+            virtual void run() = 0;
+
+            char* buffer(uint32_t range)
+            {
+                return slots[range % slots.size()]->data;
+            }
+
+            // Can `range` be read into its buffer without waiting?
+            bool slotFree(uint32_t range)
+            {
+                std::lock_guard<std::mutex> lock(m);
+                return range - released < slots.size();
+            }
+
+            // Waits until `range` may be read, false when stopping
+            bool waitSlot(uint32_t range)
+            {
+                std::unique_lock<std::mutex> lock(m);
+                cv.wait(lock, [&] {
+                    return stopping || range - released < slots.size();
+                });
+                return !stopping;
+            }
+
+            bool isStopping()
+            {
+                std::lock_guard<std::mutex> lock(m);
+                return stopping;
+            }
+
+            // Makes the next range available to acquire()
+            void publish(std::span<const char> view)
+            {
+                {
+                    std::lock_guard<std::mutex> lock(m);
+                    views[ready % slots.size()] = view;
+                    ++ready;
+                }
+                cv.notify_all();
+            }
+
+            BlockRanges ranges;
+
+        private:
+            std::vector<std::unique_ptr<AlignedBuffer>> slots;
+            std::vector<std::span<const char>> views;
+
+            std::mutex m;
+            std::condition_variable cv;
+            uint32_t ready = 0;
+            uint32_t acquired = 0;
+            uint32_t released = 0;
+            bool finished = false;
+            bool stopping = false;
+            std::thread worker;
+        };
+
+        // Blocking reads through any ImageSource on a worker thread
+        class ThreadReader : public PrefetchReader
+        {
+        public:
+            ThreadReader(std::unique_ptr<ImageSource> img,
+                         const BlockRanges& ranges, uint32_t depth)
+                : PrefetchReader(ranges, depth, ranges.size),
+                  img(std::move(img))
+            {
+                start();
+            }
+
+            ~ThreadReader() override
+            {
+                stop();
+            }
+
+        protected:
+            void run() override
+            {
+                for (uint32_t k = 0; k < ranges.count; ++k)
+                {
+                    if (!waitSlot(k))
+                    {
+                        return;
+                    }
+                    auto data = img->read(ranges.offset + ranges.stride * k,
+                                          ranges.size);
+                    memcpy(buffer(k), data.data(), data.size());
+                    publish({buffer(k), data.size()});
+                    if (data.size() != ranges.size)
+                    {
+                        return;
+                    }
+                }
+            }
+
+        private:
+            std::unique_ptr<ImageSource> img;
+        };
+
+#ifdef LINUX
+        // Minimal io_uring without liburing: `depth` reads in flight
+        class UringReader : public PrefetchReader
+        {
+        public:
+            UringReader(const BlockRanges& ranges, uint32_t depth, bool direct)
+                : PrefetchReader(ranges, depth,
+                                 ranges.size + (direct ? 2 * ioAlign : 0)),
+                  depth(std::max(1u, depth)),
+                  direct(direct)
+            {
+            }
+
+            ~UringReader() override
+            {
+                stop();
+                if (sqPtr)
+                {
+                    munmap(sqPtr, sqLen);
+                }
+                if (cqPtr && cqPtr != sqPtr)
+                {
+                    munmap(cqPtr, cqLen);
+                }
+                if (sqes)
+                {
+                    munmap(sqes, sqesLen);
+                }
+                if (ringFd >= 0)
+                {
+                    close(ringFd);
+                }
+                if (fd >= 0)
+                {
+                    close(fd);
+                }
+            }
+
+            bool open(const std::string& imgName)
+            {
+                fd = ::open(imgName.c_str(), O_RDONLY | (direct ? O_DIRECT : 0));
+                if (fd < 0)
+                {
+                    GERROR("Unable to open image " << imgName << ": "
+                                                   << strerror(errno));
+                    return false;
+                }
+                if (!setupRing())
+                {
+                    return false;
+                }
+                start();
+                return true;
+            }
+
+        protected:
+            void run() override
+            {
+                std::vector<int> results(depth);
+                std::vector<bool> done(depth, false);
+                uint32_t submitted = 0;
+                uint32_t published = 0;
+                uint32_t inflight = 0;
+                unsigned toSubmit = 0;
+
+                while (published < ranges.count)
+                {
+                    while (submitted < ranges.count && slotFree(submitted))
+                    {
+                        queueRead(submitted++);
+                        ++inflight;
+                        ++toSubmit;
+                    }
+
+                    if (inflight == 0)
+                    {
+                        if (!waitSlot(submitted))
+                        {
+                            return;
+                        }
+                        continue;
+                    }
+
+                    if (!enter(toSubmit, 1))
+                    {
+                        drain(inflight);
+                        return;
+                    }
+                    toSubmit = 0;
+
+                    reap([&](uint32_t range, int res) {
+                        results[range % depth] = res;
+                        done[range % depth] = true;
+                        --inflight;
+                    });
+
+                    while (published < submitted && done[published % depth])
+                    {
+                        done[published % depth] = false;
+                        auto view = complete(published,
+                                             results[published % depth]);
+                        publish(view);
+                        ++published;
+                        if (view.size() != ranges.size)
+                        {
+                            drain(inflight);
+                            return;
+                        }
+                    }
+
+                    if (isStopping())
+                    {
+                        drain(inflight);
+                        return;
+                    }
+                }
+            }
+
+        private:
+            uint64_t alignedOffset(uint32_t range) const
+            {
+                auto offset = ranges.offset + ranges.stride * range;
+                return direct ? offset & ~(ioAlign - 1) : offset;
+            }
+
+            uint64_t alignedLength(uint32_t range) const
+            {
+                auto head = ranges.offset + ranges.stride * range -
+                            alignedOffset(range);
+                auto length = head + ranges.size;
+                return direct ? (length + ioAlign - 1) & ~(ioAlign - 1)
+                              : length;
+            }
+
+            bool setupRing()
+            {
+                io_uring_params p = {};
+                ringFd = syscall(__NR_io_uring_setup, depth, &p);
+                if (ringFd < 0)
+                {
+                    GDEBUG("io_uring_setup failed: " << strerror(errno));
+                    return false;
+                }
+
+                sqLen = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+                cqLen = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+                if (p.features & IORING_FEAT_SINGLE_MMAP)
+                {
+                    sqLen = cqLen = std::max(sqLen, cqLen);
+                }
+
+                sqPtr = mmap(nullptr, sqLen, PROT_READ | PROT_WRITE,
+                             MAP_SHARED | MAP_POPULATE, ringFd,
+                             IORING_OFF_SQ_RING);
+                if (sqPtr == MAP_FAILED)
+                {
+                    sqPtr = nullptr;
+                    return false;
+                }
+                if (p.features & IORING_FEAT_SINGLE_MMAP)
+                {
+                    cqPtr = sqPtr;
+                }
+                else
+                {
+                    cqPtr = mmap(nullptr, cqLen, PROT_READ | PROT_WRITE,
+                                 MAP_SHARED | MAP_POPULATE, ringFd,
+                                 IORING_OFF_CQ_RING);
+                    if (cqPtr == MAP_FAILED)
+                    {
+                        cqPtr = nullptr;
+                        return false;
+                    }
+                }
+                sqesLen = p.sq_entries * sizeof(io_uring_sqe);
+                auto sqesPtr = mmap(nullptr, sqesLen, PROT_READ | PROT_WRITE,
+                                    MAP_SHARED | MAP_POPULATE, ringFd,
+                                    IORING_OFF_SQES);
+                if (sqesPtr == MAP_FAILED)
+                {
+                    return false;
+                }
+                sqes = (io_uring_sqe*)sqesPtr;
+
+                auto sq = (char*)sqPtr;
+                sqTail = (unsigned*)(sq + p.sq_off.tail);
+                sqMask = *(unsigned*)(sq + p.sq_off.ring_mask);
+                sqArray = (unsigned*)(sq + p.sq_off.array);
+                auto cq = (char*)cqPtr;
+                cqHead = (unsigned*)(cq + p.cq_off.head);
+                cqTail = (unsigned*)(cq + p.cq_off.tail);
+                cqMask = *(unsigned*)(cq + p.cq_off.ring_mask);
+                cqes = (io_uring_cqe*)(cq + p.cq_off.cqes);
+                return true;
+            }
+
+            void queueRead(uint32_t range)
+            {
+                auto tail = *sqTail;
+                auto index = tail & sqMask;
+                auto& sqe = sqes[index];
+                memset(&sqe, 0, sizeof(sqe));
+                sqe.opcode = IORING_OP_READ;
+                sqe.fd = fd;
+                sqe.off = alignedOffset(range);
+                sqe.addr = (uint64_t)buffer(range);
+                sqe.len = alignedLength(range);
+                sqe.user_data = range;
+                queued[range % depth] = std::chrono::steady_clock::now();
+                sqArray[index] = index;
+                __atomic_store_n(sqTail, tail + 1, __ATOMIC_RELEASE);
+            }
+
+            bool enter(unsigned toSubmit, unsigned minComplete)
+            {
+                while (syscall(__NR_io_uring_enter, ringFd, toSubmit,
+                               minComplete, IORING_ENTER_GETEVENTS, nullptr,
+                               0) < 0)
+                {
+                    if (errno != EINTR)
+                    {
+                        GERROR("io_uring_enter failed: " << strerror(errno));
+                        return false;
+                    }
+                    toSubmit = 0;
+                }
+                return true;
+            }
+
+            template <typename F>
+            void reap(F&& onComplete)
+            {
+                auto head = *cqHead;
+                while (head != __atomic_load_n(cqTail, __ATOMIC_ACQUIRE))
+                {
+                    auto& cqe = cqes[head & cqMask];
+                    onComplete(uint32_t(cqe.user_data), cqe.res);
+                    ++head;
+                }
+                __atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+            }
+
+            // buffers can't go away with reads still in flight
+            void drain(uint32_t inflight)
+            {
+                while (inflight && enter(0, 1))
+                {
+                    reap([&](uint32_t, int) { --inflight; });
+                }
+            }
+
+            // View of a completed read, finishing short or unsupported
+            // reads with pread
+            std::span<const char> complete(uint32_t range, int res)
+            {
+                auto offset = alignedOffset(range);
+                auto length = alignedLength(range);
+                auto head = ranges.offset + ranges.stride * range - offset;
+
+                if (res == -EINVAL || res == -EOPNOTSUPP)
+                {
+                    // IORING_OP_READ needs Linux 5.6
+                    res = 0;
+                }
+                if (res < 0)
+                {
+                    GERROR("Image read at " << std::hex << offset
+                                            << " failed: " << strerror(-res));
+                    return {};
+                }
+
+                uint64_t got = res;
+                while (got < length)
+                {
+                    auto n = pread(fd, buffer(range) + got, length - got,
+                                   offset + got);
+                    if (n <= 0)
+                    {
+                        break;
+                    }
+                    got += n;
+                }
+
+                metrics().reads.add();
+                metrics().bytesRead.add(got);
+                if (range > 0 && ranges.stride != ranges.size)
+                {
+                    metrics().seeks.add();
+                }
+                metrics().readTime.record(std::chrono::steady_clock::now() -
+                                          queued[range % depth]);
+
+                if (got <= head)
+                {
+                    return {};
+                }
+                return {buffer(range) + head,
+                        size_t(std::min<uint64_t>(got - head, ranges.size))};
+            }
+
+            uint32_t depth;
+            bool direct;
+            // when every slot's read was queued
+            std::vector<std::chrono::steady_clock::time_point> queued =
+                std::vector<std::chrono::steady_clock::time_point>(depth);
+            int fd = -1;
+            int ringFd = -1;
+
+            void* sqPtr = nullptr;
+            size_t sqLen = 0;
+            void* cqPtr = nullptr;
+            size_t cqLen = 0;
+            io_uring_sqe* sqes = nullptr;
+            size_t sqesLen = 0;
+
+            unsigned* sqTail = nullptr;
+            unsigned sqMask = 0;
+            unsigned* sqArray = nullptr;
+            unsigned* cqHead = nullptr;
+            unsigned* cqTail = nullptr;
+            unsigned cqMask = 0;
+            io_uring_cqe* cqes = nullptr;
+        };
+#endif
+    }  // namespace
+
+    std::unique_ptr<BlockReader> openBlockReader(const ImageSpec& image,
+                                                 const std::string& backend,
+                                                 const BlockRanges& ranges,
+                                                 const PipelineOptions& opts)
+    {
+        auto img = openImage(image, backend);
+        if (!img)
+        {
+            return nullptr;
+        }
+
+#ifdef LINUX
+        if ((opts.io == "auto" || opts.io == "uring") && img->isPlainFile())
+        {
+            auto reader =
+                std::make_unique<UringReader>(ranges, opts.depth, opts.direct);
+            if (reader->open(image.parts.front()))
+            {
+                GINFO("Reading image with io_uring, depth "
+                      << std::dec << opts.depth
+                      << (opts.direct ? ", O_DIRECT" : ""));
+                return reader;
+            }
+        }
+#endif
+        if (opts.io == "uring")
+        {
+            GINFO("io_uring is not available for " << image.parts.front()
+                                                   << ", using a thread");
+        }
+
+        GINFO("Reading image with a prefetch thread, depth " << std::dec
+                                                             << opts.depth);
+        return std::make_unique<ThreadReader>(std::move(img), ranges,
+                                              opts.depth);
+    }
+}  // namespace Recovery
@@ -0,0 +1,51 @@
+#pragma once
+
+#include "recovery/imageSource.h"
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <string>
+
+namespace Recovery
+{
+    struct PipelineOptions
+    {
+        std::string io = "auto";  // auto, uring, thread
+        uint32_t depth = 4;       // ranges read ahead of the consumer
+        bool direct = false;      // O_DIRECT image reads (uring only)
+    };
+
+    // `count` ranges of `size` bytes, `stride` apart, from `offset`
+    struct BlockRanges
+    {
+        uint64_t offset;
+        uint64_t stride;
+        uint64_t size;
+        uint32_t count;
+    };
+
+    // Reads a known sequence of ranges ahead of the consumer, so reading
+    // overlaps with whatever is done with the data
+    class BlockReader
+    {
+    public:
+        virtual ~BlockReader() = default;
+
+        // Waits for the next range. The view is shorter at the end of the
+        // image, empty after the last range or a failed read, and valid
+        // until it is released.
+        virtual std::span<const char> acquire() = 0;
+
+        // Hands the oldest acquired range back for reuse.
+        // May be called from any thread.
+        virtual void release() = 0;
+    };
+
+    // io_uring reader for plain image files on Linux, otherwise a thread
+    // prefetching through openImage(). Returns nullptr if the image can't
+    // be opened.
+    std::unique_ptr<BlockReader> openBlockReader(const ImageSpec& image,
+                                                 const std::string& backend,
+                                                 const BlockRanges& ranges,
+                                                 const PipelineOptions& opts);
+}  // namespace Recovery
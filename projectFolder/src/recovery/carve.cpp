@@ -0,0 +1,109 @@
+#include "carve.h"
+#include "flexibity/log.h"
+#include "metrics.h"
+#include "parallel.h"
+#include "stream.h"
+#include "wav.h"
+#include <filesystem>
+#include <format>
+#include <fstream>
+
+namespace Recovery
+{
+    size_t IoScheduler::read(uint64_t offset, size_t size,
+                             std::vector<char>& buffer)
+    {
+        std::unique_lock<std::mutex> guard(lock);
+        auto request = pending.insert(offset);
+        due.wait(guard, [&] {
+            if (busy)
+            {
+                return false;
+            }
+            auto next = pending.lower_bound(head);
+            return (next == pending.end() ? pending.begin() : next) == request;
+        });
+        pending.erase(request);
+        busy = true;
+        guard.unlock();
+
+        // copied while it is the only read, so the device (or the page
+        // faults of a mapping) follows the schedule
+        auto data = img.read(offset, size);
+        buffer.assign(data.begin(), data.end());
+
+        guard.lock();
+        busy = false;
+        head = offset + data.size();
+        guard.unlock();
+        due.notify_all();
+        return buffer.size();
+    }
+
+    std::span<const char> ScheduledImageSource::read(uint64_t offset,
+                                                     size_t size)
+    {
+        auto got = io.read(offset, size, buffer);
+        return {buffer.data(), got};
+    }
+
+    std::vector<CarvedSession> carveSessions(
+        ImageSource& img, const std::vector<DetectedSession>& sessions,
+        const std::string& dest, unsigned threads,
+        const OccupancyMap* occupancy)
+    {
+        IoScheduler io(img);
+        std::vector<CarvedSession> carved(sessions.size());
+
+        runWorkers(threads, sessions.size(), [&](uint64_t i) {
+            auto& session = sessions[i];
+            auto& layout = session.layout;
+            auto& result = carved[i];
+            result.session = session;
+            result.dir = std::format("{}/Session {}", dest, i + 1);
+            result.blocks = 0;
+
+            std::filesystem::create_directories(result.dir);
+            WavFormat format;
+            format.sampleRate = session.sampleRate;
+            format.bitsPerSample = session.bitsPerSample;
+
+            std::vector<std::ofstream> outs(layout.numTracks);
+            for (uint32_t t = 0; t < layout.numTracks; ++t)
+            {
+                auto fn = std::format("{}/Recover {}.wav", result.dir, t + 1);
+                outs[t].open(fn, std::ios::binary);
+                if (!outs[t])
+                {
+                    GERROR("Unable to open target file " << fn);
+                    return;
+                }
+                writeWavHeader(outs[t], format);
+            }
+
+            ScheduledImageSource src(io);
+            result.blocks = streamTracks(
+                src, layout,
+                [&](uint32_t track, uint32_t, std::span<const char> audio) {
+                    {
+                        StageTimer timer(metrics().writeTime);
+                        outs[track].write(audio.data(), audio.size());
+                    }
+                    metrics().writes.add();
+                    metrics().bytesWritten.add(audio.size());
+                },
+                {{}, occupancy});
+
+            for (auto& out : outs)
+            {
+                finalizeWav(out, format);
+            }
+            GINFO("Session " << std::dec << i + 1 << " at " << std::hex
+                  << session.headerOffset << ": " << std::dec << result.blocks
+                  << " of " << layout.count << " Data Blocks of "
+                  << layout.numTracks << " tracks into " << result.dir);
+        });
+
+        return carved;
+    }
+}  // namespace Recovery
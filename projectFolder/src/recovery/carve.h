@@ -0,0 +1,78 @@
+#pragma once
+
+#include "recovery/detect.h"
+#include "recovery/imageSource.h"
+#include "recovery/occupancy.h"
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+
+namespace Recovery
+{
+    // Shares one image between several workers: reads go to the device one
+    // at a time, the pending one with the lowest offset past the last read
+    // first, wrapping around at the end. The device sees one forward sweep
+    // instead of a seek between every worker's stream.
+    class IoScheduler
+    {
+    public:
+        explicit IoScheduler(ImageSource& img) : img(img)
+        {
+        }
+
+        uint64_t size() const
+        {
+            return img.size();
+        }
+
+        // Copies up to `size` bytes at `offset` into `buffer` once the
+        // request is due. Returns the number of bytes read.
+        size_t read(uint64_t offset, size_t size, std::vector<char>& buffer);
+
+    private:
+        ImageSource& img;
+        std::mutex lock;
+        std::condition_variable due;
+        std::multiset<uint64_t> pending;
+        bool busy = false;
+        uint64_t head = 0;  // end of the last read
+    };
+
+    // A worker's view of a scheduled image, read() returns its own copy
+    class ScheduledImageSource : public ImageSource
+    {
+    public:
+        explicit ScheduledImageSource(IoScheduler& io) : io(io)
+        {
+        }
+
+        uint64_t size() const override
+        {
+            return io.size();
+        }
+        std::span<const char> read(uint64_t offset, size_t size) override;
+
+    private:
+        IoScheduler& io;
+        std::vector<char> buffer;
+    };
+
+    struct CarvedSession
+    {
+        DetectedSession session;
+        std::string dir;  // `Recover N.wav` of every track
+        uint32_t blocks;  // Data Blocks recovered
+    };
+
+    // Recovers every session into its own folder `dest/Session N` on
+    // `threads` workers (0 picks the number of cores), all reading through
+    // one IoScheduler. Channel Blocks `occupancy` knows are dead are
+    // rebuilt from their fill byte.
+    std::vector<CarvedSession> carveSessions(
+        ImageSource& img, const std::vector<DetectedSession>& sessions,
+        const std::string& dest, unsigned threads,
+        const OccupancyMap* occupancy = nullptr);
+}  // namespace Recovery
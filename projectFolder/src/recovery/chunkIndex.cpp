@@ -0,0 +1,173 @@
+#include "chunkIndex.h"
+#include "flexibity/log.h"
+#include "metrics.h"
+#include "occupancy.h"
+#include <algorithm>
+#include <cstring>
+#include <format>
+
+namespace Recovery
+{
+    namespace
+    {
+        const uint64_t prime1 = 0x9E3779B185EBCA87ull;
+        const uint64_t prime2 = 0xC2B2AE3D27D4EB4Full;
+        const uint64_t prime3 = 0x165667B19E3779F9ull;
+        const uint64_t prime4 = 0x85EBCA77C2B2AE63ull;
+        const uint64_t prime5 = 0x27D4EB2F165667C5ull;
+
+        inline uint64_t rotl(uint64_t x, int r)
+        {
+            return (x << r) | (x >> (64 - r));
+        }
+
+        inline uint64_t load64(const char* p)
+        {
+            uint64_t v;
+            memcpy(&v, p, sizeof(v));
+            return v;
+        }
+
+        inline uint64_t round(uint64_t acc, uint64_t input)
+        {
+            acc += input * prime2;
+            return rotl(acc, 31) * prime1;
+        }
+
+        inline uint64_t merge(uint64_t acc, uint64_t lane)
+        {
+            acc ^= round(0, lane);
+            return acc * prime1 + prime4;
+        }
+    }  // namespace
+
+    uint64_t hashChunk(const char* data, size_t size)
+    {
+        const char* p = data;
+        const char* end = data + size;
+        uint64_t h;
+
+        if (size >= 32)
+        {
+            // four independent lanes keep the multipliers busy
+            uint64_t v1 = prime1 + prime2;
+            uint64_t v2 = prime2;
+            uint64_t v3 = 0;
+            uint64_t v4 = 0 - prime1;
+            for (; p + 32 <= end; p += 32)
+            {
+                v1 = round(v1, load64(p));
+                v2 = round(v2, load64(p + 8));
+                v3 = round(v3, load64(p + 16));
+                v4 = round(v4, load64(p + 24));
+            }
+            h = rotl(v1, 1) + rotl(v2, 7) + rotl(v3, 12) + rotl(v4, 18);
+            h = merge(h, v1);
+            h = merge(h, v2);
+            h = merge(h, v3);
+            h = merge(h, v4);
+        }
+        else
+        {
+            h = prime5;
+        }
+
+        h += size;
+        for (; p + 8 <= end; p += 8)
+        {
+            h ^= round(0, load64(p));
+            h = rotl(h, 27) * prime1 + prime4;
+        }
+        for (; p < end; ++p)
+        {
+            h ^= uint8_t(*p) * prime5;
+            h = rotl(h, 11) * prime1;
+        }
+
+        h ^= h >> 33;
+        h *= prime2;
+        h ^= h >> 29;
+        h *= prime3;
+        h ^= h >> 32;
+        return h;
+    }
+
+    bool ChunkIndex::build(const std::string& dest, uint32_t numTracks,
+                           uint32_t chunkSize, const std::string& backend)
+    {
+        this->chunkSize = chunkSize;
+        uniformChunks = false;
+        entries.clear();
+        refs.clear();
+        chunksPerTrack.assign(numTracks, 0);
+
+        for (uint32_t i = 0; i < numTracks; ++i)
+        {
+            auto fn = std::format("{}/{}.audio(0).wav", dest, i + 1);
+            auto ref = openImage(fn, backend);
+            if (!ref)
+            {
+                GERROR("Unable to open target file " << fn);
+                return false;
+            }
+
+            // a trailing partial chunk can't be matched against the image
+            uint32_t chunks = ref->size() / chunkSize;
+            ref->advise(ImageSource::Access::Sequential, 0, ref->size());
+            for (uint32_t c = 0; c < chunks; ++c)
+            {
+                auto data = ref->read(uint64_t(c) * chunkSize, chunkSize);
+                entries.push_back(
+                    {hashChunk(data.data(), data.size()), {i, c}});
+                uniformChunks |= nearlyUniform(data.data(), data.size(), 0);
+            }
+            ref->advise(ImageSource::Access::Random, 0, ref->size());
+
+            GINFO("Track " << i + 1 << ": indexed " << std::dec << chunks
+                           << " chunks of " << fn);
+            chunksPerTrack[i] = chunks;
+            refs.push_back(std::move(ref));
+        }
+
+        std::sort(entries.begin(), entries.end());
+        return true;
+    }
+
+    size_t ChunkIndex::find(std::span<const char> chunk,
+                            std::vector<ChunkLocation>& matches) const
+    {
+        matches.clear();
+        if (chunk.size() != chunkSize)
+        {
+            return 0;
+        }
+
+        StageTimer timer(metrics().matchTime);
+        metrics().matchAttempts.add();
+
+        Entry key = {hashChunk(chunk.data(), chunk.size()), {}};
+        auto range = std::equal_range(entries.begin(), entries.end(), key);
+        for (auto it = range.first; it != range.second; ++it)
+        {
+            auto& loc = it->location;
+            auto& src = *refs[loc.track];
+
+            std::unique_lock<std::mutex> lock(refLock, std::defer_lock);
+            if (!src.concurrentReads())
+            {
+                lock.lock();
+            }
+
+            auto ref = src.read(uint64_t(loc.chunk) * chunkSize, chunkSize);
+            if (memcmp(ref.data(), chunk.data(), chunkSize) == 0)
+            {
+                matches.push_back(loc);
+            }
+        }
+        if (!matches.empty())
+        {
+            metrics().matches.add();
+        }
+        return matches.size();
+    }
+}  // namespace Recovery
@@ -0,0 +1,76 @@
+#pragma once
+
+#include "recovery/imageSource.h"
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <string>
+#include <vector>
+
+namespace Recovery
+{
+    // 64 bit non-cryptographic hash of a chunk (xxh64 style, 4 lanes)
+    uint64_t hashChunk(const char* data, size_t size);
+
+    struct ChunkLocation
+    {
+        uint32_t track;  // 0-based
+        uint32_t chunk;  // chunk number inside the reference file
+    };
+
+    // Hash index of every chunk of the reference tracks
+    // `N.audio(0).wav` saved in the destination folder. A hash hit is
+    // confirmed with memcmp against the reference file, so collisions can't
+    // produce false matches.
+    class ChunkIndex
+    {
+    public:
+        bool build(const std::string& dest, uint32_t numTracks,
+                   uint32_t chunkSize, const std::string& backend);
+
+        // Fills `matches` with every reference chunk equal to `chunk`
+        // (digital silence is usually found in many places).
+        // Returns the number of matches. Safe to call from several threads.
+        size_t find(std::span<const char> chunk,
+                    std::vector<ChunkLocation>& matches) const;
+
+        size_t size() const
+        {
+            return entries.size();
+        }
+
+        uint32_t trackChunks(uint32_t track) const
+        {
+            return chunksPerTrack[track];
+        }
+
+        // Whether a chunk of one byte value throughout is indexed, which an
+        // erased or uniform image chunk may be equal to
+        bool holdsUniformChunks() const
+        {
+            return uniformChunks;
+        }
+
+    private:
+        struct Entry
+        {
+            uint64_t hash;
+            ChunkLocation location;
+
+            bool operator<(const Entry& other) const
+            {
+                return hash < other.hash;
+            }
+        };
+
+        uint32_t chunkSize = 0;
+        bool uniformChunks = false;
+        std::vector<Entry> entries;  // sorted by hash
+        std::vector<uint32_t> chunksPerTrack;
+        std::vector<std::unique_ptr<ImageSource>> refs;
+        // serializes reference reads for backends that share a buffer
+        mutable std::mutex refLock;
+    };
+}  // namespace Recovery
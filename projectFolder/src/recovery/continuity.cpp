@@ -0,0 +1,164 @@
+#include "continuity.h"
+#include <algorithm>
+#include <cstdlib>
+
+#if defined(__AVX2__) || defined(__SSSE3__)
+#include <immintrin.h>
+#endif
+
+namespace Recovery
+{
+    namespace
+    {
+        // samples decoded at once by roughness()
+        const size_t batch = 64;
+
+        uint64_t roughness(const char* data, size_t size, unsigned phase)
+        {
+            if (size < phase + 9)
+            {
+                return 0;
+            }
+
+            int32_t samples[batch];
+            uint64_t sum = 0;
+            size_t count = (size - phase) / 3;
+            const char* p = data + phase;
+
+            // consecutive batches overlap by the two samples a second
+            // difference looks back
+            for (size_t i = 0; i + 2 < count; i += batch - 2)
+            {
+                auto n = std::min(batch, count - i);
+                decode24(p + 3 * i, n, samples);
+                sum += secondDiffSum(samples, n);
+            }
+            return sum;
+        }
+    }  // namespace
+
+    void decode24(const char* data, size_t count, int32_t* out)
+    {
+        size_t i = 0;
+
+#if defined(__SSSE3__) || defined(__AVX2__)
+        // bytes of 4 samples into the top 3 bytes of 4 int32 lanes,
+        // the arithmetic shift sign extends
+        const auto spread = _mm_setr_epi8(-1, 0, 1, 2, -1, 3, 4, 5, -1, 6, 7,
+                                          8, -1, 9, 10, 11);
+#endif
+#if defined(__AVX2__)
+        const auto spread2 = _mm256_broadcastsi128_si256(spread);
+        // loads read 4 bytes past the 8 samples
+        for (; i + 10 <= count; i += 8)
+        {
+            auto lo = _mm_loadu_si128((const __m128i*)(data + 3 * i));
+            auto hi = _mm_loadu_si128((const __m128i*)(data + 3 * i + 12));
+            auto v = _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1);
+            v = _mm256_srai_epi32(_mm256_shuffle_epi8(v, spread2), 8);
+            _mm256_storeu_si256((__m256i*)(out + i), v);
+        }
+#endif
+#if defined(__SSSE3__) || defined(__AVX2__)
+        for (; i + 6 <= count; i += 4)
+        {
+            auto v = _mm_loadu_si128((const __m128i*)(data + 3 * i));
+            v = _mm_srai_epi32(_mm_shuffle_epi8(v, spread), 8);
+            _mm_storeu_si128((__m128i*)(out + i), v);
+        }
+#endif
+        for (; i < count; ++i)
+        {
+            out[i] = sample24(data + 3 * i);
+        }
+    }
+
+    uint64_t secondDiffSum(const int32_t* samples, size_t count)
+    {
+        uint64_t sum = 0;
+        size_t i = 0;
+
+#if defined(__AVX2__)
+        // 24 bit samples keep the differences well inside int32
+        auto acc = _mm256_setzero_si256();
+        for (; i + 10 <= count; i += 8)
+        {
+            auto s0 = _mm256_loadu_si256((const __m256i*)(samples + i));
+            auto s1 = _mm256_loadu_si256((const __m256i*)(samples + i + 1));
+            auto s2 = _mm256_loadu_si256((const __m256i*)(samples + i + 2));
+            auto d = _mm256_abs_epi32(_mm256_add_epi32(
+                _mm256_sub_epi32(s2, _mm256_add_epi32(s1, s1)), s0));
+            acc = _mm256_add_epi64(
+                acc, _mm256_cvtepu32_epi64(_mm256_castsi256_si128(d)));
+            acc = _mm256_add_epi64(
+                acc, _mm256_cvtepu32_epi64(_mm256_extracti128_si256(d, 1)));
+        }
+        uint64_t lanes[4];
+        _mm256_storeu_si256((__m256i*)lanes, acc);
+        sum = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+#endif
+        for (; i + 2 < count; ++i)
+        {
+            sum += std::abs(samples[i + 2] - 2 * samples[i + 1] + samples[i]);
+        }
+        return sum;
+    }
+
+    unsigned samplePhase(const char* data, size_t size)
+    {
+        unsigned best = 0;
+        auto bestRoughness = roughness(data, size, 0);
+        for (unsigned phase = 1; phase < 3; ++phase)
+        {
+            auto r = roughness(data, size, phase);
+            if (r < bestRoughness)
+            {
+                best = phase;
+                bestRoughness = r;
+            }
+        }
+        return best;
+    }
+
+    BoundaryTail boundaryTail(const char* end)
+    {
+        const char* window = end - boundaryWindow;
+        auto phase = samplePhase(window, boundaryWindow);
+        auto samples = (boundaryWindow - phase) / 3;
+
+        // last two samples fully before `end` on the same phase, and the
+        // bytes of the one straddling it
+        const char* next = window + phase + samples * 3;
+        BoundaryTail tail;
+        tail.s1 = sample24(next - 6);
+        tail.s2 = sample24(next - 3);
+        tail.pending = end - next;
+        std::copy(next, end, tail.partial);
+        tail.noise = double(roughness(window, boundaryWindow, phase)) /
+                     (samples - 2);
+        return tail;
+    }
+
+    double boundaryScore(const BoundaryTail& tail, const char* head)
+    {
+        char straddle[8];
+        std::copy(tail.partial, tail.partial + tail.pending, straddle);
+        std::copy(head, head + 6, straddle + tail.pending);
+
+        int64_t s1 = tail.s1;
+        int64_t s2 = tail.s2;
+        int64_t a0 = sample24(straddle);
+        int64_t a1 = sample24(straddle + 3);
+
+        // sample jump and derivative mismatch across the boundary
+        auto err = std::llabs(a0 - (2 * s2 - s1)) +
+                   std::llabs(a1 - (2 * a0 - s2));
+
+        return err / (2 * tail.noise + 1);
+    }
+
+    double boundaryScore(const char* data, size_t pos)
+    {
+        return boundaryScore(boundaryTail(data + pos), data + pos);
+    }
+}  // namespace Recovery
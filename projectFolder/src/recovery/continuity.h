@@ -0,0 +1,54 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace Recovery
+{
+    // Little endian signed 24 bit sample
+    inline int32_t sample24(const char* p)
+    {
+        auto u = uint8_t(p[0]) | uint32_t(uint8_t(p[1])) << 8 |
+                 uint32_t(uint8_t(p[2])) << 16;
+        return int32_t(u << 8) >> 8;
+    }
+
+    // Decodes `count` samples from `data` into `out`, vectorized with
+    // AVX2 / SSSE3 where available
+    void decode24(const char* data, size_t count, int32_t* out);
+
+    // Sum of |s[i+2] - 2 s[i+1] + s[i]|, how far the samples are from a
+    // straight line
+    uint64_t secondDiffSum(const int32_t* samples, size_t count);
+
+    // Byte phase (0..2) under which `size` bytes at `data` decode as the
+    // smoothest 24 bit audio. Wrong phases put the MSB into the low byte
+    // and decode as noise.
+    unsigned samplePhase(const char* data, size_t size);
+
+    // How badly the 24 bit stream in `data` jumps at byte `pos`: the error
+    // of a linear prediction across `pos`, relative to the second
+    // difference of the samples before it. Continuous audio scores around
+    // 1, a switch to another channel scores much higher. Needs
+    // `boundaryWindow` bytes before and 6 bytes after `pos`.
+    double boundaryScore(const char* data, size_t pos);
+
+    const size_t boundaryWindow = 3 * 64;
+
+    // What boundaryScore() needs from the bytes before the boundary, so
+    // the two sides can come from different places
+    struct BoundaryTail
+    {
+        int32_t s1 = 0;
+        int32_t s2 = 0;
+        double noise = 0;
+        unsigned pending = 0;  // bytes of the sample straddling the boundary
+        char partial[2] = {};
+    };
+
+    // Tail of the `boundaryWindow` bytes ending at `end`
+    BoundaryTail boundaryTail(const char* end);
+
+    // boundaryScore() of `tail` followed by the 6 bytes at `head`
+    double boundaryScore(const BoundaryTail& tail, const char* head);
+}  // namespace Recovery
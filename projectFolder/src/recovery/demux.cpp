@@ -0,0 +1,92 @@
+#include "demux.h"
+#include "flexibity/log.h"
+#include "recovery/interleave.h"
+#include <atomic>
+#include <cstring>
+#include <memory>
+
+namespace Recovery
+{
+    uint32_t demux(ImageSource& img, const Layout& layout,
+                   const ChannelSink& sink, const OccupancyMap* occupancy)
+    {
+        return streamTracks(
+            img, layout,
+            [&](uint32_t track, uint32_t, std::span<const char> audio) {
+                sink(track, audio.data(), audio.size());
+            },
+            {{}, occupancy});
+    }
+
+    uint32_t demux(BlockReader& reader, const Layout& layout,
+                   std::vector<std::ofstream>& outs, AsyncWriter& writer,
+                   const std::function<void(uint32_t blocks)>& queued)
+    {
+        auto channelBlockSize = layout.channelBlockSize();
+        auto dataBlockSize = layout.dataBlockSize();
+
+        uint32_t block = 0;
+        for (; block < layout.count; ++block)
+        {
+            auto data = reader.acquire();
+            if (data.size() != dataBlockSize)
+            {
+                GERROR("Short read of Data Block " << std::dec << block
+                                                   << ": got " << std::hex
+                                                   << data.size() << " of "
+                                                   << dataBlockSize);
+                break;
+            }
+
+            auto pending =
+                std::make_shared<std::atomic<uint32_t>>(layout.numTracks);
+            for (uint32_t track = 0; track < layout.numTracks; ++track)
+            {
+                writer.write(outs[track],
+                             data.subspan(channelBlockSize * track,
+                                          channelBlockSize),
+                             [&reader, pending] {
+                                 if (--*pending == 0)
+                                 {
+                                     reader.release();
+                                 }
+                             });
+            }
+            if (queued)
+            {
+                queued(block + 1);
+            }
+        }
+
+        writer.flush();
+        return block;
+    }
+
+    uint32_t demuxInterleaved(BlockReader& reader, const Layout& layout,
+                              std::ostream& out)
+    {
+        auto dataBlockSize = layout.dataBlockSize();
+        Interleaver interleaver(layout);
+
+        uint32_t block = 0;
+        for (; block < layout.count; ++block)
+        {
+            auto data = reader.acquire();
+            if (data.size() != dataBlockSize)
+            {
+                GERROR("Short read of Data Block " << std::dec << block
+                                                   << ": got " << std::hex
+                                                   << data.size() << " of "
+                                                   << dataBlockSize);
+                break;
+            }
+
+            // the block can be read again while the frames are written
+            auto frames = interleaver.append(data.data());
+            reader.release();
+            out.write(frames.data(), frames.size());
+        }
+
+        return block;
+    }
+}  // namespace Recovery
@@ -0,0 +1,52 @@
+#pragma once
+
+#include "recovery/asyncWriter.h"
+#include "recovery/blockReader.h"
+#include "recovery/imageSource.h"
+#include "recovery/layout.h"
+#include "recovery/occupancy.h"
+#include "recovery/stream.h"
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <vector>
+
+namespace Recovery
+{
+    // Receives one Channel Block (`repition` consecutive chunks) of `track`
+    using ChannelSink =
+        std::function<void(uint32_t track, const char* data, size_t size)>;
+
+    // Single pass demultiplexer: every Data Block of `layout` is read once,
+    // in image order, and split into its per-track Channel Blocks (see
+    // streamTracks()). Channel Blocks `occupancy` knows are dead are
+    // rebuilt from their fill byte, Data Blocks that are dead altogether
+    // aren't read at all. Returns the number of complete Data Blocks
+    // delivered.
+    uint32_t demux(ImageSource& img, const Layout& layout,
+                   const ChannelSink& sink,
+                   const OccupancyMap* occupancy = nullptr);
+
+    // Pipelined demultiplexer: `reader` reads the Data Blocks ahead (see
+    // dataBlockRanges()) while `writer` appends each Channel Block to
+    // outs[track]. A Data Block goes back to the reader once all of its
+    // Channel Blocks are written, so nothing is copied. `queued` is called once all
+    // Channel Blocks of a Data Block are queued, with the number of Data
+    // Blocks queued so far, e.g. to flush `writer` for a checkpoint.
+    uint32_t demux(BlockReader& reader, const Layout& layout,
+                   std::vector<std::ofstream>& outs, AsyncWriter& writer,
+                   const std::function<void(uint32_t blocks)>& queued = {});
+
+    // Interleaving demultiplexer: the Channel Blocks of every Data Block
+    // from `reader` are transposed into frames of all tracks (see
+    // Interleaver) and appended to `out`, one sequential stream.
+    uint32_t demuxInterleaved(BlockReader& reader, const Layout& layout,
+                              std::ostream& out);
+
+    inline BlockRanges dataBlockRanges(const Layout& layout)
+    {
+        return {layout.offset, layout.dataBlockSize(), layout.dataBlockSize(),
+                layout.count};
+    }
+}  // namespace Recovery
@@ -0,0 +1,308 @@
+#include "detect.h"
+#include "continuity.h"
+#include "flexibity/log.h"
+#include "wav.h"
+#include <algorithm>
+#include <bit>
+#include <cstring>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+namespace Recovery
+{
+    namespace
+    {
+        const char riff[4] = {'R', 'I', 'F', 'F'};
+        const char waveFmt[8] = {'W', 'A', 'V', 'E', 'f', 'm', 't', ' '};
+        // bytes a signature needs: chunkId .. subchunk1Id
+        const size_t signatureSize = 16;
+
+        // bytes read per scan step, overlapping so no header is split
+        const uint64_t scanBlock = 64 << 20;
+
+        // the largest repition tried when inferring the Channel Block
+        const uint32_t maxRepition = 64;
+        // chunk boundaries sampled for that
+        const uint32_t maxBoundaries = 1024;
+        // boundaryScore() above this is a channel switch
+        const double roughScore = 8;
+
+        inline bool isSignature(const char* p)
+        {
+            return memcmp(p, riff, sizeof(riff)) == 0 &&
+                   memcmp(p + 8, waveFmt, sizeof(waveFmt)) == 0;
+        }
+
+        bool isRecorderHeader(std::span<const char> data)
+        {
+            if (data.size() < sizeof(WAV_HEADER))
+            {
+                return false;
+            }
+            WAV_HEADER wh;
+            memcpy(&wh, data.data(), sizeof(wh));
+            return wh.audioFormat == 1 && wh.numChannels == 1 &&
+                   wh.bitsPerSample == 24 &&
+                   wh.blockAlign == wh.bitsPerSample / 8;
+        }
+
+        struct Run
+        {
+            uint64_t start;
+            uint64_t stride;
+            uint32_t count;
+        };
+
+        // Picks the repition whose Channel Block boundaries are rough and
+        // whose inner chunk boundaries are smooth
+        uint32_t inferRepition(ImageSource& img, const Layout& layout,
+                               double& confidence)
+        {
+            confidence = 0;
+
+            auto available = img.size() - std::min(img.size(), layout.offset);
+            uint32_t boundaries = std::min<uint64_t>(
+                maxBoundaries, available / layout.chunkSize);
+            if (boundaries < 4)
+            {
+                return 1;
+            }
+
+            auto region = img.read(layout.offset,
+                                   uint64_t(boundaries) * layout.chunkSize);
+            std::vector<bool> rough(boundaries, false);
+            for (uint32_t j = 1; j + 1 < boundaries; ++j)
+            {
+                rough[j] = boundaryScore(region.data(),
+                                         size_t(j) * layout.chunkSize) >
+                           roughScore;
+            }
+
+            uint32_t best = 1;
+            for (uint32_t rep = 2; rep <= maxRepition; rep *= 2)
+            {
+                uint32_t outer = 0, outerRough = 0;
+                uint32_t inner = 0, innerRough = 0;
+                for (uint32_t j = 1; j + 1 < boundaries; ++j)
+                {
+                    if (j % rep == 0)
+                    {
+                        ++outer;
+                        outerRough += rough[j];
+                    }
+                    else
+                    {
+                        ++inner;
+                        innerRough += rough[j];
+                    }
+                }
+                if (outer < 2)
+                {
+                    break;
+                }
+
+                double score =
+                    double(outerRough) / outer - double(innerRough) / inner;
+                GDEBUG("Repition " << std::dec << rep << " score " << score);
+                if (score > confidence)
+                {
+                    confidence = score;
+                    best = rep;
+                }
+            }
+            return best;
+        }
+    }  // namespace
+
+    void findWavHeaders(std::span<const char> data, uint64_t base,
+                        std::vector<uint64_t>& found)
+    {
+        const char* p = data.data();
+        size_t size = data.size();
+        size_t i = 0;
+
+        if (size < signatureSize)
+        {
+            return;
+        }
+        size_t last = size - signatureSize;
+
+        // candidates have 'R' at +0, 'F' at +3 and 'W' at +8,
+        // confirmed with a full compare
+#if defined(__AVX2__)
+        const auto r = _mm256_set1_epi8('R');
+        const auto f = _mm256_set1_epi8('F');
+        const auto w = _mm256_set1_epi8('W');
+        for (; i + 32 <= last; i += 32)
+        {
+            auto m0 = _mm256_cmpeq_epi8(
+                _mm256_loadu_si256((const __m256i*)(p + i)), r);
+            auto m3 = _mm256_cmpeq_epi8(
+                _mm256_loadu_si256((const __m256i*)(p + i + 3)), f);
+            auto m8 = _mm256_cmpeq_epi8(
+                _mm256_loadu_si256((const __m256i*)(p + i + 8)), w);
+            uint32_t mask = _mm256_movemask_epi8(
+                _mm256_and_si256(m0, _mm256_and_si256(m3, m8)));
+            while (mask)
+            {
+                auto bit = std::countr_zero(mask);
+                if (isSignature(p + i + bit))
+                {
+                    found.push_back(base + i + bit);
+                }
+                mask &= mask - 1;
+            }
+        }
+#elif defined(__SSE2__)
+        const auto r = _mm_set1_epi8('R');
+        const auto f = _mm_set1_epi8('F');
+        const auto w = _mm_set1_epi8('W');
+        for (; i + 16 <= last; i += 16)
+        {
+            auto m0 =
+                _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(p + i)), r);
+            auto m3 = _mm_cmpeq_epi8(
+                _mm_loadu_si128((const __m128i*)(p + i + 3)), f);
+            auto m8 = _mm_cmpeq_epi8(
+                _mm_loadu_si128((const __m128i*)(p + i + 8)), w);
+            uint32_t mask =
+                _mm_movemask_epi8(_mm_and_si128(m0, _mm_and_si128(m3, m8)));
+            while (mask)
+            {
+                auto bit = std::countr_zero(mask);
+                if (isSignature(p + i + bit))
+                {
+                    found.push_back(base + i + bit);
+                }
+                mask &= mask - 1;
+            }
+        }
+#endif
+        // tail, and the whole buffer without SIMD: memchr is vectorized
+        // by the C library
+        while (i <= last)
+        {
+            auto next = (const char*)memchr(p + i, 'R', last - i + 1);
+            if (!next)
+            {
+                break;
+            }
+            i = next - p;
+            if (isSignature(next))
+            {
+                found.push_back(base + i);
+            }
+            ++i;
+        }
+    }
+
+    std::vector<DetectedSession> detectSessions(ImageSource& img,
+                                                uint64_t offset,
+                                                uint64_t length)
+    {
+        std::vector<DetectedSession> sessions;
+
+        auto end = img.size();
+        if (length && offset + length < end)
+        {
+            end = offset + length;
+        }
+        if (offset >= end)
+        {
+            return sessions;
+        }
+
+        std::vector<uint64_t> headers;
+        img.advise(ImageSource::Access::Sequential, offset, end - offset);
+        for (auto pos = offset; pos + signatureSize <= end;
+             pos += scanBlock - signatureSize)
+        {
+            auto data = img.read(pos, std::min(scanBlock, end - pos));
+            findWavHeaders(data, pos, headers);
+            if (pos + data.size() >= end)
+            {
+                break;
+            }
+        }
+        headers.erase(std::unique(headers.begin(), headers.end()),
+                      headers.end());
+        GINFO("Found " << std::dec << headers.size() << " WAV signatures");
+
+        // group headers into runs at a constant power of two stride
+        std::vector<Run> runs;
+        for (auto header : headers)
+        {
+            if (!isRecorderHeader(img.read(header, sizeof(WAV_HEADER))))
+            {
+                continue;
+            }
+            if (!runs.empty())
+            {
+                auto& run = runs.back();
+                auto next = run.start + run.stride * run.count;
+                if (run.count == 1)
+                {
+                    auto stride = header - run.start;
+                    if (std::has_single_bit(stride) && stride >= 512 &&
+                        stride <= (16 << 20))
+                    {
+                        run.stride = stride;
+                        run.count = 2;
+                        continue;
+                    }
+                }
+                else if (header == next)
+                {
+                    ++run.count;
+                    continue;
+                }
+            }
+            runs.push_back({header, 0, 1});
+        }
+
+        for (auto& run : runs)
+        {
+            if (run.count < 2)
+            {
+                continue;
+            }
+
+            WAV_HEADER wh;
+            memcpy(&wh, img.read(run.start, sizeof(wh)).data(), sizeof(wh));
+
+            DetectedSession session = {
+                .headerOffset = run.start,
+                .layout =
+                    {
+                        .offset = run.start + run.stride * run.count,
+                        .chunkSize = uint32_t(run.stride),
+                        .repition = 1,
+                        .numTracks = run.count,
+                        .count = 0,
+                    },
+                .sampleRate = wh.sampleRate,
+                .bitsPerSample = wh.bitsPerSample,
+                .confidence = 0,
+            };
+            session.layout.repition =
+                inferRepition(img, session.layout, session.confidence);
+            sessions.push_back(session);
+        }
+
+        // a session's data runs up to the next one
+        for (size_t i = 0; i < sessions.size(); ++i)
+        {
+            auto& layout = sessions[i].layout;
+            auto limit = i + 1 < sessions.size() ? sessions[i + 1].headerOffset
+                                                 : img.size();
+            layout.count =
+                limit > layout.offset
+                    ? (limit - layout.offset) / layout.dataBlockSize()
+                    : 0;
+        }
+
+        return sessions;
+    }
+}  // namespace Recovery
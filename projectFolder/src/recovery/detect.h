@@ -0,0 +1,34 @@
+#pragma once
+
+#include "recovery/imageSource.h"
+#include "recovery/layout.h"
+#include <cstdint>
+#include <span>
+#include <vector>
+
+namespace Recovery
+{
+    // Session found by its run of per-track WAV headers
+    struct DetectedSession
+    {
+        uint64_t headerOffset;  // first WAV header (Readme "Headers start")
+        Layout layout;          // offset is the first Data Block
+        uint32_t sampleRate;
+        uint16_t bitsPerSample;
+        double confidence;  // 0..1, how clearly `repition` was inferred
+    };
+
+    // Appends the image offsets of every `RIFF....WAVEfmt ` signature in
+    // `data` (located at image offset `base`) to `found`. Vectorized with
+    // AVX2 / SSE2 where available.
+    void findWavHeaders(std::span<const char> data, uint64_t base,
+                        std::vector<uint64_t>& found);
+
+    // Scans `length` bytes of the image from `offset` (0 is up to the end)
+    // for runs of recorder WAV headers at chunk stride and infers each
+    // session's layout. layout.count is an estimate: the Data Blocks up to
+    // the next session or the end of the image.
+    std::vector<DetectedSession> detectSessions(ImageSource& img,
+                                                uint64_t offset,
+                                                uint64_t length);
+}  // namespace Recovery
@@ -0,0 +1,512 @@
+#include "fatfs.h"
+#include "flexibity/log.h"
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+
+namespace Recovery
+{
+    namespace
+    {
+        const size_t sectorSize = 512;  // of the boot sector and partitions
+        const unsigned maxDepth = 32;   // directory nesting walked
+
+        enum class FatType
+        {
+            None,
+            Fat32,
+            ExFat,
+        };
+
+        uint16_t le16(const char* p)
+        {
+            uint16_t v;
+            memcpy(&v, p, sizeof(v));
+            return v;
+        }
+
+        uint32_t le32(const char* p)
+        {
+            uint32_t v;
+            memcpy(&v, p, sizeof(v));
+            return v;
+        }
+
+        uint64_t le64(const char* p)
+        {
+            uint64_t v;
+            memcpy(&v, p, sizeof(v));
+            return v;
+        }
+
+        bool powerOfTwo(uint32_t v)
+        {
+            return v && (v & (v - 1)) == 0;
+        }
+
+        FatType fatType(std::span<const char> boot)
+        {
+            if (boot.size() < sectorSize)
+            {
+                return FatType::None;
+            }
+            auto p = boot.data();
+            if (memcmp(p + 3, "EXFAT   ", 8) == 0)
+            {
+                unsigned sectorShift = uint8_t(p[108]);
+                unsigned clusterShift = uint8_t(p[109]);
+                bool sane = sectorShift >= 9 && sectorShift <= 12 &&
+                            sectorShift + clusterShift <= 25;
+                return sane ? FatType::ExFat : FatType::None;
+            }
+
+            // FAT32: no fixed root directory and no 16 bit FAT size
+            auto bytesPerSector = le16(p + 11);
+            bool sane = uint8_t(p[510]) == 0x55 && uint8_t(p[511]) == 0xAA &&
+                        bytesPerSector >= 512 && bytesPerSector <= 4096 &&
+                        powerOfTwo(bytesPerSector) &&
+                        powerOfTwo(uint8_t(p[13])) && le16(p + 14) &&
+                        p[16] && le16(p + 17) == 0 && le16(p + 22) == 0 &&
+                        le32(p + 36);
+            return sane ? FatType::Fat32 : FatType::None;
+        }
+
+        void appendUtf8(std::string& out, uint32_t c)
+        {
+            if (c < 0x80)
+            {
+                out += char(c);
+            }
+            else if (c < 0x800)
+            {
+                out += char(0xC0 | c >> 6);
+                out += char(0x80 | (c & 0x3F));
+            }
+            else if (c < 0x10000)
+            {
+                out += char(0xE0 | c >> 12);
+                out += char(0x80 | (c >> 6 & 0x3F));
+                out += char(0x80 | (c & 0x3F));
+            }
+            else
+            {
+                out += char(0xF0 | c >> 18);
+                out += char(0x80 | (c >> 12 & 0x3F));
+                out += char(0x80 | (c >> 6 & 0x3F));
+                out += char(0x80 | (c & 0x3F));
+            }
+        }
+
+        // Long names are UTF-16, stopped by a 0 or the end of `name`
+        std::string utf8(const std::u16string& name)
+        {
+            std::string out;
+            for (size_t i = 0; i < name.size() && name[i]; ++i)
+            {
+                uint32_t c = name[i];
+                if (c >= 0xD800 && c < 0xDC00 && i + 1 < name.size())
+                {
+                    c = 0x10000 + ((c - 0xD800) << 10) + (name[++i] - 0xDC00);
+                }
+                appendUtf8(out, c);
+            }
+            return out;
+        }
+
+        std::string shortName(const char* e)
+        {
+            auto part = [](const char* p, size_t size, bool lower) {
+                std::string s(p, size);
+                s.erase(s.find_last_not_of(' ') + 1);
+                if (lower)
+                {
+                    std::transform(s.begin(), s.end(), s.begin(),
+                                   [](unsigned char c) { return char(std::tolower(c)); });
+                }
+                return s;
+            };
+            auto name = part(e, 8, e[12] & 0x08);
+            if (uint8_t(name[0]) == 0x05)
+            {
+                name[0] = char(0xE5);
+            }
+            auto ext = part(e + 8, 3, e[12] & 0x10);
+            return ext.empty() ? name : name + "." + ext;
+        }
+    }  // namespace
+
+    bool FatVolume::open(ImageSource& img, uint64_t offset)
+    {
+        this->img = &img;
+        std::vector<char> boot;
+        {
+            auto data = img.read(offset, sectorSize);
+            boot.assign(data.begin(), data.end());
+        }
+        auto p = boot.data();
+
+        uint64_t fatOffset;
+        uint64_t fatEntries;
+        switch (fatType(boot))
+        {
+        case FatType::ExFat:
+        {
+            exFat = true;
+            unsigned sectorShift = uint8_t(p[108]);
+            fatOffset = offset + (uint64_t(le32(p + 80)) << sectorShift);
+            fatEntries = (uint64_t(le32(p + 84)) << sectorShift) / 4;
+            heapOffset = offset + (uint64_t(le32(p + 88)) << sectorShift);
+            bytesPerCluster = uint64_t(1) << (sectorShift + uint8_t(p[109]));
+            clusterCount = le32(p + 92);
+            rootCluster = le32(p + 96);
+            break;
+        }
+        case FatType::Fat32:
+        {
+            exFat = false;
+            uint64_t bytesPerSector = le16(p + 11);
+            uint32_t sectorsPerCluster = uint8_t(p[13]);
+            uint64_t reserved = le16(p + 14);
+            uint64_t fats = uint8_t(p[16]);
+            uint64_t fatSectors = le32(p + 36);
+            uint64_t sectors = le16(p + 19) ? le16(p + 19) : le32(p + 32);
+
+            fatOffset = offset + reserved * bytesPerSector;
+            fatEntries = fatSectors * bytesPerSector / 4;
+            heapOffset = fatOffset + fats * fatSectors * bytesPerSector;
+            bytesPerCluster = bytesPerSector * sectorsPerCluster;
+            auto metadata = reserved + fats * fatSectors;
+            clusterCount =
+                sectors > metadata ? (sectors - metadata) / sectorsPerCluster
+                                   : 0;
+            rootCluster = le32(p + 44);
+            break;
+        }
+        default:
+            GERROR("No FAT32 or exFAT boot sector at " << std::hex << offset);
+            return false;
+        }
+
+        fatEntries = std::min<uint64_t>(fatEntries, uint64_t(clusterCount) + 2);
+        auto data = img.read(fatOffset, fatEntries * 4);
+        if (data.size() != fatEntries * 4 || fatEntries < 3)
+        {
+            GERROR("Short FAT at " << std::hex << fatOffset);
+            return false;
+        }
+        fat.resize(fatEntries);
+        memcpy(fat.data(), data.data(), data.size());
+        if (!exFat)
+        {
+            for (auto& entry : fat)
+            {
+                entry &= 0x0FFFFFFF;
+            }
+        }
+
+        GINFO((exFat ? "exFAT" : "FAT32") << " volume at " << std::hex
+              << offset << ": " << std::dec << clusterCount
+              << " clusters of " << bytesPerCluster << " bytes");
+        return true;
+    }
+
+    std::vector<FileExtent> FatVolume::chain(uint32_t cluster, uint64_t size,
+                                             bool contiguous) const
+    {
+        std::vector<FileExtent> extents;
+        if (cluster < 2 || cluster >= fat.size() || size == 0)
+        {
+            return extents;
+        }
+
+        if (contiguous)
+        {
+            auto available = (fat.size() - cluster) * bytesPerCluster;
+            extents.push_back({clusterOffset(cluster),
+                               std::min<uint64_t>(size, available)});
+            return extents;
+        }
+
+        // the step limit stops cycles in a damaged FAT
+        uint64_t left = size;
+        for (size_t steps = 0; left && steps < fat.size(); ++steps)
+        {
+            auto length = std::min(left, bytesPerCluster);
+            auto offset = clusterOffset(cluster);
+            if (!extents.empty() &&
+                extents.back().offset + extents.back().length == offset)
+            {
+                extents.back().length += length;
+            }
+            else
+            {
+                extents.push_back({offset, length});
+            }
+            left -= length;
+
+            // end of chain, bad or free clusters are all out of range
+            cluster = fat[cluster];
+            if (cluster < 2 || cluster >= fat.size())
+            {
+                break;
+            }
+        }
+        return extents;
+    }
+
+    std::vector<char> FatVolume::readExtents(
+        const std::vector<FileExtent>& extents)
+    {
+        std::vector<char> data;
+        for (auto& extent : extents)
+        {
+            auto part = img->read(extent.offset, extent.length);
+            data.insert(data.end(), part.begin(), part.end());
+        }
+        return data;
+    }
+
+    std::vector<FatVolume::Entry> FatVolume::directory(
+        const std::vector<FileExtent>& extents)
+    {
+        auto data = readExtents(extents);
+        std::vector<Entry> entries;
+        auto count = data.size() / 32;
+
+        std::u16string longName;
+        for (size_t i = 0; i < count; ++i)
+        {
+            const char* e = data.data() + 32 * i;
+            if (e[0] == 0)
+            {
+                break;
+            }
+
+            if (exFat)
+            {
+                // a File entry, then its Stream Extension and File Names
+                uint8_t secondary = e[1];
+                if (uint8_t(e[0]) != 0x85 || secondary < 2 ||
+                    i + 1 + secondary > count)
+                {
+                    continue;
+                }
+                const char* stream = e + 32;
+                if (uint8_t(stream[0]) != 0xC0)
+                {
+                    continue;
+                }
+
+                std::u16string name(uint8_t(stream[3]), u'\0');
+                for (size_t k = 0; k < name.size(); ++k)
+                {
+                    auto n = e + 64 + 32 * (k / 15);
+                    if (k / 15 + 2 > secondary || uint8_t(n[0]) != 0xC1)
+                    {
+                        break;
+                    }
+                    name[k] = le16(n + 2 + 2 * (k % 15));
+                }
+
+                bool directory = le16(e + 4) & 0x10;
+                entries.push_back(
+                    {utf8(name), directory, le32(stream + 20),
+                     directory ? le64(stream + 24) : le64(stream + 8),
+                     bool(stream[1] & 0x02)});
+                i += secondary;
+                continue;
+            }
+
+            uint8_t attributes = e[11];
+            if (uint8_t(e[0]) == 0xE5)
+            {
+                longName.clear();
+                continue;
+            }
+            if (attributes == 0x0F)
+            {
+                // long name pieces come last first, 13 characters each
+                size_t piece = (e[0] & 0x1F) - 1;
+                if (e[0] & 0x40)
+                {
+                    longName.assign((piece + 1) * 13, u'\0');
+                }
+                if ((piece + 1) * 13 > longName.size())
+                {
+                    continue;
+                }
+                auto out = longName.begin() + piece * 13;
+                for (auto [at, chars] : {std::pair{1, 5}, {14, 6}, {28, 2}})
+                {
+                    for (int k = 0; k < chars; ++k)
+                    {
+                        *out++ = le16(e + at + 2 * k);
+                    }
+                }
+                continue;
+            }
+            if (attributes & 0x08)
+            {
+                longName.clear();
+                continue;
+            }
+
+            auto name = longName.empty() ? shortName(e) : utf8(longName);
+            longName.clear();
+            if (name == "." || name == "..")
+            {
+                continue;
+            }
+            uint32_t cluster = uint32_t(le16(e + 20)) << 16 | le16(e + 26);
+            bool directory = attributes & 0x10;
+            entries.push_back(
+                {name, directory, cluster, directory ? 0 : le32(e + 28),
+                 false});
+        }
+        return entries;
+    }
+
+    bool safeFileName(std::string_view name)
+    {
+        return !name.empty() && name != "." && name != ".." &&
+               name.find_first_of(std::string_view("/\\\0", 3)) ==
+                   std::string_view::npos;
+    }
+
+    void FatVolume::walk(const std::string& path,
+                         const std::vector<FileExtent>& extents,
+                         std::vector<FsFile>& out, unsigned depth)
+    {
+        if (depth > maxDepth)
+        {
+            GERROR("Directories nested too deep at " << path);
+            return;
+        }
+
+        for (auto& entry : directory(extents))
+        {
+            // a damaged directory must not lead outside of the copy
+            if (!safeFileName(entry.name))
+            {
+                GERROR("Skipping an unsafe file name in /" << path);
+                continue;
+            }
+            auto name = path.empty() ? entry.name : path + "/" + entry.name;
+            if (entry.directory)
+            {
+                // FAT32 directories have no size, their chain ends them
+                walk(name,
+                     chain(entry.cluster, entry.size ? entry.size : UINT64_MAX,
+                           entry.contiguous),
+                     out, depth + 1);
+            }
+            else
+            {
+                out.push_back({name, entry.size,
+                               chain(entry.cluster, entry.size,
+                                     entry.contiguous)});
+            }
+        }
+    }
+
+    std::vector<FsFile> FatVolume::files()
+    {
+        std::vector<FsFile> out;
+        walk("", chain(rootCluster, UINT64_MAX, false), out, 0);
+        return out;
+    }
+
+    std::vector<uint64_t> findFatVolumes(ImageSource& img)
+    {
+        std::vector<uint64_t> candidates;
+        std::vector<char> mbr;
+        {
+            auto data = img.read(0, sectorSize);
+            if (fatType(data) != FatType::None)
+            {
+                return {0};
+            }
+            mbr.assign(data.begin(), data.end());
+        }
+        if (mbr.size() < sectorSize || uint8_t(mbr[510]) != 0x55 ||
+            uint8_t(mbr[511]) != 0xAA)
+        {
+            return {};
+        }
+
+        for (int i = 0; i < 4; ++i)
+        {
+            auto e = mbr.data() + 446 + 16 * i;
+            uint8_t type = e[4];
+            if (type == 0xEE)
+            {
+                // protective MBR, the partitions are in the GPT
+                std::vector<char> header;
+                {
+                    auto data = img.read(sectorSize, 92);
+                    header.assign(data.begin(), data.end());
+                }
+                if (header.size() < 92 ||
+                    memcmp(header.data(), "EFI PART", 8) != 0)
+                {
+                    break;
+                }
+                auto table = le64(header.data() + 72) * sectorSize;
+                auto count = std::min<uint32_t>(le32(header.data() + 80), 128);
+                auto size = le32(header.data() + 84);
+                for (uint32_t k = 0; size >= 48 && k < count; ++k)
+                {
+                    auto entry = img.read(table + uint64_t(k) * size, 48);
+                    if (entry.size() == 48)
+                    {
+                        auto first = le64(entry.data() + 32);
+                        if (first)
+                        {
+                            candidates.push_back(first * sectorSize);
+                        }
+                    }
+                }
+                break;
+            }
+            if (type && le32(e + 8))
+            {
+                candidates.push_back(uint64_t(le32(e + 8)) * sectorSize);
+            }
+        }
+
+        std::vector<uint64_t> volumes;
+        for (auto offset : candidates)
+        {
+            if (fatType(img.read(offset, sectorSize)) != FatType::None)
+            {
+                volumes.push_back(offset);
+            }
+        }
+        return volumes;
+    }
+
+    uint64_t readFile(ImageSource& img, const FsFile& file,
+                      const std::function<void(std::span<const char>)>& sink,
+                      size_t readSize)
+    {
+        uint64_t delivered = 0;
+        for (auto& extent : file.extents)
+        {
+            img.advise(ImageSource::Access::Sequential, extent.offset,
+                       extent.length);
+            for (uint64_t pos = 0; pos < extent.length; pos += readSize)
+            {
+                auto size = std::min<uint64_t>(readSize, extent.length - pos);
+                auto data = img.read(extent.offset + pos, size);
+                sink(data);
+                delivered += data.size();
+                if (data.size() != size)
+                {
+                    GERROR("Img eof in " << file.path);
+                    return delivered;
+                }
+            }
+        }
+        return delivered;
+    }
+}  // namespace Recovery
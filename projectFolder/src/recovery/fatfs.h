@@ -0,0 +1,93 @@
+#pragma once
+
+#include "recovery/imageSource.h"
+#include <cstdint>
+#include <functional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace Recovery
+{
+    // Contiguous run of a file's clusters, in image bytes
+    struct FileExtent
+    {
+        uint64_t offset;
+        uint64_t length;
+    };
+
+    struct FsFile
+    {
+        std::string path;  // from the volume root, '/' separated
+        uint64_t size = 0;
+        std::vector<FileExtent> extents;  // adjacent clusters coalesced
+    };
+
+    // Read only FAT32 / exFAT volume of an image. Only what is needed to
+    // find files and resolve their cluster chains is parsed: no FAT12/16,
+    // no checksums, nothing is ever written.
+    class FatVolume
+    {
+    public:
+        // Opens the volume whose boot sector is at image `offset`
+        bool open(ImageSource& img, uint64_t offset);
+
+        bool isExFat() const
+        {
+            return exFat;
+        }
+        uint64_t clusterSize() const
+        {
+            return bytesPerCluster;
+        }
+
+        // Every file of the volume, directories are walked recursively
+        std::vector<FsFile> files();
+
+    private:
+        struct Entry
+        {
+            std::string name;
+            bool directory;
+            uint32_t cluster;
+            uint64_t size;
+            bool contiguous;  // exFAT NoFatChain, the FAT isn't used
+        };
+
+        uint64_t clusterOffset(uint32_t cluster) const
+        {
+            return heapOffset + uint64_t(cluster - 2) * bytesPerCluster;
+        }
+        std::vector<FileExtent> chain(uint32_t cluster, uint64_t size,
+                                      bool contiguous) const;
+        std::vector<char> readExtents(const std::vector<FileExtent>& extents);
+        std::vector<Entry> directory(const std::vector<FileExtent>& extents);
+        void walk(const std::string& path,
+                  const std::vector<FileExtent>& extents,
+                  std::vector<FsFile>& out, unsigned depth);
+
+        ImageSource* img = nullptr;
+        bool exFat = false;
+        uint64_t heapOffset = 0;  // image offset of cluster 2
+        uint64_t bytesPerCluster = 0;
+        uint32_t clusterCount = 0;
+        uint32_t rootCluster = 0;
+        std::vector<uint32_t> fat;  // the first FAT, all of it
+    };
+
+    // Whether a name read from a directory is safe to create as one path
+    // component: not empty, "." or "..", and free of '/', '\\' and NUL
+    bool safeFileName(std::string_view name);
+
+    // Image offsets of the FAT32 and exFAT volumes: the image itself when
+    // it starts with a boot sector, else the MBR or GPT partitions
+    std::vector<uint64_t> findFatVolumes(ImageSource& img);
+
+    // Hands the content of `file` to `sink` in image order, reading each
+    // extent in pieces of at most `readSize` bytes. Returns the bytes
+    // delivered, less than file.size if the image ends early.
+    uint64_t readFile(ImageSource& img, const FsFile& file,
+                      const std::function<void(std::span<const char>)>& sink,
+                      size_t readSize = 0x1000000);
+}  // namespace Recovery
@@ -0,0 +1,548 @@
+#include "flac.h"
+#include "flexibity/log.h"
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <chrono>
+#include <cstring>
+
+namespace Recovery
+{
+    namespace
+    {
+        const uint32_t batchFrames = 8;   // frames per pool job
+        const size_t maxInFlight = 16;    // jobs per stream before waiting
+
+        // MSB first bit packing into a byte string
+        class BitWriter
+        {
+        public:
+            void put(uint32_t value, uint32_t bits)
+            {
+                if (!bits)
+                {
+                    return;
+                }
+                acc = (acc << bits) | (value & (~0u >> (32 - bits)));
+                used += bits;
+                while (used >= 8)
+                {
+                    used -= 8;
+                    out.push_back(char(acc >> used));
+                }
+            }
+
+            void putSigned(int32_t value, uint32_t bits)
+            {
+                put(uint32_t(value), bits);
+            }
+
+            void putUnary(uint32_t zeros)
+            {
+                for (; zeros >= 32; zeros -= 32)
+                {
+                    put(0, 32);
+                }
+                put(1, zeros + 1);
+            }
+
+            void align()
+            {
+                if (used)
+                {
+                    put(0, 8 - used);
+                }
+            }
+
+            std::string out;
+
+        private:
+            uint64_t acc = 0;
+            uint32_t used = 0;
+        };
+
+        uint8_t crc8(const std::string& data)
+        {
+            uint8_t crc = 0;
+            for (auto c : data)
+            {
+                crc ^= uint8_t(c);
+                for (int bit = 0; bit < 8; ++bit)
+                {
+                    crc = crc & 0x80 ? uint8_t(crc << 1) ^ 0x07 : crc << 1;
+                }
+            }
+            return crc;
+        }
+
+        const std::array<uint16_t, 256> crc16Table = [] {
+            std::array<uint16_t, 256> table{};
+            for (uint32_t i = 0; i < 256; ++i)
+            {
+                uint16_t crc = uint16_t(i << 8);
+                for (int bit = 0; bit < 8; ++bit)
+                {
+                    crc = crc & 0x8000 ? uint16_t(crc << 1) ^ 0x8005
+                                       : uint16_t(crc << 1);
+                }
+                table[i] = crc;
+            }
+            return table;
+        }();
+
+        uint16_t crc16(const std::string& data)
+        {
+            uint16_t crc = 0;
+            for (auto c : data)
+            {
+                crc = uint16_t(crc << 8) ^
+                      crc16Table[(crc >> 8) ^ uint8_t(c)];
+            }
+            return crc;
+        }
+
+        uint32_t sampleRateCode(uint32_t rate)
+        {
+            switch (rate)
+            {
+            case 88200: return 1;
+            case 176400: return 2;
+            case 192000: return 3;
+            case 8000: return 4;
+            case 16000: return 5;
+            case 22050: return 6;
+            case 24000: return 7;
+            case 32000: return 8;
+            case 44100: return 9;
+            case 48000: return 10;
+            case 96000: return 11;
+            default: return 0;  // taken from STREAMINFO
+            }
+        }
+
+        uint32_t sampleSizeCode(uint32_t bits)
+        {
+            switch (bits)
+            {
+            case 8: return 1;
+            case 16: return 4;
+            case 24: return 6;
+            case 32: return 7;
+            default: return 0;
+            }
+        }
+
+        // Frame numbers are coded like UTF-8, up to 36 bits
+        void putFrameNumber(BitWriter& bits, uint64_t n)
+        {
+            if (n < 0x80)
+            {
+                bits.put(uint32_t(n), 8);
+                return;
+            }
+            uint32_t bytes = 2;
+            while (bytes < 7 && n >> (5 * bytes + 1))
+            {
+                ++bytes;
+            }
+            auto lead = uint32_t(0xFF00 >> bytes) & 0xFF;
+            bits.put(lead | uint32_t(n >> (6 * (bytes - 1))), 8);
+            for (auto k = bytes - 1; k-- > 0;)
+            {
+                bits.put(0x80 | uint32_t((n >> (6 * k)) & 0x3F), 8);
+            }
+        }
+
+        uint32_t zigzag(int64_t r)
+        {
+            return uint32_t((r << 1) ^ (r >> 63));
+        }
+
+        // Residual of the fixed predictor of `order` for sample i >= order
+        int64_t fixedResidual(const int32_t* x, uint32_t i, uint32_t order)
+        {
+            int64_t s = x[i];
+            switch (order)
+            {
+            case 0: return s;
+            case 1: return s - x[i - 1];
+            case 2: return s - 2 * int64_t(x[i - 1]) + x[i - 2];
+            case 3:
+                return s - 3 * int64_t(x[i - 1]) + 3 * int64_t(x[i - 2]) -
+                       x[i - 3];
+            default:
+                return s - 4 * int64_t(x[i - 1]) + 6 * int64_t(x[i - 2]) -
+                       4 * int64_t(x[i - 3]) + x[i - 4];
+            }
+        }
+
+        // Rice parameter for a partition of `n` residuals summing to `sum`
+        // and its estimated size in bits
+        std::pair<uint32_t, uint64_t> riceParameter(uint64_t sum, uint32_t n)
+        {
+            uint32_t k = 0;
+            if (n && sum > n)
+            {
+                k = std::min<uint32_t>(std::bit_width(sum / n) - 1, 30);
+            }
+            return {k, 5 + n * uint64_t(k + 1) + (sum >> k)};
+        }
+
+        struct Residual
+        {
+            uint32_t partitionOrder = 0;
+            std::vector<uint32_t> parameters;
+            uint64_t bits = ~0ull;
+        };
+
+        // Best partitioning of the zigzag coded residuals `u` of a block
+        // of `count` samples predicted with `order` warm-up samples
+        Residual partitionResidual(const std::vector<uint32_t>& u,
+                                   uint32_t count, uint32_t order)
+        {
+            Residual best;
+            for (uint32_t p = 0; p <= 8; ++p)
+            {
+                auto partitions = 1u << p;
+                if (count % partitions || (count >> p) <= order)
+                {
+                    break;
+                }
+                Residual candidate;
+                candidate.partitionOrder = p;
+                candidate.bits = 6;
+                auto size = count >> p;
+                for (uint32_t part = 0, at = 0; part < partitions; ++part)
+                {
+                    auto n = part ? size : size - order;
+                    uint64_t sum = 0;
+                    for (uint32_t i = 0; i < n; ++i)
+                    {
+                        sum += u[at + i];
+                    }
+                    at += n;
+                    auto [k, bits] = riceParameter(sum, n);
+                    candidate.parameters.push_back(k);
+                    candidate.bits += bits;
+                }
+                if (candidate.bits < best.bits)
+                {
+                    best = std::move(candidate);
+                }
+            }
+            return best;
+        }
+
+        void encodeSubframe(BitWriter& bits, const int32_t* x, uint32_t count,
+                            uint32_t bps)
+        {
+            if (std::all_of(x, x + count, [&](int32_t s) { return s == x[0]; }))
+            {
+                bits.put(0x00, 8);
+                bits.putSigned(x[0], bps);
+                return;
+            }
+
+            // the fixed predictor with the smallest residual, if it beats
+            // the samples verbatim
+            uint64_t bestBits = uint64_t(count) * bps;
+            uint32_t bestOrder = 0;
+            Residual best;
+            std::vector<uint32_t> u(count), bestU;
+            for (uint32_t order = 0; order <= 4 && order < count; ++order)
+            {
+                bool fits = true;
+                for (uint32_t i = order; i < count; ++i)
+                {
+                    auto r = fixedResidual(x, i, order);
+                    if (r > INT32_MAX || r < INT32_MIN)
+                    {
+                        fits = false;
+                        break;
+                    }
+                    u[i - order] = zigzag(r);
+                }
+                if (!fits)
+                {
+                    continue;
+                }
+                auto residual = partitionResidual(u, count, order);
+                auto size = uint64_t(order) * bps + 2 + residual.bits;
+                if (size < bestBits)
+                {
+                    bestBits = size;
+                    bestOrder = order;
+                    best = std::move(residual);
+                    bestU.swap(u);
+                    u.resize(count);
+                }
+            }
+
+            if (best.parameters.empty())
+            {
+                bits.put(0x02, 8);
+                for (uint32_t i = 0; i < count; ++i)
+                {
+                    bits.putSigned(x[i], bps);
+                }
+                return;
+            }
+
+            bits.put((0x08 | bestOrder) << 1, 8);
+            for (uint32_t i = 0; i < bestOrder; ++i)
+            {
+                bits.putSigned(x[i], bps);
+            }
+            bits.put(1, 2);  // RICE2, 5 bit parameters
+            bits.put(best.partitionOrder, 4);
+            const uint32_t* r = bestU.data();
+            auto size = count >> best.partitionOrder;
+            for (size_t part = 0; part < best.parameters.size(); ++part)
+            {
+                auto k = best.parameters[part];
+                bits.put(k, 5);
+                auto n = part ? size : size - bestOrder;
+                for (uint32_t i = 0; i < n; ++i, ++r)
+                {
+                    bits.putUnary(*r >> k);
+                    bits.put(*r, k);
+                }
+            }
+        }
+    }  // namespace
+
+    std::string encodeFlacFrame(const int32_t* samples, uint32_t count,
+                                const WavFormat& format, uint64_t frame)
+    {
+        auto channels = format.numChannels;
+        auto bps = format.bitsPerSample;
+
+        BitWriter bits;
+        bits.put(0xFFF8, 16);  // sync code, fixed block size
+        bits.put(count == flacBlockSize ? 12 : 7, 4);
+        bits.put(sampleRateCode(format.sampleRate), 4);
+        bits.put(channels - 1, 4);  // independent channels
+        bits.put(sampleSizeCode(bps), 3);
+        bits.put(0, 1);
+        putFrameNumber(bits, frame);
+        if (count != flacBlockSize)
+        {
+            bits.put(count - 1, 16);
+        }
+        bits.put(crc8(bits.out), 8);
+
+        std::vector<int32_t> channel(count);
+        for (uint32_t c = 0; c < channels; ++c)
+        {
+            for (uint32_t i = 0; i < count; ++i)
+            {
+                channel[i] = samples[size_t(i) * channels + c];
+            }
+            encodeSubframe(bits, channel.data(), count, bps);
+        }
+        bits.align();
+        bits.put(crc16(bits.out), 16);
+        return std::move(bits.out);
+    }
+
+    FlacEncoderPool::FlacEncoderPool(unsigned threads)
+    {
+        if (!threads)
+        {
+            threads = std::max(1u, std::thread::hardware_concurrency());
+        }
+        for (unsigned i = 0; i < threads; ++i)
+        {
+            workers.emplace_back([this] { run(); });
+        }
+    }
+
+    FlacEncoderPool::~FlacEncoderPool()
+    {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (auto& worker : workers)
+        {
+            worker.join();
+        }
+    }
+
+    std::future<std::string> FlacEncoderPool::submit(
+        std::function<std::string()> job)
+    {
+        std::packaged_task<std::string()> task(std::move(job));
+        auto result = task.get_future();
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            jobs.push_back(std::move(task));
+        }
+        wake.notify_one();
+        return result;
+    }
+
+    void FlacEncoderPool::run()
+    {
+        for (;;)
+        {
+            std::packaged_task<std::string()> task;
+            {
+                std::unique_lock<std::mutex> guard(lock);
+                wake.wait(guard, [&] { return stopping || !jobs.empty(); });
+                if (jobs.empty())
+                {
+                    return;
+                }
+                task = std::move(jobs.front());
+                jobs.pop_front();
+            }
+            task();
+        }
+    }
+
+    FlacStream::FlacStream(std::ostream& out, const WavFormat& format,
+                           FlacEncoderPool& pool)
+        : out(out), format(format), pool(pool)
+    {
+        start = out.tellp();
+        writeStreamInfo();
+    }
+
+    void FlacStream::writeStreamInfo()
+    {
+        BitWriter bits;
+        bits.put(0x664C6143, 32);  // "fLaC"
+        bits.put(0x80, 8);         // last metadata block, STREAMINFO
+        bits.put(34, 24);
+        bits.put(flacBlockSize, 16);
+        bits.put(flacBlockSize, 16);
+        bits.put(0, 24);  // frame sizes unknown
+        bits.put(0, 24);
+        bits.put(format.sampleRate, 20);
+        bits.put(format.numChannels - 1, 3);
+        bits.put(format.bitsPerSample - 1, 5);
+        bits.put(uint32_t(totalSamples >> 32), 4);
+        bits.put(uint32_t(totalSamples), 32);
+        for (int i = 0; i < 4; ++i)
+        {
+            bits.put(0, 32);  // no MD5
+        }
+        out.write(bits.out.data(), bits.out.size());
+    }
+
+    void FlacStream::append(std::span<const char> pcm)
+    {
+        auto bytes = format.bitsPerSample / 8;
+        auto unit = size_t(format.blockAlign());
+
+        auto take = [&](const char* p, size_t size) {
+            for (size_t at = 0; at + bytes <= size; at += bytes)
+            {
+                // little-endian, sign extended from the top byte
+                uint32_t v = 0;
+                memcpy(&v, p + at, bytes);
+                int32_t s;
+                if (bytes == 1)
+                {
+                    s = int32_t(v) - 128;  // 8 bit WAV is unsigned
+                }
+                else
+                {
+                    auto shift = 32 - 8 * bytes;
+                    s = int32_t(v << shift) >> shift;
+                }
+                pending.push_back(s);
+            }
+        };
+
+        if (!partial.empty())
+        {
+            auto need = std::min(unit - partial.size(), pcm.size());
+            partial.append(pcm.data(), need);
+            pcm = pcm.subspan(need);
+            if (partial.size() < unit)
+            {
+                return;
+            }
+            take(partial.data(), unit);
+            partial.clear();
+        }
+        auto whole = pcm.size() / unit * unit;
+        take(pcm.data(), whole);
+        partial.assign(pcm.data() + whole, pcm.size() - whole);
+
+        auto batch = size_t(batchFrames) * flacBlockSize * format.numChannels;
+        if (pending.size() >= batch)
+        {
+            submit(pending.size() / batch * batch);
+        }
+    }
+
+    void FlacStream::submit(size_t samples)
+    {
+        auto channels = format.numChannels;
+        auto batch = size_t(batchFrames) * flacBlockSize * channels;
+        for (size_t at = 0; at < samples; at += batch)
+        {
+            auto size = std::min(batch, samples - at);
+            std::vector<int32_t> block(pending.begin() + at,
+                                       pending.begin() + at + size);
+            auto first = nextFrame;
+            auto count = uint32_t(size / channels);
+            nextFrame += (count + flacBlockSize - 1) / flacBlockSize;
+            totalSamples += count;
+
+            auto fmt = format;
+            frames.push_back(pool.submit(
+                [block = std::move(block), count, fmt, first] {
+                    std::string encoded;
+                    for (uint32_t i = 0; i < count; i += flacBlockSize)
+                    {
+                        auto n = std::min(flacBlockSize, count - i);
+                        encoded += encodeFlacFrame(
+                            block.data() + size_t(i) * fmt.numChannels, n,
+                            fmt, first + i / flacBlockSize);
+                    }
+                    return encoded;
+                }));
+            drain(frames.size() > maxInFlight);
+        }
+        pending.erase(pending.begin(), pending.begin() + samples);
+    }
+
+    void FlacStream::drain(bool wait)
+    {
+        while (!frames.empty() &&
+               (wait || frames.front().wait_for(std::chrono::seconds(0)) ==
+                            std::future_status::ready))
+        {
+            auto encoded = frames.front().get();
+            frames.pop_front();
+            out.write(encoded.data(), encoded.size());
+            wait = false;
+        }
+    }
+
+    bool FlacStream::finish()
+    {
+        submit(pending.size());
+        while (!frames.empty())
+        {
+            drain(true);
+        }
+        if (!partial.empty())
+        {
+            GDEBUG("Dropping " << std::dec << partial.size()
+                               << " bytes of a partial sample");
+            partial.clear();
+        }
+
+        auto end = out.tellp();
+        out.seekp(start);
+        writeStreamInfo();
+        out.seekp(end);
+        return bool(out);
+    }
+}  // namespace Recovery
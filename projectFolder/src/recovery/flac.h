@@ -0,0 +1,85 @@
+#pragma once
+
+#include "recovery/wav.h"
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <ostream>
+#include <span>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace Recovery
+{
+    const uint32_t flacBlockSize = 4096;  // samples per frame
+
+    // Encodes one FLAC frame of `count` samples: the best of the fixed
+    // predictors (orders 0 to 4) with partitioned Rice residuals, or the
+    // samples verbatim, or a constant. `samples` are interleaved, `count`
+    // per channel, and `frame` is the frame number.
+    std::string encodeFlacFrame(const int32_t* samples, uint32_t count,
+                                const WavFormat& format, uint64_t frame);
+
+    // Worker threads encoding FLAC frames for any number of streams
+    class FlacEncoderPool
+    {
+    public:
+        // 0 picks the number of cores
+        explicit FlacEncoderPool(unsigned threads = 0);
+        ~FlacEncoderPool();
+
+        std::future<std::string> submit(std::function<std::string()> job);
+
+    private:
+        void run();
+
+        std::mutex lock;
+        std::condition_variable wake;
+        std::deque<std::packaged_task<std::string()>> jobs;
+        bool stopping = false;
+        std::vector<std::thread> workers;
+    };
+
+    // Mono FLAC stream fed with the same little-endian PCM a WAV data
+    // chunk holds, so it decodes to exactly the samples of the WAV
+    // output. Frames are encoded on `pool` and written to `out` in order
+    // as they complete.
+    class FlacStream
+    {
+    public:
+        FlacStream(std::ostream& out, const WavFormat& format,
+                   FlacEncoderPool& pool);
+
+        // Samples may be split between calls
+        void append(std::span<const char> pcm);
+
+        // Encodes what is left, waits for all frames and fills in the
+        // STREAMINFO block. A trailing partial sample is dropped.
+        bool finish();
+
+        uint64_t samples() const
+        {
+            return totalSamples;
+        }
+
+    private:
+        void writeStreamInfo();
+        void submit(size_t samples);  // the first `samples` of pending
+        void drain(bool wait);        // writes the frames done, or one
+
+        std::ostream& out;
+        WavFormat format;
+        FlacEncoderPool& pool;
+        std::vector<int32_t> pending;  // samples of the next frames
+        std::string partial;           // bytes of a split sample
+        std::deque<std::future<std::string>> frames;  // in stream order
+        uint64_t nextFrame = 0;
+        uint64_t totalSamples = 0;
+        std::streampos start;  // of the STREAMINFO patched by finish()
+    };
+
+}  // namespace Recovery
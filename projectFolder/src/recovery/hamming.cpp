@@ -0,0 +1,113 @@
+#include "hamming.h"
+#include <bit>
+#include <cstring>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+namespace Recovery
+{
+    namespace
+    {
+        // windows compared by the prefilter of nearlyEqual()
+        const size_t sampleWindows = 8;
+        const size_t sampleSize = 32;
+
+        uint64_t popcountTail(const char* a, const char* b, size_t size)
+        {
+            uint64_t bits = 0;
+            size_t i = 0;
+            for (; i + 8 <= size; i += 8)
+            {
+                uint64_t x, y;
+                memcpy(&x, a + i, sizeof(x));
+                memcpy(&y, b + i, sizeof(y));
+                bits += std::popcount(x ^ y);
+            }
+            for (; i < size; ++i)
+            {
+                bits += std::popcount(uint8_t(a[i] ^ b[i]));
+            }
+            return bits;
+        }
+    }  // namespace
+
+    uint64_t hammingDistance(const char* a, const char* b, size_t size,
+                             uint64_t limit)
+    {
+        uint64_t bits = 0;
+        size_t i = 0;
+
+#if defined(__AVX2__)
+        // nibble lookup popcount, byte counts summed with sad every 256
+        // bytes, which is also where the limit is checked
+        const auto lut = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3,
+                                          2, 3, 3, 4, 0, 1, 1, 2, 1, 2, 2, 3,
+                                          1, 2, 2, 3, 2, 3, 3, 4);
+        const auto nibble = _mm256_set1_epi8(0x0f);
+        for (; i + 256 <= size; i += 256)
+        {
+            auto counts = _mm256_setzero_si256();
+            for (size_t j = i; j < i + 256; j += 32)
+            {
+                auto x = _mm256_xor_si256(
+                    _mm256_loadu_si256((const __m256i*)(a + j)),
+                    _mm256_loadu_si256((const __m256i*)(b + j)));
+                auto lo = _mm256_and_si256(x, nibble);
+                auto hi = _mm256_and_si256(_mm256_srli_epi16(x, 4), nibble);
+                counts = _mm256_add_epi8(
+                    counts, _mm256_add_epi8(_mm256_shuffle_epi8(lut, lo),
+                                            _mm256_shuffle_epi8(lut, hi)));
+            }
+            auto sums = _mm256_sad_epu8(counts, _mm256_setzero_si256());
+            bits += _mm256_extract_epi64(sums, 0) +
+                    _mm256_extract_epi64(sums, 1) +
+                    _mm256_extract_epi64(sums, 2) +
+                    _mm256_extract_epi64(sums, 3);
+            if (bits > limit)
+            {
+                return bits;
+            }
+        }
+#else
+        for (; i + 256 <= size; i += 256)
+        {
+            bits += popcountTail(a + i, b + i, 256);
+            if (bits > limit)
+            {
+                return bits;
+            }
+        }
+#endif
+        return bits + popcountTail(a + i, b + i, size - i);
+    }
+
+    bool nearlyEqual(const char* a, const char* b, size_t size,
+                     uint64_t maxBitErrors, uint64_t& bitErrors)
+    {
+        bitErrors = 0;
+        if (maxBitErrors == 0)
+        {
+            return memcmp(a, b, size) == 0;
+        }
+
+        if (size >= sampleWindows * sampleSize)
+        {
+            uint64_t sampled = 0;
+            auto stride = size / sampleWindows;
+            for (size_t w = 0; w < sampleWindows; ++w)
+            {
+                sampled += popcountTail(a + w * stride, b + w * stride,
+                                        sampleSize);
+                if (sampled > maxBitErrors)
+                {
+                    return false;
+                }
+            }
+        }
+
+        bitErrors = hammingDistance(a, b, size, maxBitErrors);
+        return bitErrors <= maxBitErrors;
+    }
+}  // namespace Recovery
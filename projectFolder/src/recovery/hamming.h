@@ -0,0 +1,21 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace Recovery
+{
+    // Number of bits that differ between `a` and `b`, counted with AVX2
+    // where available. Counting stops once `limit` is exceeded, the result
+    // is then some value above `limit`.
+    uint64_t hammingDistance(const char* a, const char* b, size_t size,
+                             uint64_t limit = UINT64_MAX);
+
+    // True if at most `maxBitErrors` bits differ, `bitErrors` is set to
+    // their number on a match. Eight windows spread over the chunk are
+    // compared first, so unrelated chunks are rejected without a full pass
+    // even when they start alike (e.g. both with silence). A plain memcmp
+    // for maxBitErrors 0.
+    bool nearlyEqual(const char* a, const char* b, size_t size,
+                     uint64_t maxBitErrors, uint64_t& bitErrors);
+}  // namespace Recovery
@@ -0,0 +1,362 @@
+#include "imageSource.h"
+#include "flexibity/log.h"
+#include "metrics.h"
+#include "multiPartImage.h"
+#include "xzImageSource.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+
+#ifndef WINDOWS
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+namespace Recovery
+{
+    namespace
+    {
+        std::span<const char> clamp(std::span<const char> data,
+                                    uint64_t offset, size_t size)
+        {
+            if (offset >= data.size())
+            {
+                return {};
+            }
+            auto avail = data.size() - offset;
+            return data.subspan(offset, size < avail ? size : avail);
+        }
+
+        const char xzMagic[6] = {'\xFD', '7', 'z', 'X', 'Z', '\0'};
+        const size_t tarBlock = 512;
+
+        uint64_t tarNumber(const char* field, size_t size)
+        {
+            // GNU base-256 encoding for sizes over 8 GB
+            if (field[0] & 0x80)
+            {
+                uint64_t value = 0;
+                for (size_t i = 1; i < size; ++i)
+                {
+                    value = value << 8 | uint8_t(field[i]);
+                }
+                return value;
+            }
+            return strtoull(std::string(field, size).c_str(), nullptr, 8);
+        }
+
+        // A tar archive is replaced by a slice over its first regular file
+        std::unique_ptr<ImageSource> unpackTar(std::unique_ptr<ImageSource> src)
+        {
+            auto header = src->read(0, tarBlock);
+            if (header.size() != tarBlock ||
+                memcmp(header.data() + 257, "ustar", 5) != 0)
+            {
+                return src;
+            }
+
+            uint64_t pos = 0;
+            while (pos + tarBlock <= src->size())
+            {
+                header = src->read(pos, tarBlock);
+                auto size = tarNumber(header.data() + 124, 12);
+                auto type = header[156];
+                std::string name(header.data(), strnlen(header.data(), 100));
+
+                if (name.empty())
+                {
+                    break;
+                }
+                if (type == '0' || type == '\0' || type == '7')
+                {
+                    GINFO("Reading " << name << " from tar archive");
+                    return std::make_unique<SliceImageSource>(
+                        std::move(src), pos + tarBlock, size);
+                }
+
+                // directories, long names, pax headers
+                pos += tarBlock + (size + tarBlock - 1) / tarBlock * tarBlock;
+            }
+
+            GERROR("No file found in tar archive");
+            return nullptr;
+        }
+    }  // namespace
+
+    bool StreamImageSource::open(const std::string& fn)
+    {
+        img.open(fn, std::ios::binary);
+        if (!img.is_open())
+        {
+            GERROR("Unable to open image " << fn << " with " << img.rdstate());
+            return false;
+        }
+        img.seekg(0, std::ios_base::end);
+        imgSize = img.tellg();
+        return true;
+    }
+
+    std::span<const char> StreamImageSource::read(uint64_t offset,
+                                                  size_t size)
+    {
+        if (offset >= imgSize)
+        {
+            return {};
+        }
+        if (readBuf.size() < size)
+        {
+            readBuf.resize(size);
+        }
+        StageTimer timer(metrics().readTime);
+        img.clear();
+        if (offset != next)
+        {
+            metrics().seeks.add();
+        }
+        img.seekg(offset);
+        img.read(readBuf.data(), size);
+        next = offset + img.gcount();
+        metrics().reads.add();
+        metrics().bytesRead.add(img.gcount());
+        return {readBuf.data(), size_t(img.gcount())};
+    }
+
+#ifndef WINDOWS
+    MmapImageSource::~MmapImageSource()
+    {
+        if (map)
+        {
+            munmap((void*)map, mapSize);
+        }
+    }
+
+    bool MmapImageSource::open(const std::string& fn)
+    {
+        int fd = ::open(fn.c_str(), O_RDONLY);
+        if (fd < 0)
+        {
+            GERROR("Unable to open image " << fn << ": " << strerror(errno));
+            return false;
+        }
+
+        // st_size is 0 for block devices, seeking works for both
+        auto size = lseek(fd, 0, SEEK_END);
+        if (size <= 0)
+        {
+            GERROR("Unable to size image " << fn << ": " << strerror(errno));
+            ::close(fd);
+            return false;
+        }
+
+        auto addr = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+        // the mapping keeps its own reference to the file
+        ::close(fd);
+        if (addr == MAP_FAILED)
+        {
+            GERROR("Unable to map image " << fn << ": " << strerror(errno));
+            return false;
+        }
+
+        map = (const char*)addr;
+        mapSize = size;
+        return true;
+    }
+
+    std::span<const char> MmapImageSource::read(uint64_t offset, size_t size)
+    {
+        // pages are only faulted in when the view is used, so there is no
+        // read time to take here
+        auto view = clamp({map, mapSize}, offset, size);
+        metrics().reads.add();
+        metrics().bytesRead.add(view.size());
+        return view;
+    }
+
+    void MmapImageSource::advise(Access access, uint64_t offset,
+                                 uint64_t length)
+    {
+        if (offset >= mapSize)
+        {
+            return;
+        }
+        length = std::min(length, mapSize - offset);
+
+        // madvise wants a page aligned start
+        static const uint64_t pageSize = sysconf(_SC_PAGESIZE);
+        auto aligned = offset & ~(pageSize - 1);
+        length += offset - aligned;
+
+        int advice = MADV_NORMAL;
+        switch (access)
+        {
+            case Access::Normal:
+                advice = MADV_NORMAL;
+                break;
+            case Access::Sequential:
+                advice = MADV_SEQUENTIAL;
+                break;
+            case Access::Random:
+                advice = MADV_RANDOM;
+                break;
+            case Access::WillNeed:
+                advice = MADV_WILLNEED;
+                break;
+            case Access::DontNeed:
+                advice = MADV_DONTNEED;
+                break;
+        }
+
+        if (madvise((void*)(map + aligned), length, advice) != 0)
+        {
+            GDEBUG("madvise " << advice << " failed: " << strerror(errno));
+        }
+    }
+#else
+    MmapImageSource::~MmapImageSource() = default;
+
+    bool MmapImageSource::open(const std::string& fn)
+    {
+        GERROR("mmap backend is not available on this platform, image " << fn);
+        return false;
+    }
+
+    std::span<const char> MmapImageSource::read(uint64_t, size_t)
+    {
+        return {};
+    }
+
+    void MmapImageSource::advise(Access, uint64_t, uint64_t) {}
+#endif
+
+    std::span<const char> MemoryImageSource::read(uint64_t offset, size_t size)
+    {
+        return clamp(data, offset, size);
+    }
+
+    std::span<const char> SliceImageSource::read(uint64_t offset, size_t size)
+    {
+        if (offset >= sliceSize)
+        {
+            return {};
+        }
+        return src->read(base + offset,
+                         std::min<uint64_t>(size, sliceSize - offset));
+    }
+
+    void SliceImageSource::advise(Access access, uint64_t offset,
+                                  uint64_t length)
+    {
+        src->advise(access, base + offset, length);
+    }
+
+    namespace
+    {
+        std::unique_ptr<ImageSource> openFile(const std::string& fn,
+                                              const std::string& backend)
+        {
+            if (backend == "mmap")
+            {
+                auto mmapSrc = std::make_unique<MmapImageSource>();
+                if (mmapSrc->open(fn))
+                {
+                    return mmapSrc;
+                }
+            }
+            else if (backend == "stream")
+            {
+                auto streamSrc = std::make_unique<StreamImageSource>();
+                if (streamSrc->open(fn))
+                {
+                    return streamSrc;
+                }
+            }
+            else
+            {
+                GERROR("Unknown image backend " << backend);
+            }
+            return nullptr;
+        }
+    }  // namespace
+
+    std::unique_ptr<ImageSource> openImage(const ImageSpec& spec,
+                                           const std::string& backend)
+    {
+        if (spec.parts.empty())
+        {
+            GERROR("No image given");
+            return nullptr;
+        }
+        auto& fn = spec.parts.front();
+
+        std::unique_ptr<ImageSource> src;
+        if (spec.parts.size() > 1)
+        {
+            auto concat = std::make_unique<ConcatImageSource>();
+            for (auto& part : spec.parts)
+            {
+                auto partSrc = openFile(part, backend);
+                if (!partSrc)
+                {
+                    return nullptr;
+                }
+                concat->add(std::move(partSrc));
+            }
+            GINFO("Reading " << std::dec << spec.parts.size() << " parts "
+                             << spec.parts.front() << " to "
+                             << spec.parts.back() << " as one image of "
+                             << concat->size() << " bytes");
+            src = std::move(concat);
+        }
+        else
+        {
+            src = openFile(fn, backend);
+        }
+        if (!src)
+        {
+            return nullptr;
+        }
+
+        auto magic = src->read(0, sizeof(xzMagic));
+        if (magic.size() == sizeof(xzMagic) &&
+            memcmp(magic.data(), xzMagic, sizeof(xzMagic)) == 0)
+        {
+#ifdef HAVE_LZMA
+            auto xz = std::make_unique<XzImageSource>();
+            if (!xz->open(std::move(src)))
+            {
+                GERROR("Unable to decode xz image " << fn);
+                return nullptr;
+            }
+            src = std::move(xz);
+#else
+            GERROR("Built without liblzma, extract " << fn << " first");
+            return nullptr;
+#endif
+        }
+
+        src = unpackTar(std::move(src));
+
+        if (src && !spec.rescueMap.empty())
+        {
+            std::vector<ByteRange> unread;
+            if (!loadRescueMap(spec.rescueMap, unread))
+            {
+                return nullptr;
+            }
+            uint64_t bytes = 0;
+            for (auto& range : unread)
+            {
+                bytes += range.length;
+            }
+            GINFO("ddrescue mapfile " << spec.rescueMap << ": " << std::dec
+                                      << bytes << " bytes in "
+                                      << unread.size()
+                                      << " ranges unread, read as zeros");
+            src = std::make_unique<RescuedImageSource>(std::move(src),
+                                                       std::move(unread));
+        }
+        return src;
+    }
+}  // namespace Recovery
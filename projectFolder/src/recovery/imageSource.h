@@ -0,0 +1,183 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <span>
+#include <string>
+#include <vector>
+
+namespace Recovery
+{
+    // Random access to a card image. read() hands out a view into memory
+    // owned by the source: for the mmap backend that is the mapping itself,
+    // so no copy and no syscall is made per chunk. A view stays valid until
+    // the next read() on the same source.
+    class ImageSource
+    {
+    public:
+        // Access pattern hints, mapped to madvise() by the mmap backend
+        enum class Access
+        {
+            Normal,
+            Sequential,
+            Random,
+            WillNeed,
+            DontNeed,
+        };
+
+        virtual ~ImageSource() = default;
+
+        virtual uint64_t size() const = 0;
+
+        // Returns up to `size` bytes at `offset`, shorter at the end of the
+        // image and empty past it
+        virtual std::span<const char> read(uint64_t offset, size_t size) = 0;
+
+        // True if read() may be called from several threads at once
+        virtual bool concurrentReads() const
+        {
+            return false;
+        }
+
+        // True if offsets are file offsets of the opened file, i.e. it is
+        // not decoded or sliced out of a container
+        virtual bool isPlainFile() const
+        {
+            return false;
+        }
+
+        virtual void advise(Access access, uint64_t offset, uint64_t length)
+        {
+            (void)access;
+            (void)offset;
+            (void)length;
+        }
+    };
+
+    // Buffered std::ifstream reader, works everywhere
+    class StreamImageSource : public ImageSource
+    {
+    public:
+        bool open(const std::string& fn);
+
+        uint64_t size() const override
+        {
+            return imgSize;
+        }
+        std::span<const char> read(uint64_t offset, size_t size) override;
+
+        bool isPlainFile() const override
+        {
+            return true;
+        }
+
+    private:
+        std::ifstream img;
+        uint64_t imgSize = 0;
+        uint64_t next = 0;  // offset following the last read
+        std::vector<char> readBuf;
+    };
+
+    // Read only mapping of the whole image
+    class MmapImageSource : public ImageSource
+    {
+    public:
+        ~MmapImageSource() override;
+
+        bool open(const std::string& fn);
+
+        uint64_t size() const override
+        {
+            return mapSize;
+        }
+        std::span<const char> read(uint64_t offset, size_t size) override;
+        void advise(Access access, uint64_t offset, uint64_t length) override;
+
+        bool concurrentReads() const override
+        {
+            return true;
+        }
+        bool isPlainFile() const override
+        {
+            return true;
+        }
+
+    private:
+        const char* map = nullptr;
+        uint64_t mapSize = 0;
+    };
+
+    // Image already in memory (tests, embedding)
+    class MemoryImageSource : public ImageSource
+    {
+    public:
+        explicit MemoryImageSource(std::span<const char> data) : data(data)
+        {
+        }
+
+        uint64_t size() const override
+        {
+            return data.size();
+        }
+        std::span<const char> read(uint64_t offset, size_t size) override;
+
+        bool concurrentReads() const override
+        {
+            return true;
+        }
+
+    private:
+        std::span<const char> data;
+    };
+
+    // Window of another source, e.g. the member of a tar archive
+    class SliceImageSource : public ImageSource
+    {
+    public:
+        SliceImageSource(std::unique_ptr<ImageSource> src, uint64_t base,
+                         uint64_t size)
+            : src(std::move(src)), base(base), sliceSize(size)
+        {
+        }
+
+        uint64_t size() const override
+        {
+            return sliceSize;
+        }
+        std::span<const char> read(uint64_t offset, size_t size) override;
+        void advise(Access access, uint64_t offset, uint64_t length) override;
+
+        bool concurrentReads() const override
+        {
+            return src->concurrentReads();
+        }
+
+    private:
+        std::unique_ptr<ImageSource> src;
+        uint64_t base;
+        uint64_t sliceSize;
+    };
+
+    // The files a card image is read from: one file, or the parts of a
+    // split dump joined in the order given. With the GNU ddrescue
+    // `rescueMap` of the joined image the ranges ddrescue couldn't read
+    // come as zeros. Nothing is guessed from file names.
+    struct ImageSpec
+    {
+        std::vector<std::string> parts;
+        std::string rescueMap;
+
+        ImageSpec() = default;
+        ImageSpec(std::string fn) : parts{std::move(fn)} {}
+        ImageSpec(const char* fn) : parts{fn} {}
+    };
+
+    // Opens `spec` with the named backend ("mmap" or "stream"). xz
+    // compressed images are decoded on the fly (when built with liblzma)
+    // and a tar archive is opened as its first file. Returns nullptr if
+    // the image or its mapfile can't be opened.
+    std::unique_ptr<ImageSource> openImage(const ImageSpec& spec,
+                                           const std::string& backend);
+}  // namespace Recovery
@@ -0,0 +1,223 @@
+#include "interleave.h"
+#include <array>
+#include <cstring>
+#include <type_traits>
+#include <utility>
+
+#if defined(__SSSE3__)
+#include <immintrin.h>
+#endif
+
+namespace Recovery
+{
+    namespace
+    {
+        // Calls f(std::integral_constant<size_t, i>) for i below N, spelled
+        // out by the compiler
+        template <size_t N, typename F>
+        inline void unroll(const F& f)
+        {
+            [&]<size_t... I>(std::index_sequence<I...>) {
+                (f(std::integral_constant<size_t, I>{}), ...);
+            }(std::make_index_sequence<N>{});
+        }
+
+        // transpose24() of the Channel Blocks of one Data Block, with the
+        // stride and the track count known at compile time: no channel
+        // pointers to load and every track of a frame copied unrolled
+        template <uint32_t ChunkSize, uint32_t Repition, uint32_t NumTracks>
+        void interleave24(const char* dataBlock, size_t start, size_t frames,
+                          char* out)
+        {
+            constexpr size_t stride = size_t(ChunkSize) * Repition;
+            constexpr size_t frameSize = size_t(NumTracks) * 3;
+            const char* base = dataBlock + start;
+            for (size_t f = 0; f < frames; ++f)
+            {
+                char* row = out + frameSize * f;
+                unroll<NumTracks>([&](auto c) {
+                    memcpy(row + 3 * c, base + stride * c + 3 * f, 3);
+                });
+            }
+        }
+
+        struct KernelEntry
+        {
+            InterleaveKernelKey key;
+            InterleaveKernel kernel;
+        };
+
+        template <uint32_t ChunkSize, uint32_t Repition, uint32_t NumTracks>
+        constexpr KernelEntry entry24()
+        {
+            return {{ChunkSize, Repition, NumTracks, 24},
+                    &interleave24<ChunkSize, Repition, NumTracks>};
+        }
+
+        // The SSSE3 transpose24() is as fast as these, they only pay off
+        // where it falls back to copying sample by sample
+#if defined(__SSSE3__)
+        const std::array<KernelEntry, 0> kernels = {};
+#else
+        const std::array<KernelEntry, 3> kernels = {
+            entry24<0x8000, 8, 32>(),
+            entry24<0x8000, 8, 34>(),
+            entry24<0x8000, 8, 64>(),
+        };
+#endif
+
+        const std::array<InterleaveKernelKey, kernels.size()> kernelKeys = [] {
+            std::array<InterleaveKernelKey, kernels.size()> keys = {};
+            for (size_t i = 0; i < kernels.size(); ++i)
+            {
+                keys[i] = kernels[i].key;
+            }
+            return keys;
+        }();
+    }  // namespace
+
+    void transpose24(const char* const* channels, uint32_t numChannels,
+                     size_t frames, char* out)
+    {
+        auto frameSize = size_t(numChannels) * 3;
+        size_t f = 0;
+
+#if defined(__SSSE3__)
+        // 4 samples of 4 channels at a time: spread to 32 bit lanes,
+        // transpose the 4x4 lanes and pack every frame back to 12 bytes.
+        // The 16 byte loads read 4 bytes ahead, hence the margin.
+        const __m128i spread = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7,
+                                             8, -1, 9, 10, 11, -1);
+        const __m128i pack = _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12,
+                                           13, 14, -1, -1, -1, -1);
+        auto load = [&](uint32_t c) {
+            return _mm_shuffle_epi8(
+                _mm_loadu_si128((const __m128i*)(channels[c] + 3 * f)),
+                spread);
+        };
+        auto store = [&](char* p, __m128i v) {
+            v = _mm_shuffle_epi8(v, pack);
+            _mm_storel_epi64((__m128i*)p, v);
+            uint32_t rest = _mm_cvtsi128_si32(_mm_srli_si128(v, 8));
+            memcpy(p + 8, &rest, 4);
+        };
+
+        for (; f + 6 <= frames; f += 4)
+        {
+            char* row = out + frameSize * f;
+            uint32_t c = 0;
+            for (; c + 4 <= numChannels; c += 4)
+            {
+                auto a = load(c);
+                auto b = load(c + 1);
+                auto d = load(c + 2);
+                auto e = load(c + 3);
+
+                auto ab01 = _mm_unpacklo_epi32(a, b);
+                auto de01 = _mm_unpacklo_epi32(d, e);
+                auto ab23 = _mm_unpackhi_epi32(a, b);
+                auto de23 = _mm_unpackhi_epi32(d, e);
+
+                store(row + 3 * c, _mm_unpacklo_epi64(ab01, de01));
+                store(row + frameSize + 3 * c, _mm_unpackhi_epi64(ab01, de01));
+                store(row + 2 * frameSize + 3 * c,
+                      _mm_unpacklo_epi64(ab23, de23));
+                store(row + 3 * frameSize + 3 * c,
+                      _mm_unpackhi_epi64(ab23, de23));
+            }
+            for (; c < numChannels; ++c)
+            {
+                for (size_t i = 0; i < 4; ++i)
+                {
+                    memcpy(row + frameSize * i + 3 * c,
+                           channels[c] + 3 * (f + i), 3);
+                }
+            }
+        }
+#endif
+        for (; f < frames; ++f)
+        {
+            char* row = out + frameSize * f;
+            for (uint32_t c = 0; c < numChannels; ++c)
+            {
+                memcpy(row + 3 * c, channels[c] + 3 * f, 3);
+            }
+        }
+    }
+
+    InterleaveKernel findInterleaveKernel(const Layout& layout,
+                                          uint16_t bitsPerSample)
+    {
+        for (auto& entry : kernels)
+        {
+            auto& key = entry.key;
+            if (key.chunkSize == layout.chunkSize &&
+                key.repition == layout.repition &&
+                key.numTracks == layout.numTracks &&
+                key.bitsPerSample == bitsPerSample)
+            {
+                return entry.kernel;
+            }
+        }
+        return nullptr;
+    }
+
+    std::span<const InterleaveKernelKey> interleaveKernelKeys()
+    {
+        return kernelKeys;
+    }
+
+    Interleaver::Interleaver(const Layout& layout)
+        : layout(layout),
+          kernel(findInterleaveKernel(layout)),
+          carry(layout.numTracks * 2),
+          channels(layout.numTracks)
+    {
+    }
+
+    std::span<const char> Interleaver::append(const char* dataBlock)
+    {
+        auto channelBlockSize = layout.channelBlockSize();
+        auto numTracks = layout.numTracks;
+        auto frameSize = size_t(numTracks) * 3;
+        frames.resize((pending + channelBlockSize) / 3 * frameSize);
+
+        // first complete the samples split by the previous Data Block
+        size_t start = 0;
+        char* out = frames.data();
+        if (pending)
+        {
+            start = 3 - pending;
+            for (uint32_t t = 0; t < numTracks; ++t)
+            {
+                memcpy(out + 3 * t, carry.data() + 2 * t, pending);
+                memcpy(out + 3 * t + pending,
+                       dataBlock + channelBlockSize * t, start);
+            }
+            out += frameSize;
+        }
+
+        auto count = (channelBlockSize - start) / 3;
+        for (uint32_t t = 0; t < numTracks; ++t)
+        {
+            channels[t] = dataBlock + channelBlockSize * t + start;
+        }
+        if (kernel)
+        {
+            kernel(dataBlock, start, count, out);
+        }
+        else
+        {
+            transpose24(channels.data(), numTracks, count, out);
+        }
+
+        auto used = start + 3 * count;
+        pending = channelBlockSize - used;
+        for (uint32_t t = 0; t < numTracks; ++t)
+        {
+            memcpy(carry.data() + 2 * t, channels[t] + 3 * count, pending);
+        }
+
+        return frames;
+    }
+}  // namespace Recovery
@@ -0,0 +1,64 @@
+#pragma once
+
+#include "recovery/layout.h"
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+namespace Recovery
+{
+    // Transposes `frames` 24 bit samples of each of `numChannels` channels
+    // into frame interleaved samples at `out` (frames * numChannels * 3
+    // bytes), vectorized with SSSE3 where available
+    void transpose24(const char* const* channels, uint32_t numChannels,
+                     size_t frames, char* out);
+
+    // Interleaves `frames` samples of every track of the Data Block at
+    // `dataBlock` into frames at `out`, the samples of each track starting
+    // `start` bytes into its Channel Block
+    using InterleaveKernel = void (*)(const char* dataBlock, size_t start,
+                                      size_t frames, char* out);
+
+    // Layout and sample format an interleave kernel is compiled for
+    struct InterleaveKernelKey
+    {
+        uint32_t chunkSize;
+        uint32_t repition;
+        uint32_t numTracks;
+        uint16_t bitsPerSample;
+    };
+
+    // In builds without SSSE3 the layouts of the common consoles (32, 34
+    // and 64 tracks of 0x8000 byte chunks repeated 8 times, 24 bit) have
+    // kernels with the Channel Block stride and track count built in and
+    // every frame copied unrolled. Returns nullptr for other layouts and
+    // in SSSE3 builds, where transpose24() is as fast.
+    InterleaveKernel findInterleaveKernel(const Layout& layout,
+                                          uint16_t bitsPerSample = 24);
+
+    // Layouts findInterleaveKernel() has a kernel for
+    std::span<const InterleaveKernelKey> interleaveKernelKeys();
+
+    // Turns the Channel Blocks of consecutive Data Blocks into frames of
+    // all tracks. A Channel Block rarely holds a whole number of samples,
+    // the sample split between two of them is completed by the next Data
+    // Block.
+    class Interleaver
+    {
+    public:
+        explicit Interleaver(const Layout& layout);
+
+        // Interleaves one Data Block. Returns the complete frames, valid
+        // until the next call.
+        std::span<const char> append(const char* dataBlock);
+
+    private:
+        Layout layout;
+        InterleaveKernel kernel;  // nullptr for transpose24()
+        unsigned pending = 0;     // bytes of every track's split sample
+        std::vector<char> carry;  // and the bytes themselves, 2 per track
+        std::vector<const char*> channels;
+        std::vector<char> frames;
+    };
+}  // namespace Recovery
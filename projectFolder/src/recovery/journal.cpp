@@ -0,0 +1,174 @@
+#include "journal.h"
+#include "flexibity/log.h"
+#include <cstring>
+#include <filesystem>
+
+namespace Recovery
+{
+    namespace
+    {
+        const char fileMagic[8] = {'P', 'S', 'J', 'O', 'U', 'R', 'N', '1'};
+
+        template <typename T>
+        void put(std::ostream& out, const T& value)
+        {
+            out.write((const char*)&value, sizeof(value));
+        }
+
+        template <typename T>
+        void put(std::ostream& out, const std::vector<T>& values)
+        {
+            put(out, uint64_t(values.size()));
+            out.write((const char*)values.data(), values.size() * sizeof(T));
+        }
+
+        template <typename T>
+        bool get(std::istream& in, T& value)
+        {
+            return bool(in.read((char*)&value, sizeof(value)));
+        }
+
+        template <typename T>
+        bool get(std::istream& in, std::vector<T>& values)
+        {
+            uint64_t size = 0;
+            if (!get(in, size) || size > (1u << 24))
+            {
+                return false;
+            }
+            values.resize(size);
+            return bool(in.read((char*)values.data(), size * sizeof(T)));
+        }
+    }  // namespace
+
+    bool JobState::sameJob(const JobState& other) const
+    {
+        return mode == other.mode && offset == other.offset &&
+               chunkSize == other.chunkSize && repition == other.repition &&
+               numTracks == other.numTracks && count == other.count &&
+               selected == other.selected;
+    }
+
+    bool JobState::save(const std::string& fn) const
+    {
+        auto tmp = fn + ".tmp";
+        {
+            std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+            out.write(fileMagic, sizeof(fileMagic));
+            put(out, mode);
+            put(out, offset);
+            put(out, chunkSize);
+            put(out, repition);
+            put(out, numTracks);
+            put(out, count);
+            put(out, selected);
+            put(out, position);
+            put(out, outputs);
+            put(out, chunks);
+            put(out, matched);
+            put(out, matches);
+            put(out, skipped);
+            put(out, damaged);
+            put(out, bitErrors);
+            out.flush();
+            if (!out)
+            {
+                GERROR("Unable to write journal " << tmp);
+                return false;
+            }
+        }
+
+        std::error_code error;
+        std::filesystem::rename(tmp, fn, error);
+        if (error)
+        {
+            GERROR("Unable to replace journal " << fn << ": "
+                                                << error.message());
+            return false;
+        }
+        return true;
+    }
+
+    bool JobState::load(const std::string& fn)
+    {
+        std::ifstream in(fn, std::ios::binary);
+        char magic[sizeof(fileMagic)] = {};
+        if (!in.read(magic, sizeof(magic)) ||
+            memcmp(magic, fileMagic, sizeof(fileMagic)) != 0)
+        {
+            GERROR("Not a job journal: " << fn);
+            return false;
+        }
+        if (!get(in, mode) || !get(in, offset) || !get(in, chunkSize) ||
+            !get(in, repition) || !get(in, numTracks) || !get(in, count) ||
+            !get(in, selected) || !get(in, position) || !get(in, outputs) ||
+            !get(in, chunks) || !get(in, matched) || !get(in, matches) ||
+            !get(in, skipped) || !get(in, damaged) || !get(in, bitErrors))
+        {
+            GERROR("Truncated job journal: " << fn);
+            return false;
+        }
+        return true;
+    }
+
+    Checkpointer::Checkpointer(std::string fn, std::chrono::seconds interval)
+        : fn(std::move(fn)),
+          interval(interval),
+          last(std::chrono::steady_clock::now())
+    {
+    }
+
+    bool Checkpointer::due() const
+    {
+        return !fn.empty() &&
+               std::chrono::steady_clock::now() - last >= interval;
+    }
+
+    bool Checkpointer::save(const JobState& state)
+    {
+        last = std::chrono::steady_clock::now();
+        if (!state.save(fn))
+        {
+            return false;
+        }
+        GDEBUG("Checkpoint at " << std::dec << state.position);
+        return true;
+    }
+
+    void Checkpointer::finish()
+    {
+        if (!fn.empty())
+        {
+            std::error_code error;
+            std::filesystem::remove(fn, error);
+        }
+    }
+
+    bool resumeOutput(std::ofstream& out, const std::string& fn,
+                      uint64_t length)
+    {
+        std::error_code error;
+        auto size = std::filesystem::file_size(fn, error);
+        if (error || size < length)
+        {
+            GERROR("Output " << fn << " is shorter than its checkpoint, "
+                             << std::dec << length << " bytes");
+            return false;
+        }
+        std::filesystem::resize_file(fn, length, error);
+        if (error)
+        {
+            GERROR("Unable to truncate " << fn << ": " << error.message());
+            return false;
+        }
+
+        out.open(fn, std::ios::binary | std::ios::in | std::ios::out);
+        out.seekp(0, std::ios::end);
+        if (!out)
+        {
+            GERROR("Unable to reopen target file " << fn);
+            return false;
+        }
+        return true;
+    }
+}  // namespace Recovery
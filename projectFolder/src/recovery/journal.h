@@ -0,0 +1,66 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+namespace Recovery
+{
+    // Checkpoint of a recovery or mapping job: which job it is and how far
+    // it got. Outputs are flushed before their lengths are recorded, so
+    // the files on disk are never shorter than the journal says.
+    struct JobState
+    {
+        // the job, a journal of another job is not resumed
+        uint32_t mode = 0;
+        uint64_t offset = 0;
+        uint32_t chunkSize = 0;
+        uint32_t repition = 0;
+        uint32_t numTracks = 0;
+        uint32_t count = 0;
+        uint32_t selected = 0;
+
+        // Data Blocks written (modes 3, 4) or chunks scanned (modes 1, 2)
+        uint64_t position = 0;
+        std::vector<uint64_t> outputs;  // bytes of every output file
+        std::vector<uint32_t> chunks;   // next reference chunk per track
+        std::vector<uint8_t> matched;   // reference chunk found per track
+        uint64_t matches = 0;
+        uint64_t skipped = 0;
+        uint64_t damaged = 0;
+        uint64_t bitErrors = 0;
+
+        bool sameJob(const JobState& other) const;
+
+        // Replaces the file at once: an interrupted save leaves the last
+        // checkpoint intact
+        bool save(const std::string& fn) const;
+        bool load(const std::string& fn);
+    };
+
+    // Saves the job state every `interval`. Without a file name it never
+    // comes due, so jobs can checkpoint unconditionally.
+    class Checkpointer
+    {
+    public:
+        Checkpointer(std::string fn, std::chrono::seconds interval);
+
+        bool due() const;
+        bool save(const JobState& state);
+
+        // The job completed: its journal is removed
+        void finish();
+
+    private:
+        std::string fn;
+        std::chrono::seconds interval;
+        std::chrono::steady_clock::time_point last;
+    };
+
+    // Reopens an output of an interrupted job for appending, cut back to
+    // the `length` of its last checkpoint
+    bool resumeOutput(std::ofstream& out, const std::string& fn,
+                      uint64_t length);
+}  // namespace Recovery
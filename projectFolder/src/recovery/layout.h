@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstdint>
+
+namespace Recovery
+{
+    // Interleaved session layout as described in Readme.md:
+    //   Chunk (0x8000) * repition (8) = Channel Block (0x40000)
+    //   Channel Block * numTracks (34) = Data Block (0x880000)
+    struct Layout
+    {
+        uint64_t offset = 0;  // first Data Block in the image
+        uint32_t chunkSize = 0x8000;
+        uint32_t repition = 8;
+        uint32_t numTracks = 34;
+        uint32_t count = 0;  // number of Data Blocks to process
+
+        uint64_t channelBlockSize() const
+        {
+            return uint64_t(chunkSize) * repition;
+        }
+
+        uint64_t dataBlockSize() const
+        {
+            return channelBlockSize() * numTracks;
+        }
+
+        // Image offset of the Channel Block of `track` (0-based)
+        // inside Data Block `block`
+        uint64_t channelBlockOffset(uint32_t block, uint32_t track) const
+        {
+            return offset + dataBlockSize() * block +
+                   channelBlockSize() * track;
+        }
+    };
+}  // namespace Recovery
@@ -0,0 +1,153 @@
+#include "mapper.h"
+#include "flexibity/log.h"
+#include <algorithm>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace Recovery
+{
+    namespace
+    {
+        uint64_t chunksAvailable(uint64_t imgSize, uint64_t offset,
+                                 uint64_t count, uint32_t chunkSize)
+        {
+            uint64_t available =
+                offset < imgSize ? (imgSize - offset) / chunkSize : 0;
+            return count == 0 || count > available ? available : count;
+        }
+    }  // namespace
+
+    MapStats mapImage(ImageSource& img, uint64_t offset, uint64_t count,
+                      uint32_t chunkSize, const ChunkIndex& index,
+                      const MatchSink& sink, const OccupancyMap* occupancy)
+    {
+        MapStats stats;
+
+        count = chunksAvailable(img.size(), offset, count, chunkSize);
+        bool skipDead = occupancy && !index.holdsUniformChunks();
+
+        img.advise(ImageSource::Access::Sequential, offset,
+                   count * chunkSize);
+
+        std::vector<ChunkLocation> matches;
+        for (uint64_t j = 0; j < count; ++j)
+        {
+            auto startPos = offset + j * chunkSize;
+            if (skipDead && !occupancy->live(startPos, chunkSize))
+            {
+                ++stats.skipped;
+                continue;
+            }
+            auto chunk = img.read(startPos, chunkSize);
+
+            ++stats.chunks;
+            if (!index.find(chunk, matches))
+            {
+                continue;
+            }
+
+            ++stats.matched;
+            if (matches.size() > 1)
+            {
+                ++stats.ambiguous;
+            }
+            sink(startPos, matches);
+        }
+
+        return stats;
+    }
+
+    MapStats mapImageParallel(const ImageSpec& image,
+                              const std::string& backend, uint64_t offset,
+                              uint64_t count, uint32_t chunkSize,
+                              const ChunkIndex& index, unsigned threads,
+                              ChunkMap& map, const OccupancyMap* occupancy)
+    {
+        MapStats stats;
+
+        auto first = openImage(image, backend);
+        if (!first)
+        {
+            return stats;
+        }
+        count = chunksAvailable(first->size(), offset, count, chunkSize);
+
+        if (threads == 0)
+        {
+            threads = std::max(1u, std::thread::hardware_concurrency());
+        }
+        if (threads > count)
+        {
+            threads = std::max<uint64_t>(1, count);
+        }
+
+        struct Range
+        {
+            uint64_t offset;
+            uint64_t count;
+            std::unique_ptr<ImageSource> img;
+            MapStats stats;
+            std::vector<std::pair<uint64_t, MappedChunk>> found;
+        };
+
+        std::vector<Range> ranges(threads);
+        auto perRange = (count + threads - 1) / threads;
+        for (unsigned t = 0; t < threads; ++t)
+        {
+            auto& range = ranges[t];
+            auto start = std::min<uint64_t>(count, perRange * t);
+            range.offset = offset + start * chunkSize;
+            range.count = std::min<uint64_t>(count - start, perRange);
+            range.img = t == 0 ? std::move(first) : openImage(image, backend);
+            if (!range.img)
+            {
+                return stats;
+            }
+        }
+
+        auto work = [&](Range& range) {
+            if (range.count == 0)
+            {
+                return;
+            }
+            range.stats = mapImage(
+                *range.img, range.offset, range.count, chunkSize, index,
+                [&](uint64_t startPos,
+                    std::span<const ChunkLocation> matches) {
+                    range.found.push_back(
+                        {startPos,
+                         {matches.front(), uint32_t(matches.size())}});
+                },
+                occupancy);
+        };
+
+        GINFO("Mapping " << std::dec << count << " chunks with " << threads
+                         << " threads");
+        std::vector<std::thread> workers;
+        for (unsigned t = 1; t < threads; ++t)
+        {
+            workers.emplace_back(work, std::ref(ranges[t]));
+        }
+        work(ranges[0]);
+        for (auto& worker : workers)
+        {
+            worker.join();
+        }
+
+        // ranges are disjoint and each one is already sorted
+        for (auto& range : ranges)
+        {
+            stats.chunks += range.stats.chunks;
+            stats.matched += range.stats.matched;
+            stats.skipped += range.stats.skipped;
+            stats.ambiguous += range.stats.ambiguous;
+            for (auto& item : range.found)
+            {
+                map.emplace_hint(map.end(), item.first, item.second);
+            }
+        }
+
+        return stats;
+    }
+}  // namespace Recovery
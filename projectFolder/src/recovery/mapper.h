@@ -0,0 +1,54 @@
+#pragma once
+
+#include "recovery/chunkIndex.h"
+#include "recovery/imageSource.h"
+#include "recovery/occupancy.h"
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <span>
+#include <string>
+
+namespace Recovery
+{
+    struct MapStats
+    {
+        uint64_t chunks = 0;     // image chunks scanned
+        uint64_t matched = 0;    // chunks found in the references
+        uint64_t ambiguous = 0;  // chunks found in more than one place
+        uint64_t skipped = 0;    // dead chunks never read
+    };
+
+    struct MappedChunk
+    {
+        ChunkLocation location;  // first reference location
+        uint32_t candidates;     // number of reference locations
+    };
+
+    // Matched image chunks ordered by image offset
+    using ChunkMap = std::map<uint64_t, MappedChunk>;
+
+    // Receives every matched image chunk with all of its reference locations
+    using MatchSink = std::function<void(
+        uint64_t offset, std::span<const ChunkLocation> matches)>;
+
+    // Looks up `count` chunks of the image starting at `offset` in `index`
+    // (count 0 scans up to the end of the image). Unlike the sequential
+    // mapping modes, chunks may come in any order. Chunks `occupancy`
+    // knows are dead are skipped unless the index holds uniform chunks
+    // they could be equal to.
+    MapStats mapImage(ImageSource& img, uint64_t offset, uint64_t count,
+                      uint32_t chunkSize, const ChunkIndex& index,
+                      const MatchSink& sink,
+                      const OccupancyMap* occupancy = nullptr);
+
+    // Partitioned version of mapImage(): the range is split on chunk
+    // boundaries between `threads` workers (0 picks the number of cores),
+    // each with its own reader of `image`. Results are merged into `map`.
+    MapStats mapImageParallel(const ImageSpec& image,
+                              const std::string& backend, uint64_t offset,
+                              uint64_t count, uint32_t chunkSize,
+                              const ChunkIndex& index, unsigned threads,
+                              ChunkMap& map,
+                              const OccupancyMap* occupancy = nullptr);
+}  // namespace Recovery
@@ -0,0 +1,154 @@
+#include "metrics.h"
+#include <algorithm>
+#include <bit>
+#include <iomanip>
+#include <sstream>
+
+namespace Recovery
+{
+    namespace
+    {
+        void writeHistogram(std::ostream& out, const char* name,
+                            const LatencyHistogram& histogram)
+        {
+            out << "    \"" << name << "\": {\"count\": " << histogram.count()
+                << ", \"totalNs\": " << histogram.total().count()
+                << ", \"p50Ns\": " << histogram.quantile(0.5).count()
+                << ", \"p99Ns\": " << histogram.quantile(0.99).count() << "}";
+        }
+    }  // namespace
+
+    void LatencyHistogram::record(std::chrono::nanoseconds latency)
+    {
+        uint64_t ns = std::max<int64_t>(0, latency.count());
+        counts[std::min<unsigned>(std::bit_width(ns), buckets - 1)].add();
+        sum.add(ns);
+    }
+
+    uint64_t LatencyHistogram::count() const
+    {
+        uint64_t n = 0;
+        for (auto& c : counts)
+        {
+            n += c.get();
+        }
+        return n;
+    }
+
+    std::chrono::nanoseconds LatencyHistogram::total() const
+    {
+        return std::chrono::nanoseconds(sum.get());
+    }
+
+    std::chrono::nanoseconds LatencyHistogram::quantile(double q) const
+    {
+        auto rank = uint64_t(q * count());
+        uint64_t seen = 0;
+        for (unsigned i = 0; i < buckets; ++i)
+        {
+            seen += counts[i].get();
+            if (seen > rank)
+            {
+                // bucket i holds latencies below 2^i ns
+                return std::chrono::nanoseconds(uint64_t(1) << i);
+            }
+        }
+        return std::chrono::nanoseconds(0);
+    }
+
+    Metrics& metrics()
+    {
+        static Metrics m;
+        return m;
+    }
+
+    void writeStats(std::ostream& out, std::chrono::duration<double> elapsed)
+    {
+        auto& m = metrics();
+        auto seconds = std::max(elapsed.count(), 1e-9);
+        auto attempts = m.matchAttempts.get();
+
+        out << std::dec << std::fixed << std::setprecision(3) << "{\n"
+            << "  \"elapsedSeconds\": " << elapsed.count() << ",\n"
+            << "  \"bytesRead\": " << m.bytesRead.get() << ",\n"
+            << "  \"reads\": " << m.reads.get() << ",\n"
+            << "  \"seeks\": " << m.seeks.get() << ",\n"
+            << "  \"readMBps\": " << m.bytesRead.get() / seconds / 1e6 << ",\n"
+            << "  \"bytesWritten\": " << m.bytesWritten.get() << ",\n"
+            << "  \"writes\": " << m.writes.get() << ",\n"
+            << "  \"writeMBps\": " << m.bytesWritten.get() / seconds / 1e6
+            << ",\n"
+            << "  \"matchAttempts\": " << attempts << ",\n"
+            << "  \"matches\": " << m.matches.get() << ",\n"
+            << "  \"hitRate\": "
+            << (attempts ? double(m.matches.get()) / attempts : 0) << ",\n"
+            << "  \"unreadBytes\": " << m.unreadBytes.get() << ",\n"
+            << "  \"latency\": {\n";
+        writeHistogram(out, "read", m.readTime);
+        out << ",\n";
+        writeHistogram(out, "write", m.writeTime);
+        out << ",\n";
+        writeHistogram(out, "match", m.matchTime);
+        out << "\n  }\n}\n";
+    }
+
+    Progress::Progress(std::string what, const Counter& counter,
+                       uint64_t total, std::string unit,
+                       std::chrono::milliseconds interval)
+        : what(std::move(what)),
+          unit(std::move(unit)),
+          counter(counter),
+          first(counter.get()),
+          total(total),
+          interval(interval),
+          start(std::chrono::steady_clock::now()),
+          worker([this] { run(); })
+    {
+    }
+
+    Progress::~Progress()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m);
+            stopping = true;
+        }
+        cv.notify_all();
+        worker.join();
+        report(true);
+    }
+
+    void Progress::run()
+    {
+        std::unique_lock<std::mutex> lock(m);
+        while (!cv.wait_for(lock, interval, [&] { return stopping; }))
+        {
+            report(false);
+        }
+    }
+
+    void Progress::report(bool last)
+    {
+        auto done = counter.get() - first;
+        std::chrono::duration<double> elapsed =
+            std::chrono::steady_clock::now() - start;
+        auto rate = done / std::max(elapsed.count(), 1e-9);
+
+        std::ostringstream line;
+        line << what << ": " << std::fixed << std::setprecision(1);
+        if (total)
+        {
+            line << 100.0 * std::min(done, total) / total << "% ";
+        }
+        line << "at " << rate / 1e6 << " M" << unit << "/s";
+        if (last)
+        {
+            line << " in " << elapsed.count() << " s";
+        }
+        else if (total && rate > 0)
+        {
+            line << ", ETA " << (total > done ? total - done : 0) / rate
+                 << " s";
+        }
+        GINFO(line.str());
+    }
+}  // namespace Recovery
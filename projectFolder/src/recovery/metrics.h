@@ -0,0 +1,138 @@
+#pragma once
+
+#include "flexibity/log.h"
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+
+// Per chunk tracing costs more than the I/O on large images, so it is only
+// compiled in with RECOVERY_TRACE (cmake -DRECOVERY_TRACE=ON). Otherwise
+// the statement is still type checked but never runs.
+#ifdef RECOVERY_TRACE
+#define RTRACE(x) GINFO(x)
+#else
+#define RTRACE(x)     \
+    do                \
+    {                 \
+        if (false)    \
+        {             \
+            GINFO(x); \
+        }             \
+    } while (0)
+#endif
+
+namespace Recovery
+{
+    // Event counter for the hot paths: one relaxed atomic add, no lock
+    class Counter
+    {
+    public:
+        void add(uint64_t n = 1)
+        {
+            value.fetch_add(n, std::memory_order_relaxed);
+        }
+
+        uint64_t get() const
+        {
+            return value.load(std::memory_order_relaxed);
+        }
+
+    private:
+        std::atomic<uint64_t> value = 0;
+    };
+
+    // Latencies counted in power of two nanosecond buckets
+    class LatencyHistogram
+    {
+    public:
+        static const unsigned buckets = 40;
+
+        void record(std::chrono::nanoseconds latency);
+
+        uint64_t count() const;
+        std::chrono::nanoseconds total() const;
+        // Upper bound of the bucket holding the `q` quantile
+        std::chrono::nanoseconds quantile(double q) const;
+
+    private:
+        std::array<Counter, buckets> counts;
+        Counter sum;
+    };
+
+    // Records the lifetime of the scope into a histogram
+    class StageTimer
+    {
+    public:
+        explicit StageTimer(LatencyHistogram& histogram)
+            : histogram(histogram), start(std::chrono::steady_clock::now())
+        {
+        }
+
+        ~StageTimer()
+        {
+            histogram.record(std::chrono::steady_clock::now() - start);
+        }
+
+    private:
+        LatencyHistogram& histogram;
+        std::chrono::steady_clock::time_point start;
+    };
+
+    struct Metrics
+    {
+        Counter bytesRead;  // by every image source, references included
+        Counter reads;
+        Counter seeks;  // reads not following the previous one
+        Counter bytesWritten;
+        Counter writes;
+        Counter matchAttempts;  // image chunks looked up in the references
+        Counter matches;
+        Counter unreadBytes;  // zero-filled where the dump has no data
+
+        LatencyHistogram readTime;
+        LatencyHistogram writeTime;
+        LatencyHistogram matchTime;
+    };
+
+    // Process wide metrics
+    Metrics& metrics();
+
+    // Writes metrics() as JSON, rates over `elapsed`
+    void writeStats(std::ostream& out, std::chrono::duration<double> elapsed);
+
+    // Logs the progress of `counter` towards `total` with its rate and ETA,
+    // at most once every `interval`, from a thread of its own so the hot
+    // path only pays for the counter
+    class Progress
+    {
+    public:
+        Progress(std::string what, const Counter& counter, uint64_t total,
+                 std::string unit = "B",
+                 std::chrono::milliseconds interval =
+                     std::chrono::milliseconds(1000));
+        ~Progress();
+
+    private:
+        void run();
+        void report(bool last);
+
+        std::string what;
+        std::string unit;
+        const Counter& counter;
+        uint64_t first;
+        uint64_t total;
+        std::chrono::milliseconds interval;
+        std::chrono::steady_clock::time_point start;
+
+        std::mutex m;
+        std::condition_variable cv;
+        bool stopping = false;
+        std::thread worker;
+    };
+}  // namespace Recovery
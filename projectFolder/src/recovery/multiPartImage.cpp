@@ -0,0 +1,206 @@
+#include "multiPartImage.h"
+#include "flexibity/log.h"
+#include "metrics.h"
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+
+namespace Recovery
+{
+    namespace
+    {
+        // ddrescue block states, '+' is finished
+        const std::string rescueStates = "?*/-+";
+
+        bool parseNumber(const std::string& text, uint64_t& value)
+        {
+            char* end = nullptr;
+            value = strtoull(text.c_str(), &end, 0);
+            return !text.empty() && *end == '\0';
+        }
+    }  // namespace
+
+    void ConcatImageSource::add(std::unique_ptr<ImageSource> part)
+    {
+        auto size = part->size();
+        parts.push_back({std::move(part), total});
+        total += size;
+    }
+
+    std::span<const char> ConcatImageSource::read(uint64_t offset,
+                                                  size_t size)
+    {
+        if (offset >= total)
+        {
+            return {};
+        }
+        size = size_t(std::min<uint64_t>(size, total - offset));
+
+        // the last part starting at or before `offset`
+        auto part = std::upper_bound(parts.begin(), parts.end(), offset,
+                                     [](uint64_t at, const Part& part) {
+                                         return at < part.start;
+                                     }) -
+                    1;
+        auto local = offset - part->start;
+        if (local + size <= part->src->size())
+        {
+            return part->src->read(local, size);
+        }
+
+        readBuf.resize(size);
+        size_t done = 0;
+        for (; done < size && part != parts.end(); ++part, local = 0)
+        {
+            auto data = part->src->read(local, size - done);
+            memcpy(readBuf.data() + done, data.data(), data.size());
+            done += data.size();
+            if (local + data.size() != part->src->size())
+            {
+                break;  // cut short, the rest isn't where it belongs
+            }
+        }
+        return {readBuf.data(), done};
+    }
+
+    void ConcatImageSource::advise(Access access, uint64_t offset,
+                                   uint64_t length)
+    {
+        for (auto& part : parts)
+        {
+            auto end = part.start + part.src->size();
+            if (part.start < offset + length && offset < end)
+            {
+                auto from = std::max(offset, part.start);
+                auto to = std::min(offset + length, end);
+                part.src->advise(access, from - part.start, to - from);
+            }
+        }
+    }
+
+    bool loadRescueMap(const std::string& fn, std::vector<ByteRange>& unread)
+    {
+        std::ifstream in(fn);
+        if (!in)
+        {
+            GERROR("Unable to open mapfile " << fn);
+            return false;
+        }
+
+        unread.clear();
+        bool status = false;  // the current position line comes first
+        std::string line;
+        for (uint32_t number = 1; std::getline(in, line); ++number)
+        {
+            auto comment = line.find('#');
+            std::istringstream fields(line.substr(0, comment));
+            std::string pos;
+            if (!(fields >> pos))
+            {
+                continue;
+            }
+
+            std::string size;
+            std::string state;
+            ByteRange range;
+            if (!status)
+            {
+                if (!parseNumber(pos, range.offset))
+                {
+                    break;
+                }
+                status = true;
+                continue;
+            }
+            if (!(fields >> size >> state) || state.size() != 1 ||
+                rescueStates.find(state[0]) == std::string::npos ||
+                !parseNumber(pos, range.offset) ||
+                !parseNumber(size, range.length))
+            {
+                GERROR(fn << ":" << std::dec << number
+                          << ": not a ddrescue mapfile line");
+                return false;
+            }
+            if (state != "+" && range.length)
+            {
+                unread.push_back(range);
+            }
+        }
+        if (!status)
+        {
+            GERROR(fn << " is not a ddrescue mapfile");
+            return false;
+        }
+
+        std::sort(unread.begin(), unread.end(),
+                  [](const ByteRange& a, const ByteRange& b) {
+                      return a.offset < b.offset;
+                  });
+        // ddrescue splits what it couldn't read by how far it got
+        std::vector<ByteRange> merged;
+        for (auto& range : unread)
+        {
+            if (!merged.empty() &&
+                merged.back().offset + merged.back().length >= range.offset)
+            {
+                merged.back().length =
+                    std::max(merged.back().offset + merged.back().length,
+                             range.offset + range.length) -
+                    merged.back().offset;
+            }
+            else
+            {
+                merged.push_back(range);
+            }
+        }
+        unread = std::move(merged);
+        return true;
+    }
+
+    RescuedImageSource::RescuedImageSource(std::unique_ptr<ImageSource> src,
+                                           std::vector<ByteRange> unread)
+        : src(std::move(src)),
+          unread(std::move(unread)),
+          reported(this->unread.size())
+    {
+    }
+
+    std::span<const char> RescuedImageSource::read(uint64_t offset,
+                                                   size_t size)
+    {
+        auto data = src->read(offset, size);
+        auto end = offset + data.size();
+
+        // the first range ending past `offset`
+        auto range = std::upper_bound(unread.begin(), unread.end(), offset,
+                                      [](uint64_t at, const ByteRange& r) {
+                                          return at < r.offset + r.length;
+                                      });
+        if (range == unread.end() || range->offset >= end)
+        {
+            return data;
+        }
+
+        readBuf.assign(data.begin(), data.end());
+        for (; range != unread.end() && range->offset < end; ++range)
+        {
+            auto from = std::max(range->offset, offset);
+            auto to = std::min(range->offset + range->length, end);
+            memset(readBuf.data() + (from - offset), 0, to - from);
+            metrics().unreadBytes.add(to - from);
+
+            auto i = size_t(range - unread.begin());
+            if (!reported[i])
+            {
+                reported[i] = true;
+                GERROR("Zero-filled " << std::dec << range->length
+                                      << " bytes ddrescue couldn't read at "
+                                      << std::hex << range->offset);
+            }
+        }
+        return {readBuf.data(), readBuf.size()};
+    }
+
+}  // namespace Recovery
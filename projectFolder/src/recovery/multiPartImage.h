@@ -0,0 +1,76 @@
+#pragma once
+
+#include "recovery/imageSource.h"
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace Recovery
+{
+    // Parts of a split dump presented as one image, in the order added.
+    // A read crossing parts is copied together, others are the part's own
+    // view.
+    class ConcatImageSource : public ImageSource
+    {
+    public:
+        void add(std::unique_ptr<ImageSource> part);
+
+        uint64_t size() const override
+        {
+            return total;
+        }
+        std::span<const char> read(uint64_t offset, size_t size) override;
+        void advise(Access access, uint64_t offset, uint64_t length) override;
+
+    private:
+        struct Part
+        {
+            std::unique_ptr<ImageSource> src;
+            uint64_t start;  // image offset of its first byte
+        };
+
+        std::vector<Part> parts;
+        uint64_t total = 0;
+        std::vector<char> readBuf;
+    };
+
+    struct ByteRange
+    {
+        uint64_t offset;
+        uint64_t length;
+    };
+
+    // Reads the ranges a GNU ddrescue mapfile doesn't mark as finished
+    // ('+') into `unread`, sorted and merged. False if `fn` isn't a
+    // mapfile.
+    bool loadRescueMap(const std::string& fn, std::vector<ByteRange>& unread);
+
+    // Image dumped by ddrescue: what it couldn't read comes as zeros,
+    // whatever the image file holds there. The bytes are counted in
+    // metrics().unreadBytes and every range is logged the first time a read
+    // touches it.
+    class RescuedImageSource : public ImageSource
+    {
+    public:
+        RescuedImageSource(std::unique_ptr<ImageSource> src,
+                           std::vector<ByteRange> unread);
+
+        uint64_t size() const override
+        {
+            return src->size();
+        }
+        std::span<const char> read(uint64_t offset, size_t size) override;
+        void advise(Access access, uint64_t offset, uint64_t length) override
+        {
+            src->advise(access, offset, length);
+        }
+
+    private:
+        std::unique_ptr<ImageSource> src;
+        std::vector<ByteRange> unread;
+        std::vector<bool> reported;
+        std::vector<char> readBuf;
+    };
+
+}  // namespace Recovery
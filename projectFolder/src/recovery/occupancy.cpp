@@ -0,0 +1,338 @@
+#include "occupancy.h"
+#include "continuity.h"
+#include "flexibity/log.h"
+#include "metrics.h"
+#include "parallel.h"
+#include <algorithm>
+#include <bit>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <mutex>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+namespace Recovery
+{
+    namespace
+    {
+        const char fileMagic[8] = {'P', 'S', 'O', 'C', 'C', 'U', 'P', '2'};
+
+        struct FileHeader
+        {
+            char magic[8];
+            uint64_t offset;
+            uint64_t chunks;
+            uint32_t chunkSize;
+            uint32_t reserved;
+        };
+
+        // chunks classified per work item, a multiple of 64 so no two
+        // workers share a word of the bitmap
+        const uint64_t chunksPerItem = 256;
+
+        // True if all `size` bytes are `value`. Bails out at the first
+        // 128 byte stretch that differs.
+        bool allBytes(const char* data, size_t size, char value)
+        {
+            size_t i = 0;
+#if defined(__AVX2__)
+            auto v = _mm256_set1_epi8(value);
+            for (; i + 128 <= size; i += 128)
+            {
+                auto p = (const __m256i*)(data + i);
+                auto diff = _mm256_or_si256(
+                    _mm256_or_si256(
+                        _mm256_xor_si256(_mm256_loadu_si256(p), v),
+                        _mm256_xor_si256(_mm256_loadu_si256(p + 1), v)),
+                    _mm256_or_si256(
+                        _mm256_xor_si256(_mm256_loadu_si256(p + 2), v),
+                        _mm256_xor_si256(_mm256_loadu_si256(p + 3), v)));
+                if (!_mm256_testz_si256(diff, diff))
+                {
+                    return false;
+                }
+            }
+#elif defined(__SSE2__)
+            auto v = _mm_set1_epi8(value);
+            for (; i + 128 <= size; i += 128)
+            {
+                auto p = (const __m128i*)(data + i);
+                auto eq = _mm_set1_epi8(-1);
+                for (int k = 0; k < 8; ++k)
+                {
+                    eq = _mm_and_si128(eq,
+                                       _mm_cmpeq_epi8(_mm_loadu_si128(p + k), v));
+                }
+                if (_mm_movemask_epi8(eq) != 0xFFFF)
+                {
+                    return false;
+                }
+            }
+#endif
+            for (; i < size; ++i)
+            {
+                if (data[i] != value)
+                {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        // A window of 24 bit audio is either smooth (small second
+        // differences for its level) or quiet (all samples near zero)
+        bool audioWindow(const char* window)
+        {
+            auto phase = samplePhase(window, boundaryWindow);
+            int32_t samples[boundaryWindow / 3];
+            auto count = (boundaryWindow - phase) / 3;
+            decode24(window + phase, count, samples);
+
+            uint64_t level = 0;
+            int32_t peak = 0;
+            for (size_t i = 0; i < count; ++i)
+            {
+                level += std::abs(samples[i]);
+                peak = std::max(peak, std::abs(samples[i]));
+            }
+            auto rough = secondDiffSum(samples, count);
+            return peak < (1 << 12) || 2 * rough < level;
+        }
+
+        bool audioLike(const char* data, size_t size)
+        {
+            const size_t windows = 4;
+            if (size < boundaryWindow * windows)
+            {
+                return size >= boundaryWindow && audioWindow(data);
+            }
+
+            size_t votes = 0;
+            for (size_t w = 0; w < windows; ++w)
+            {
+                votes += audioWindow(data + (size - boundaryWindow) *
+                                                w / (windows - 1));
+            }
+            return votes * 2 > windows;
+        }
+    }  // namespace
+
+    const char* chunkClassName(ChunkClass c)
+    {
+        switch (c)
+        {
+            case ChunkClass::Erased:
+                return "erased";
+            case ChunkClass::Uniform:
+                return "uniform";
+            case ChunkClass::WavHeader:
+                return "WAV header";
+            case ChunkClass::Audio:
+                return "audio";
+            case ChunkClass::Other:
+                break;
+        }
+        return "other";
+    }
+
+    ChunkClass classifyChunk(const char* data, size_t size)
+    {
+        if (size == 0)
+        {
+            return ChunkClass::Erased;
+        }
+        if (allBytes(data, size, data[0]))
+        {
+            return data[0] == 0 || data[0] == char(0xFF) ? ChunkClass::Erased
+                                                          : ChunkClass::Uniform;
+        }
+        if (size >= 12 && memcmp(data, "RIFF", 4) == 0 &&
+            memcmp(data + 8, "WAVE", 4) == 0)
+        {
+            return ChunkClass::WavHeader;
+        }
+        return audioLike(data, size) ? ChunkClass::Audio : ChunkClass::Other;
+    }
+
+    bool nearlyUniform(const char* data, size_t size, uint64_t maxBitErrors)
+    {
+        if (size == 0 || allBytes(data, size, data[0]))
+        {
+            return true;
+        }
+        if (maxBitErrors == 0)
+        {
+            return false;
+        }
+
+        // the nearest uniform chunk takes the majority of every bit
+        const uint64_t lowBits = 0x0101010101010101ull;
+        uint64_t ones[8] = {};
+        size_t i = 0;
+        for (; i + 8 <= size; i += 8)
+        {
+            uint64_t word;
+            memcpy(&word, data + i, sizeof(word));
+            for (int b = 0; b < 8; ++b)
+            {
+                ones[b] += std::popcount(word & lowBits << b);
+            }
+        }
+        for (; i < size; ++i)
+        {
+            for (int b = 0; b < 8; ++b)
+            {
+                ones[b] += uint8_t(data[i]) >> b & 1;
+            }
+        }
+
+        uint64_t bitErrors = 0;
+        for (auto n : ones)
+        {
+            bitErrors += std::min<uint64_t>(n, size - n);
+        }
+        return bitErrors <= maxBitErrors;
+    }
+
+    bool OccupancyMap::live(uint64_t start, uint64_t size) const
+    {
+        if (size == 0 || start < offset ||
+            start + size > offset + chunks * chunkSize)
+        {
+            return true;
+        }
+
+        auto first = (start - offset) / chunkSize;
+        auto last = (start + size - 1 - offset) / chunkSize;
+        for (auto i = first; i <= last; ++i)
+        {
+            if (bits[i / 64] >> (i % 64) & 1)
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void OccupancyMap::fillDead(uint64_t start, std::span<char> out) const
+    {
+        for (size_t done = 0; done < out.size();)
+        {
+            auto i = (start + done - offset) / chunkSize;
+            auto end = offset + (i + 1) * chunkSize - start;
+            auto size = std::min<uint64_t>(end, out.size()) - done;
+            memset(out.data() + done, fills[i], size);
+            done += size;
+        }
+    }
+
+    bool OccupancyMap::save(const std::string& fn) const
+    {
+        std::ofstream out(fn, std::ios::binary);
+        FileHeader header = {{}, offset, chunks, chunkSize, 0};
+        memcpy(header.magic, fileMagic, sizeof(fileMagic));
+        out.write((const char*)&header, sizeof(header));
+        out.write((const char*)bits.data(), bits.size() * sizeof(bits[0]));
+        out.write((const char*)fills.data(), fills.size());
+        if (!out)
+        {
+            GERROR("Unable to write occupancy map " << fn);
+            return false;
+        }
+        return true;
+    }
+
+    bool OccupancyMap::load(const std::string& fn)
+    {
+        std::ifstream in(fn, std::ios::binary);
+        FileHeader header;
+        if (!in.read((char*)&header, sizeof(header)) ||
+            memcmp(header.magic, fileMagic, sizeof(fileMagic)) != 0 ||
+            header.chunkSize == 0)
+        {
+            GERROR("Not an occupancy map: " << fn);
+            return false;
+        }
+
+        offset = header.offset;
+        chunks = header.chunks;
+        chunkSize = header.chunkSize;
+        bits.resize((chunks + 63) / 64);
+        fills.resize(chunks);
+        if (!in.read((char*)bits.data(), bits.size() * sizeof(bits[0])) ||
+            !in.read((char*)fills.data(), fills.size()))
+        {
+            GERROR("Truncated occupancy map: " << fn);
+            return false;
+        }
+        counts = {};
+        return true;
+    }
+
+    OccupancyMap mapOccupancy(ImageSource& img, uint64_t offset,
+                              uint64_t count, uint32_t chunkSize,
+                              unsigned threads)
+    {
+        OccupancyMap map;
+        map.offset = offset;
+        map.chunkSize = chunkSize;
+        if (offset < img.size())
+        {
+            auto available = (img.size() - offset) / chunkSize;
+            map.chunks = count ? std::min(count, available) : available;
+        }
+        map.bits.resize((map.chunks + 63) / 64);
+        map.fills.resize(map.chunks);
+
+        img.advise(ImageSource::Access::Sequential, offset,
+                   map.chunks * chunkSize);
+
+        std::mutex lock;
+        auto items = (map.chunks + chunksPerItem - 1) / chunksPerItem;
+        runWorkers(threads, items, [&](uint64_t item) {
+            std::array<uint64_t, chunkClasses> counts = {};
+            std::vector<char> copy;
+            auto first = item * chunksPerItem;
+            auto last = std::min(map.chunks, first + chunksPerItem);
+
+            for (auto i = first; i < last; ++i)
+            {
+                std::span<const char> chunk;
+                if (img.concurrentReads())
+                {
+                    chunk = img.read(offset + i * chunkSize, chunkSize);
+                }
+                else
+                {
+                    // the view is only good until the next read
+                    std::lock_guard<std::mutex> guard(lock);
+                    auto data = img.read(offset + i * chunkSize, chunkSize);
+                    copy.assign(data.begin(), data.end());
+                    chunk = copy;
+                }
+
+                auto c = classifyChunk(chunk.data(), chunk.size());
+                ++counts[size_t(c)];
+                if (c != ChunkClass::Erased && c != ChunkClass::Uniform)
+                {
+                    map.bits[i / 64] |= uint64_t(1) << (i % 64);
+                }
+                else
+                {
+                    map.fills[i] = chunk.empty() ? 0 : uint8_t(chunk[0]);
+                }
+            }
+
+            std::lock_guard<std::mutex> guard(lock);
+            for (size_t c = 0; c < chunkClasses; ++c)
+            {
+                map.counts[c] += counts[c];
+            }
+        });
+
+        return map;
+    }
+}  // namespace Recovery
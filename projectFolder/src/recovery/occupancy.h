@@ -0,0 +1,68 @@
+#pragma once
+
+#include "recovery/imageSource.h"
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <string>
+#include <vector>
+
+namespace Recovery
+{
+    enum class ChunkClass : uint8_t
+    {
+        Erased,     // all 0x00 or all 0xFF
+        Uniform,    // one other byte value throughout
+        WavHeader,  // starts with a RIFF WAVE header
+        Audio,      // decodes as smooth or quiet 24 bit audio
+        Other,
+    };
+
+    const size_t chunkClasses = 5;
+
+    const char* chunkClassName(ChunkClass c);
+
+    // Classifies one chunk, vectorized with AVX2 / SSE2 where available.
+    // Erased and uniform chunks are rejected at memory bandwidth, the audio
+    // test only decodes a few sample windows.
+    ChunkClass classifyChunk(const char* data, size_t size);
+
+    // True if `data` is within `maxBitErrors` bits of one byte value
+    // throughout, so an erased or uniform image chunk may match it. The
+    // digital silence of a muted track is all 0x00.
+    bool nearlyUniform(const char* data, size_t size, uint64_t maxBitErrors);
+
+    // One bit per chunk of the image: set for live chunks, clear for the
+    // erased and uniform ones, with the byte every dead chunk is filled
+    // with. Recovery rebuilds dead chunks from their fill byte instead of
+    // reading them, mapping can only skip them while no reference chunk
+    // is nearlyUniform(), as a silent one is.
+    struct OccupancyMap
+    {
+        uint64_t offset = 0;
+        uint32_t chunkSize = 0x8000;
+        uint64_t chunks = 0;
+        std::vector<uint64_t> bits;
+        std::vector<uint8_t> fills;  // per chunk, 0 for live ones
+        std::array<uint64_t, chunkClasses> counts = {};  // chunks per class
+
+        // False only if every chunk overlapping the range is dead. Ranges
+        // reaching outside the map count as live.
+        bool live(uint64_t offset, uint64_t size) const;
+
+        // Writes what the card holds in the dead range at `start` to
+        // `out`: the fill byte of every chunk it overlaps. Only for ranges
+        // live() is false for.
+        void fillDead(uint64_t start, std::span<char> out) const;
+
+        bool save(const std::string& fn) const;
+        bool load(const std::string& fn);
+    };
+
+    // Classifies `count` chunks from `offset` (count 0 runs to the end of
+    // the image) on `threads` workers (0 picks the number of cores)
+    OccupancyMap mapOccupancy(ImageSource& img, uint64_t offset,
+                              uint64_t count, uint32_t chunkSize,
+                              unsigned threads);
+}  // namespace Recovery
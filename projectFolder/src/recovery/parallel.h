@@ -0,0 +1,42 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+namespace Recovery
+{
+    // Calls work(i) for every i below `items` on `threads` workers (0 picks
+    // the number of cores), the calling thread being one of them. Items
+    // are handed out one at a time, so uneven items balance out.
+    template <typename Work>
+    void runWorkers(unsigned threads, uint64_t items, const Work& work)
+    {
+        if (threads == 0)
+        {
+            threads = std::max(1u, std::thread::hardware_concurrency());
+        }
+        threads = unsigned(std::clamp<uint64_t>(items, 1, threads));
+
+        std::atomic<uint64_t> next = 0;
+        auto worker = [&] {
+            for (uint64_t i; (i = next++) < items;)
+            {
+                work(i);
+            }
+        };
+
+        std::vector<std::thread> workers;
+        for (unsigned t = 1; t < threads; ++t)
+        {
+            workers.emplace_back(worker);
+        }
+        worker();
+        for (auto& w : workers)
+        {
+            w.join();
+        }
+    }
+}  // namespace Recovery
@@ -0,0 +1,275 @@
+#include "preview.h"
+#include "continuity.h"
+#include "stream.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <iomanip>
+#include <limits>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+namespace Recovery
+{
+    namespace
+    {
+        const double fullScale = 8388608.0;  // 2^23
+        const int32_t clipLevel = 0x7FFFFF;
+
+        // samples decoded at once by measure24()
+        const size_t batch = 4096;
+
+        // keeps the 64 bit sums of squares from overflowing
+        const size_t energyBlock = 1 << 16;
+
+        const double silentDb = -80;
+        const double noisyAbove = 1.0;
+
+        void writeDb(std::ostream& out, double db)
+        {
+            if (std::isfinite(db))
+            {
+                out << db;
+            }
+            else
+            {
+                out << "null";
+            }
+        }
+    }  // namespace
+
+    void SampleStats::add(const SampleStats& other)
+    {
+        samples += other.samples;
+        peak = std::max(peak, other.peak);
+        clipped += other.clipped;
+        energy += other.energy;
+        roughness += other.roughness;
+    }
+
+    double SampleStats::peakDb() const
+    {
+        return peak ? 20 * std::log10(peak / fullScale)
+                    : -std::numeric_limits<double>::infinity();
+    }
+
+    double SampleStats::rmsDb() const
+    {
+        return energy > 0
+                   ? 10 * std::log10(energy / samples / (fullScale * fullScale))
+                   : -std::numeric_limits<double>::infinity();
+    }
+
+    double SampleStats::noisiness() const
+    {
+        if (energy <= 0 || samples < 3)
+        {
+            return 0;
+        }
+        return roughness / (samples - 2) / std::sqrt(energy / samples);
+    }
+
+    void measureSamples(const int32_t* samples, size_t count,
+                        SampleStats& stats)
+    {
+        for (size_t start = 0; start < count; start += energyBlock)
+        {
+            auto end = std::min(count, start + energyBlock);
+            auto i = start;
+            uint32_t peak = 0;
+            uint64_t clipped = 0;
+            int64_t energy = 0;
+
+#if defined(__AVX2__)
+            auto peaks = _mm256_setzero_si256();
+            auto clips = _mm256_setzero_si256();
+            auto even = _mm256_setzero_si256();
+            auto odd = _mm256_setzero_si256();
+            const auto belowClip = _mm256_set1_epi32(clipLevel - 1);
+            for (; i + 8 <= end; i += 8)
+            {
+                auto v = _mm256_loadu_si256((const __m256i*)(samples + i));
+                auto magnitude = _mm256_abs_epi32(v);
+                peaks = _mm256_max_epi32(peaks, magnitude);
+                // the compare gives -1 per clipped lane
+                clips = _mm256_sub_epi32(
+                    clips, _mm256_cmpgt_epi32(magnitude, belowClip));
+                // squares of the even lanes, then of the odd ones
+                even = _mm256_add_epi64(even, _mm256_mul_epi32(v, v));
+                auto high = _mm256_srli_epi64(v, 32);
+                odd = _mm256_add_epi64(odd, _mm256_mul_epi32(high, high));
+            }
+
+            int32_t lanes[8];
+            _mm256_storeu_si256((__m256i*)lanes, peaks);
+            peak = uint32_t(*std::max_element(lanes, lanes + 8));
+            _mm256_storeu_si256((__m256i*)lanes, clips);
+            for (auto lane : lanes)
+            {
+                clipped += uint32_t(lane);
+            }
+            int64_t sums[4];
+            _mm256_storeu_si256((__m256i*)sums, _mm256_add_epi64(even, odd));
+            energy = sums[0] + sums[1] + sums[2] + sums[3];
+#endif
+            for (; i < end; ++i)
+            {
+                auto magnitude = uint32_t(std::abs(samples[i]));
+                peak = std::max(peak, magnitude);
+                clipped += magnitude >= uint32_t(clipLevel);
+                energy += int64_t(samples[i]) * samples[i];
+            }
+
+            stats.samples += end - start;
+            stats.peak = std::max(stats.peak, peak);
+            stats.clipped += clipped;
+            stats.energy += double(energy);
+        }
+    }
+
+    void measure24(const char* data, size_t size, unsigned phase,
+                   SampleStats& stats)
+    {
+        int32_t samples[batch];
+        size_t count = size > phase ? (size - phase) / 3 : 0;
+        const char* p = data + phase;
+
+        // batches overlap by the two samples a second difference looks
+        // back, those are measured once
+        for (size_t i = 0; i < count;)
+        {
+            size_t back = i ? 2 : 0;
+            auto n = std::min(batch, count - i + back);
+            decode24(p + 3 * (i - back), n, samples);
+            measureSamples(samples + back, n - back, stats);
+            stats.roughness += double(secondDiffSum(samples, n));
+            i += n - back;
+        }
+    }
+
+    std::vector<TrackPreview> previewTracks(ImageSource& img,
+                                            const Layout& layout,
+                                            uint32_t width,
+                                            const OccupancyMap* occupancy)
+    {
+        std::vector<TrackPreview> tracks(layout.numTracks);
+        if (!layout.count)
+        {
+            return tracks;
+        }
+        auto bins = std::clamp(width, 1u, layout.count);
+        for (auto& track : tracks)
+        {
+            track.bins.resize(bins);
+        }
+
+        auto channelBlockSize = layout.channelBlockSize();
+        streamTracks(
+            img, layout,
+            [&](uint32_t track, uint32_t block, std::span<const char> audio) {
+                // the sample split off the previous Channel Block is
+                // skipped, the rest decodes aligned as in the WAV output
+                auto phase =
+                    unsigned((3 - uint64_t(block) * channelBlockSize % 3) % 3);
+                SampleStats stats;
+                measure24(audio.data(), audio.size(), phase, stats);
+                tracks[track].bins[uint64_t(block) * bins / layout.count].add(
+                    stats);
+            },
+            {{}, occupancy});
+
+        for (auto& track : tracks)
+        {
+            for (auto& bin : track.bins)
+            {
+                track.total.add(bin);
+            }
+        }
+        return tracks;
+    }
+
+    const char* previewVerdict(const SampleStats& stats)
+    {
+        if (!stats.samples || stats.peakDb() < silentDb)
+        {
+            return "silent";
+        }
+        if (stats.noisiness() > noisyAbove)
+        {
+            return "noise";
+        }
+        // a few clipped peaks are part of many recordings
+        if (stats.clipped * 1000 > stats.samples)
+        {
+            return "clipping";
+        }
+        return "ok";
+    }
+
+    std::string previewWaveform(const TrackPreview& track)
+    {
+        static const char levels[] = " .:-=+*#%@";
+        const int top = sizeof(levels) - 2;
+
+        std::string line;
+        for (auto& bin : track.bins)
+        {
+            auto db = bin.peakDb();
+            if (!bin.samples || db < silentDb)
+            {
+                line += ' ';
+            }
+            else if (bin.noisiness() > noisyAbove)
+            {
+                line += '?';
+            }
+            else
+            {
+                auto level = int(std::lround((db - silentDb) / -silentDb * top));
+                line += levels[std::clamp(level, 0, top)];
+            }
+        }
+        return line;
+    }
+
+    void writePreviewJson(std::ostream& out, const Layout& layout,
+                          const std::vector<TrackPreview>& tracks)
+    {
+        out << std::dec << std::fixed << std::setprecision(2) << "{\n"
+            << "  \"offset\": " << layout.offset << ",\n"
+            << "  \"chunkSize\": " << layout.chunkSize << ",\n"
+            << "  \"repition\": " << layout.repition << ",\n"
+            << "  \"numTracks\": " << layout.numTracks << ",\n"
+            << "  \"count\": " << layout.count << ",\n"
+            << "  \"tracks\": [";
+        for (size_t t = 0; t < tracks.size(); ++t)
+        {
+            auto& track = tracks[t];
+            auto& total = track.total;
+            out << (t ? ",\n" : "\n") << "    {\"track\": " << t + 1
+                << ", \"verdict\": \"" << previewVerdict(total)
+                << "\", \"samples\": " << total.samples << ", \"peakDb\": ";
+            writeDb(out, total.peakDb());
+            out << ", \"rmsDb\": ";
+            writeDb(out, total.rmsDb());
+            out << ", \"clipped\": " << total.clipped
+                << ", \"noisiness\": " << total.noisiness()
+                << ",\n     \"peakDbBins\": [";
+            for (size_t b = 0; b < track.bins.size(); ++b)
+            {
+                out << (b ? ", " : "");
+                writeDb(out, track.bins[b].peakDb());
+            }
+            out << "],\n     \"rmsDbBins\": [";
+            for (size_t b = 0; b < track.bins.size(); ++b)
+            {
+                out << (b ? ", " : "");
+                writeDb(out, track.bins[b].rmsDb());
+            }
+            out << "]}";
+        }
+        out << "\n  ]\n}\n";
+    }
+}  // namespace Recovery
@@ -0,0 +1,66 @@
+#pragma once
+
+#include "recovery/imageSource.h"
+#include "recovery/layout.h"
+#include "recovery/occupancy.h"
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace Recovery
+{
+    // Level statistics of a stretch of 24 bit samples
+    struct SampleStats
+    {
+        uint64_t samples = 0;
+        uint32_t peak = 0;     // largest magnitude
+        uint64_t clipped = 0;  // samples at full scale
+        double energy = 0;     // sum of squares
+        double roughness = 0;  // sum of |second differences|
+
+        void add(const SampleStats& other);
+
+        double peakDb() const;  // dBFS, -inf for digital silence
+        double rmsDb() const;
+
+        // Mean second difference relative to the RMS: well below 1 for
+        // audio, about 2 for noise such as misaligned samples
+        double noisiness() const;
+    };
+
+    // Adds the peak, clipping and energy of `count` samples to `stats`,
+    // vectorized with AVX2 where available. The roughness is left alone.
+    void measureSamples(const int32_t* samples, size_t count,
+                        SampleStats& stats);
+
+    // Decodes and measures the 24 bit samples in `size` bytes from
+    // `data`, skipping `phase` bytes of a sample split off before them
+    void measure24(const char* data, size_t size, unsigned phase,
+                   SampleStats& stats);
+
+    struct TrackPreview
+    {
+        SampleStats total;
+        std::vector<SampleStats> bins;  // consecutive stretches of time
+    };
+
+    // Measures every track of the session in one pass over the image,
+    // without writing any audio: `width` bins per track (at most one per
+    // Data Block). Samples are aligned as in the WAV output.
+    std::vector<TrackPreview> previewTracks(
+        ImageSource& img, const Layout& layout, uint32_t width,
+        const OccupancyMap* occupancy = nullptr);
+
+    // "silent", "noise" (a wrong layout decodes as noise), "clipping" or
+    // "ok"
+    const char* previewVerdict(const SampleStats& stats);
+
+    // One character per bin, from ' ' for silence to '@' near full scale,
+    // '?' where the bin decodes as noise
+    std::string previewWaveform(const TrackPreview& track);
+
+    void writePreviewJson(std::ostream& out, const Layout& layout,
+                          const std::vector<TrackPreview>& tracks);
+}  // namespace Recovery
@@ -0,0 +1,469 @@
+#include "reassembly.h"
+#include "flexibity/log.h"
+#include "parallel.h"
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+namespace Recovery
+{
+    namespace
+    {
+        // boundaryScore() up to this is continuous, as in the analysis
+        const double linkScore = 8;
+
+        // samples the predictor is fitted to and samples it predicts
+        const size_t fitSamples = 16;
+        const size_t edgeSamples = 8;
+
+        // candidate successors kept per chunk
+        const size_t maxLinks = 4;
+
+        // chunks fingerprinted per image read
+        const uint64_t batchChunks = 1024;
+
+        // chunks per successor search work item
+        const uint64_t searchChunks = 4096;
+
+        // soundDistance() up to this is the same channel
+        const double sameChannel = 1;
+
+        // chains shorter than this join a stream but don't start one
+        const uint64_t minStreamChunks = 4;
+
+        // samples decoded at once by fingerprintChunk()
+        const size_t batch = 1024;
+
+        // head sample of a dead chunk, farther from any prediction than
+        // the largest tolerance
+        const int32_t deadHead = 1 << 30;
+        const int64_t maxTolerance = 1 << 28;
+        const int64_t maxPrediction = 1 << 26;
+
+        const double fullScale = 1 << 23;
+
+        const uint32_t none = UINT32_MAX;
+
+        struct Link
+        {
+            uint32_t to = none;
+            float cost = 0;
+        };
+
+        // Calls found(j) for every j in [from, to) whose head is within
+        // `tolerance` of `prediction`
+        template <typename Found>
+        void scanHeads(const int32_t* heads, uint64_t from, uint64_t to,
+                       int32_t prediction, int32_t tolerance,
+                       const Found& found)
+        {
+            auto j = from;
+#if defined(__AVX2__)
+            auto p = _mm256_set1_epi32(prediction);
+            auto t = _mm256_set1_epi32(tolerance);
+            for (; j + 8 <= to; j += 8)
+            {
+                auto v = _mm256_loadu_si256((const __m256i*)(heads + j));
+                auto far = _mm256_cmpgt_epi32(
+                    _mm256_abs_epi32(_mm256_sub_epi32(v, p)), t);
+                auto near =
+                    ~unsigned(_mm256_movemask_ps(_mm256_castsi256_ps(far))) &
+                    0xff;
+                for (; near; near &= near - 1)
+                {
+                    found(j + std::countr_zero(near));
+                }
+            }
+#endif
+            for (; j < to; ++j)
+            {
+                if (std::abs(heads[j] - prediction) <= tolerance)
+                {
+                    found(j);
+                }
+            }
+        }
+
+        // Mean fingerprint of a run of chunks, to compare how they sound
+        struct Sound
+        {
+            double levelDb = 0;
+            double tilt = 0;
+            double dc = 0;
+            uint64_t chunks = 0;
+
+            void add(const ChunkFingerprint& fp)
+            {
+                levelDb += fp.levelDb;
+                tilt += fp.tilt;
+                dc += fp.dc;
+                ++chunks;
+            }
+
+            ChunkFingerprint mean() const
+            {
+                ChunkFingerprint fp = {};
+                fp.levelDb = float(levelDb / chunks);
+                fp.tilt = float(tilt / chunks);
+                fp.dc = float(dc / chunks);
+                return fp;
+            }
+        };
+    }  // namespace
+
+    ChunkFingerprint fingerprintChunk(const char* data, size_t size)
+    {
+        ChunkFingerprint fp = {};
+        fp.dead = size < boundaryWindow ||
+                  memcmp(data, data + 1, size - 1) == 0;
+        if (fp.dead)
+        {
+            return fp;
+        }
+        std::copy(data, data + sizeof(fp.head), fp.head);
+        fp.tail = boundaryTail(data + size);
+
+        // least squares fit of x[n] = c1 x[n-1] + c2 x[n-2] to the full
+        // samples before the straddling one
+        int32_t x[fitSamples];
+        decode24(data + size - fp.tail.pending - 3 * fitSamples, fitSamples,
+                 x);
+        double r11 = 0, r12 = 0, r22 = 0, r1 = 0, r2 = 0;
+        for (size_t i = 2; i < fitSamples; ++i)
+        {
+            double x0 = x[i], x1 = x[i - 1], x2 = x[i - 2];
+            r11 += x1 * x1;
+            r12 += x1 * x2;
+            r22 += x2 * x2;
+            r1 += x0 * x1;
+            r2 += x0 * x2;
+        }
+        auto det = r11 * r22 - r12 * r12;
+        double c1 = 2, c2 = -1;  // a straight line for silence or DC
+        if (det > 1e-9 * r11 * r22)
+        {
+            c1 = (r1 * r22 - r2 * r12) / det;
+            c2 = (r2 * r11 - r1 * r12) / det;
+        }
+        double residual = 0;
+        for (size_t i = 2; i < fitSamples; ++i)
+        {
+            residual += std::abs(x[i] - (c1 * x[i - 1] + c2 * x[i - 2]));
+        }
+        fp.predictor[0] = float(c1);
+        fp.predictor[1] = float(c2);
+        fp.residual = float(residual / (fitSamples - 2));
+
+        // the phase of a 3 KB start is the phase of the chunk
+        auto phase = samplePhase(data, std::min<size_t>(size, 3 * batch));
+        auto count = (size - phase) / 3;
+        const char* p = data + phase;
+
+        // consecutive batches overlap by the sample a first difference
+        // looks back
+        int32_t samples[batch];
+        int64_t sum = 0;
+        double energy = 0;
+        double diffEnergy = 0;
+        for (size_t i = 0; i + 1 < count; i += batch - 1)
+        {
+            auto n = std::min(batch, count - i);
+            decode24(p + 3 * i, n, samples);
+
+            // 24 bit squares of a batch stay well inside int64
+            int64_t e = 0;
+            int64_t d = 0;
+            for (size_t k = 1; k < n; ++k)
+            {
+                int64_t diff = samples[k] - samples[k - 1];
+                e += int64_t(samples[k]) * samples[k];
+                d += diff * diff;
+                sum += samples[k];
+            }
+            if (i == 0)
+            {
+                e += int64_t(samples[0]) * samples[0];
+                sum += samples[0];
+            }
+            energy += double(e);
+            diffEnergy += double(d);
+        }
+
+        auto meanSquare = energy / count / (fullScale * fullScale);
+        fp.levelDb = meanSquare > 0 ? float(10 * std::log10(meanSquare))
+                                    : -150.f;
+        fp.tilt = float(std::log((diffEnergy + 1) / (energy + 1)));
+        fp.dc = float(double(sum) / count / fullScale);
+        return fp;
+    }
+
+    double continuationScore(const ChunkFingerprint& a,
+                             const ChunkFingerprint& b)
+    {
+        auto& tail = a.tail;
+        char edge[3 * edgeSamples];
+        std::copy(tail.partial, tail.partial + tail.pending, edge);
+        std::copy(b.head, b.head + sizeof(edge) - tail.pending,
+                  edge + tail.pending);
+
+        double x1 = tail.s2, x2 = tail.s1;
+        double err = 0;
+        for (size_t i = 0; i < edgeSamples; ++i)
+        {
+            double x0 = sample24(edge + 3 * i);
+            err += std::abs(x0 - (a.predictor[0] * x1 + a.predictor[1] * x2));
+            x2 = x1;
+            x1 = x0;
+        }
+        return err / edgeSamples / (a.residual + 1);
+    }
+
+    double soundDistance(const ChunkFingerprint& a, const ChunkFingerprint& b)
+    {
+        // 10 dB, a factor e in brightness or 10% of DC offset count alike
+        return std::abs(a.levelDb - b.levelDb) / 10 +
+               std::abs(a.tilt - b.tilt) + std::abs(a.dc - b.dc) * 10;
+    }
+
+    std::vector<ReassembledStream> reassembleChunks(
+        ImageSource& img, const ReassemblyOptions& opts,
+        ReassemblyStats& stats, const OccupancyMap* occupancy)
+    {
+        stats = {};
+        std::vector<ReassembledStream> streams;
+        auto chunkSize = opts.chunkSize;
+        if (!chunkSize || opts.offset >= img.size())
+        {
+            return streams;
+        }
+        auto n = (img.size() - opts.offset) / chunkSize;
+        if (opts.chunks)
+        {
+            n = std::min(n, opts.chunks);
+        }
+        if (n >= none)
+        {
+            GERROR("Too many chunks to reassemble: " << std::dec << n);
+            return streams;
+        }
+        stats.chunks = n;
+
+        // the first sample after the boundary for each number of bytes a
+        // sample straddling it leaves to this chunk, kept apart from the
+        // rest of the fingerprints for the successor search to scan
+        std::vector<ChunkFingerprint> fps(n);
+        std::vector<int32_t> heads[3];
+        for (auto& h : heads)
+        {
+            h.resize(n);
+        }
+
+        img.advise(ImageSource::Access::Sequential, opts.offset,
+                   n * chunkSize);
+        for (uint64_t first = 0; first < n; first += batchChunks)
+        {
+            auto count = std::min(batchChunks, n - first);
+            auto data =
+                img.read(opts.offset + first * chunkSize, count * chunkSize);
+            count = data.size() / chunkSize;
+
+            // the view stays valid while nothing else reads the image
+            runWorkers(opts.threads, count, [&](uint64_t i) {
+                auto c = first + i;
+                auto offset = opts.offset + c * chunkSize;
+                if (occupancy && !occupancy->live(offset, chunkSize))
+                {
+                    fps[c].dead = true;
+                }
+                else
+                {
+                    fps[c] = fingerprintChunk(data.data() + i * chunkSize,
+                                              chunkSize);
+                }
+                for (unsigned phase = 0; phase < 3; ++phase)
+                {
+                    heads[phase][c] = fps[c].dead
+                                          ? deadHead
+                                          : sample24(fps[c].head + phase);
+                }
+            });
+            if (count < std::min(batchChunks, n - first))
+            {
+                n = first + count;  // cut short by the image
+                stats.chunks = n;
+                break;
+            }
+        }
+        img.advise(ImageSource::Access::Normal, opts.offset, n * chunkSize);
+
+        // the best successors of every chunk within the window after it
+        std::vector<Link> links(n * maxLinks);
+        runWorkers(opts.threads, (n + searchChunks - 1) / searchChunks,
+                   [&](uint64_t item) {
+            auto end = std::min(n, (item + 1) * searchChunks);
+            for (auto a = item * searchChunks; a < end; ++a)
+            {
+                auto& fp = fps[a];
+                if (fp.dead)
+                {
+                    continue;
+                }
+
+                // a straddling sample isn't known before it is scored, so
+                // the one after it is predicted two samples ahead; its
+                // error is at most three times that of boundaryScore()
+                auto& tail = fp.tail;
+                auto phase = (3 - tail.pending) % 3;
+                auto slope = int64_t(tail.s2) - tail.s1;
+                auto prediction =
+                    tail.s2 + (tail.pending ? 2 : 1) * slope;
+                auto tolerance = (tail.pending ? 3 : 1) * linkScore *
+                                 (2 * tail.noise + 1);
+
+                auto best = &links[a * maxLinks];
+                scanHeads(
+                    heads[phase].data(), a + 1,
+                    std::min<uint64_t>(n, a + 1 + opts.window),
+                    int32_t(std::clamp(prediction, -maxPrediction,
+                                       maxPrediction)),
+                    int32_t(std::min(int64_t(tolerance), maxTolerance)),
+                    [&](uint64_t b) {
+                        auto score = boundaryScore(tail, fps[b].head);
+                        if (score > linkScore)
+                        {
+                            return;
+                        }
+                        auto cost = float(
+                            continuationScore(fp, fps[b]) +
+                            soundDistance(fp, fps[b]));
+                        auto worst = best + maxLinks - 1;
+                        if (worst->to != none && worst->cost <= cost)
+                        {
+                            return;
+                        }
+                        *worst = {uint32_t(b), cost};
+                        std::sort(best, best + maxLinks,
+                                  [](const Link& x, const Link& y) {
+                                      return x.to != none &&
+                                             (y.to == none ||
+                                              x.cost < y.cost);
+                                  });
+                    });
+            }
+        });
+
+        // cheapest links first, every chunk linked once each way. Links
+        // only go forward, so the chains can't close into loops.
+        struct Candidate
+        {
+            float cost;
+            uint32_t from;
+            uint32_t to;
+        };
+        std::vector<Candidate> candidates;
+        std::vector<uint32_t> found(n);
+        for (uint64_t a = 0; a < n; ++a)
+        {
+            for (size_t k = 0; k < maxLinks; ++k)
+            {
+                auto& link = links[a * maxLinks + k];
+                if (link.to != none)
+                {
+                    candidates.push_back({link.cost, uint32_t(a), link.to});
+                    ++found[a];
+                }
+            }
+        }
+        links.clear();
+        links.shrink_to_fit();
+        std::sort(candidates.begin(), candidates.end(),
+                  [](const Candidate& x, const Candidate& y) {
+                      return x.cost < y.cost;
+                  });
+
+        std::vector<uint32_t> next(n, none);
+        std::vector<bool> linked(n);  // has a predecessor
+        for (auto& c : candidates)
+        {
+            if (next[c.from] == none && !linked[c.to])
+            {
+                next[c.from] = c.to;
+                linked[c.to] = true;
+                ++stats.links;
+            }
+        }
+
+        // chains in the order they start, each to the stream that sounds
+        // most like it among those it can follow
+        struct Open
+        {
+            ChunkFingerprint sound;  // of its last chain
+            uint64_t last;           // chunk
+        };
+        std::vector<Open> open;
+        for (uint64_t c = 0; c < n; ++c)
+        {
+            if (fps[c].dead)
+            {
+                ++stats.dead;
+                continue;
+            }
+            if (linked[c])
+            {
+                continue;
+            }
+            ++stats.chains;
+
+            Sound sound;
+            std::vector<ReassembledChunk> chain;
+            uint32_t candidatesBefore = 1;
+            for (auto k = c; k != none; k = next[k])
+            {
+                sound.add(fps[k]);
+                chain.push_back({opts.offset + k * chunkSize,
+                                 std::max(candidatesBefore, 1u)});
+                candidatesBefore = found[k];
+            }
+            auto chainSound = sound.mean();
+            auto first = c;
+            auto last = (chain.back().offset - opts.offset) / chunkSize;
+
+            size_t stream = open.size();
+            double distance = 0;
+            for (size_t s = 0; s < open.size(); ++s)
+            {
+                auto d = soundDistance(open[s].sound, chainSound);
+                if (open[s].last < first &&
+                    (stream == open.size() || d < distance))
+                {
+                    stream = s;
+                    distance = d;
+                }
+            }
+
+            auto full = opts.maxStreams && open.size() >= opts.maxStreams;
+            if (stream != open.size() && (distance <= sameChannel || full))
+            {
+                auto& chunks = streams[stream].chunks;
+                chunks.insert(chunks.end(), chain.begin(), chain.end());
+                open[stream] = {chainSound, last};
+            }
+            else if (!full && chain.size() >= minStreamChunks)
+            {
+                streams.push_back({std::move(chain)});
+                open.push_back({chainSound, last});
+            }
+            else
+            {
+                stats.dropped += chain.size();
+            }
+        }
+        return streams;
+    }
+}  // namespace Recovery
@@ -0,0 +1,85 @@
+#pragma once
+
+#include "recovery/continuity.h"
+#include "recovery/imageSource.h"
+#include "recovery/occupancy.h"
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace Recovery
+{
+    // What the reassembly knows of one image chunk: the samples at its
+    // edges to chain it to the next, and the sound of it to tell the
+    // channels apart
+    struct ChunkFingerprint
+    {
+        BoundaryTail tail;   // of the samples it ends with
+        float predictor[2];  // order 2 linear prediction fitted there
+        float residual;      // mean error of the prediction there
+        char head[32];       // its first bytes
+        float levelDb;       // RMS, dBFS
+        float tilt;  // ln(first difference energy / energy), high for bright
+        float dc;    // mean, in full scale
+        bool dead;   // all bytes equal: erased or never written
+    };
+
+    // Fingerprint of the `size` byte chunk at `data`, its samples decoded
+    // under the smoothest phase
+    ChunkFingerprint fingerprintChunk(const char* data, size_t size);
+
+    // How far the first samples of `b` stray from the prediction of `a`,
+    // relative to the prediction error within `a`: about 1 if `b` follows
+    // `a` in the same channel. Tells apart signals boundaryScore() can't,
+    // such as sines of close frequencies.
+    double continuationScore(const ChunkFingerprint& a,
+                             const ChunkFingerprint& b);
+
+    // How differently two chunks sound, 0 for the same level, tilt and DC
+    double soundDistance(const ChunkFingerprint& a, const ChunkFingerprint& b);
+
+    struct ReassemblyOptions
+    {
+        uint64_t offset = 0;  // of the first chunk
+        uint64_t chunks = 0;  // 0 runs up to the end of the image
+        uint32_t chunkSize = 0x8000;
+        uint32_t window = 544;  // chunks after a chunk its successor may be
+        uint32_t maxStreams = 0;  // 0 is unlimited
+        unsigned threads = 0;     // 0 picks the number of cores
+    };
+
+    struct ReassembledChunk
+    {
+        uint64_t offset;      // in the image
+        uint32_t candidates;  // successors its predecessor had, 1 is certain
+    };
+
+    // One channel as far as it could be chained, in recording order
+    struct ReassembledStream
+    {
+        std::vector<ReassembledChunk> chunks;
+    };
+
+    struct ReassemblyStats
+    {
+        uint64_t chunks = 0;
+        uint64_t dead = 0;
+        uint64_t links = 0;    // successors chosen
+        uint64_t chains = 0;   // runs of linked chunks
+        uint64_t dropped = 0;  // chunks of chains no stream took
+    };
+
+    // Puts the chunks of a card written in no known order back into
+    // per-channel streams, without references or a fixed stride. Every
+    // chunk is fingerprinted, the chunks within `window` after it whose
+    // first samples continue its last ones become its candidate
+    // successors, ranked by continuationScore() and soundDistance(), and
+    // the best links are taken greedily, each chunk linked once. The
+    // chains are then joined into streams by how they sound, a chain going
+    // to the stream that sounds most alike and ended before it; at most
+    // `maxStreams` streams are started. Fingerprinting and the successor
+    // search run on `threads` workers.
+    std::vector<ReassembledStream> reassembleChunks(
+        ImageSource& img, const ReassemblyOptions& opts,
+        ReassemblyStats& stats, const OccupancyMap* occupancy = nullptr);
+}  // namespace Recovery
@@ -0,0 +1,302 @@
+#include "splice.h"
+#include "flexibity/log.h"
+#include "hamming.h"
+#include "journal.h"
+#include "metrics.h"
+#include "wav.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <format>
+#include <fstream>
+
+#ifdef LINUX
+#include <fcntl.h>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+#endif
+
+namespace Recovery
+{
+    namespace
+    {
+        // Bytes of the file the recorder saves for every track of `layout`
+        uint64_t sessionFileSize(const Layout& layout)
+        {
+            return layout.chunkSize + layout.channelBlockSize() * layout.count;
+        }
+
+        bool copyStream(const std::string& from, const std::string& to,
+                        uint64_t length)
+        {
+            std::ifstream in(from, std::ios::binary);
+            std::ofstream out(to, std::ios::binary | std::ios::trunc);
+            std::vector<char> buffer(1 << 20);
+            while (length && in && out)
+            {
+                auto size = std::min<uint64_t>(length, buffer.size());
+                in.read(buffer.data(), size);
+                out.write(buffer.data(), in.gcount());
+                length -= in.gcount();
+            }
+            return !length && out;
+        }
+
+#ifdef LINUX
+        // Leaves `to` holding the first `length` bytes of `from` without
+        // copying them through user space. False where the filesystems
+        // can't, the caller copies then.
+        bool copyInKernel(const std::string& from, const std::string& to,
+                          uint64_t length)
+        {
+            int in = open(from.c_str(), O_RDONLY);
+            if (in < 0)
+            {
+                return false;
+            }
+            int out = open(to.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            if (out < 0)
+            {
+                close(in);
+                return false;
+            }
+
+            // a reflink shares the extents, the copy is only cut short
+            bool done =
+                ioctl(out, FICLONE, in) == 0 && ftruncate(out, length) == 0;
+            if (done)
+            {
+                GDEBUG("Reflinked " << from << " to " << to);
+            }
+            else
+            {
+                loff_t inPos = 0;
+                loff_t outPos = 0;
+                while (uint64_t(outPos) < length)
+                {
+                    auto n = copy_file_range(in, &inPos, out, &outPos,
+                                             length - outPos, 0);
+                    if (n <= 0)
+                    {
+                        GDEBUG("copy_file_range() of " << from << ": "
+                                                       << strerror(errno));
+                        break;
+                    }
+                }
+                done = uint64_t(outPos) == length;
+            }
+            close(in);
+            return close(out) == 0 && done;
+        }
+#endif
+    }  // namespace
+
+    uint64_t savedFileOffset(const Layout& layout, uint32_t track,
+                             uint64_t position)
+    {
+        if (position < layout.chunkSize)
+        {
+            return layout.offset -
+                   uint64_t(layout.chunkSize) * (layout.numTracks - track) +
+                   position;
+        }
+        position -= layout.chunkSize;
+        auto block = uint32_t(position / layout.channelBlockSize());
+        return layout.channelBlockOffset(block, track) +
+               position % layout.channelBlockSize();
+    }
+
+    bool confirmSaved(ImageSource& img, const Layout& layout, uint32_t track,
+                      uint64_t maxBitErrors, SavedTrack& saved)
+    {
+        std::ifstream in(saved.fn, std::ios::binary | std::ios::ate);
+        if (!in)
+        {
+            GERROR("Unable to open saved track " << saved.fn);
+            return false;
+        }
+        saved.size = in.tellg();
+        saved.confirmed = 0;
+        saved.bitErrors = 0;
+
+        auto chunkSize = layout.chunkSize;
+        auto end = std::min(saved.size, sessionFileSize(layout));
+        std::vector<char> chunk(chunkSize);
+        // chunks of the file are chunks of the image, the last one may be
+        // cut short
+        for (auto start = (end + chunkSize - 1) / chunkSize * chunkSize;
+             start;)
+        {
+            start -= chunkSize;
+            auto size = std::min<uint64_t>(chunkSize, end - start);
+            in.seekg(start);
+            if (!in.read(chunk.data(), size))
+            {
+                GERROR("Unable to read saved track " << saved.fn);
+                return false;
+            }
+
+            metrics().matchAttempts.add();
+            auto data = img.read(savedFileOffset(layout, track, start), size);
+            uint64_t bitErrors = 0;
+            if (data.size() == size &&
+                nearlyEqual(chunk.data(), data.data(), size, maxBitErrors,
+                            bitErrors))
+            {
+                metrics().matches.add();
+                saved.confirmed = start + size;
+                saved.bitErrors = bitErrors;
+                break;
+            }
+        }
+        return true;
+    }
+
+    bool copyPrefix(const std::string& from, const std::string& to,
+                    uint64_t length)
+    {
+#ifdef LINUX
+        if (copyInKernel(from, to, length))
+        {
+            return true;
+        }
+#endif
+        if (!copyStream(from, to, length))
+        {
+            GERROR("Unable to copy " << std::dec << length << " bytes of "
+                                     << from << " to " << to);
+            return false;
+        }
+        metrics().bytesWritten.add(length);
+        return true;
+    }
+
+    std::vector<SplicedTrack> spliceTracks(
+        ImageSource& img, const Layout& layout,
+        const std::vector<SavedTrack>& saved, const std::string& dir,
+        const OccupancyMap* occupancy)
+    {
+        auto chunkSize = layout.chunkSize;
+        auto channelBlockSize = layout.channelBlockSize();
+        auto length = sessionFileSize(layout);
+
+        std::vector<SplicedTrack> spliced(layout.numTracks);
+        std::vector<std::ofstream> outs(layout.numTracks);
+        std::vector<uint64_t> from(layout.numTracks);  // first byte carved
+        std::vector<uint32_t> tails;  // tracks with a tail to carve
+        uint32_t first = layout.count;  // first Data Block a tail needs
+
+        auto write = [&](uint32_t track, std::span<const char> data) {
+            {
+                StageTimer timer(metrics().writeTime);
+                outs[track].write(data.data(), data.size());
+            }
+            metrics().writes.add();
+            metrics().bytesWritten.add(data.size());
+            spliced[track].carved += data.size();
+        };
+
+        for (uint32_t t = 0; t < layout.numTracks; ++t)
+        {
+            auto& result = spliced[t];
+            result.fn = std::format("{}/Recover {}.wav", dir, t + 1);
+            auto reuse = t < saved.size()
+                             ? std::min(saved[t].confirmed, length)
+                             : 0;
+            if (reuse)
+            {
+                if (!copyPrefix(saved[t].fn, result.fn, reuse) ||
+                    !resumeOutput(outs[t], result.fn, reuse))
+                {
+                    return {};
+                }
+            }
+            else
+            {
+                outs[t].open(result.fn, std::ios::binary);
+            }
+            if (!outs[t])
+            {
+                GERROR("Unable to open target file " << result.fn);
+                return {};
+            }
+            result.reused = reuse;
+
+            // the rest of the header chunk is in the run of headers
+            if (reuse < chunkSize)
+            {
+                auto header = img.read(savedFileOffset(layout, t, reuse),
+                                       chunkSize - reuse);
+                write(t, header);
+                if (header.size() != chunkSize - reuse)
+                {
+                    GERROR("Img eof!");
+                    return {};
+                }
+                reuse = chunkSize;
+            }
+
+            from[t] = reuse;
+            if (reuse < length)
+            {
+                tails.push_back(t);
+                first = std::min(
+                    first, uint32_t((reuse - chunkSize) / channelBlockSize));
+            }
+        }
+
+        // one forward pass that reads the tails and nothing else
+        if (!tails.empty())
+        {
+            img.advise(ImageSource::Access::Sequential,
+                       layout.channelBlockOffset(first, 0),
+                       layout.dataBlockSize() * (layout.count - first));
+        }
+        std::vector<char> filled(occupancy ? channelBlockSize : 0);
+        bool eof = false;
+        for (auto block = first; block < layout.count && !eof; ++block)
+        {
+            auto position = chunkSize + channelBlockSize * block;
+            for (auto t : tails)
+            {
+                if (position + channelBlockSize <= from[t])
+                {
+                    continue;
+                }
+                auto skip = from[t] > position ? from[t] - position : 0;
+                auto size = channelBlockSize - skip;
+                auto offset = layout.channelBlockOffset(block, t);
+                if (occupancy && !occupancy->live(offset, channelBlockSize))
+                {
+                    auto dead = std::span<char>(filled).first(size);
+                    occupancy->fillDead(offset + skip, dead);
+                    write(t, dead);
+                    continue;
+                }
+                auto audio = img.read(offset + skip, size);
+                write(t, audio);
+                if (audio.size() != size)
+                {
+                    GERROR("Img eof! " << std::dec << block << " of "
+                                       << layout.count
+                                       << " Data Blocks spliced");
+                    eof = true;
+                    break;
+                }
+            }
+        }
+
+        for (uint32_t t = 0; t < layout.numTracks; ++t)
+        {
+            outs[t].close();
+            std::fstream file(spliced[t].fn,
+                              std::ios::binary | std::ios::in | std::ios::out);
+            if (!finalizeRecorderWav(file))
+            {
+                GERROR("Left the header of " << spliced[t].fn << " as it is");
+            }
+        }
+        return spliced;
+    }
+}  // namespace Recovery
@@ -0,0 +1,59 @@
+#pragma once
+
+#include "recovery/imageSource.h"
+#include "recovery/layout.h"
+#include "recovery/occupancy.h"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace Recovery
+{
+    // A track the recorder saved before the crash, `N.audio(0).wav`
+    struct SavedTrack
+    {
+        std::string fn;          // empty if the track wasn't saved
+        uint64_t size = 0;       // bytes in the file
+        uint64_t confirmed = 0;  // leading bytes found in place in the image
+        uint64_t bitErrors = 0;  // in the chunk that confirmed them
+    };
+
+    // Image offset of byte `position` of the file the recorder saves for
+    // `track` (0-based): its WAV header chunk in the run before the first
+    // Data Block, then its Channel Blocks
+    uint64_t savedFileOffset(const Layout& layout, uint32_t track,
+                             uint64_t position);
+
+    // Finds how much of `saved.fn` lies where `layout` puts it in the image.
+    // Chunks are compared from the end of the file backwards and the first
+    // one that matches (with up to `maxBitErrors` flipped bits) confirms
+    // everything before it, so only the lost tail is read. Bytes past the
+    // session's `count` Data Blocks can't be confirmed.
+    // Returns false if the file can't be read.
+    bool confirmSaved(ImageSource& img, const Layout& layout, uint32_t track,
+                      uint64_t maxBitErrors, SavedTrack& saved);
+
+    // Creates `to` from the first `length` bytes of `from`, sharing its
+    // extents with a reflink where the filesystem can, with
+    // copy_file_range() otherwise, and a plain copy as the last resort
+    bool copyPrefix(const std::string& from, const std::string& to,
+                    uint64_t length);
+
+    struct SplicedTrack
+    {
+        std::string fn;       // `dir/Recover N.wav`
+        uint64_t reused = 0;  // bytes taken from the saved file
+        uint64_t carved = 0;  // bytes read from the image
+    };
+
+    // Completes every track of the session to the file the recorder would
+    // have saved: the confirmed bytes of `saved[track]` as they are, then
+    // the rest carved from the image in one pass over the Data Blocks the
+    // tails need. Channel Blocks `occupancy` knows are dead are rebuilt
+    // from their fill byte. Returns an empty vector if an output can't be
+    // written.
+    std::vector<SplicedTrack> spliceTracks(
+        ImageSource& img, const Layout& layout,
+        const std::vector<SavedTrack>& saved, const std::string& dir,
+        const OccupancyMap* occupancy = nullptr);
+}  // namespace Recovery
@@ -0,0 +1,168 @@
+#include "stream.h"
+#include "flexibity/log.h"
+#include <numeric>
+
+namespace Recovery
+{
+    namespace
+    {
+        // What streamTracks() needs for every Data Block
+        struct StreamPlan
+        {
+            const Layout& layout;
+            const StreamOptions& opts;
+            BlockRanges ranges;
+            std::vector<uint32_t> tracks;
+            std::vector<char> filled;  // a dead Channel Block rebuilt
+
+            StreamPlan(const Layout& layout, const StreamOptions& opts)
+                : layout(layout),
+                  opts(opts),
+                  ranges(streamRanges(layout, opts)),
+                  tracks(opts.tracks),
+                  filled(opts.occupancy ? layout.channelBlockSize() : 0)
+            {
+                if (tracks.empty())
+                {
+                    tracks.resize(layout.numTracks);
+                    std::iota(tracks.begin(), tracks.end(), 0);
+                }
+            }
+
+            bool valid() const
+            {
+                for (auto track : tracks)
+                {
+                    if (track >= layout.numTracks)
+                    {
+                        GERROR("No track " << std::dec << track + 1 << " in a "
+                                           << layout.numTracks
+                                           << " track session");
+                        return false;
+                    }
+                }
+                return true;
+            }
+
+            uint64_t rangeOffset(uint32_t block) const
+            {
+                return ranges.offset + ranges.stride * block;
+            }
+
+            bool dead(uint64_t offset, uint64_t size) const
+            {
+                return opts.occupancy && !opts.occupancy->live(offset, size);
+            }
+
+            // Hands the wanted Channel Blocks out of the range read for
+            // `block`, `data` is not looked at if the range is dead
+            void deliver(uint32_t block, std::span<const char> data,
+                         const TrackSink& sink)
+            {
+                auto channelBlockSize = layout.channelBlockSize();
+                for (auto track : tracks)
+                {
+                    auto offset = layout.channelBlockOffset(block, track);
+                    if (dead(offset, channelBlockSize))
+                    {
+                        opts.occupancy->fillDead(offset, filled);
+                        sink(track, block, filled);
+                    }
+                    else
+                    {
+                        sink(track, block,
+                             data.subspan(offset - rangeOffset(block),
+                                          channelBlockSize));
+                    }
+                }
+            }
+
+            void shortRead(uint32_t block, size_t size) const
+            {
+                GERROR("Short read of Data Block "
+                       << std::dec << block << " at " << std::hex
+                       << rangeOffset(block) << ": got " << size << " of "
+                       << ranges.size);
+            }
+        };
+    }  // namespace
+
+    BlockRanges streamRanges(const Layout& layout, const StreamOptions& opts)
+    {
+        if (opts.tracks.size() == 1)
+        {
+            return {layout.channelBlockOffset(0, opts.tracks.front()),
+                    layout.dataBlockSize(), layout.channelBlockSize(),
+                    layout.count};
+        }
+        return {layout.offset, layout.dataBlockSize(), layout.dataBlockSize(),
+                layout.count};
+    }
+
+    uint32_t streamTracks(ImageSource& img, const Layout& layout,
+                          const TrackSink& sink, const StreamOptions& opts)
+    {
+        StreamPlan plan(layout, opts);
+        if (!plan.valid())
+        {
+            return 0;
+        }
+        auto& ranges = plan.ranges;
+
+        // when only part of every Data Block is wanted, read-ahead of the
+        // rest is wasted I/O: the next range is asked for explicitly
+        bool gaps = ranges.size != ranges.stride;
+        img.advise(gaps ? ImageSource::Access::Random
+                        : ImageSource::Access::Sequential,
+                   ranges.offset, ranges.stride * ranges.count);
+
+        uint32_t block = 0;
+        for (; block < layout.count; ++block)
+        {
+            std::span<const char> data;
+            auto offset = plan.rangeOffset(block);
+            if (gaps)
+            {
+                img.advise(ImageSource::Access::WillNeed,
+                           plan.rangeOffset(block + 1), ranges.size);
+            }
+            if (!plan.dead(offset, ranges.size))
+            {
+                data = img.read(offset, ranges.size);
+                if (data.size() != ranges.size)
+                {
+                    plan.shortRead(block, data.size());
+                    break;
+                }
+            }
+            plan.deliver(block, data, sink);
+        }
+
+        return block;
+    }
+
+    uint32_t streamTracks(BlockReader& reader, const Layout& layout,
+                          const TrackSink& sink, const StreamOptions& opts)
+    {
+        StreamPlan plan(layout, opts);
+        if (!plan.valid())
+        {
+            return 0;
+        }
+
+        uint32_t block = 0;
+        for (; block < layout.count; ++block)
+        {
+            auto data = reader.acquire();
+            if (data.size() != plan.ranges.size)
+            {
+                plan.shortRead(block, data.size());
+                break;
+            }
+            plan.deliver(block, data, sink);
+            reader.release();
+        }
+
+        return block;
+    }
+}  // namespace Recovery
@@ -0,0 +1,48 @@
+#pragma once
+
+#include "recovery/blockReader.h"
+#include "recovery/imageSource.h"
+#include "recovery/layout.h"
+#include "recovery/occupancy.h"
+#include <cstdint>
+#include <functional>
+#include <span>
+#include <vector>
+
+namespace Recovery
+{
+    // Receives the Channel Block of `track` (0-based) in Data Block
+    // `block`. `audio` is a view into the image source, or into a shared
+    // buffer a dead Channel Block is rebuilt in, and only valid during the
+    // call: copy what has to outlive it.
+    using TrackSink = std::function<void(uint32_t track, uint32_t block,
+                                         std::span<const char> audio)>;
+
+    struct StreamOptions
+    {
+        std::vector<uint32_t> tracks;  // 0-based tracks wanted, empty for all
+        // Channel Blocks the map knows are dead are rebuilt from their fill
+        // byte instead of read
+        const OccupancyMap* occupancy = nullptr;
+    };
+
+    // Ranges a BlockReader has to read for streamTracks(): only the
+    // Channel Blocks of a single wanted track, whole Data Blocks otherwise
+    BlockRanges streamRanges(const Layout& layout, const StreamOptions& opts);
+
+    // Streams the audio of the wanted tracks of a session to `sink`, Data
+    // Block by Data Block and in the order the tracks are given, without
+    // copying it. Nothing is read that isn't needed: a single track is
+    // read one Channel Block at a time and dead blocks are skipped.
+    // Returns the number of Data Blocks delivered, less than layout.count
+    // if the image ends early.
+    uint32_t streamTracks(ImageSource& img, const Layout& layout,
+                          const TrackSink& sink,
+                          const StreamOptions& opts = {});
+
+    // Same from a reader opened on streamRanges(layout, opts), which reads
+    // the next blocks while `sink` works on the current one
+    uint32_t streamTracks(BlockReader& reader, const Layout& layout,
+                          const TrackSink& sink,
+                          const StreamOptions& opts = {});
+}  // namespace Recovery
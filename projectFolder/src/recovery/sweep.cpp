@@ -0,0 +1,200 @@
+#include "sweep.h"
+#include "continuity.h"
+#include "flexibity/log.h"
+#include "parallel.h"
+#include <algorithm>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <thread>
+
+namespace Recovery
+{
+    namespace
+    {
+        // boundaryScore() above this is a discontinuity
+        const double roughScore = 8;
+
+        // Both sides of the chunk boundary at one image offset
+        struct Edge
+        {
+            BoundaryTail tail;  // of the chunk ending here
+            char head[6];       // of the chunk starting here
+        };
+
+        // Edges of every chunk boundary between `first` and `last` (both
+        // inclusive), one chunk apart. Candidates whose offsets differ by
+        // whole chunks share a lane.
+        struct EdgeLane
+        {
+            uint32_t chunkSize = 0;
+            uint64_t first = UINT64_MAX;
+            uint64_t last = 0;
+            std::vector<Edge> edges;
+        };
+    }  // namespace
+
+    std::vector<Layout> SweepRanges::candidates() const
+    {
+        std::vector<Layout> layouts;
+        auto step = offsetStep ? offsetStep : base.chunkSize;
+        auto lastRep = std::max(lastRepition, base.repition);
+        auto lastTracks = std::max(lastNumTracks, base.numTracks);
+        for (uint64_t offset = base.offset; offset <= lastOffset;
+             offset += step)
+        {
+            for (uint32_t rep = base.repition; rep <= lastRep; ++rep)
+            {
+                for (uint32_t tracks = base.numTracks; tracks <= lastTracks;
+                     ++tracks)
+                {
+                    auto layout = base;
+                    layout.offset = offset;
+                    layout.repition = rep;
+                    layout.numTracks = tracks;
+                    layouts.push_back(layout);
+                }
+            }
+        }
+        return layouts;
+    }
+
+    std::vector<SweepResult> sweepLayouts(ImageSource& img,
+                                          const std::vector<Layout>& candidates,
+                                          unsigned threads)
+    {
+        if (threads == 0)
+        {
+            threads = std::max(1u, std::thread::hardware_concurrency());
+        }
+
+        // clamp the candidates to the image and plan the lanes they need
+        std::vector<SweepResult> results;
+        std::map<std::pair<uint32_t, uint64_t>, EdgeLane> lanes;
+        for (auto layout : candidates)
+        {
+            if (!layout.chunkSize || !layout.repition || !layout.numTracks ||
+                layout.offset < boundaryWindow ||
+                layout.offset >= img.size())
+            {
+                continue;
+            }
+            auto fits = (img.size() - layout.offset) / layout.dataBlockSize();
+            if (!layout.count || layout.count > fits)
+            {
+                layout.count = fits;
+            }
+            if (!layout.count)
+            {
+                continue;
+            }
+
+            auto& lane =
+                lanes[{layout.chunkSize, layout.offset % layout.chunkSize}];
+            lane.chunkSize = layout.chunkSize;
+            lane.first = std::min(lane.first, layout.offset);
+            lane.last = std::max(lane.last,
+                                 layout.offset +
+                                     layout.dataBlockSize() * layout.count);
+            results.push_back({layout, {}});
+        }
+
+        // decode every boundary once
+        std::vector<std::pair<EdgeLane*, uint64_t>> work;
+        const uint64_t edgesPerItem = 1024;
+        uint64_t total = 0;
+        for (auto& [key, lane] : lanes)
+        {
+            auto count = (lane.last - lane.first) / lane.chunkSize + 1;
+            lane.edges.resize(count);
+            for (uint64_t i = 0; i < count; i += edgesPerItem)
+            {
+                work.push_back({&lane, i});
+            }
+            total += count;
+        }
+        GINFO("Sweeping " << std::dec << results.size() << " layouts over "
+                          << total << " chunk boundaries with " << threads
+                          << " threads");
+
+        // only a few hundred bytes of every chunk are read
+        img.advise(ImageSource::Access::Random, 0, img.size());
+
+        std::mutex imgLock;
+        runWorkers(threads, work.size(), [&](uint64_t item) {
+            auto& [lane, start] = work[item];
+            auto end = std::min<uint64_t>(lane->edges.size(),
+                                          start + edgesPerItem);
+            char window[boundaryWindow + 6];
+
+            for (auto i = start; i < end; ++i)
+            {
+                auto pos = lane->first + uint64_t(lane->chunkSize) * i;
+                memset(window, 0, sizeof(window));
+                {
+                    std::unique_lock<std::mutex> lock(imgLock,
+                                                      std::defer_lock);
+                    if (!img.concurrentReads())
+                    {
+                        lock.lock();
+                    }
+                    auto data = img.read(pos - boundaryWindow, sizeof(window));
+                    memcpy(window, data.data(), data.size());
+                }
+
+                auto& edge = lane->edges[i];
+                edge.tail = boundaryTail(window + boundaryWindow);
+                memcpy(edge.head, window + boundaryWindow, sizeof(edge.head));
+            }
+        });
+
+        // then score the candidates from the cache
+        runWorkers(threads, results.size(), [&](uint64_t item) {
+            auto& result = results[item];
+            auto& layout = result.layout;
+            auto& lane =
+                lanes.at({layout.chunkSize, layout.offset % layout.chunkSize});
+            auto edgeAt = [&](uint64_t pos) -> const Edge& {
+                return lane.edges[(pos - lane.first) / layout.chunkSize];
+            };
+            auto score = [&](const Edge& before, const Edge& after) {
+                ++result.boundaries.total;
+                result.boundaries.rough +=
+                    boundaryScore(before.tail, after.head) > roughScore;
+            };
+
+            for (uint32_t block = 0; block < layout.count; ++block)
+            {
+                for (uint32_t t = 0; t < layout.numTracks; ++t)
+                {
+                    auto channelBlock = layout.channelBlockOffset(block, t);
+                    if (block > 0)
+                    {
+                        auto previous = layout.channelBlockOffset(block - 1, t);
+                        score(edgeAt(previous + layout.channelBlockSize()),
+                              edgeAt(channelBlock));
+                    }
+                    for (uint32_t j = 1; j < layout.repition; ++j)
+                    {
+                        auto& edge = edgeAt(channelBlock +
+                                            uint64_t(layout.chunkSize) * j);
+                        score(edge, edge);
+                    }
+                }
+            }
+        });
+
+        // smoothest first, more evidence first among equals
+        std::stable_sort(results.begin(), results.end(),
+                         [](const SweepResult& a, const SweepResult& b) {
+                             auto fa = a.boundaries.roughFraction();
+                             auto fb = b.boundaries.roughFraction();
+                             if (fa != fb)
+                             {
+                                 return fa < fb;
+                             }
+                             return a.boundaries.total > b.boundaries.total;
+                         });
+        return results;
+    }
+}  // namespace Recovery
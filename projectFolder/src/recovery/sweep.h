@@ -0,0 +1,40 @@
+#pragma once
+
+#include "recovery/analysis.h"
+#include "recovery/imageSource.h"
+#include "recovery/layout.h"
+#include <cstdint>
+#include <vector>
+
+namespace Recovery
+{
+    // Candidate layouts: every combination of the offsets from
+    // `firstOffset` to `lastOffset` by `offsetStep`, the repitions and the
+    // track counts, with the chunk size and count of `base`
+    struct SweepRanges
+    {
+        Layout base;
+        uint64_t lastOffset = 0;
+        uint64_t offsetStep = 0;  // 0 is one chunk
+        uint32_t lastRepition = 0;
+        uint32_t lastNumTracks = 0;
+
+        std::vector<Layout> candidates() const;
+    };
+
+    struct SweepResult
+    {
+        Layout layout;  // count clamped to the image
+        BoundaryStats boundaries;
+    };
+
+    // Scores the audio continuity of every chunk boundary each candidate
+    // layout produces, like analyzeContinuity(), and ranks the candidates
+    // smoothest first. Boundaries are decoded once into a cache shared by
+    // all candidates, then the candidates are scored on `threads` workers
+    // (0 picks the number of cores). Candidates with count 0 run up to the
+    // end of the image.
+    std::vector<SweepResult> sweepLayouts(ImageSource& img,
+                                          const std::vector<Layout>& candidates,
+                                          unsigned threads);
+}  // namespace Recovery
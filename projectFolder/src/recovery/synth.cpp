@@ -0,0 +1,115 @@
+#include "synth.h"
+#include "wav.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <numbers>
+
+namespace Recovery
+{
+    namespace
+    {
+        // small deterministic generator, the same everywhere
+        struct Lcg
+        {
+            uint64_t state;
+
+            uint32_t next()
+            {
+                state = state * 6364136223846793005ull + 1442695040888963407ull;
+                return uint32_t(state >> 33);
+            }
+        };
+
+        std::string trackAudio(uint32_t track, size_t size, Lcg& rng)
+        {
+            auto wh = recorderWavHeader();
+            std::string audio((const char*)&wh, sizeof(wh));
+            audio.reserve(size + 3);
+
+            double freq = 100 + 37 * track;
+            double amplitude = (1 << 21) + 1000 * track;
+            double phase = rng.next() % 628 / 100.0;
+            double step = 2 * std::numbers::pi * freq / wh.sampleRate;
+            for (uint64_t i = 0; audio.size() < size; ++i)
+            {
+                int32_t noise = int32_t(rng.next() % 101) - 50;
+                int32_t s = int32_t(amplitude * std::sin(phase + step * i)) +
+                            noise;
+                audio.append((const char*)&s, 3);
+            }
+            audio.resize(size);
+            return audio;
+        }
+    }  // namespace
+
+    SynthSession synthesizeImage(const SynthOptions& opts, std::string& image)
+    {
+        SynthSession session;
+        auto& layout = session.layout;
+        layout = opts.layout;
+        session.headerOffset = opts.pad;
+        layout.offset = opts.pad + uint64_t(layout.chunkSize) * layout.numTracks;
+
+        Lcg rng = {opts.seed};
+        auto trackSize =
+            layout.chunkSize + layout.channelBlockSize() * layout.count;
+        for (uint32_t t = 0; t < layout.numTracks; ++t)
+        {
+            session.tracks.push_back(trackAudio(t, trackSize, rng));
+        }
+        for (auto& silence : opts.silence)
+        {
+            auto& track = session.tracks.at(silence.track);
+            auto offset = std::min<uint64_t>(layout.chunkSize + silence.offset,
+                                             track.size());
+            auto length = std::min<uint64_t>(silence.length,
+                                             track.size() - offset);
+            memset(track.data() + offset, 0, length);
+        }
+
+        image.assign(opts.pad, '\xff');
+        image.reserve(layout.offset + layout.dataBlockSize() * layout.count);
+        for (auto& track : session.tracks)
+        {
+            image.append(track, 0, layout.chunkSize);
+        }
+        for (uint32_t block = 0; block < layout.count; ++block)
+        {
+            for (auto& track : session.tracks)
+            {
+                image.append(track,
+                             layout.chunkSize + layout.channelBlockSize() * block,
+                             layout.channelBlockSize());
+            }
+        }
+
+        for (auto& damage : opts.damage)
+        {
+            auto offset = std::min<uint64_t>(damage.offset, image.size());
+            auto length = std::min<uint64_t>(damage.length,
+                                             image.size() - offset);
+            switch (damage.kind)
+            {
+            case SynthDamage::Kind::Zero:
+                memset(image.data() + offset, 0, length);
+                break;
+            case SynthDamage::Kind::Skip:
+                image.erase(offset, length);
+                break;
+            case SynthDamage::Kind::Shift:
+            {
+                std::string junk;
+                for (uint64_t i = 0; i < damage.length; ++i)
+                {
+                    junk.push_back(char(rng.next()));
+                }
+                image.insert(offset, junk);
+                break;
+            }
+            }
+        }
+
+        return session;
+    }
+}  // namespace Recovery
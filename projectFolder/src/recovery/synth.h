@@ -0,0 +1,57 @@
+#pragma once
+
+#include "recovery/layout.h"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace Recovery
+{
+    // Damage applied to a synthetic image after it is built
+    struct SynthDamage
+    {
+        enum class Kind
+        {
+            Zero,   // `length` bytes at `offset` are zeroed
+            Skip,   // `length` bytes at `offset` are lost, the rest moves up
+            Shift,  // `length` junk bytes are inserted at `offset`
+        };
+
+        Kind kind;
+        uint64_t offset;
+        uint64_t length;
+    };
+
+    // A stretch a track recorded as digital silence, all 0x00 in its saved
+    // file as well as on the card
+    struct SynthSilence
+    {
+        uint32_t track;
+        uint64_t offset;  // in the audio, after the WAV header chunk
+        uint64_t length;
+    };
+
+    struct SynthOptions
+    {
+        Layout layout;       // offset is ignored, count Data Blocks are built
+        uint64_t pad = 0x2800;  // filler before the WAV header chunks
+        std::vector<SynthSilence> silence;
+        std::vector<SynthDamage> damage;  // applied in order
+        uint32_t seed = 1;
+    };
+
+    struct SynthSession
+    {
+        Layout layout;  // offset of the first Data Block as built
+        uint64_t headerOffset = 0;
+        // What the recorder saved for every track: the WAV header chunk,
+        // then `count` Channel Blocks of audio
+        std::vector<std::string> tracks;
+    };
+
+    // Builds a card image in the recorder's layout (see Readme.md): filler,
+    // one WAV header chunk per track, then the Data Blocks. Every track is
+    // a sine of its own frequency with a little noise, so the audio is
+    // continuous within a track and no two chunks are equal.
+    SynthSession synthesizeImage(const SynthOptions& opts, std::string& image);
+}  // namespace Recovery
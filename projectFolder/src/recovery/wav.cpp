@@ -0,0 +1,169 @@
+#include "wav.h"
+#include "flexibity/log.h"
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <string>
+
+namespace Recovery
+{
+    namespace
+    {
+        // RIFF / ds64 sizes are little endian
+        void put16(std::string& out, uint16_t v)
+        {
+            out.push_back(char(v));
+            out.push_back(char(v >> 8));
+        }
+
+        void put32(std::string& out, uint32_t v)
+        {
+            put16(out, uint16_t(v));
+            put16(out, uint16_t(v >> 16));
+        }
+
+        void put64(std::string& out, uint64_t v)
+        {
+            put32(out, uint32_t(v));
+            put32(out, uint32_t(v >> 32));
+        }
+
+        // "JUNK" or "ds64": RIFF size, data size, sample count, table length
+        const uint32_t ds64Size = 28;
+        const uint32_t ds64Offset = 12;
+
+        bool extensible(const WavFormat& format)
+        {
+            return format.numChannels > 2;
+        }
+
+        uint32_t fmtSize(const WavFormat& format)
+        {
+            return extensible(format) ? 40 : 16;
+        }
+
+        // KSDATAFORMAT_SUBTYPE_PCM
+        const uint8_t pcmSubFormat[16] = {0x01, 0x00, 0x00, 0x00, 0x00, 0x00,
+                                          0x10, 0x00, 0x80, 0x00, 0x00, 0xaa,
+                                          0x00, 0x38, 0x9b, 0x71};
+    }  // namespace
+
+    uint32_t wavHeaderSize(const WavFormat& format)
+    {
+        return 12 + 8 + ds64Size + 8 + fmtSize(format) + 8;
+    }
+
+    bool writeWavHeader(std::ostream& out, const WavFormat& format)
+    {
+        std::string header = "RIFF";
+        put32(header, 0);
+        header += "WAVE";
+
+        header += "JUNK";
+        put32(header, ds64Size);
+        header.append(ds64Size, '\0');
+
+        header += "fmt ";
+        put32(header, fmtSize(format));
+        put16(header, extensible(format) ? 0xFFFE : 1);
+        put16(header, format.numChannels);
+        put32(header, format.sampleRate);
+        put32(header, format.sampleRate * format.blockAlign());
+        put16(header, format.blockAlign());
+        put16(header, format.bitsPerSample);
+        if (extensible(format))
+        {
+            put16(header, 22);
+            put16(header, format.bitsPerSample);
+            put32(header, 0);  // no speaker positions for multitrack
+            header.append((const char*)pcmSubFormat, sizeof(pcmSubFormat));
+        }
+
+        header += "data";
+        put32(header, 0);
+
+        out.write(header.data(), header.size());
+        return bool(out);
+    }
+
+    bool finalizeWav(std::ostream& out, const WavFormat& format)
+    {
+        out.seekp(0, std::ios::end);
+        uint64_t end = out.tellp();
+        auto headerSize = wavHeaderSize(format);
+        if (!out || end < headerSize)
+        {
+            GERROR("Not a WAV file started by writeWavHeader()");
+            return false;
+        }
+
+        // odd sized chunks are padded, the pad byte is not part of the data
+        uint64_t dataSize = end - headerSize;
+        if (dataSize & 1)
+        {
+            out.put('\0');
+            ++end;
+        }
+
+        uint64_t riffSize = end - 8;
+        bool rf64 = riffSize > UINT32_MAX;
+
+        std::string riff = rf64 ? "RF64" : "RIFF";
+        put32(riff, rf64 ? UINT32_MAX : uint32_t(riffSize));
+        out.seekp(0);
+        out.write(riff.data(), riff.size());
+
+        if (rf64)
+        {
+            std::string ds64 = "ds64";
+            put32(ds64, ds64Size);
+            put64(ds64, riffSize);
+            put64(ds64, dataSize);
+            put64(ds64, dataSize / format.blockAlign());
+            put32(ds64, 0);
+            out.seekp(ds64Offset);
+            out.write(ds64.data(), ds64.size());
+        }
+
+        std::string data;
+        put32(data, rf64 ? UINT32_MAX : uint32_t(dataSize));
+        out.seekp(headerSize - 4);
+        out.write(data.data(), data.size());
+
+        out.seekp(0, std::ios::end);
+        return bool(out);
+    }
+
+    bool finalizeRecorderWav(std::iostream& file)
+    {
+        WAV_HEADER header;
+        file.seekg(0);
+        if (!file.read((char*)&header, sizeof(header)) ||
+            memcmp(header.chunkId, "RIFF", 4) ||
+            memcmp(header.format, "WAVE", 4) ||
+            memcmp(header.subchunk1Id, "fmt ", 4) ||
+            header.subchunk1Size != 16 ||
+            memcmp(header.subchunk2Id, "data", 4))
+        {
+            GERROR("Not a file with a recorder WAV header");
+            return false;
+        }
+
+        file.seekp(0, std::ios::end);
+        uint64_t end = file.tellp();
+        // the recorder's files stay well below 4 GB
+        std::string riff;
+        put32(riff, uint32_t(std::min<uint64_t>(end - 8, UINT32_MAX)));
+        file.seekp(offsetof(WAV_HEADER, chunkSize));
+        file.write(riff.data(), riff.size());
+
+        std::string data;
+        put32(data, uint32_t(std::min<uint64_t>(end - sizeof(header),
+                                                UINT32_MAX)));
+        file.seekp(offsetof(WAV_HEADER, subchunk2Size));
+        file.write(data.data(), data.size());
+
+        file.seekp(0, std::ios::end);
+        return bool(file);
+    }
+}  // namespace Recovery
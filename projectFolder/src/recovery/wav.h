@@ -0,0 +1,125 @@
+#pragma once
+
+#include <cstdint>
+#include <iostream>
+#include <ostream>
+
+namespace Recovery
+{
+    struct WAV_HEADER
+    {
+        // WAV-формат начинается с RIFF-заголовка:
+
+        // Содержит символы "RIFF" в ASCII кодировке
+        // (0x52494646 в big-endian представлении)
+        char chunkId[4];
+
+        // 36 + subchunk2Size, или более точно:
+        // 4 + (8 + subchunk1Size) + (8 + subchunk2Size)
+        // Это оставшийся размер цепочки, начиная с этой позиции.
+        // Иначе говоря, это размер файла - 8, то есть,
+        // исключены поля chunkId и chunkSize.
+        uint32_t chunkSize;
+
+        // Содержит символы "WAVE"
+        // (0x57415645 в big-endian представлении)
+        char format[4];
+
+        // Формат "WAVE" состоит из двух подцепочек: "fmt " и "data":
+        // Подцепочка "fmt " описывает формат звуковых данных:
+
+        // Содержит символы "fmt "
+        // (0x666d7420 в big-endian представлении)
+        char subchunk1Id[4];
+
+        // 16 для формата PCM.
+        // Это оставшийся размер подцепочки, начиная с этой позиции.
+        uint32_t subchunk1Size;
+
+        // Аудио формат, полный список можно получить здесь
+        // http://audiocoding.ru/wav_formats.txt Для PCM = 1 (то есть,
+        // Линейное квантование). Значения, отличающиеся от 1, обозначают
+        // некоторый формат сжатия.
+        uint16_t audioFormat;
+
+        // Количество каналов. Моно = 1, Стерео = 2 и т.д.
+        uint16_t numChannels;
+
+        // Частота дискретизации. 8000 Гц, 44100 Гц и т.д.
+        uint32_t sampleRate;
+
+        // sampleRate * numChannels * bitsPerSample/8
+        uint32_t byteRate;
+
+        // numChannels * bitsPerSample/8
+        // Количество байт для одного сэмпла, включая все каналы.
+        uint16_t blockAlign;
+
+        // Так называемая "глубиная" или точность звучания. 8 бит, 16 бит и
+        // т.д.
+        uint16_t bitsPerSample;
+
+        // Подцепочка "data" содержит аудио-данные и их размер.
+
+        // Содержит символы "data"
+        // (0x64617461 в big-endian представлении)
+        char subchunk2Id[4];
+
+        // numSamples * numChannels * bitsPerSample/8
+        // Количество байт в области данных.
+        uint32_t subchunk2Size;
+
+        // Далее следуют непосредственно Wav данные.
+    };
+
+    // Sample format of a WAV file written by writeWavHeader()
+    struct WavFormat
+    {
+        uint16_t numChannels = 1;
+        uint32_t sampleRate = 48000;
+        uint16_t bitsPerSample = 24;
+
+        uint16_t blockAlign() const
+        {
+            return numChannels * bitsPerSample / 8;
+        }
+    };
+
+    // Bytes before the audio data of a file started by writeWavHeader()
+    uint32_t wavHeaderSize(const WavFormat& format);
+
+    // Starts a WAV file of unknown length. A JUNK chunk keeps room for the
+    // RF64 ds64 chunk, so files over 4 GB can be finalized in place.
+    // More than two channels are written as WAVE_FORMAT_EXTENSIBLE.
+    bool writeWavHeader(std::ostream& out, const WavFormat& format);
+
+    // Patches the sizes of a file started by writeWavHeader() once all the
+    // audio is appended, promoting it to RF64 if it no longer fits RIFF.
+    // Leaves the stream at its end.
+    bool finalizeWav(std::ostream& out, const WavFormat& format);
+
+    // Sets the RIFF and data sizes of a file that starts with a recorder
+    // header (see recorderWavHeader()) to its length, in place of the
+    // recorder's placeholders. Leaves the stream at its end.
+    bool finalizeRecorderWav(std::iostream& file);
+
+    // Header of the mono 24 bit / 48 kHz tracks the recorder writes
+    inline WAV_HEADER recorderWavHeader()
+    {
+        return {
+            .chunkId = {'R', 'I', 'F', 'F'},
+            .chunkSize = 0x7FFFFF98,
+            .format = {'W', 'A', 'V', 'E'},
+            .subchunk1Id = {'f', 'm', 't', ' '},
+            .subchunk1Size = 16,
+            .audioFormat = 1,
+            .numChannels = 1,
+            .sampleRate = 48000,  // TODO: add to params
+            .byteRate = 144000,
+            .blockAlign = 3,
+            .bitsPerSample = 24,
+            .subchunk2Id = {'d', 'a', 't', 'a'},
+            .subchunk2Size = 0x7FFFFF74,
+        };
+    }
+}  // namespace Recovery
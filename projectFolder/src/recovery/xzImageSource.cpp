@@ -0,0 +1,270 @@
+#ifdef HAVE_LZMA
+
+#include "xzImageSource.h"
+#include "flexibity/log.h"
+#include <algorithm>
+#include <cstdlib>
+
+namespace Recovery
+{
+    namespace
+    {
+        // compressed bytes handed to the decoder at once
+        const size_t inputChunk = 1 << 20;
+
+        void freeFilters(lzma_filter* filters)
+        {
+            for (size_t i = 0; filters[i].id != LZMA_VLI_UNKNOWN; ++i)
+            {
+                free(filters[i].options);
+                filters[i].options = nullptr;
+            }
+            filters[0].id = LZMA_VLI_UNKNOWN;
+        }
+    }  // namespace
+
+    XzImageSource::~XzImageSource()
+    {
+        lzma_end(&strm);
+        freeFilters(filters);
+        lzma_index_end(index, nullptr);
+    }
+
+    bool XzImageSource::open(std::unique_ptr<ImageSource> file)
+    {
+        this->file = std::move(file);
+        filters[0].id = LZMA_VLI_UNKNOWN;
+
+        if (!readIndex())
+        {
+            return false;
+        }
+        imgSize = lzma_index_uncompressed_size(index);
+        GINFO("xz image: " << std::dec << lzma_index_block_count(index)
+                           << " Blocks, " << std::hex << imgSize
+                           << " bytes uncompressed");
+        return true;
+    }
+
+    // Reads the Index of every Stream, walking back from the end of file
+    bool XzImageSource::readIndex()
+    {
+        auto end = file->size();
+        while (end > 0)
+        {
+            // Stream Padding
+            uint64_t padding = 0;
+            while (end >= 4)
+            {
+                auto tail = file->read(end - 4, 4);
+                if (std::any_of(tail.begin(), tail.end(),
+                                [](char c) { return c != 0; }))
+                {
+                    break;
+                }
+                end -= 4;
+                padding += 4;
+            }
+
+            if (end < 2 * LZMA_STREAM_HEADER_SIZE)
+            {
+                GERROR("xz image is truncated");
+                return false;
+            }
+
+            lzma_stream_flags footer;
+            auto footerBytes = file->read(end - LZMA_STREAM_HEADER_SIZE,
+                                          LZMA_STREAM_HEADER_SIZE);
+            if (lzma_stream_footer_decode(
+                    &footer, (const uint8_t*)footerBytes.data()) != LZMA_OK)
+            {
+                GERROR("xz Stream Footer is corrupt at " << std::hex << end);
+                return false;
+            }
+
+            auto indexEnd = end - LZMA_STREAM_HEADER_SIZE;
+            if (footer.backward_size > indexEnd)
+            {
+                GERROR("xz Index is corrupt at " << std::hex << indexEnd);
+                return false;
+            }
+            auto indexBytes = file->read(indexEnd - footer.backward_size,
+                                         footer.backward_size);
+
+            lzma_index* stream = nullptr;
+            uint64_t memlimit = UINT64_MAX;
+            size_t inPos = 0;
+            if (lzma_index_buffer_decode(
+                    &stream, &memlimit, nullptr,
+                    (const uint8_t*)indexBytes.data(), &inPos,
+                    indexBytes.size()) != LZMA_OK)
+            {
+                GERROR("xz Index is corrupt at " << std::hex
+                                                 << indexEnd -
+                                                        footer.backward_size);
+                return false;
+            }
+            if (lzma_index_stream_flags(stream, &footer) != LZMA_OK ||
+                lzma_index_stream_padding(stream, padding) != LZMA_OK)
+            {
+                GERROR("xz Stream Footer is corrupt at " << std::hex << end);
+                lzma_index_end(stream, nullptr);
+                return false;
+            }
+
+            auto streamSize = lzma_index_stream_size(stream);
+            if (streamSize > end ||
+                (index && lzma_index_cat(stream, index, nullptr) != LZMA_OK))
+            {
+                GERROR("xz Stream is corrupt at " << std::hex << end);
+                lzma_index_end(stream, nullptr);
+                return false;
+            }
+            index = stream;
+            end -= streamSize;
+        }
+
+        return index != nullptr;
+    }
+
+    // Starts decoding the Block holding image `offset`
+    bool XzImageSource::startBlock(uint64_t offset)
+    {
+        active = false;
+        freeFilters(filters);
+
+        lzma_index_iter iter;
+        lzma_index_iter_init(&iter, index);
+        if (lzma_index_iter_locate(&iter, offset))
+        {
+            return false;
+        }
+
+        auto blockPos = iter.block.compressed_file_offset;
+        auto sizeByte = file->read(blockPos, 1);
+        if (sizeByte.empty())
+        {
+            return false;
+        }
+
+        block = {};
+        block.version = 0;
+        block.check = iter.stream.flags->check;
+        block.filters = filters;
+        block.header_size = lzma_block_header_size_decode(sizeByte[0]);
+
+        auto header = file->read(blockPos, block.header_size);
+        if (header.size() != block.header_size ||
+            lzma_block_header_decode(&block, nullptr,
+                                     (const uint8_t*)header.data()) !=
+                LZMA_OK ||
+            lzma_block_compressed_size(&block, iter.block.unpadded_size) !=
+                LZMA_OK ||
+            lzma_block_decoder(&strm, &block) != LZMA_OK)
+        {
+            GERROR("xz Block header is corrupt at " << std::hex << blockPos);
+            return false;
+        }
+
+        strm.avail_in = 0;
+        compressedPos = blockPos + block.header_size;
+        position = iter.block.uncompressed_file_offset;
+        blockEnd = position + iter.block.uncompressed_size;
+        active = true;
+        return true;
+    }
+
+    size_t XzImageSource::decode(char* out, size_t size)
+    {
+        strm.next_out = (uint8_t*)out;
+        strm.avail_out = size;
+
+        while (strm.avail_out)
+        {
+            if (!active || position == blockEnd)
+            {
+                if (!startBlock(position))
+                {
+                    break;
+                }
+            }
+            if (strm.avail_in == 0)
+            {
+                auto in = file->read(compressedPos, inputChunk);
+                if (in.empty())
+                {
+                    GERROR("xz image ends inside a Block");
+                    active = false;
+                    break;
+                }
+                strm.next_in = (const uint8_t*)in.data();
+                strm.avail_in = in.size();
+                compressedPos += in.size();
+            }
+
+            auto before = strm.avail_out;
+            auto ret = lzma_code(&strm, LZMA_RUN);
+            position += before - strm.avail_out;
+
+            if (ret == LZMA_STREAM_END)
+            {
+                // the next Block starts at a different compressed offset
+                active = false;
+            }
+            else if (ret != LZMA_OK)
+            {
+                GERROR("xz decoding failed with " << ret << " at "
+                                                  << std::hex << position);
+                active = false;
+                break;
+            }
+        }
+
+        return size - strm.avail_out;
+    }
+
+    std::span<const char> XzImageSource::read(uint64_t offset, size_t size)
+    {
+        if (offset >= imgSize)
+        {
+            return {};
+        }
+        size = std::min<uint64_t>(size, imgSize - offset);
+
+        if (offset >= bufStart && offset + size <= bufStart + bufSize)
+        {
+            return {readBuf.data() + (offset - bufStart), size};
+        }
+
+        // decoding backwards or past the current Block means restarting
+        // at the Block holding `offset`
+        if (!active || offset < position || offset >= blockEnd)
+        {
+            if (!startBlock(offset))
+            {
+                return {};
+            }
+        }
+
+        if (readBuf.size() < size)
+        {
+            readBuf.resize(size);
+        }
+
+        bufSize = 0;
+        while (position < offset)
+        {
+            auto skip = std::min<uint64_t>(offset - position, readBuf.size());
+            if (!decode(readBuf.data(), skip))
+            {
+                return {};
+            }
+        }
+
+        bufStart = offset;
+        bufSize = decode(readBuf.data(), size);
+        return {readBuf.data(), bufSize};
+    }
+}  // namespace Recovery
+
+#endif
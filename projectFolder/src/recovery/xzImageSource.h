@@ -0,0 +1,55 @@
+#pragma once
+
+#ifdef HAVE_LZMA
+
+#include "recovery/imageSource.h"
+#include <lzma.h>
+
+namespace Recovery
+{
+    // Decodes an .xz compressed image on the fly. The xz index maps image
+    // offsets to compressed Blocks, so reads start decoding at the Block
+    // that holds them: images compressed with several Blocks (xz -T0)
+    // are random access, single Block ones decode forward from the start.
+    // Forward reads, as done by the demux and mapping modes, never decode
+    // a byte twice.
+    class XzImageSource : public ImageSource
+    {
+    public:
+        ~XzImageSource() override;
+
+        // `file` supplies the compressed bytes
+        bool open(std::unique_ptr<ImageSource> file);
+
+        uint64_t size() const override
+        {
+            return imgSize;
+        }
+        std::span<const char> read(uint64_t offset, size_t size) override;
+
+    private:
+        bool readIndex();
+        bool startBlock(uint64_t offset);
+        size_t decode(char* out, size_t size);
+
+        std::unique_ptr<ImageSource> file;
+        lzma_index* index = nullptr;
+        lzma_stream strm = LZMA_STREAM_INIT;
+        // the decoder keeps pointers to both while a Block is decoded
+        lzma_block block;
+        lzma_filter filters[LZMA_FILTERS_MAX + 1];
+        bool active = false;
+
+        uint64_t imgSize = 0;
+        uint64_t position = 0;  // image offset the decoder is at
+        uint64_t blockEnd = 0;  // image offset the current Block ends at
+        uint64_t compressedPos = 0;
+
+        // last decoded window
+        std::vector<char> readBuf;
+        uint64_t bufStart = 0;
+        size_t bufSize = 0;
+    };
+}  // namespace Recovery
+
+#endif
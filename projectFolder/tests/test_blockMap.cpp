@@ -0,0 +1,89 @@
+#include "test.h"
+#include "recovery/blockMap.h"
+#include <cstdio>
+
+void testWriteAndOpen()
+{
+    const char* fn = "test_blockMap.map";
+    {
+        Recovery::BlockMapWriter writer;
+        assertTrue(writer.open(fn, 0x8000, 3));
+        writer.add(0x10000, 2, 0);
+        writer.add(0x18000, 0, 7, 4);
+        writer.add(0x40000, 1, 1, 1, 3);
+        // header written on destruction
+    }
+
+    for (auto backend : {"mmap", "stream"})
+    {
+        Recovery::BlockMap map;
+        assertTrue(map.open(fn, backend));
+        assertTrue(map.chunkSize() == 0x8000);
+        assertTrue(map.numTracks() == 3);
+        assertTrue(map.entries().size() == 3);
+
+        auto entry = map.find(0x18000);
+        assertTrue(entry != nullptr);
+        assertTrue(entry->track == 0 && entry->chunk == 7);
+        assertTrue(entry->candidates == 4);
+        assertTrue(entry->bitErrors == 0);
+        assertTrue(map.find(0x40000)->candidates == 1);
+        assertTrue(map.find(0x40000)->bitErrors == 3);
+        assertTrue(map.find(0x20000) == nullptr);
+        assertTrue(map.find(0x50000) == nullptr);
+    }
+
+    std::remove(fn);
+}
+
+void testGatherInMapOrder()
+{
+    const uint32_t chunkSize = 16;
+    std::string image;
+    for (char c = 'a'; c < 'a' + 8; ++c)
+    {
+        image.append(chunkSize, c);
+    }
+
+    const char* fn = "test_blockMap.map";
+    {
+        Recovery::BlockMapWriter writer;
+        assertTrue(writer.open(fn, chunkSize, 2));
+        for (uint32_t i : {1u, 2u, 5u, 7u})
+        {
+            writer.add(chunkSize * i, i % 2, i);
+        }
+        // runs past the end of the image
+        writer.add(chunkSize * 8, 0, 8);
+        assertTrue(writer.close());
+    }
+
+    Recovery::BlockMap map;
+    assertTrue(map.open(fn, "stream"));
+    Recovery::MemoryImageSource img(image);
+    std::string gathered;
+    auto chunks = Recovery::gatherChunks(
+        img, map,
+        [&](const Recovery::BlockMapEntry& entry, const char* data,
+            size_t size) {
+            assertTrue(entry.offset == uint64_t(data[0] - 'a') * chunkSize);
+            gathered.append(data, size);
+        });
+    assertTrue(chunks == 4);
+    assertTrue(gathered == image.substr(chunkSize, 2 * chunkSize) +
+                               image.substr(5 * chunkSize, chunkSize) +
+                               image.substr(7 * chunkSize, chunkSize));
+
+    std::remove(fn);
+
+    Recovery::BlockMap missing;
+    assertTrue(!missing.open(fn, "stream"));
+}
+
+int main()
+{
+    testWriteAndOpen();
+    testGatherInMapOrder();
+
+    return 0;
+}
@@ -0,0 +1,61 @@
+#include "test.h"
+#include "recovery/asyncWriter.h"
+#include "recovery/blockReader.h"
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+
+void testReadersYieldRangesInOrder(const std::string& fn)
+{
+    std::string image;
+    for (int i = 0; i < 100000; ++i)
+    {
+        image.push_back(char(i % 253));
+    }
+    {
+        std::ofstream out(fn, std::ios::binary);
+        out.write(image.data(), image.size());
+    }
+
+    // the last range runs past the end of the image
+    Recovery::BlockRanges ranges = {100, 9000, 5000, 12};
+
+    for (auto io : {"uring", "thread"})
+    {
+        for (uint32_t depth : {1u, 3u})
+        {
+            Recovery::PipelineOptions opts = {io, depth, false};
+            auto reader = Recovery::openBlockReader(fn, "mmap", ranges, opts);
+            assertTrue(reader != nullptr);
+
+            // writes release the ranges from the writer thread
+            std::ostringstream out;
+            Recovery::AsyncWriter writer;
+            std::string expected;
+            for (uint32_t k = 0; k < ranges.count; ++k)
+            {
+                auto offset = ranges.offset + ranges.stride * k;
+                expected += image.substr(offset, ranges.size);
+
+                auto data = reader->acquire();
+                assertTrue(data.size() ==
+                           std::min<size_t>(ranges.size, image.size() - offset));
+                writer.write(out, data, [&] { reader->release(); });
+            }
+            writer.flush();
+
+            assertTrue(out.str() == expected);
+            assertTrue(reader->acquire().empty());
+        }
+    }
+
+    std::remove(fn.c_str());
+}
+
+int main()
+{
+    testReadersYieldRangesInOrder("test_blockReader.img");
+
+    return 0;
+}
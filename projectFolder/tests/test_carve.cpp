@@ -0,0 +1,108 @@
+#include "test.h"
+#include "recovery/carve.h"
+#include "recovery/parallel.h"
+#include "recovery/synth.h"
+#include "recovery/wav.h"
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+
+std::string readFile(const std::filesystem::path& fn)
+{
+    std::ifstream in(fn, std::ios::binary);
+    std::ostringstream data;
+    data << in.rdbuf();
+    return data.str();
+}
+
+void testScheduledReads()
+{
+    std::string image;
+    for (int i = 0; i < 200000; ++i)
+    {
+        image.push_back(char(i % 241));
+    }
+    Recovery::MemoryImageSource img(image);
+    Recovery::IoScheduler io(img);
+
+    // every worker reads its own stream, interleaved with the others
+    Recovery::runWorkers(4, 4, [&](uint64_t worker) {
+        Recovery::ScheduledImageSource src(io);
+        for (uint64_t offset = worker * 1000; offset < image.size();
+             offset += 9000)
+        {
+            auto data = src.read(offset, 1500);
+            assertTrue(std::string(data.begin(), data.end()) ==
+                       image.substr(offset, 1500));
+        }
+    });
+}
+
+void testCarveEverySession()
+{
+    // two sessions of different layouts, one after the other
+    std::vector<Recovery::SynthSession> synth;
+    std::string image;
+    for (auto [numTracks, repition] : {std::pair{3u, 4u}, {5u, 2u}})
+    {
+        Recovery::SynthOptions opts;
+        opts.layout.chunkSize = 0x1000;
+        opts.layout.numTracks = numTracks;
+        opts.layout.repition = repition;
+        opts.layout.count = 4;
+        opts.seed = numTracks;
+
+        std::string part;
+        auto session = Recovery::synthesizeImage(opts, part);
+        session.headerOffset += image.size();
+        session.layout.offset += image.size();
+        synth.push_back(session);
+        image += part;
+    }
+    Recovery::MemoryImageSource img(image);
+
+    auto sessions = Recovery::detectSessions(img, 0, 0);
+    assertTrue(sessions.size() == 2);
+
+    auto dest = std::filesystem::temp_directory_path() / "test_carve";
+    for (unsigned threads : {1u, 2u})
+    {
+        std::filesystem::remove_all(dest);
+        auto carved =
+            Recovery::carveSessions(img, sessions, dest.string(), threads);
+        assertTrue(carved.size() == 2);
+
+        auto headerSize = Recovery::wavHeaderSize({});
+        for (size_t i = 0; i < carved.size(); ++i)
+        {
+            auto& layout = synth[i].layout;
+            assertTrue(carved[i].blocks == layout.count);
+            for (uint32_t t = 0; t < layout.numTracks; ++t)
+            {
+                auto wav = readFile(std::filesystem::path(carved[i].dir) /
+                                    ("Recover " + std::to_string(t + 1) +
+                                     ".wav"));
+                assertTrue(wav.substr(headerSize) ==
+                           synth[i].tracks[t].substr(layout.chunkSize));
+            }
+        }
+    }
+    std::filesystem::remove_all(dest);
+
+    // a track that can't be written leaves its session at 0 Data Blocks,
+    // the others are carved all the same
+    std::filesystem::create_directories(dest / "Session 2" / "Recover 3.wav");
+    auto carved = Recovery::carveSessions(img, sessions, dest.string(), 2);
+    assertTrue(carved.size() == 2);
+    assertTrue(carved[0].blocks == synth[0].layout.count);
+    assertTrue(carved[1].blocks == 0);
+    std::filesystem::remove_all(dest);
+}
+
+int main()
+{
+    testScheduledReads();
+    testCarveEverySession();
+
+    return 0;
+}
@@ -0,0 +1,64 @@
+#include "test.h"
+#include "recovery/chunkIndex.h"
+#include <filesystem>
+#include <fstream>
+
+void testHashChunk()
+{
+    std::string a(0x8000, 'a');
+    std::string b = a;
+    b[0x4000] ^= 1;
+
+    assertTrue(Recovery::hashChunk(a.data(), a.size()) ==
+               Recovery::hashChunk(a.data(), a.size()));
+    assertTrue(Recovery::hashChunk(a.data(), a.size()) !=
+               Recovery::hashChunk(b.data(), b.size()));
+    assertTrue(Recovery::hashChunk(a.data(), 31) !=
+               Recovery::hashChunk(a.data(), 30));
+}
+
+void testIndexFindsChunksOutOfOrder()
+{
+    const uint32_t chunkSize = 64;
+    auto dest = std::filesystem::temp_directory_path() / "test_chunkIndex";
+    std::filesystem::create_directories(dest);
+
+    // two tracks of three chunks, every chunk distinct, plus a partial tail
+    for (int track = 0; track < 2; ++track)
+    {
+        std::ofstream out(dest / (std::to_string(track + 1) + ".audio(0).wav"),
+                          std::ios::binary);
+        for (int chunk = 0; chunk < 3; ++chunk)
+        {
+            out << std::string(chunkSize, char('A' + track * 3 + chunk));
+        }
+        out << "tail";
+    }
+
+    Recovery::ChunkIndex index;
+    assertTrue(index.build(dest.string(), 2, chunkSize, "stream"));
+    assertTrue(index.size() == 6);
+    assertTrue(index.trackChunks(1) == 3);
+
+    std::vector<Recovery::ChunkLocation> matches;
+    std::string chunk(chunkSize, 'F');
+    assertTrue(index.find(chunk, matches) == 1);
+    assertTrue(matches[0].track == 1 && matches[0].chunk == 2);
+
+    chunk = std::string(chunkSize, 'A');
+    assertTrue(index.find(chunk, matches) == 1);
+    assertTrue(matches[0].track == 0 && matches[0].chunk == 0);
+
+    chunk[5] = 'B';
+    assertTrue(index.find(chunk, matches) == 0);
+
+    std::filesystem::remove_all(dest);
+}
+
+int main()
+{
+    testHashChunk();
+    testIndexFindsChunksOutOfOrder();
+
+    return 0;
+}
@@ -0,0 +1,94 @@
+#include "test.h"
+#include "recovery/imageSource.h"
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+
+#ifdef HAVE_LZMA
+#include <lzma.h>
+#endif
+
+std::string testImage()
+{
+    std::string image;
+    for (int i = 0; i < 300000; ++i)
+    {
+        image.push_back(char(i % 251));
+    }
+    return image;
+}
+
+void writeFile(const std::string& fn, const std::string& data)
+{
+    std::ofstream out(fn, std::ios::binary);
+    out.write(data.data(), data.size());
+}
+
+std::string tarOf(const std::string& name, const std::string& data)
+{
+    std::string header(512, '\0');
+    memcpy(header.data(), name.data(), name.size());
+    snprintf(header.data() + 124, 12, "%011o", unsigned(data.size()));
+    header[156] = '0';
+    memcpy(header.data() + 257, "ustar", 5);
+
+    std::string tar = header + data;
+    tar.resize((tar.size() + 511) / 512 * 512 + 1024, '\0');
+    return tar;
+}
+
+void testTarMemberIsTheImage()
+{
+    auto image = testImage();
+    writeFile("test_compressedImage.tar", tarOf("card.dd", image));
+
+    auto img = Recovery::openImage("test_compressedImage.tar", "stream");
+    assertTrue(img != nullptr);
+    assertTrue(img->size() == image.size());
+    auto data = img->read(image.size() - 100, 1000);
+    assertTrue(std::string(data.begin(), data.end()) ==
+               image.substr(image.size() - 100));
+
+    std::remove("test_compressedImage.tar");
+}
+
+#ifdef HAVE_LZMA
+void testXzRandomAccess()
+{
+    auto image = testImage();
+    auto tar = tarOf("card.dd", image);
+
+    std::string xz(lzma_stream_buffer_bound(tar.size()), '\0');
+    size_t xzSize = 0;
+    assertTrue(lzma_easy_buffer_encode(6, LZMA_CHECK_CRC64, nullptr,
+                                       (const uint8_t*)tar.data(),
+                                       tar.size(), (uint8_t*)xz.data(),
+                                       &xzSize, xz.size()) == LZMA_OK);
+    xz.resize(xzSize);
+    writeFile("test_compressedImage.xz", xz);
+
+    auto img = Recovery::openImage("test_compressedImage.xz", "mmap");
+    assertTrue(img != nullptr);
+    assertTrue(img->size() == image.size());
+
+    // forward, backward, overlapping and clamped reads
+    for (uint64_t offset : {0, 70000, 1000, 1500, 299990, 65536})
+    {
+        auto data = img->read(offset, 4096);
+        assertTrue(std::string(data.begin(), data.end()) ==
+                   image.substr(offset, 4096));
+    }
+
+    std::remove("test_compressedImage.xz");
+}
+#endif
+
+int main()
+{
+    testTarMemberIsTheImage();
+#ifdef HAVE_LZMA
+    testXzRandomAccess();
+#endif
+
+    return 0;
+}
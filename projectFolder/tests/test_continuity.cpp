@@ -0,0 +1,82 @@
+#include "test.h"
+#include "recovery/analysis.h"
+#include "recovery/continuity.h"
+#include <cmath>
+
+void testVectorDecodeMatchesScalar()
+{
+    std::string data;
+    for (int i = 0; i < 3 * 100; ++i)
+    {
+        data.push_back(char(i * 37 + (i >> 3)));
+    }
+
+    for (size_t count : {0, 1, 5, 6, 10, 11, 64, 100})
+    {
+        std::vector<int32_t> samples(count);
+        Recovery::decode24(data.data(), count, samples.data());
+
+        uint64_t expected = 0;
+        for (size_t i = 0; i < count; ++i)
+        {
+            assertTrue(samples[i] == Recovery::sample24(data.data() + 3 * i));
+            if (i >= 2)
+            {
+                expected += std::abs(int64_t(samples[i]) - 2 * samples[i - 1] +
+                                     samples[i - 2]);
+            }
+        }
+        assertTrue(Recovery::secondDiffSum(samples.data(), count) == expected);
+    }
+}
+
+void testDetectChunkMisalignment()
+{
+    Recovery::Layout layout;
+    layout.offset = 0x3000;
+    layout.chunkSize = 0x600;
+    layout.repition = 4;
+    layout.numTracks = 3;
+    layout.count = 5;
+
+    // one sine per track, packed like the recorder does
+    std::string image(layout.offset, '\0');
+    for (uint32_t block = 0; block < layout.count; ++block)
+    {
+        for (uint32_t t = 0; t < layout.numTracks; ++t)
+        {
+            auto samples = layout.channelBlockSize() / 3;
+            for (uint64_t i = samples * block; i < samples * (block + 1); ++i)
+            {
+                int32_t s = 3e6 * std::sin(0.003 * (t + 1) * i + 2 * t);
+                image.append((const char*)&s, 3);
+            }
+        }
+    }
+    Recovery::MemoryImageSource img(image);
+
+    auto report = Recovery::analyzeContinuity(img, layout);
+    assertTrue(report.misalignment == 0);
+    assertTrue(report.correctedOffset == layout.offset);
+    for (auto& track : report.tracks)
+    {
+        assertTrue(track.flagged.empty());
+    }
+
+    // read every Channel Block one chunk late
+    auto late = layout;
+    late.offset += layout.chunkSize;
+    late.count -= 1;
+    report = Recovery::analyzeContinuity(img, late);
+    assertTrue(report.positions[3].roughFraction() == 1);
+    assertTrue(report.misalignment == 1);
+    assertTrue(report.correctedOffset == layout.offset);
+}
+
+int main()
+{
+    testVectorDecodeMatchesScalar();
+    testDetectChunkMisalignment();
+
+    return 0;
+}
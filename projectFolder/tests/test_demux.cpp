@@ -0,0 +1,135 @@
+#include "test.h"
+#include "recovery/demux.h"
+#include <cstdio>
+#include <sstream>
+
+void testDemuxSplitsDataBlocks()
+{
+    Recovery::Layout layout = {
+        .offset = 16,
+        .chunkSize = 4,
+        .repition = 2,
+        .numTracks = 3,
+        .count = 2,
+    };
+
+    // every byte of a Channel Block carries its track number
+    std::string image(layout.offset, 'x');
+    for (uint32_t block = 0; block < layout.count; ++block)
+    {
+        for (uint32_t track = 0; track < layout.numTracks; ++track)
+        {
+            image.append(layout.channelBlockSize(), char('a' + track));
+        }
+    }
+    Recovery::MemoryImageSource img(image);
+
+    std::vector<std::string> tracks(layout.numTracks);
+    auto blocks = Recovery::demux(
+        img, layout, [&](uint32_t track, const char* data, size_t size) {
+            tracks[track].append(data, size);
+        });
+
+    assertTrue(blocks == layout.count);
+    for (uint32_t track = 0; track < layout.numTracks; ++track)
+    {
+        assertTrue(tracks[track] ==
+                   std::string(layout.channelBlockSize() * layout.count,
+                               char('a' + track)));
+    }
+}
+
+void testDemuxStopsOnShortImage()
+{
+    Recovery::Layout layout = {
+        .offset = 0,
+        .chunkSize = 4,
+        .repition = 1,
+        .numTracks = 2,
+        .count = 3,
+    };
+
+    std::string image(layout.dataBlockSize() + 3, 'z');
+    Recovery::MemoryImageSource img(image);
+
+    auto blocks = Recovery::demux(img, layout,
+                                  [](uint32_t, const char*, size_t) {});
+
+    assertTrue(blocks == 1);
+}
+
+void testDemuxKeepsConstantBlocks()
+{
+    Recovery::Layout layout = {
+        .offset = 6,
+        .chunkSize = 6,
+        .repition = 2,
+        .numTracks = 3,
+        .count = 3,
+    };
+
+    // constant Channel Blocks are dead to the occupancy map, yet they are
+    // audio: track 2 rests at -1 LSB (all 0xFF) in Data Block 1, track 3
+    // holds a DC offset in Data Block 2 and two fills in Data Block 0
+    std::string image(layout.offset, '\0');
+    for (uint32_t block = 0; block < layout.count; ++block)
+    {
+        for (uint32_t track = 0; track < layout.numTracks; ++track)
+        {
+            for (uint32_t i = 0; i < layout.channelBlockSize(); ++i)
+            {
+                char byte = char(block * 40 + track * 13 + i + 1);
+                if (block == 1 && track == 1)
+                {
+                    byte = '\xff';
+                }
+                else if (block == 2 && track == 2)
+                {
+                    byte = '\x42';
+                }
+                else if (block == 0 && track == 2)
+                {
+                    byte = i < layout.chunkSize ? '\0' : '\x11';
+                }
+                image += byte;
+            }
+        }
+    }
+    Recovery::MemoryImageSource img(image);
+    auto map = Recovery::mapOccupancy(img, 0, 0, layout.chunkSize, 1);
+    assertTrue(!map.live(layout.channelBlockOffset(1, 1),
+                         layout.channelBlockSize()));
+    assertTrue(!map.live(layout.channelBlockOffset(2, 2),
+                         layout.channelBlockSize()));
+    assertTrue(!map.live(layout.channelBlockOffset(0, 2),
+                         layout.channelBlockSize()));
+
+    std::vector<std::string> tracks(layout.numTracks);
+    auto blocks = Recovery::demux(
+        img, layout,
+        [&](uint32_t track, const char* data, size_t size) {
+            tracks[track].append(data, size);
+        },
+        &map);
+
+    assertTrue(blocks == layout.count);
+    for (uint32_t track = 0; track < layout.numTracks; ++track)
+    {
+        std::string expected;
+        for (uint32_t block = 0; block < layout.count; ++block)
+        {
+            expected += image.substr(layout.channelBlockOffset(block, track),
+                                     layout.channelBlockSize());
+        }
+        assertTrue(tracks[track] == expected);
+    }
+}
+
+int main()
+{
+    testDemuxSplitsDataBlocks();
+    testDemuxStopsOnShortImage();
+    testDemuxKeepsConstantBlocks();
+
+    return 0;
+}
@@ -0,0 +1,96 @@
+#include "test.h"
+#include "recovery/detect.h"
+#include "recovery/wav.h"
+#include <cmath>
+#include <cstring>
+
+std::string wavHeaderChunk(uint32_t chunkSize)
+{
+    auto wh = Recovery::recorderWavHeader();
+    std::string chunk((const char*)&wh, sizeof(wh));
+    chunk.resize(chunkSize, '\0');
+    return chunk;
+}
+
+void testFindWavHeadersAtAnyAlignment()
+{
+    std::string data(4096, 'R');
+    auto header = wavHeaderChunk(64);
+    std::vector<uint64_t> expected = {0, 17, 33, 100, 1000, 4096 - 16};
+    for (auto pos : expected)
+    {
+        memcpy(data.data() + pos, header.data(), 16);
+    }
+
+    std::vector<uint64_t> found;
+    Recovery::findWavHeaders(data, 0x1000, found);
+    assertTrue(found.size() == expected.size());
+    for (size_t i = 0; i < found.size(); ++i)
+    {
+        assertTrue(found[i] == expected[i] + 0x1000);
+    }
+}
+
+void testDetectSessionLayout()
+{
+    const uint32_t chunkSize = 0x1000;
+    const uint32_t repition = 4;
+    const uint32_t numTracks = 5;
+    const uint32_t blocks = 6;
+    const size_t pad = 0x2800;
+
+    // one sine per track, packed like the recorder does
+    std::vector<std::string> streams(numTracks);
+    for (uint32_t t = 0; t < numTracks; ++t)
+    {
+        auto& stream = streams[t];
+        stream = wavHeaderChunk(chunkSize);
+        stream.resize(sizeof(Recovery::WAV_HEADER));
+        for (int i = 0; stream.size() < chunkSize * (1 + repition * blocks);
+             ++i)
+        {
+            int32_t s = 3e6 * std::sin(0.01 * (t + 1) * i + t);
+            stream.append((const char*)&s, 3);
+        }
+    }
+
+    std::string image(pad, '\xff');
+    for (uint32_t t = 0; t < numTracks; ++t)
+    {
+        image.append(streams[t], 0, chunkSize);
+    }
+    for (uint32_t block = 0; block < blocks; ++block)
+    {
+        for (uint32_t t = 0; t < numTracks; ++t)
+        {
+            image.append(streams[t],
+                         chunkSize * (1 + repition * block),
+                         chunkSize * repition);
+        }
+    }
+
+    Recovery::MemoryImageSource img(image);
+    auto sessions = Recovery::detectSessions(img, 0, 0);
+    assertTrue(sessions.size() == 1);
+
+    auto& session = sessions.front();
+    assertTrue(session.headerOffset == pad);
+    assertTrue(session.sampleRate == 48000);
+    assertTrue(session.layout.numTracks == numTracks);
+    assertTrue(session.layout.chunkSize == chunkSize);
+    assertTrue(session.layout.offset == pad + chunkSize * numTracks);
+    assertTrue(session.layout.repition == repition);
+    assertTrue(session.layout.count == blocks);
+
+    // nothing to find after the headers
+    assertTrue(
+        Recovery::detectSessions(img, session.layout.offset, 0).empty());
+}
+
+int main()
+{
+    testFindWavHeadersAtAnyAlignment();
+    testDetectSessionLayout();
+
+    return 0;
+}
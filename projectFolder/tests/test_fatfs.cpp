@@ -0,0 +1,366 @@
+#include "test.h"
+#include "recovery/fatfs.h"
+#include <cstring>
+
+const uint32_t sector = 512;
+
+void put16(std::string& s, size_t at, uint16_t v)
+{
+    memcpy(s.data() + at, &v, sizeof(v));
+}
+
+void put32(std::string& s, size_t at, uint32_t v)
+{
+    memcpy(s.data() + at, &v, sizeof(v));
+}
+
+void put64(std::string& s, size_t at, uint64_t v)
+{
+    memcpy(s.data() + at, &v, sizeof(v));
+}
+
+std::string content(size_t size, char seed)
+{
+    std::string data(size, '\0');
+    for (size_t i = 0; i < size; ++i)
+    {
+        data[i] = char(seed + i * 7 + i / 251);
+    }
+    return data;
+}
+
+// FAT32 with one sector per cluster: reserved sectors, two FATs, the heap
+struct Fat32Builder
+{
+    const uint32_t reserved = 32;
+    const uint32_t fatSectors = 2;
+    const uint32_t clusters = 200;
+    std::string volume;
+
+    Fat32Builder()
+    {
+        auto sectors = reserved + 2 * fatSectors + clusters;
+        volume.assign(size_t(sectors) * sector, '\0');
+        memcpy(volume.data() + 3, "MSDOS5.0", 8);
+        put16(volume, 11, sector);
+        volume[13] = 1;
+        put16(volume, 14, reserved);
+        volume[16] = 2;
+        put32(volume, 32, sectors);
+        put32(volume, 36, fatSectors);
+        put32(volume, 44, 2);
+        volume[510] = char(0x55);
+        volume[511] = char(0xAA);
+        link(0, 0x0FFFFFF8);
+        link(1, 0x0FFFFFFF);
+    }
+
+    size_t clusterOffset(uint32_t cluster)
+    {
+        return size_t(reserved + 2 * fatSectors + cluster - 2) * sector;
+    }
+
+    void link(uint32_t cluster, uint32_t next)
+    {
+        for (uint32_t fat = 0; fat < 2; ++fat)
+        {
+            put32(volume, (reserved + fat * fatSectors) * sector + 4 * cluster,
+                  next);
+        }
+    }
+
+    // Stores `data` in `chain`, linked in the FAT
+    void write(const std::vector<uint32_t>& chain, const std::string& data)
+    {
+        for (size_t i = 0; i < chain.size(); ++i)
+        {
+            link(chain[i], i + 1 < chain.size() ? chain[i + 1] : 0x0FFFFFFF);
+            auto part = data.substr(i * sector, sector);
+            memcpy(volume.data() + clusterOffset(chain[i]), part.data(),
+                   part.size());
+        }
+    }
+
+    static std::string entry(const char* shortName, uint8_t attributes,
+                             uint32_t cluster, uint32_t size)
+    {
+        std::string e(32, '\0');
+        memcpy(e.data(), shortName, 11);
+        e[11] = char(attributes);
+        put16(e, 20, cluster >> 16);
+        put16(e, 26, cluster & 0xFFFF);
+        put32(e, 28, size);
+        return e;
+    }
+
+    // Long name entries, last piece first, then the short entry
+    static std::string named(const std::u16string& name, const char* shortName,
+                             uint8_t attributes, uint32_t cluster,
+                             uint32_t size)
+    {
+        auto pieces = (name.size() + 12) / 13;
+        std::u16string padded = name;
+        if (padded.size() < pieces * 13)
+        {
+            padded += u'\0';
+        }
+        padded.resize(pieces * 13, u'\xFFFF');
+
+        std::string entries;
+        for (auto piece = pieces; piece-- > 0;)
+        {
+            std::string e(32, '\0');
+            e[0] = char((piece + 1) | (piece + 1 == pieces ? 0x40 : 0));
+            e[11] = 0x0F;
+            auto chars = padded.data() + piece * 13;
+            for (auto [at, count] : {std::pair{1, 5}, {14, 6}, {28, 2}})
+            {
+                for (int k = 0; k < count; ++k)
+                {
+                    put16(e, at + 2 * k, *chars++);
+                }
+            }
+            entries += e;
+        }
+        return entries + entry(shortName, attributes, cluster, size);
+    }
+};
+
+void testFat32()
+{
+    Fat32Builder fat;
+
+    auto track1 = content(5 * sector - 100, 1);
+    auto readme = content(300, 2);
+
+    // root: a label, a deleted file and the session folder
+    std::string root = Fat32Builder::entry("CARD       ", 0x08, 0, 0);
+    auto deleted = Fat32Builder::entry("OLD     WAV", 0x20, 50, 10);
+    deleted[0] = char(0xE5);
+    root += deleted;
+    root += Fat32Builder::named(u"Session 001", "SESSIO~1   ", 0x10, 3, 0);
+    fat.write({2}, root);
+
+    // the session folder spans two clusters
+    std::string session = Fat32Builder::entry(".          ", 0x10, 3, 0);
+    session += Fat32Builder::entry("..         ", 0x10, 0, 0);
+    while (session.size() < sector)
+    {
+        auto e = Fat32Builder::entry("GONE       ", 0x20, 0, 0);
+        e[0] = char(0xE5);
+        session += e;
+    }
+    session += Fat32Builder::named(u"1.audio(0).wav", "1AUDIO~1WAV", 0x20,
+                                   10, track1.size());
+    auto lower = Fat32Builder::entry("README  TXT", 0x20, 40, readme.size());
+    lower[12] = 0x18;
+    session += lower;
+    fat.write({3, 4}, session);
+
+    // fragmented: 10-12, then 20-21
+    fat.write({10, 11, 12, 20, 21}, track1);
+    fat.write({40}, readme);
+
+    // behind an MBR partition at LBA 8
+    std::string image(8 * sector, '\0');
+    image[446 + 4] = 0x0C;
+    put32(image, 446 + 8, 8);
+    image[510] = char(0x55);
+    image[511] = char(0xAA);
+    image += fat.volume;
+    Recovery::MemoryImageSource img(image);
+
+    auto volumes = Recovery::findFatVolumes(img);
+    assertTrue(volumes.size() == 1 && volumes[0] == 8 * sector);
+
+    Recovery::FatVolume volume;
+    assertTrue(volume.open(img, volumes[0]));
+    assertTrue(!volume.isExFat());
+    assertTrue(volume.clusterSize() == sector);
+
+    auto files = volume.files();
+    assertTrue(files.size() == 2);
+    assertTrue(files[0].path == "Session 001/1.audio(0).wav");
+    assertTrue(files[0].size == track1.size());
+    assertTrue(files[0].extents.size() == 2);
+    assertTrue(files[0].extents[0].offset ==
+               8 * sector + fat.clusterOffset(10));
+    assertTrue(files[0].extents[0].length == 3 * sector);
+    assertTrue(files[1].path == "Session 001/readme.txt");
+
+    std::string copied;
+    auto size = Recovery::readFile(
+        img, files[0],
+        [&](std::span<const char> data) {
+            assertTrue(data.size() <= 256);
+            copied.append(data.begin(), data.end());
+        },
+        256);
+    assertTrue(size == track1.size());
+    assertTrue(copied == track1);
+
+    // no boot sector there
+    assertTrue(!volume.open(img, 0));
+}
+
+// exFAT with 512 byte clusters, the heap at sector 32
+struct ExFatBuilder
+{
+    const uint32_t heap = 32;
+    const uint32_t clusters = 100;
+    std::string volume;
+
+    ExFatBuilder()
+    {
+        volume.assign(size_t(heap + clusters) * sector, '\0');
+        memcpy(volume.data() + 3, "EXFAT   ", 8);
+        put64(volume, 72, heap + clusters);
+        put32(volume, 80, 24);
+        put32(volume, 84, 2);
+        put32(volume, 88, heap);
+        put32(volume, 92, clusters);
+        put32(volume, 96, 2);
+        volume[108] = 9;
+        volume[109] = 0;
+        volume[510] = char(0x55);
+        volume[511] = char(0xAA);
+    }
+
+    size_t clusterOffset(uint32_t cluster)
+    {
+        return size_t(heap + cluster - 2) * sector;
+    }
+
+    void write(const std::vector<uint32_t>& chain, const std::string& data,
+               bool linked = true)
+    {
+        for (size_t i = 0; i < chain.size(); ++i)
+        {
+            if (linked)
+            {
+                put32(volume, 24 * sector + 4 * chain[i],
+                      i + 1 < chain.size() ? chain[i + 1] : 0xFFFFFFFF);
+            }
+            auto part = data.substr(i * sector, sector);
+            memcpy(volume.data() + clusterOffset(chain[i]), part.data(),
+                   part.size());
+        }
+    }
+
+    // File, Stream Extension and File Name entries
+    static std::string file(const std::u16string& name, bool directory,
+                            uint32_t cluster, uint64_t validSize,
+                            uint64_t size, bool contiguous)
+    {
+        auto names = (name.size() + 14) / 15;
+        std::string set(32 * (2 + names), '\0');
+        set[0] = char(0x85);
+        set[1] = char(1 + names);
+        put16(set, 4, directory ? 0x10 : 0x20);
+
+        set[32] = char(0xC0);
+        set[33] = char(0x01 | (contiguous ? 0x02 : 0));
+        set[35] = char(name.size());
+        put64(set, 40, validSize);
+        put32(set, 52, cluster);
+        put64(set, 56, size);
+
+        for (size_t k = 0; k < name.size(); ++k)
+        {
+            auto at = 64 + 32 * (k / 15);
+            set[at] = char(0xC1);
+            put16(set, at + 2 + 2 * (k % 15), name[k]);
+        }
+        return set;
+    }
+};
+
+void testExFat()
+{
+    ExFatBuilder ex;
+
+    auto track1 = content(3 * sector - 7, 3);
+    auto track34 = content(1000, 4);
+
+    // root: an allocation bitmap entry and the session folder
+    std::string root(32, '\0');
+    root[0] = char(0x81);
+    root += ExFatBuilder::file(u"Session", true, 5, sector, sector, true);
+    // names of a damaged directory that would leave the copy's folder
+    root += ExFatBuilder::file(u"..", true, 2, sector, sector, true);
+    root += ExFatBuilder::file(u"/1.audio(0).wav", false, 10, 10, 10, true);
+    root += ExFatBuilder::file(u"a\\1.audio(0).wav", false, 10, 10, 10,
+                               true);
+    ex.write({2}, root);
+
+    std::string session =
+        ExFatBuilder::file(u"1.audio(0).wav", false, 10, track1.size(),
+                           track1.size(), false);
+    // only 900 bytes are valid, the rest was never written
+    session += ExFatBuilder::file(u"Track 34.audio(0).wav", false, 40, 900,
+                                  track34.size(), true);
+    ex.write({5}, session, false);
+
+    ex.write({10, 11, 30}, track1);
+    ex.write({40, 41}, track34, false);
+
+    // behind a GPT, the partition at LBA 64
+    std::string image(64 * sector, '\0');
+    image[446 + 4] = char(0xEE);
+    put32(image, 446 + 8, 1);
+    image[510] = char(0x55);
+    image[511] = char(0xAA);
+    memcpy(image.data() + sector, "EFI PART", 8);
+    put64(image, sector + 72, 2);
+    put32(image, sector + 80, 4);
+    put32(image, sector + 84, 128);
+    image[2 * sector] = 1;  // partition type GUID
+    put64(image, 2 * sector + 32, 64);
+    image += ex.volume;
+    Recovery::MemoryImageSource img(image);
+
+    auto volumes = Recovery::findFatVolumes(img);
+    assertTrue(volumes.size() == 1 && volumes[0] == 64 * sector);
+
+    Recovery::FatVolume volume;
+    assertTrue(volume.open(img, volumes[0]));
+    assertTrue(volume.isExFat());
+
+    auto files = volume.files();
+    assertTrue(files.size() == 2);
+    assertTrue(files[0].path == "Session/1.audio(0).wav");
+    assertTrue(files[0].extents.size() == 2);
+    assertTrue(files[1].path == "Session/Track 34.audio(0).wav");
+    assertTrue(files[1].size == 900);
+    assertTrue(files[1].extents.size() == 1);
+
+    for (size_t i = 0; i < files.size(); ++i)
+    {
+        std::string copied;
+        Recovery::readFile(img, files[i], [&](std::span<const char> data) {
+            copied.append(data.begin(), data.end());
+        });
+        assertTrue(copied == (i ? track34.substr(0, 900) : track1));
+    }
+
+    assertTrue(Recovery::safeFileName("1.audio(0).wav"));
+    assertTrue(Recovery::safeFileName("..."));
+    for (std::string name : {"", ".", "..", "a/b", "a\\b", "/"})
+    {
+        assertTrue(!Recovery::safeFileName(name));
+    }
+    assertTrue(!Recovery::safeFileName(std::string("a\0b", 3)));
+
+    // a bare volume without a partition table
+    Recovery::MemoryImageSource bare(ex.volume);
+    volumes = Recovery::findFatVolumes(bare);
+    assertTrue(volumes.size() == 1 && volumes[0] == 0);
+}
+
+int main()
+{
+    testFat32();
+    testExFat();
+
+    return 0;
+}
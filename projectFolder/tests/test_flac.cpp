@@ -0,0 +1,327 @@
+#include "test.h"
+#include "recovery/flac.h"
+#include <cmath>
+#include <cstring>
+#include <sstream>
+
+// Decodes the subset of FLAC the encoder writes: STREAMINFO, fixed block
+// sizes, independent channels and CONSTANT, VERBATIM and FIXED subframes
+// with Rice coded residuals. Checks both CRCs of every frame.
+struct FlacReader
+{
+    std::string data;
+    size_t bit = 0;
+
+    uint32_t get(uint32_t bits)
+    {
+        uint32_t v = 0;
+        for (uint32_t i = 0; i < bits; ++i, ++bit)
+        {
+            v = (v << 1) | ((uint8_t(data[bit / 8]) >> (7 - bit % 8)) & 1);
+        }
+        return v;
+    }
+
+    int32_t getSigned(uint32_t bits)
+    {
+        auto v = get(bits);
+        return bits < 32 ? int32_t(v << (32 - bits)) >> (32 - bits)
+                         : int32_t(v);
+    }
+
+    static uint32_t crc(const std::string& bytes, uint32_t width,
+                        uint32_t poly)
+    {
+        uint32_t crc = 0;
+        uint32_t top = 1u << (width - 1);
+        for (auto c : bytes)
+        {
+            crc ^= uint32_t(uint8_t(c)) << (width - 8);
+            for (int i = 0; i < 8; ++i)
+            {
+                crc = crc & top ? (crc << 1) ^ poly : crc << 1;
+                crc &= (1u << width) - 1;
+            }
+        }
+        return crc;
+    }
+
+    uint32_t sampleRate = 0;
+    uint32_t channels = 0;
+    uint32_t bps = 0;
+    uint64_t totalSamples = 0;
+
+    // Interleaved samples of the whole stream
+    std::vector<int32_t> decode()
+    {
+        assertTrue(data.substr(0, 4) == "fLaC");
+        bit = 32;
+        assertTrue(get(1) == 1 && get(7) == 0 && get(24) == 34);
+        assertTrue(get(16) == Recovery::flacBlockSize);
+        assertTrue(get(16) == Recovery::flacBlockSize);
+        get(48);
+        sampleRate = get(20);
+        channels = get(3) + 1;
+        bps = get(5) + 1;
+        totalSamples = uint64_t(get(4)) << 32;
+        totalSamples |= get(32);
+        get(128);
+
+        std::vector<int32_t> samples;
+        uint64_t frame = 0;
+        while (bit / 8 < data.size())
+        {
+            auto start = bit / 8;
+            assertTrue(get(16) == 0xFFF8);
+            auto sizeCode = get(4);
+            get(4);
+            assertTrue(get(4) == channels - 1);
+            get(4);
+            uint64_t number = get(8);
+            auto extra = std::countl_one(uint8_t(number));
+            if (extra)
+            {
+                number &= 0x7F >> extra;
+                for (int k = 1; k < extra; ++k)
+                {
+                    auto b = get(8);
+                    assertTrue((b & 0xC0) == 0x80);
+                    number = (number << 6) | (b & 0x3F);
+                }
+            }
+            assertTrue(number == frame++);
+            uint32_t count = Recovery::flacBlockSize;
+            if (sizeCode == 7)
+            {
+                count = get(16) + 1;
+            }
+            else
+            {
+                assertTrue(sizeCode == 12);
+            }
+            auto header = data.substr(start, bit / 8 - start);
+            assertTrue(get(8) == crc(header, 8, 0x07));
+
+            std::vector<std::vector<int32_t>> decoded(channels);
+            for (auto& x : decoded)
+            {
+                x = subframe(count);
+            }
+            bit = (bit + 7) / 8 * 8;
+            auto body = data.substr(start, bit / 8 - start);
+            assertTrue(get(16) == crc(body, 16, 0x8005));
+
+            for (uint32_t i = 0; i < count; ++i)
+            {
+                for (auto& x : decoded)
+                {
+                    samples.push_back(x[i]);
+                }
+            }
+        }
+        return samples;
+    }
+
+    std::vector<int32_t> subframe(uint32_t count)
+    {
+        assertTrue(get(1) == 0);
+        auto type = get(6);
+        assertTrue(get(1) == 0);
+        std::vector<int32_t> x;
+        if (type == 0)
+        {
+            x.assign(count, getSigned(bps));
+            return x;
+        }
+        if (type == 1)
+        {
+            for (uint32_t i = 0; i < count; ++i)
+            {
+                x.push_back(getSigned(bps));
+            }
+            return x;
+        }
+        assertTrue((type & 0x38) == 0x08);
+        auto order = type & 7;
+        assertTrue(order <= 4);
+        for (uint32_t i = 0; i < order; ++i)
+        {
+            x.push_back(getSigned(bps));
+        }
+        auto method = get(2);
+        assertTrue(method <= 1);
+        auto partitionOrder = get(4);
+        for (uint32_t part = 0; part < (1u << partitionOrder); ++part)
+        {
+            auto k = get(method ? 5 : 4);
+            assertTrue(k < (method ? 31u : 15u));
+            auto n = (count >> partitionOrder) - (part ? 0 : order);
+            for (uint32_t i = 0; i < n; ++i)
+            {
+                uint32_t q = 0;
+                while (!get(1))
+                {
+                    ++q;
+                }
+                uint32_t u = (q << k) | get(k);
+                int64_t r = (u >> 1) ^ -int64_t(u & 1);
+                auto j = x.size();
+                int64_t p = 0;
+                switch (order)
+                {
+                case 1: p = x[j - 1]; break;
+                case 2: p = 2 * int64_t(x[j - 1]) - x[j - 2]; break;
+                case 3:
+                    p = 3 * int64_t(x[j - 1]) - 3 * int64_t(x[j - 2]) +
+                        x[j - 3];
+                    break;
+                case 4:
+                    p = 4 * int64_t(x[j - 1]) - 6 * int64_t(x[j - 2]) +
+                        4 * int64_t(x[j - 3]) - x[j - 4];
+                    break;
+                }
+                x.push_back(int32_t(p + r));
+            }
+        }
+        return x;
+    }
+};
+
+// Little-endian PCM as a WAV data chunk holds it
+std::string pcm(const std::vector<int32_t>& samples, uint32_t bps)
+{
+    std::string bytes;
+    for (auto s : samples)
+    {
+        bytes.append(reinterpret_cast<const char*>(&s), bps / 8);
+    }
+    return bytes;
+}
+
+// Encodes `samples` appended in pieces of `piece` bytes and checks the
+// stream decodes to them again
+void roundTrip(const std::vector<int32_t>& samples,
+               const Recovery::WavFormat& format, size_t piece,
+               unsigned threads = 3)
+{
+    auto bytes = pcm(samples, format.bitsPerSample);
+    std::stringstream out;
+    {
+        Recovery::FlacEncoderPool pool(threads);
+        Recovery::FlacStream stream(out, format, pool);
+        for (size_t at = 0; at < bytes.size(); at += piece)
+        {
+            stream.append({bytes.data() + at,
+                           std::min(piece, bytes.size() - at)});
+        }
+        assertTrue(stream.finish());
+        assertTrue(stream.samples() == samples.size() / format.numChannels);
+    }
+
+    FlacReader reader{out.str()};
+    auto decoded = reader.decode();
+    assertTrue(reader.sampleRate == format.sampleRate);
+    assertTrue(reader.channels == format.numChannels);
+    assertTrue(reader.bps == format.bitsPerSample);
+    assertTrue(reader.totalSamples == samples.size() / format.numChannels);
+    assertTrue(decoded == samples);
+}
+
+std::vector<int32_t> sine(size_t count, double amplitude)
+{
+    std::vector<int32_t> samples(count);
+    for (size_t i = 0; i < count; ++i)
+    {
+        samples[i] = int32_t(amplitude * std::sin(i * 0.01) +
+                             0.001 * amplitude * std::sin(i * 1.3));
+    }
+    return samples;
+}
+
+std::vector<int32_t> noise(size_t count, uint32_t bps)
+{
+    std::vector<int32_t> samples(count);
+    uint32_t state = 12345;
+    for (auto& s : samples)
+    {
+        state = state * 1664525 + 1013904223;
+        s = int32_t(state) >> (32 - bps);
+    }
+    return samples;
+}
+
+void testRoundTrip24()
+{
+    Recovery::WavFormat format;
+
+    // silence compresses to constant subframes
+    std::vector<int32_t> silence(3 * Recovery::flacBlockSize);
+    std::stringstream out;
+    {
+        Recovery::FlacEncoderPool pool(2);
+        Recovery::FlacStream stream(out, format, pool);
+        auto bytes = pcm(silence, 24);
+        stream.append(bytes);
+        assertTrue(stream.finish());
+    }
+    assertTrue(out.str().size() < 100);
+    roundTrip(silence, format, 0x40000);
+
+    // a short last frame, appends splitting samples
+    auto music = sine(20 * Recovery::flacBlockSize + 1000, 4000000);
+    roundTrip(music, format, 0x8000);
+    roundTrip(music, format, 1000, 1);
+
+    // full scale noise falls back to verbatim
+    roundTrip(noise(Recovery::flacBlockSize + 7, 24), format, 0x8000);
+}
+
+void testCompresses()
+{
+    Recovery::WavFormat format;
+    auto music = sine(50 * Recovery::flacBlockSize, 1000000);
+    auto bytes = pcm(music, 24);
+
+    std::stringstream out;
+    Recovery::FlacEncoderPool pool;
+    Recovery::FlacStream stream(out, format, pool);
+    stream.append(bytes);
+    assertTrue(stream.finish());
+    assertTrue(out.str().size() < bytes.size() * 3 / 5);
+}
+
+void testFormats()
+{
+    Recovery::WavFormat cd;
+    cd.sampleRate = 44100;
+    cd.bitsPerSample = 16;
+    cd.numChannels = 2;
+    auto left = sine(5 * Recovery::flacBlockSize, 20000);
+    std::vector<int32_t> stereo;
+    for (size_t i = 0; i < left.size(); ++i)
+    {
+        stereo.push_back(left[i]);
+        stereo.push_back(-left[i] / 2);
+    }
+    roundTrip(stereo, cd, 0x1000);
+
+    Recovery::WavFormat odd;
+    odd.sampleRate = 47999;
+    odd.numChannels = 8;
+    roundTrip(noise(8 * 300, 20), odd, 999);
+
+    // over 127 frames the frame number takes two bytes
+    Recovery::WavFormat low;
+    low.sampleRate = 8000;
+    low.bitsPerSample = 16;
+    roundTrip(sine(200 * Recovery::flacBlockSize, 100), low, 0x40000);
+}
+
+int main()
+{
+    testRoundTrip24();
+    testCompresses();
+    testFormats();
+
+    return 0;
+}
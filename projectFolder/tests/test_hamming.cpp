@@ -0,0 +1,91 @@
+#include "test.h"
+#include "recovery/hamming.h"
+#include <bit>
+#include <string>
+
+std::string noise(size_t size, uint32_t seed)
+{
+    std::string data(size, '\0');
+    for (auto& c : data)
+    {
+        seed = seed * 1664525 + 1013904223;
+        c = char(seed >> 24);
+    }
+    return data;
+}
+
+uint64_t naiveDistance(const std::string& a, const std::string& b)
+{
+    uint64_t bits = 0;
+    for (size_t i = 0; i < a.size(); ++i)
+    {
+        bits += std::popcount(uint8_t(a[i] ^ b[i]));
+    }
+    return bits;
+}
+
+void testHammingDistance()
+{
+    // sizes around the 256 byte steps and the word tail
+    for (size_t size : {0, 1, 7, 8, 31, 255, 256, 257, 1000, 0x8000})
+    {
+        auto a = noise(size, 1);
+        auto b = noise(size, 2);
+        assertTrue(Recovery::hammingDistance(a.data(), b.data(), size) ==
+                   naiveDistance(a, b));
+        assertTrue(Recovery::hammingDistance(a.data(), a.data(), size) == 0);
+    }
+
+    // flipped bits anywhere, the last one in the tail
+    auto a = noise(0x1003, 3);
+    auto b = a;
+    for (size_t pos : {0, 300, 0x1000, 0x1002})
+    {
+        b[pos] ^= 0x81;
+    }
+    assertTrue(Recovery::hammingDistance(a.data(), b.data(), a.size()) == 8);
+
+    // stops early once over the limit
+    auto c = noise(0x8000, 4);
+    auto d = noise(0x8000, 5);
+    auto bits = Recovery::hammingDistance(c.data(), d.data(), c.size(), 10);
+    assertTrue(bits > 10);
+    assertTrue(bits < naiveDistance(c, d));
+}
+
+void testNearlyEqual()
+{
+    const size_t size = 0x8000;
+    auto a = noise(size, 6);
+    auto b = a;
+    b[5] ^= 1;
+    b[size / 2 + 3] ^= 0x10;
+    b[size - 1] ^= 0x03;
+
+    uint64_t bitErrors = 99;
+    assertTrue(!Recovery::nearlyEqual(a.data(), b.data(), size, 0, bitErrors));
+    assertTrue(Recovery::nearlyEqual(a.data(), a.data(), size, 0, bitErrors));
+    assertTrue(bitErrors == 0);
+    assertTrue(Recovery::nearlyEqual(a.data(), b.data(), size, 4, bitErrors));
+    assertTrue(bitErrors == 4);
+    assertTrue(!Recovery::nearlyEqual(a.data(), b.data(), size, 3, bitErrors));
+
+    // alike at the start, unrelated further on
+    auto c = a;
+    auto tail = noise(size / 2, 7);
+    c.replace(size / 2, tail.size(), tail);
+    assertTrue(!Recovery::nearlyEqual(a.data(), c.data(), size, 64,
+                                      bitErrors));
+
+    // too small to sample
+    assertTrue(Recovery::nearlyEqual(a.data(), b.data(), 16, 1, bitErrors));
+    assertTrue(bitErrors == 1);
+}
+
+int main()
+{
+    testHammingDistance();
+    testNearlyEqual();
+
+    return 0;
+}
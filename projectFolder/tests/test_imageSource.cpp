@@ -0,0 +1,49 @@
+#include "test.h"
+#include "recovery/imageSource.h"
+#include <cstdio>
+#include <fstream>
+
+void testBackendsReadTheSameBytes(const std::string& fn)
+{
+    std::string image;
+    for (int i = 0; i < 10000; ++i)
+    {
+        image.push_back(char(i * 7));
+    }
+    {
+        std::ofstream out(fn, std::ios::binary);
+        out.write(image.data(), image.size());
+    }
+
+    for (auto backend : {"mmap", "stream"})
+    {
+#ifdef WINDOWS
+        if (std::string(backend) == "mmap")
+        {
+            continue;
+        }
+#endif
+        auto img = Recovery::openImage(fn, backend);
+        assertTrue(img != nullptr);
+        assertTrue(img->size() == image.size());
+
+        auto data = img->read(4093, 100);
+        assertTrue(std::string(data.begin(), data.end()) ==
+                   image.substr(4093, 100));
+
+        // clamped at the end of the image
+        data = img->read(image.size() - 10, 100);
+        assertTrue(data.size() == 10);
+        assertTrue(img->read(image.size(), 1).empty());
+    }
+
+    assertTrue(Recovery::openImage(fn, "bogus") == nullptr);
+    std::remove(fn.c_str());
+}
+
+int main()
+{
+    testBackendsReadTheSameBytes("test_imageSource.img");
+
+    return 0;
+}
@@ -0,0 +1,138 @@
+#include "test.h"
+#include "recovery/blockMap.h"
+#include "recovery/journal.h"
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+
+std::string readAll(const std::string& fn)
+{
+    std::ifstream in(fn, std::ios::binary);
+    return {std::istreambuf_iterator<char>(in), {}};
+}
+
+void testSaveLoad()
+{
+    Recovery::JobState state;
+    state.mode = 2;
+    state.offset = 0x146AA800;
+    state.chunkSize = 0x8000;
+    state.repition = 8;
+    state.numTracks = 3;
+    state.count = 70;
+    state.position = 41;
+    state.outputs = {1000, 2000};
+    state.chunks = {4, 5, 6};
+    state.matched = {1, 0, 1};
+    state.matches = 38;
+    state.skipped = 2;
+    state.damaged = 1;
+    state.bitErrors = 9;
+
+    auto fn = "test_journal.journal";
+    assertTrue(state.save(fn));
+    assertTrue(!std::filesystem::exists(std::string(fn) + ".tmp"));
+
+    Recovery::JobState loaded;
+    assertTrue(loaded.load(fn));
+    assertTrue(loaded.sameJob(state));
+    assertTrue(loaded.position == 41);
+    assertTrue(loaded.outputs == state.outputs);
+    assertTrue(loaded.chunks == state.chunks);
+    assertTrue(loaded.matched == state.matched);
+    assertTrue(loaded.matches == 38 && loaded.skipped == 2);
+    assertTrue(loaded.damaged == 1 && loaded.bitErrors == 9);
+
+    // a later checkpoint replaces it
+    state.position = 50;
+    assertTrue(state.save(fn));
+    assertTrue(loaded.load(fn) && loaded.position == 50);
+
+    auto other = state;
+    other.offset += 0x8000;
+    assertTrue(!other.sameJob(state));
+
+    // cut short
+    auto bytes = readAll(fn);
+    std::ofstream(fn, std::ios::binary).write(bytes.data(), bytes.size() - 3);
+    assertTrue(!loaded.load(fn));
+    std::ofstream(fn, std::ios::binary) << "not a journal";
+    assertTrue(!loaded.load(fn));
+    std::remove(fn);
+}
+
+void testCheckpointer()
+{
+    auto fn = "test_journal_cp.journal";
+    Recovery::Checkpointer never("", std::chrono::seconds(0));
+    assertTrue(!never.due());
+
+    Recovery::Checkpointer always(fn, std::chrono::seconds(0));
+    assertTrue(always.due());
+    Recovery::JobState state;
+    state.position = 7;
+    assertTrue(always.save(state));
+    assertTrue(std::filesystem::exists(fn));
+
+    Recovery::Checkpointer hourly(fn, std::chrono::seconds(3600));
+    assertTrue(!hourly.due());
+
+    always.finish();
+    assertTrue(!std::filesystem::exists(fn));
+}
+
+void testResumeOutput()
+{
+    auto fn = "test_journal.out";
+    std::ofstream(fn, std::ios::binary) << "header" << "block1" << "partial";
+
+    std::ofstream out;
+    assertTrue(Recovery::resumeOutput(out, fn, 12));
+    out << "block2";
+    out.close();
+    assertTrue(readAll(fn) == "headerblock1block2");
+
+    // the file has to hold what the checkpoint says
+    assertTrue(!Recovery::resumeOutput(out, fn, 100));
+    std::remove(fn);
+}
+
+void testBlockMapResume()
+{
+    auto fn = "test_journal.map";
+    uint64_t length = 0;
+    {
+        Recovery::BlockMapWriter writer;
+        assertTrue(writer.open(fn, 0x8000, 2));
+        writer.add(0x1000, 0, 1);
+        writer.add(0x9000, 1, 1);
+        length = writer.flush();
+        // added after the checkpoint, lost with the interruption
+        writer.add(0x11000, 0, 2, 1, 5);
+    }
+
+    Recovery::BlockMapWriter writer;
+    assertTrue(!writer.resume(fn, 0x8000, 2, length - 1));
+    assertTrue(writer.resume(fn, 0x8000, 2, length));
+    writer.add(0x19000, 1, 2);
+    assertTrue(writer.close());
+
+    Recovery::BlockMap map;
+    assertTrue(map.open(fn, "stream"));
+    auto entries = map.entries();
+    assertTrue(entries.size() == 3);
+    assertTrue(entries[1].offset == 0x9000);
+    assertTrue(entries[2].offset == 0x19000 && entries[2].bitErrors == 0);
+    std::remove(fn);
+}
+
+int main()
+{
+    testSaveLoad();
+    testCheckpointer();
+    testResumeOutput();
+    testBlockMapResume();
+
+    return 0;
+}
@@ -0,0 +1,149 @@
+#include "test.h"
+#include "recovery/mapper.h"
+#include "recovery/synth.h"
+#include <filesystem>
+#include <fstream>
+
+void testParallelMapMatchesSequential()
+{
+    const uint32_t chunkSize = 32;
+    auto dest = std::filesystem::temp_directory_path() / "test_mapper";
+    std::filesystem::create_directories(dest);
+
+    // three tracks of five chunks each
+    auto chunkOf = [&](int track, int chunk) {
+        return std::string(chunkSize, char('!' + track * 5 + chunk));
+    };
+    for (int track = 0; track < 3; ++track)
+    {
+        std::ofstream out(dest / (std::to_string(track + 1) + ".audio(0).wav"),
+                          std::ios::binary);
+        for (int chunk = 0; chunk < 5; ++chunk)
+        {
+            out << chunkOf(track, chunk);
+        }
+    }
+
+    // image: junk, then chunks in reverse order with junk in between
+    auto imgName = (dest / "card.dd").string();
+    {
+        std::ofstream out(imgName, std::ios::binary);
+        out << std::string(chunkSize, '\0');
+        for (int i = 14; i >= 0; --i)
+        {
+            out << chunkOf(i % 3, i / 3);
+            if (i % 4 == 0)
+            {
+                out << std::string(chunkSize, '\xff');
+            }
+        }
+    }
+
+    Recovery::ChunkIndex index;
+    assertTrue(index.build(dest.string(), 3, chunkSize, "mmap"));
+
+    Recovery::ChunkMap sequential;
+    auto stats = Recovery::mapImageParallel(imgName, "stream", 0, 0, chunkSize,
+                                            index, 1, sequential);
+    assertTrue(stats.chunks == 20);
+    assertTrue(stats.matched == 15);
+    assertTrue(sequential.size() == 15);
+    assertTrue(sequential.begin()->first == chunkSize);
+    assertTrue(sequential.begin()->second.location.track == 2);
+    assertTrue(sequential.begin()->second.location.chunk == 4);
+
+    for (unsigned threads : {2u, 4u, 7u, 64u})
+    {
+        Recovery::ChunkMap parallel;
+        stats = Recovery::mapImageParallel(imgName, "mmap", 0, 0, chunkSize,
+                                           index, threads, parallel);
+        assertTrue(stats.chunks == 20);
+        assertTrue(parallel.size() == sequential.size());
+        auto it = sequential.begin();
+        for (auto& [offset, item] : parallel)
+        {
+            assertTrue(offset == it->first);
+            assertTrue(item.location.track == it->second.location.track);
+            assertTrue(item.location.chunk == it->second.location.chunk);
+            ++it;
+        }
+    }
+
+    // every reference chunk is uniform, dead chunks are still looked up
+    auto img = Recovery::openImage(imgName, "mmap");
+    auto occupancy = Recovery::mapOccupancy(*img, 0, 0, chunkSize, 1);
+    Recovery::ChunkMap skipped;
+    stats = Recovery::mapImageParallel(imgName, "mmap", 0, 0, chunkSize,
+                                       index, 2, skipped, &occupancy);
+    assertTrue(stats.skipped == 0);
+    assertTrue(skipped.size() == sequential.size());
+
+    std::filesystem::remove_all(dest);
+}
+
+void testDeadChunksOfSilentTracks()
+{
+    auto dest = std::filesystem::temp_directory_path() / "test_mapper_dead";
+    std::filesystem::create_directories(dest);
+    auto imgName = (dest / "card.dd").string();
+
+    // erased filler before the headers, 5 chunks of it
+    Recovery::SynthOptions opts;
+    opts.layout.chunkSize = 0x800;
+    opts.layout.repition = 2;
+    opts.layout.numTracks = 2;
+    opts.layout.count = 3;
+    for (bool silent : {false, true})
+    {
+        // with a Channel Block of silence in track 2
+        opts.silence.clear();
+        if (silent)
+        {
+            opts.silence.push_back({1, 0x1000, 0x1000});
+        }
+        std::string image;
+        auto session = Recovery::synthesizeImage(opts, image);
+        for (uint32_t t = 0; t < 2; ++t)
+        {
+            std::ofstream out(
+                dest / (std::to_string(t + 1) + ".audio(0).wav"),
+                std::ios::binary);
+            out << session.tracks[t];
+        }
+        {
+            std::ofstream out(imgName, std::ios::binary);
+            out << image;
+        }
+
+        Recovery::ChunkIndex index;
+        assertTrue(index.build(dest.string(), 2, opts.layout.chunkSize,
+                               "mmap"));
+        assertTrue(index.holdsUniformChunks() == silent);
+
+        Recovery::MemoryImageSource img(image);
+        auto occupancy =
+            Recovery::mapOccupancy(img, 0, 0, opts.layout.chunkSize, 1);
+        Recovery::ChunkMap all;
+        Recovery::ChunkMap map;
+        Recovery::mapImageParallel(imgName, "mmap", 0, 0,
+                                   opts.layout.chunkSize, index, 1, all);
+        auto stats =
+            Recovery::mapImageParallel(imgName, "mmap", 0, 0,
+                                       opts.layout.chunkSize, index, 1, map,
+                                       &occupancy);
+        assertTrue(stats.skipped == (silent ? 0 : 5));
+        // the silence is found either way
+        assertTrue(map.size() == all.size());
+        assertTrue(map.size() == 2 * (1 + 2 * 3));
+    }
+
+    std::filesystem::remove_all(dest);
+}
+
+int main()
+{
+    testParallelMapMatchesSequential();
+    testDeadChunksOfSilentTracks();
+
+    return 0;
+}
@@ -0,0 +1,56 @@
+#include "test.h"
+#include "recovery/metrics.h"
+#include <sstream>
+
+void testLatencyHistogram()
+{
+    Recovery::LatencyHistogram histogram;
+    for (int i = 0; i < 99; ++i)
+    {
+        histogram.record(std::chrono::nanoseconds(100));
+    }
+    histogram.record(std::chrono::milliseconds(1));
+
+    assertTrue(histogram.count() == 100);
+    assertTrue(histogram.total() ==
+               std::chrono::nanoseconds(99 * 100 + 1000000));
+    assertTrue(histogram.quantile(0.5) == std::chrono::nanoseconds(128));
+    assertTrue(histogram.quantile(0.99) == std::chrono::nanoseconds(1 << 20));
+}
+
+void testStatsReport()
+{
+    auto& metrics = Recovery::metrics();
+    metrics.matchAttempts.add(4);
+    metrics.matches.add(3);
+    metrics.bytesWritten.add(1000);
+
+    std::ostringstream out;
+    Recovery::writeStats(out, std::chrono::seconds(1));
+    auto json = out.str();
+    assertTrue(json.find("\"matchAttempts\": 4,") != std::string::npos);
+    assertTrue(json.find("\"hitRate\": 0.750,") != std::string::npos);
+    assertTrue(json.find("\"bytesWritten\": 1000,") != std::string::npos);
+    assertTrue(json.find("\"match\": {\"count\": 0") != std::string::npos);
+}
+
+void testProgressFollowsCounter()
+{
+    Recovery::Counter counter;
+    counter.add(10);
+    {
+        Recovery::Progress progress("Test", counter, 100, "B",
+                                    std::chrono::milliseconds(1));
+        counter.add(100);
+    }
+    assertTrue(counter.get() == 110);
+}
+
+int main()
+{
+    testLatencyHistogram();
+    testStatsReport();
+    testProgressFollowsCounter();
+
+    return 0;
+}
@@ -0,0 +1,158 @@
+#include "test.h"
+#include "recovery/metrics.h"
+#include "recovery/multiPartImage.h"
+#include <cstdio>
+#include <fstream>
+
+void writeFile(const std::string& fn, const std::string& data)
+{
+    std::ofstream(fn, std::ios::binary) << data;
+}
+
+std::string pattern(size_t size)
+{
+    std::string data;
+    for (size_t i = 0; i < size; ++i)
+    {
+        data.push_back(char(i * 7 + i / 251));
+    }
+    return data;
+}
+
+void testSplitDump()
+{
+    auto image = pattern(25000);
+    std::vector<std::string> parts = {"test_split.dd.000", "test_split.dd.001",
+                                      "test_split.dd.002"};
+    writeFile(parts[0], image.substr(0, 10000));
+    writeFile(parts[1], image.substr(10000, 4096));
+    writeFile(parts[2], image.substr(14096));
+
+    // only the parts given are read, nothing is guessed from the names
+    auto first = Recovery::openImage(parts[0], "stream");
+    assertTrue(first != nullptr && first->size() == 10000);
+
+    Recovery::ImageSpec spec;
+    spec.parts = parts;
+    for (auto backend : {"mmap", "stream"})
+    {
+#ifdef WINDOWS
+        if (std::string(backend) == "mmap")
+        {
+            continue;
+        }
+#endif
+        auto img = Recovery::openImage(spec, backend);
+        assertTrue(img != nullptr);
+        assertTrue(img->size() == image.size());
+        assertTrue(!img->isPlainFile());
+
+        // inside a part, across one and across all of them
+        for (auto [offset, size] : {std::pair{100ul, 900ul}, {9000ul, 2000ul},
+                                    {9999ul, 4098ul}, {0ul, 25000ul},
+                                    {24990ul, 100ul}})
+        {
+            auto data = img->read(offset, size);
+            assertTrue(std::string(data.begin(), data.end()) ==
+                       image.substr(offset, size));
+        }
+        assertTrue(img->read(image.size(), 1).empty());
+    }
+
+    for (auto& part : parts)
+    {
+        std::remove(part.c_str());
+    }
+}
+
+void testRescueMap()
+{
+    auto fn = "test_rescue.map";
+    writeFile(fn, "# Mapfile. Created by GNU ddrescue version 1.27\n"
+                  "# current_pos  current_status  current_pass\n"
+                  "0x00003000     -               1\n"
+                  "#      pos        size  status\n"
+                  "0x00000000  0x00001000  +\n"
+                  "0x00001000  0x00000200  -\n"
+                  "0x00001200  0x00000e00  /\n"
+                  "0x00002000  0x00000800  +\n"
+                  "0x00002800  0x00000100  *\n"
+                  "0x00002900  0x00000700  +\n");
+    std::vector<Recovery::ByteRange> unread;
+    assertTrue(Recovery::loadRescueMap(fn, unread));
+    assertTrue(unread.size() == 2);
+    assertTrue(unread[0].offset == 0x1000 && unread[0].length == 0x1000);
+    assertTrue(unread[1].offset == 0x2800 && unread[1].length == 0x100);
+
+    writeFile(fn, "0x0 +\n0x0 0x1000 x\n");
+    assertTrue(!Recovery::loadRescueMap(fn, unread));
+    writeFile(fn, "PSOCCUP1 binary");
+    assertTrue(!Recovery::loadRescueMap(fn, unread));
+    std::remove(fn);
+}
+
+void testRescuedReads()
+{
+    std::string image(0x3000, 'x');
+    auto src = std::make_unique<Recovery::MemoryImageSource>(image);
+    Recovery::RescuedImageSource img(std::move(src),
+                                     {{0x1000, 0x1000}, {0x2800, 0x100}});
+
+    // read as they are
+    auto data = img.read(0x100, 0x200);
+    assertTrue(data.data() == image.data() + 0x100);
+
+    auto before = Recovery::metrics().unreadBytes.get();
+    data = img.read(0xf00, 0x2000);
+    std::string expected = std::string(0x100, 'x') +
+                           std::string(0x1000, '\0') +
+                           std::string(0x800, 'x') + std::string(0x100, '\0') +
+                           std::string(0x600, 'x');
+    assertTrue(std::string(data.begin(), data.end()) == expected);
+    assertTrue(Recovery::metrics().unreadBytes.get() - before == 0x1100);
+}
+
+void testOpenWithMapfile()
+{
+    auto fn = std::string("test_rescue.img");
+    writeFile(fn, std::string(0x2000, 'x'));
+    Recovery::ImageSpec spec(fn);
+    spec.rescueMap = "test_rescue_img.map";
+    writeFile(spec.rescueMap, "0x2000 +\n"
+                              "0x0 0x800 +\n"
+                              "0x800 0x200 -\n"
+                              "0xa00 0x1600 +\n");
+    // a mapfile next to the image isn't picked up by its name
+    writeFile(fn + ".map", "0x2000 +\n0x0 0x2000 -\n");
+    auto plain = Recovery::openImage(fn, "stream");
+    assertTrue(plain != nullptr);
+    auto data = plain->read(0x800, 0x200);
+    assertTrue(std::string(data.begin(), data.end()) ==
+               std::string(0x200, 'x'));
+    std::remove((fn + ".map").c_str());
+
+    auto img = Recovery::openImage(spec, "stream");
+    assertTrue(img != nullptr);
+    data = img->read(0x700, 0x400);
+    assertTrue(std::string(data.begin(), data.end()) ==
+               std::string(0x100, 'x') + std::string(0x200, '\0') +
+                   std::string(0x100, 'x'));
+
+    // a broken mapfile isn't ignored
+    writeFile(spec.rescueMap, "0x2000 +\n0x0 0x800\n");
+    assertTrue(Recovery::openImage(spec, "stream") == nullptr);
+    spec.rescueMap = "test_rescue_missing.map";
+    assertTrue(Recovery::openImage(spec, "stream") == nullptr);
+    std::remove("test_rescue_img.map");
+    std::remove(fn.c_str());
+}
+
+int main()
+{
+    testSplitDump();
+    testRescueMap();
+    testRescuedReads();
+    testOpenWithMapfile();
+
+    return 0;
+}
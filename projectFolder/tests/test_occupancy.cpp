@@ -0,0 +1,146 @@
+#include "test.h"
+#include "recovery/occupancy.h"
+#include "recovery/synth.h"
+#include <cstdio>
+
+void testClassifyChunks()
+{
+    const size_t chunkSize = 0x8000;
+    using Recovery::ChunkClass;
+    using Recovery::classifyChunk;
+
+    std::string chunk(chunkSize, '\0');
+    assertTrue(classifyChunk(chunk.data(), chunk.size()) == ChunkClass::Erased);
+    chunk.assign(chunkSize, '\xff');
+    assertTrue(classifyChunk(chunk.data(), chunk.size()) == ChunkClass::Erased);
+    chunk.assign(chunkSize, 'R');
+    assertTrue(classifyChunk(chunk.data(), chunk.size()) == ChunkClass::Uniform);
+
+    // one odd byte late in the chunk is enough to make it live
+    chunk.assign(chunkSize, '\0');
+    chunk[chunkSize - 3] = 1;
+    assertTrue(classifyChunk(chunk.data(), chunk.size()) != ChunkClass::Erased);
+
+    Recovery::SynthOptions opts;
+    opts.layout.chunkSize = chunkSize;
+    opts.layout.repition = 1;
+    opts.layout.numTracks = 2;
+    opts.layout.count = 2;
+    std::string image;
+    auto session = Recovery::synthesizeImage(opts, image);
+    auto& track = session.tracks[0];
+    assertTrue(classifyChunk(track.data(), chunkSize) == ChunkClass::WavHeader);
+    assertTrue(classifyChunk(track.data() + chunkSize, chunkSize) ==
+               ChunkClass::Audio);
+
+    uint32_t x = 1;
+    for (auto& c : chunk)
+    {
+        x = x * 1664525 + 1013904223;
+        c = char(x >> 24);
+    }
+    assertTrue(classifyChunk(chunk.data(), chunk.size()) == ChunkClass::Other);
+}
+
+void testMapOccupancy()
+{
+    const uint32_t chunkSize = 0x1000;
+
+    // live, erased, live, uniform, erased, then a partial tail
+    std::string image;
+    for (auto c : {'a', '\0', 'b', 'U', '\xff'})
+    {
+        std::string chunk(chunkSize, c);
+        if (c != '\0' && c != '\xff' && c != 'U')
+        {
+            chunk[7] = 0;
+        }
+        image += chunk;
+    }
+    image.append(100, 'z');
+
+    Recovery::MemoryImageSource img(image);
+    for (unsigned threads : {1u, 3u})
+    {
+        auto map = Recovery::mapOccupancy(img, 0, 0, chunkSize, threads);
+        assertTrue(map.chunks == 5);
+        assertTrue(map.counts[size_t(Recovery::ChunkClass::Erased)] == 2);
+        assertTrue(map.counts[size_t(Recovery::ChunkClass::Uniform)] == 1);
+
+        assertTrue(map.live(0, chunkSize));
+        assertTrue(!map.live(chunkSize, chunkSize));
+        assertTrue(map.live(chunkSize, chunkSize + 1));
+        assertTrue(!map.live(3 * chunkSize + 10, chunkSize));
+        // a dead range comes back as the bytes the card holds there
+        std::string dead(chunkSize, 'x');
+        map.fillDead(3 * chunkSize + 10, dead);
+        assertTrue(dead == image.substr(3 * chunkSize + 10, chunkSize));
+        // beyond the map
+        assertTrue(map.live(4 * chunkSize, chunkSize + 1));
+    }
+
+    // a map of part of the image keeps its own offset
+    auto map = Recovery::mapOccupancy(img, chunkSize, 2, chunkSize, 0);
+    assertTrue(map.chunks == 2);
+    assertTrue(!map.live(chunkSize, chunkSize));
+    assertTrue(map.live(0, chunkSize));
+
+    const char* fn = "test_occupancy.map";
+    assertTrue(map.save(fn));
+    Recovery::OccupancyMap loaded;
+    assertTrue(loaded.load(fn));
+    assertTrue(loaded.offset == map.offset);
+    assertTrue(loaded.chunkSize == map.chunkSize);
+    assertTrue(loaded.chunks == map.chunks);
+    assertTrue(loaded.bits == map.bits);
+    assertTrue(loaded.fills == map.fills);
+    std::remove(fn);
+
+    assertTrue(!loaded.load(fn));
+}
+
+void testSilenceMayMatchDeadChunks()
+{
+    const uint32_t chunkSize = 0x1000;
+    Recovery::SynthOptions opts;
+    opts.layout.chunkSize = chunkSize;
+    opts.layout.repition = 1;
+    opts.layout.numTracks = 2;
+    opts.layout.count = 3;
+    // track 2 is silent in its second Channel Block
+    opts.silence = {{1, chunkSize, chunkSize}};
+    std::string image;
+    auto session = Recovery::synthesizeImage(opts, image);
+    auto& layout = session.layout;
+
+    // the silence is as dead on the card as an erased chunk
+    Recovery::MemoryImageSource img(image);
+    auto map = Recovery::mapOccupancy(img, layout.offset, 0, chunkSize, 1);
+    assertTrue(!map.live(layout.channelBlockOffset(1, 1), chunkSize));
+    assertTrue(map.live(layout.channelBlockOffset(1, 0), chunkSize));
+
+    // but its reference chunk tells a mapping run it may match one
+    auto& track = session.tracks[1];
+    assertTrue(Recovery::nearlyUniform(track.data() + 2 * chunkSize,
+                                       chunkSize, 0));
+    assertTrue(!Recovery::nearlyUniform(track.data() + chunkSize, chunkSize,
+                                        100));
+
+    // within the bit errors allowed, whichever bits they are
+    std::string chunk(chunkSize, '\xff');
+    chunk[0] = '\x7f';
+    chunk[9] = '\xfe';
+    assertTrue(!Recovery::nearlyUniform(chunk.data(), chunk.size(), 0));
+    assertTrue(!Recovery::nearlyUniform(chunk.data(), chunk.size(), 1));
+    assertTrue(Recovery::nearlyUniform(chunk.data(), chunk.size(), 2));
+    assertTrue(Recovery::nearlyUniform(chunk.data(), 9, 1));
+}
+
+int main()
+{
+    testClassifyChunks();
+    testMapOccupancy();
+    testSilenceMayMatchDeadChunks();
+
+    return 0;
+}
@@ -0,0 +1,188 @@
+#include "test.h"
+#include "recovery/preview.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <sstream>
+
+// Little-endian 24 bit PCM
+std::string pcm24(const std::vector<int32_t>& samples)
+{
+    std::string bytes;
+    for (auto s : samples)
+    {
+        bytes.append(reinterpret_cast<const char*>(&s), 3);
+    }
+    return bytes;
+}
+
+std::vector<int32_t> noise(size_t count, uint32_t seed)
+{
+    std::vector<int32_t> samples(count);
+    for (auto& s : samples)
+    {
+        seed = seed * 1664525 + 1013904223;
+        s = int32_t(seed) >> 8;
+    }
+    return samples;
+}
+
+std::vector<int32_t> sine(size_t count, double amplitude, size_t start = 0)
+{
+    std::vector<int32_t> samples(count);
+    for (size_t i = 0; i < count; ++i)
+    {
+        samples[i] = int32_t(std::lround(amplitude * std::sin((start + i) * 0.01)));
+    }
+    return samples;
+}
+
+void testMeasureSamples()
+{
+    auto samples = noise(1003, 1);
+    samples[5] = 0x7FFFFF;
+    samples[17] = -0x800000;
+    samples[1001] = -0x7FFFFF;
+
+    Recovery::SampleStats stats;
+    Recovery::measureSamples(samples.data(), samples.size(), stats);
+
+    uint32_t peak = 0;
+    uint64_t clipped = 0;
+    int64_t energy = 0;
+    for (auto s : samples)
+    {
+        peak = std::max(peak, uint32_t(std::abs(s)));
+        clipped += std::abs(s) >= 0x7FFFFF;
+        energy += int64_t(s) * s;
+    }
+    assertTrue(stats.samples == samples.size());
+    assertTrue(stats.peak == 0x800000 && peak == 0x800000);
+    assertTrue(stats.clipped == clipped && clipped >= 3);
+    assertTrue(stats.energy == double(energy));
+    assertTrue(stats.roughness == 0);
+}
+
+void testMeasure24()
+{
+    // several decode batches, after a split sample
+    auto samples = sine(10000, 3000000);
+    for (unsigned phase = 0; phase < 3; ++phase)
+    {
+        auto bytes = std::string(phase, '\x55') + pcm24(samples);
+        Recovery::SampleStats stats;
+        Recovery::measure24(bytes.data(), bytes.size(), phase, stats);
+
+        int64_t roughness = 0;
+        int64_t energy = 0;
+        for (size_t i = 0; i < samples.size(); ++i)
+        {
+            energy += int64_t(samples[i]) * samples[i];
+            if (i + 2 < samples.size())
+            {
+                roughness += std::abs(samples[i + 2] - 2 * samples[i + 1] +
+                                      samples[i]);
+            }
+        }
+        assertTrue(stats.samples == samples.size());
+        // summed per decode batch
+        assertTrue(std::abs(stats.energy / double(energy) - 1) < 1e-12);
+        assertTrue(stats.roughness == double(roughness));
+        assertTrue(std::abs(stats.peakDb() - 20 * std::log10(3.0 / 8.388608)) <
+                   0.01);
+        assertTrue(std::abs(stats.rmsDb() - stats.peakDb() + 3.01) < 0.05);
+        assertTrue(stats.noisiness() < 0.01);
+    }
+
+    Recovery::SampleStats random;
+    auto bytes = pcm24(noise(5000, 7));
+    Recovery::measure24(bytes.data(), bytes.size(), 0, random);
+    assertTrue(random.noisiness() > 1.5 && random.noisiness() < 2.5);
+
+    // misaligned by a byte, smooth audio decodes as noise
+    Recovery::SampleStats shifted;
+    bytes = pcm24(samples);
+    Recovery::measure24(bytes.data(), bytes.size(), 1, shifted);
+    assertTrue(std::string(Recovery::previewVerdict(shifted)) == "noise");
+}
+
+void testPreviewTracks()
+{
+    // 4 tracks of Channel Blocks of 2 chunks of 3001 bytes, not a whole
+    // number of samples
+    Recovery::Layout layout = {
+        .offset = 100,
+        .chunkSize = 3001,
+        .repition = 2,
+        .numTracks = 4,
+        .count = 12,
+    };
+    auto channelBlockSize = layout.channelBlockSize();
+    auto streamSize = channelBlockSize * layout.count;
+    auto samples = streamSize / 3 + 1;
+
+    // driven beyond full scale
+    auto clipped = sine(samples, 12000000);
+    for (auto& s : clipped)
+    {
+        s = std::clamp(s, -0x800000, 0x7FFFFF);
+    }
+    std::vector<std::string> streams = {
+        pcm24(sine(samples, 1000000)),
+        std::string(streamSize, '\0'),
+        pcm24(noise(samples, 3)),
+        pcm24(clipped),
+    };
+
+    std::string image(layout.offset, 'x');
+    for (uint32_t block = 0; block < layout.count; ++block)
+    {
+        for (auto& stream : streams)
+        {
+            image += stream.substr(size_t(block) * channelBlockSize,
+                                   channelBlockSize);
+        }
+    }
+    Recovery::MemoryImageSource img(image);
+
+    auto tracks = Recovery::previewTracks(img, layout, 5);
+    assertTrue(tracks.size() == 4);
+    assertTrue(tracks[0].bins.size() == 5);
+    assertTrue(std::string(Recovery::previewVerdict(tracks[0].total)) == "ok");
+    assertTrue(std::string(Recovery::previewVerdict(tracks[1].total)) ==
+               "silent");
+    assertTrue(std::string(Recovery::previewVerdict(tracks[2].total)) ==
+               "noise");
+    assertTrue(std::string(Recovery::previewVerdict(tracks[3].total)) ==
+               "clipping");
+
+    // one sample split between every two Channel Blocks is skipped
+    auto perTrack = tracks[0].total.samples;
+    assertTrue(perTrack <= streamSize / 3 && perTrack + 12 >= streamSize / 3);
+    assertTrue(tracks[0].total.noisiness() < 0.05);
+
+    auto waveform = Recovery::previewWaveform(tracks[0]);
+    assertTrue(waveform.size() == 5);
+    assertTrue(waveform.find_first_of(" ?") == std::string::npos);
+    assertTrue(Recovery::previewWaveform(tracks[1]) == "     ");
+    assertTrue(Recovery::previewWaveform(tracks[2]) == "?????");
+
+    // more bins than Data Blocks
+    assertTrue(Recovery::previewTracks(img, layout, 100)[0].bins.size() == 12);
+
+    std::ostringstream json;
+    Recovery::writePreviewJson(json, layout, tracks);
+    auto text = json.str();
+    assertTrue(text.find("\"verdict\": \"clipping\"") != std::string::npos);
+    assertTrue(text.find("\"peakDb\": null") != std::string::npos);
+    assertTrue(text.find("\"track\": 4") != std::string::npos);
+}
+
+int main()
+{
+    testMeasureSamples();
+    testMeasure24();
+    testPreviewTracks();
+
+    return 0;
+}
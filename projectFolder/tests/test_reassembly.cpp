@@ -0,0 +1,151 @@
+#include "test.h"
+#include "recovery/reassembly.h"
+#include "recovery/synth.h"
+#include <cmath>
+
+Recovery::SynthSession synthesize(uint32_t numTracks = 4)
+{
+    Recovery::SynthOptions opts;
+    opts.layout.chunkSize = 0x1000;
+    opts.layout.numTracks = numTracks;
+    opts.layout.repition = 2;
+    opts.layout.count = 12;
+    std::string image;
+    return Recovery::synthesizeImage(opts, image);
+}
+
+void testFingerprint()
+{
+    auto session = synthesize();
+    auto chunkSize = session.layout.chunkSize;
+    auto& track = session.tracks[0];
+
+    auto fp = Recovery::fingerprintChunk(track.data() + chunkSize, chunkSize);
+    assertTrue(!fp.dead);
+    // a sine at 2^21 is 12 dB below full scale and 3 dB more for its RMS
+    assertTrue(std::abs(fp.levelDb - (20 * std::log10(0.25) - 3.01)) < 0.5);
+    assertTrue(std::abs(fp.dc) < 0.01);
+
+    // continues into the next chunk
+    auto next = Recovery::fingerprintChunk(track.data() + 2 * chunkSize,
+                                           chunkSize);
+    assertTrue(Recovery::boundaryScore(fp.tail, next.head) < 8);
+    assertTrue(Recovery::soundDistance(fp, next) < 0.25);
+
+    // higher tracks are higher sines
+    auto other = Recovery::fingerprintChunk(
+        session.tracks[3].data() + chunkSize, chunkSize);
+    assertTrue(other.tilt > fp.tilt + 0.5);
+
+    // the prediction of a sine carries on into the next chunk
+    assertTrue(Recovery::continuationScore(fp, next) < 3);
+
+    std::string erased(chunkSize, '\xff');
+    assertTrue(Recovery::fingerprintChunk(erased.data(), chunkSize).dead);
+}
+
+void testReassembleIrregularWrites()
+{
+    // the sines of the higher tracks differ by little more than 5%
+    auto session = synthesize(16);
+    auto chunkSize = session.layout.chunkSize;
+    auto numTracks = session.layout.numTracks;
+    auto perTrack = session.tracks[0].size() / chunkSize - 1;
+
+    // the audio chunks of every track, a few at a time from a track picked
+    // at random, with erased chunks in between
+    std::string image(chunkSize, '\xff');
+    std::vector<size_t> written(numTracks);
+    uint32_t seed = 7;
+    auto random = [&] { return (seed = seed * 1103515245 + 12345) >> 16; };
+    for (size_t left = perTrack * numTracks; left;)
+    {
+        auto t = random() % numTracks;
+        for (auto run = 1 + random() % 3; run && written[t] < perTrack;
+             --run, --left)
+        {
+            image += session.tracks[t].substr(++written[t] * chunkSize,
+                                              chunkSize);
+        }
+        if (random() % 8 == 0)
+        {
+            image += std::string(chunkSize, '\xff');
+        }
+    }
+
+    for (unsigned threads : {1, 3})
+    {
+        Recovery::MemoryImageSource img(image);
+        Recovery::ReassemblyOptions opts;
+        opts.chunkSize = chunkSize;
+        opts.window = 256;
+        opts.maxStreams = numTracks;
+        opts.threads = threads;
+        Recovery::ReassemblyStats stats;
+        auto streams = Recovery::reassembleChunks(img, opts, stats);
+
+        assertTrue(stats.chunks == image.size() / chunkSize);
+        assertTrue(stats.chains == numTracks);
+        assertTrue(stats.dropped == 0);
+        assertTrue(streams.size() == numTracks);
+        std::vector<bool> seen(numTracks);
+        for (auto& stream : streams)
+        {
+            assertTrue(stream.chunks.size() == perTrack);
+            // whole tracks in order
+            auto chunk = [&](size_t i) {
+                return image.substr(stream.chunks[i].offset, chunkSize);
+            };
+            uint32_t t = 0;
+            while (t < numTracks &&
+                   chunk(0) != session.tracks[t].substr(chunkSize, chunkSize))
+            {
+                ++t;
+            }
+            assertTrue(t < numTracks && !seen[t]);
+            seen[t] = true;
+            for (size_t i = 0; i < perTrack; ++i)
+            {
+                assertTrue(chunk(i) == session.tracks[t].substr(
+                                           (i + 1) * chunkSize, chunkSize));
+            }
+        }
+    }
+}
+
+void testWindowLimitsLinks()
+{
+    auto session = synthesize();
+    auto chunkSize = session.layout.chunkSize;
+    auto& track = session.tracks[1];
+
+    // two halves of a track, far apart
+    auto half = 4 * chunkSize;
+    std::string image = track.substr(chunkSize, half) +
+                        std::string(8 * chunkSize, '\xff') +
+                        track.substr(chunkSize + half, half);
+    Recovery::MemoryImageSource img(image);
+    Recovery::ReassemblyOptions opts;
+    opts.chunkSize = chunkSize;
+    opts.window = 4;
+    Recovery::ReassemblyStats stats;
+    auto streams = Recovery::reassembleChunks(img, opts, stats);
+    assertTrue(stats.dead == 8);
+    assertTrue(stats.chains == 2 && stats.links == 6);
+    // the halves still sound alike
+    assertTrue(streams.size() == 1 && streams[0].chunks.size() == 8);
+
+    opts.window = 16;
+    streams = Recovery::reassembleChunks(img, opts, stats);
+    assertTrue(stats.chains == 1 && stats.links == 7);
+    assertTrue(streams.size() == 1);
+}
+
+int main()
+{
+    testFingerprint();
+    testReassembleIrregularWrites();
+    testWindowLimitsLinks();
+
+    return 0;
+}
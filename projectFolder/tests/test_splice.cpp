@@ -0,0 +1,179 @@
+#include "test.h"
+#include "recovery/splice.h"
+#include "recovery/synth.h"
+#include "recovery/wav.h"
+#include <cstring>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <sstream>
+
+std::string readFile(const std::filesystem::path& fn)
+{
+    std::ifstream in(fn, std::ios::binary);
+    std::ostringstream data;
+    data << in.rdbuf();
+    return data.str();
+}
+
+void writeFile(const std::filesystem::path& fn, const std::string& data)
+{
+    std::ofstream(fn, std::ios::binary) << data;
+}
+
+// What the recorder saved with the placeholder sizes replaced
+std::string finalized(std::string track)
+{
+    uint32_t riff = uint32_t(track.size() - 8);
+    uint32_t data = uint32_t(track.size() - sizeof(Recovery::WAV_HEADER));
+    memcpy(&track[offsetof(Recovery::WAV_HEADER, chunkSize)], &riff, 4);
+    memcpy(&track[offsetof(Recovery::WAV_HEADER, subchunk2Size)], &data, 4);
+    return track;
+}
+
+Recovery::SynthSession synthesize(std::string& image)
+{
+    Recovery::SynthOptions opts;
+    opts.layout.chunkSize = 0x1000;
+    opts.layout.numTracks = 4;
+    opts.layout.repition = 2;
+    opts.layout.count = 6;
+    return Recovery::synthesizeImage(opts, image);
+}
+
+void testSavedFileOffset()
+{
+    std::string image;
+    auto session = synthesize(image);
+    auto& layout = session.layout;
+    for (uint32_t t = 0; t < layout.numTracks; ++t)
+    {
+        auto& track = session.tracks[t];
+        for (uint64_t position : {size_t(0), size_t(100), size_t(0x1000),
+                                  size_t(0x2fff), size_t(0x5123),
+                                  track.size() - 1})
+        {
+            assertTrue(image[Recovery::savedFileOffset(layout, t, position)] ==
+                       track[position]);
+        }
+    }
+}
+
+void testConfirmSaved()
+{
+    std::string image;
+    auto session = synthesize(image);
+    auto& layout = session.layout;
+    Recovery::MemoryImageSource img(image);
+    auto dir = std::filesystem::path("test_splice_confirm");
+    std::filesystem::create_directories(dir);
+
+    // cut mid chunk, the rest never made it to the card
+    uint64_t cut = 0x4800;
+    writeFile(dir / "1.audio(0).wav",
+              session.tracks[0].substr(0, cut) + std::string(0x1400, '\0'));
+    Recovery::SavedTrack saved{(dir / "1.audio(0).wav").string()};
+    assertTrue(Recovery::confirmSaved(img, layout, 0, 0, saved));
+    assertTrue(saved.size == cut + 0x1400);
+    assertTrue(saved.confirmed == 0x4000);
+
+    // cut short cleanly, the partial last chunk is confirmed
+    writeFile(dir / "1.audio(0).wav", session.tracks[0].substr(0, cut));
+    assertTrue(Recovery::confirmSaved(img, layout, 0, 0, saved));
+    assertTrue(saved.confirmed == cut);
+
+    // a flipped bit in the last chunk
+    auto track = session.tracks[1];
+    track[track.size() - 10] ^= 4;
+    writeFile(dir / "2.audio(0).wav", track);
+    saved.fn = (dir / "2.audio(0).wav").string();
+    assertTrue(Recovery::confirmSaved(img, layout, 1, 0, saved));
+    assertTrue(saved.confirmed == track.size() - 0x1000);
+    assertTrue(Recovery::confirmSaved(img, layout, 1, 8, saved));
+    assertTrue(saved.confirmed == track.size() && saved.bitErrors == 1);
+
+    // saved for another session
+    writeFile(dir / "3.audio(0).wav", session.tracks[2]);
+    saved.fn = (dir / "3.audio(0).wav").string();
+    assertTrue(Recovery::confirmSaved(img, layout, 3, 0, saved));
+    assertTrue(saved.confirmed == 0);
+
+    saved.fn = (dir / "missing.wav").string();
+    assertTrue(!Recovery::confirmSaved(img, layout, 0, 0, saved));
+    std::filesystem::remove_all(dir);
+}
+
+void testCopyPrefix()
+{
+    auto data = std::string(100000, 'a') + std::string(100000, 'b');
+    writeFile("test_splice_from", data);
+    assertTrue(Recovery::copyPrefix("test_splice_from", "test_splice_to",
+                                    150000));
+    assertTrue(readFile("test_splice_to") == data.substr(0, 150000));
+    assertTrue(!Recovery::copyPrefix("test_splice_missing", "test_splice_to",
+                                     10));
+    std::filesystem::remove("test_splice_from");
+    std::filesystem::remove("test_splice_to");
+}
+
+void testSpliceTracks()
+{
+    std::string image;
+    auto session = synthesize(image);
+    auto& layout = session.layout;
+    Recovery::MemoryImageSource img(image);
+    auto dir = std::filesystem::path("test_splice_out");
+    std::filesystem::create_directories(dir);
+
+    // track 1 ends mid Channel Block, track 2 is whole, track 3 only has
+    // part of its header chunk and track 4 wasn't saved
+    std::vector<Recovery::SavedTrack> saved(layout.numTracks);
+    std::vector<uint64_t> lengths = {0x5a00, session.tracks[1].size(), 0x80};
+    for (uint32_t t = 0; t < lengths.size(); ++t)
+    {
+        saved[t].fn = (dir / std::format("{}.audio(0).wav", t + 1)).string();
+        writeFile(saved[t].fn,
+                  session.tracks[t].substr(0, lengths[t]) +
+                      std::string(0x800, '\x11'));
+        assertTrue(Recovery::confirmSaved(img, layout, t, 0, saved[t]));
+    }
+    assertTrue(saved[0].confirmed == 0x5000);
+    assertTrue(saved[1].confirmed == lengths[1]);
+    assertTrue(saved[2].confirmed == 0);
+
+    auto spliced = Recovery::spliceTracks(img, layout, saved, dir.string());
+    assertTrue(spliced.size() == layout.numTracks);
+    for (uint32_t t = 0; t < layout.numTracks; ++t)
+    {
+        auto& track = session.tracks[t];
+        assertTrue(readFile(spliced[t].fn) == finalized(track));
+        assertTrue(spliced[t].reused == saved[t].confirmed);
+        assertTrue(spliced[t].reused + spliced[t].carved == track.size());
+    }
+    assertTrue(spliced[1].carved == 0);
+
+    // a session cut short by the end of the image
+    Recovery::MemoryImageSource cut(
+        std::span<const char>(image).first(layout.channelBlockOffset(4, 2)));
+    spliced = Recovery::spliceTracks(cut, layout, saved, dir.string());
+    assertTrue(spliced.size() == layout.numTracks);
+    // tracks before the cut get the last Data Block, the others don't
+    auto blocks = [&](uint32_t t, uint32_t count) {
+        return finalized(session.tracks[t].substr(
+            0, layout.chunkSize + count * layout.channelBlockSize()));
+    };
+    assertTrue(readFile(spliced[0].fn) == blocks(0, 5));
+    assertTrue(readFile(spliced[1].fn) == finalized(session.tracks[1]));
+    assertTrue(readFile(spliced[3].fn) == blocks(3, 4));
+    std::filesystem::remove_all(dir);
+}
+
+int main()
+{
+    testSavedFileOffset();
+    testConfirmSaved();
+    testCopyPrefix();
+    testSpliceTracks();
+
+    return 0;
+}
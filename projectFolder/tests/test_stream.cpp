@@ -0,0 +1,150 @@
+#include "test.h"
+#include "recovery/stream.h"
+#include <cstdio>
+#include <fstream>
+
+Recovery::Layout testLayout()
+{
+    return {
+        .offset = 8,
+        .chunkSize = 4,
+        .repition = 2,
+        .numTracks = 4,
+        .count = 3,
+    };
+}
+
+// every Channel Block holds its track letter and Data Block digit
+std::string testImage(const Recovery::Layout& layout)
+{
+    std::string image(layout.offset, 'x');
+    for (uint32_t block = 0; block < layout.count; ++block)
+    {
+        for (uint32_t track = 0; track < layout.numTracks; ++track)
+        {
+            std::string channelBlock(layout.channelBlockSize(),
+                                     char('a' + track));
+            channelBlock[0] = char('0' + block);
+            image += channelBlock;
+        }
+    }
+    return image;
+}
+
+void testStreamSelectedTracksWithoutCopies()
+{
+    auto layout = testLayout();
+    auto image = testImage(layout);
+    Recovery::MemoryImageSource img(image);
+
+    for (auto tracks : {std::vector<uint32_t>{2}, {3, 0}, {}})
+    {
+        std::string order;
+        auto blocks = Recovery::streamTracks(
+            img, layout,
+            [&](uint32_t track, uint32_t block, std::span<const char> audio) {
+                assertTrue(audio.size() == layout.channelBlockSize());
+                // a view into the image itself
+                assertTrue(audio.data() ==
+                           image.data() +
+                               layout.channelBlockOffset(block, track));
+                order += audio[1];
+                order += audio[0];
+            },
+            {tracks});
+        assertTrue(blocks == layout.count);
+
+        std::string expected;
+        for (uint32_t block = 0; block < layout.count; ++block)
+        {
+            for (uint32_t t = 0; t < layout.numTracks; ++t)
+            {
+                auto track = tracks.empty() ? t : tracks[t];
+                expected += char('a' + track);
+                expected += char('0' + block);
+                if (!tracks.empty() && t + 1 == tracks.size())
+                {
+                    break;
+                }
+            }
+        }
+        assertTrue(order == expected);
+    }
+
+    // an unknown track stops before anything is read
+    assertTrue(Recovery::streamTracks(img, layout,
+                                      [](uint32_t, uint32_t,
+                                         std::span<const char>) {},
+                                      {{4}}) == 0);
+}
+
+void testDeadBlocksComeAsSilence()
+{
+    auto layout = testLayout();
+    auto image = testImage(layout);
+    // the Channel Block of track 1 in Data Block 1 is erased
+    auto erased = layout.channelBlockOffset(1, 1);
+    image.replace(erased, layout.channelBlockSize(),
+                  layout.channelBlockSize(), '\0');
+    Recovery::MemoryImageSource img(image);
+    auto map = Recovery::mapOccupancy(img, layout.offset, 0, layout.chunkSize,
+                                      1);
+
+    std::string track1;
+    Recovery::streamTracks(
+        img, layout,
+        [&](uint32_t, uint32_t, std::span<const char> audio) {
+            track1.append(audio.begin(), audio.end());
+        },
+        {{1}, &map});
+    assertTrue(track1.size() == layout.channelBlockSize() * layout.count);
+    assertTrue(track1.substr(layout.channelBlockSize(),
+                             layout.channelBlockSize()) ==
+               std::string(layout.channelBlockSize(), '\0'));
+}
+
+void testStreamFromReader(const std::string& fn)
+{
+    auto layout = testLayout();
+    auto image = testImage(layout);
+    // the last Data Block is cut short
+    image.resize(image.size() - 1);
+    {
+        std::ofstream out(fn, std::ios::binary);
+        out.write(image.data(), image.size());
+    }
+
+    for (auto tracks : {std::vector<uint32_t>{1}, {}})
+    {
+        Recovery::StreamOptions opts = {tracks};
+        Recovery::PipelineOptions pipeline = {"thread", 2, false};
+        auto reader = Recovery::openBlockReader(
+            fn, "mmap", Recovery::streamRanges(layout, opts), pipeline);
+        assertTrue(reader != nullptr);
+
+        std::string streamed;
+        auto blocks = Recovery::streamTracks(
+            *reader, layout,
+            [&](uint32_t track, uint32_t block, std::span<const char> audio) {
+                assertTrue(std::string(audio.begin(), audio.end()) ==
+                           image.substr(layout.channelBlockOffset(block, track),
+                                        layout.channelBlockSize()));
+                streamed.append(audio.begin(), audio.end());
+            },
+            opts);
+        assertTrue(blocks == (tracks.empty() ? 2 : 3));
+        assertTrue(streamed.size() == layout.channelBlockSize() * blocks *
+                                          (tracks.empty() ? 4 : 1));
+    }
+
+    std::remove(fn.c_str());
+}
+
+int main()
+{
+    testStreamSelectedTracksWithoutCopies();
+    testDeadBlocksComeAsSilence();
+    testStreamFromReader("test_stream.img");
+
+    return 0;
+}
@@ -0,0 +1,70 @@
+#include "test.h"
+#include "recovery/sweep.h"
+#include <cmath>
+
+void testSweepRanksTheRecordedLayoutFirst()
+{
+    Recovery::Layout layout;
+    layout.offset = 0x3000;
+    layout.chunkSize = 0x600;
+    layout.repition = 4;
+    layout.numTracks = 3;
+    layout.count = 6;
+
+    // one sine per track, packed like the recorder does
+    std::string image(layout.offset, '\0');
+    for (uint32_t block = 0; block < layout.count; ++block)
+    {
+        for (uint32_t t = 0; t < layout.numTracks; ++t)
+        {
+            auto samples = layout.channelBlockSize() / 3;
+            for (uint64_t i = samples * block; i < samples * (block + 1); ++i)
+            {
+                int32_t s = 3e6 * std::sin(0.003 * (t + 1) * i + 2 * t);
+                image.append((const char*)&s, 3);
+            }
+        }
+    }
+    Recovery::MemoryImageSource img(image);
+
+    Recovery::SweepRanges ranges;
+    ranges.base = layout;
+    ranges.base.offset -= 2 * layout.chunkSize;
+    ranges.base.repition = 2;
+    ranges.base.numTracks = 2;
+    ranges.base.count = 0;
+    ranges.lastOffset = layout.offset + 2 * layout.chunkSize;
+    ranges.lastRepition = 6;
+    ranges.lastNumTracks = 5;
+    auto candidates = ranges.candidates();
+    assertTrue(candidates.size() == 5 * 5 * 4);
+
+    auto ranked = Recovery::sweepLayouts(img, candidates, 1);
+    assertTrue(ranked.size() == candidates.size());
+    auto& best = ranked.front();
+    assertTrue(best.layout.offset == layout.offset);
+    assertTrue(best.layout.repition == layout.repition);
+    assertTrue(best.layout.numTracks == layout.numTracks);
+    assertTrue(best.layout.count == layout.count);
+    assertTrue(best.boundaries.rough == 0);
+    assertTrue(ranked[1].boundaries.rough > 0);
+
+    for (unsigned threads : {3u, 0u})
+    {
+        auto parallel = Recovery::sweepLayouts(img, candidates, threads);
+        assertTrue(parallel.size() == ranked.size());
+        for (size_t i = 0; i < ranked.size(); ++i)
+        {
+            assertTrue(parallel[i].layout.offset == ranked[i].layout.offset);
+            assertTrue(parallel[i].boundaries.rough ==
+                       ranked[i].boundaries.rough);
+        }
+    }
+}
+
+int main()
+{
+    testSweepRanksTheRecordedLayoutFirst();
+
+    return 0;
+}
@@ -0,0 +1,97 @@
+#include "test.h"
+#include "recovery/analysis.h"
+#include "recovery/synth.h"
+
+void testSynthLayout()
+{
+    Recovery::SynthOptions opts;
+    opts.layout.chunkSize = 0x600;
+    opts.layout.repition = 4;
+    opts.layout.numTracks = 3;
+    opts.layout.count = 5;
+    opts.pad = 0x1000;
+
+    std::string image;
+    auto session = Recovery::synthesizeImage(opts, image);
+    auto& layout = session.layout;
+    assertTrue(session.headerOffset == opts.pad);
+    assertTrue(layout.offset == opts.pad + 3 * 0x600);
+    assertTrue(image.size() ==
+               layout.offset + layout.dataBlockSize() * layout.count);
+
+    for (uint32_t t = 0; t < layout.numTracks; ++t)
+    {
+        auto& track = session.tracks[t];
+        assertTrue(track.compare(0, 4, "RIFF") == 0);
+        assertTrue(image.compare(opts.pad + layout.chunkSize * t,
+                                 layout.chunkSize, track, 0,
+                                 layout.chunkSize) == 0);
+        for (uint32_t block = 0; block < layout.count; ++block)
+        {
+            assertTrue(image.compare(layout.channelBlockOffset(block, t),
+                                     layout.channelBlockSize(), track,
+                                     layout.chunkSize +
+                                         layout.channelBlockSize() * block,
+                                     layout.channelBlockSize()) == 0);
+        }
+    }
+
+    // continuous within every track
+    Recovery::MemoryImageSource img(image);
+    auto report = Recovery::analyzeContinuity(img, layout);
+    for (auto& track : report.tracks)
+    {
+        assertTrue(track.flagged.empty());
+    }
+}
+
+void testSynthDamage()
+{
+    Recovery::SynthOptions opts;
+    opts.layout.chunkSize = 0x600;
+    opts.layout.repition = 4;
+    opts.layout.numTracks = 3;
+    opts.layout.count = 5;
+
+    std::string clean;
+    auto session = Recovery::synthesizeImage(opts, clean);
+    auto dataOffset = session.layout.offset;
+
+    opts.damage = {
+        {Recovery::SynthDamage::Kind::Zero, dataOffset, 0x10},
+        {Recovery::SynthDamage::Kind::Skip, dataOffset + 0x100, 0x20},
+        {Recovery::SynthDamage::Kind::Shift, dataOffset + 0x200, 0x600},
+    };
+    std::string image;
+    Recovery::synthesizeImage(opts, image);
+
+    assertTrue(image.size() == clean.size() - 0x20 + 0x600);
+    assertTrue(image.compare(0, dataOffset, clean, 0, dataOffset) == 0);
+    assertTrue(image.substr(dataOffset, 0x10) == std::string(0x10, '\0'));
+    assertTrue(image.compare(dataOffset + 0x10, 0xf0, clean,
+                             dataOffset + 0x10, 0xf0) == 0);
+    assertTrue(image.compare(dataOffset + 0x100, 0x100, clean,
+                             dataOffset + 0x120, 0x100) == 0);
+    assertTrue(image.compare(dataOffset + 0x800, 0x1000, clean,
+                             dataOffset + 0x220, 0x1000) == 0);
+
+    // a whole chunk lost reads every Channel Block a chunk late
+    opts.damage = {
+        {Recovery::SynthDamage::Kind::Skip, dataOffset, 0x600},
+    };
+    Recovery::synthesizeImage(opts, image);
+    Recovery::MemoryImageSource img(image);
+    auto layout = session.layout;
+    layout.count -= 1;
+    auto report = Recovery::analyzeContinuity(img, layout);
+    assertTrue(report.misalignment == 1);
+    assertTrue(report.correctedOffset == dataOffset - 0x600);
+}
+
+int main()
+{
+    testSynthLayout();
+    testSynthDamage();
+
+    return 0;
+}
@@ -0,0 +1,222 @@
+#include "test.h"
+#include "recovery/interleave.h"
+#include "recovery/wav.h"
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+
+uint32_t le32(const std::string& data, size_t pos)
+{
+    uint32_t v;
+    memcpy(&v, data.data() + pos, 4);
+    return v;
+}
+
+uint64_t le64(const std::string& data, size_t pos)
+{
+    uint64_t v;
+    memcpy(&v, data.data() + pos, 8);
+    return v;
+}
+
+void testFinalizedSizes()
+{
+    Recovery::WavFormat mono;
+    std::stringstream out;
+    assertTrue(Recovery::writeWavHeader(out, mono));
+    out << std::string(3 * 5, 'x');
+    assertTrue(Recovery::finalizeWav(out, mono));
+
+    // odd data is padded, the pad is not part of the data chunk
+    auto wav = out.str();
+    auto headerSize = Recovery::wavHeaderSize(mono);
+    assertTrue(wav.size() == headerSize + 16);
+    assertTrue(wav.compare(0, 4, "RIFF") == 0);
+    assertTrue(le32(wav, 4) == wav.size() - 8);
+    assertTrue(wav.compare(12, 4, "JUNK") == 0);
+    assertTrue(wav.compare(headerSize - 8, 4, "data") == 0);
+    assertTrue(le32(wav, headerSize - 4) == 15);
+
+    Recovery::WavFormat multi;
+    multi.numChannels = 34;
+    std::stringstream outMulti;
+    Recovery::writeWavHeader(outMulti, multi);
+    Recovery::finalizeWav(outMulti, multi);
+    wav = outMulti.str();
+    assertTrue(wav.size() == Recovery::wavHeaderSize(multi));
+    assertTrue(wav.compare(48, 4, "fmt ") == 0);
+    assertTrue(le32(wav, 52) == 40);
+    // WAVE_FORMAT_EXTENSIBLE, 34 channels
+    assertTrue(le32(wav, 56) == (0xFFFE | 34u << 16));
+}
+
+void testLargeFilesBecomeRF64()
+{
+    auto fn = (std::filesystem::temp_directory_path() / "test_wav.wav").string();
+    Recovery::WavFormat format;
+    uint64_t dataSize = 0x100000006ull;
+    {
+        std::ofstream out(fn, std::ios::binary);
+        Recovery::writeWavHeader(out, format);
+        // sparse up to the last sample
+        out.seekp(Recovery::wavHeaderSize(format) + dataSize - 1);
+        out.put('x');
+        assertTrue(Recovery::finalizeWav(out, format));
+    }
+
+    std::ifstream in(fn, std::ios::binary);
+    std::string header(Recovery::wavHeaderSize(format), '\0');
+    in.read(header.data(), header.size());
+    assertTrue(header.compare(0, 4, "RF64") == 0);
+    assertTrue(le32(header, 4) == UINT32_MAX);
+    assertTrue(header.compare(12, 4, "ds64") == 0);
+    assertTrue(le64(header, 20) == header.size() + dataSize - 8);
+    assertTrue(le64(header, 28) == dataSize);
+    assertTrue(le64(header, 36) == dataSize / 3);
+    assertTrue(le32(header, header.size() - 4) == UINT32_MAX);
+
+    in.close();
+    std::remove(fn.c_str());
+}
+
+void testInterleave()
+{
+    // transpose against a plain copy for all channel / frame remainders
+    for (uint32_t numChannels : {1u, 3u, 4u, 9u})
+    {
+        for (size_t frames : {0, 1, 5, 6, 7, 33})
+        {
+            std::vector<std::string> data(numChannels);
+            std::vector<const char*> channels;
+            for (uint32_t c = 0; c < numChannels; ++c)
+            {
+                for (size_t i = 0; i < 3 * frames; ++i)
+                {
+                    data[c].push_back(char(c * 31 + i));
+                }
+                channels.push_back(data[c].data());
+            }
+
+            std::string out(3 * frames * numChannels, '\0');
+            Recovery::transpose24(channels.data(), numChannels, frames,
+                                  out.data());
+            for (size_t f = 0; f < frames; ++f)
+            {
+                for (uint32_t c = 0; c < numChannels; ++c)
+                {
+                    assertTrue(out.compare(3 * (f * numChannels + c), 3,
+                                           data[c], 3 * f, 3) == 0);
+                }
+            }
+        }
+    }
+
+    // Channel Blocks of 0x40 bytes split a sample every Data Block
+    Recovery::Layout layout;
+    layout.chunkSize = 0x20;
+    layout.repition = 2;
+    layout.numTracks = 5;
+    layout.count = 3;
+
+    std::string image;
+    for (uint32_t block = 0; block < layout.count; ++block)
+    {
+        for (uint32_t t = 0; t < layout.numTracks; ++t)
+        {
+            for (uint64_t i = 0; i < layout.channelBlockSize(); ++i)
+            {
+                image.push_back(char(t * 50 + block * 64 + i));
+            }
+        }
+    }
+
+    Recovery::Interleaver interleaver(layout);
+    std::string frames;
+    for (uint32_t block = 0; block < layout.count; ++block)
+    {
+        auto out = interleaver.append(image.data() +
+                                      layout.dataBlockSize() * block);
+        frames.append(out.data(), out.size());
+    }
+
+    auto samples = layout.channelBlockSize() * layout.count / 3;
+    assertTrue(frames.size() == samples * 3 * layout.numTracks);
+    for (uint64_t s = 0; s < samples; ++s)
+    {
+        for (uint32_t t = 0; t < layout.numTracks; ++t)
+        {
+            for (uint64_t b = 0; b < 3; ++b)
+            {
+                auto pos = 3 * s + b;
+                auto block = pos / layout.channelBlockSize();
+                auto expected = image[layout.channelBlockOffset(block, t) +
+                                      pos % layout.channelBlockSize()];
+                assertTrue(frames[3 * (s * layout.numTracks + t) + b] ==
+                           expected);
+            }
+        }
+    }
+}
+
+void testInterleaveKernels()
+{
+    Recovery::Layout other;
+    other.numTracks = 33;
+    assertTrue(Recovery::findInterleaveKernel(other) == nullptr);
+    other.numTracks = 34;
+    assertTrue(Recovery::findInterleaveKernel(other, 16) == nullptr);
+#if !defined(__SSSE3__)
+    assertTrue(Recovery::findInterleaveKernel(other) != nullptr);
+#endif
+
+    // every kernel against transpose24() of the same Channel Blocks
+    for (auto& key : Recovery::interleaveKernelKeys())
+    {
+        Recovery::Layout layout;
+        layout.chunkSize = key.chunkSize;
+        layout.repition = key.repition;
+        layout.numTracks = key.numTracks;
+        auto kernel = Recovery::findInterleaveKernel(layout, key.bitsPerSample);
+        assertTrue(kernel != nullptr);
+
+        auto channelBlockSize = layout.channelBlockSize();
+        std::string block(layout.dataBlockSize(), '\0');
+        uint32_t seed = key.numTracks;
+        for (auto& c : block)
+        {
+            c = char((seed = seed * 1103515245 + 12345) >> 16);
+        }
+
+        for (size_t start : {0, 1, 2})
+        {
+            std::vector<const char*> channels;
+            for (uint32_t t = 0; t < layout.numTracks; ++t)
+            {
+                channels.push_back(block.data() + channelBlockSize * t +
+                                   start);
+            }
+            for (size_t frames : {size_t(0), size_t(1), size_t(5), size_t(7),
+                                  (channelBlockSize - start) / 3})
+            {
+                std::string expected(3 * frames * layout.numTracks, '\0');
+                std::string out(expected.size(), '\1');
+                Recovery::transpose24(channels.data(), layout.numTracks,
+                                      frames, expected.data());
+                kernel(block.data(), start, frames, out.data());
+                assertTrue(out == expected);
+            }
+        }
+    }
+}
+
+int main()
+{
+    testFinalizedSizes();
+    testLargeFilesBecomeRF64();
+    testInterleave();
+    testInterleaveKernels();
+
+    return 0;
+}